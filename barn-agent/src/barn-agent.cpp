@@ -3,30 +3,78 @@
  */
 
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <numeric>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
 #include <vector>
 
 #include <boost/scoped_ptr.hpp>
 
 #include "barn-agent.h"
 #include "channel_selector.h"
+#include "control_socket.h"
+#include "drain.h"
 #include "files.h"
+#include "flight_recorder.h"
+#include "handoff.h"
 #include "helpers.h"
+#include "log_writer.h"
 #include "monitor/localreport.h"
+#include "monitor/shmreport.h"
+#include "monitor/statsd.h"
 #include "process.h"
+#include "resource_limits.h"
 #include "rsync.h"
+#include "scheduler.h"
+#include "shipment_plan.h"
+#include "sighandle.h"
+#include "trace.h"
 
 using namespace std;
 using namespace boost::assign;
 using namespace boost;
 
 static Validation<int> ship_candidates(
-        const FileOps&, const AgentChannel&, const Metrics&, vector<string>);
+        const BarnConf&, const FileOps&, const AgentChannel&, const Metrics&,
+        const ShipScheduler&, const ShippingSlots&, vector<string>);
 static Validation<FileNameList> query_candidates(
-        const FileOps&, const AgentChannel&, const Metrics&);
+        const FileOps&, const AgentChannel&, const Metrics&, RotationWatch*);
+static void add_pinned_candidates(const FileOps&, const AgentChannel&, const FileNameList&,
+                                  const string&, FileNameList*);
+static set<string> pin_candidates(const BarnConf&, const FileOps&, const AgentChannel&,
+                                  const Metrics&, const FileNameList&);
+static void report_lag(const FileOps&, const AgentChannel&, const Metrics&,
+                       const FileNameList&, const FileNameList&, const FileNameList&);
 static ChannelSelector<AgentChannel>* create_channel_selector(const BarnConf&);
-static Metrics* create_metrics(const BarnConf&);
-static void sleep_it(const BarnConf&);
+static void reload_if_asked(BarnConf*, scoped_ptr<ChannelSelector<AgentChannel>>&, int64_t*);
+static int64_t modification_time(const std::string&);
+static ShippingSlots* create_shipping_slots(const BarnConf&, const AgentHandoff*);
+static bool take_handoff(const BarnConf&, AgentHandoff*);
+static void upgrade(const BarnConf&, const string&, const FileOps&,
+                    const ChannelSelector<AgentChannel>&, const ShipScheduler&,
+                    const RotationWatch&, const Metrics&, const ShippingSlots&);
+static ScheduleDecision wait_for_next_round(const FileOps&, const AgentChannel&,
+                                            const Metrics&, ScheduleDecision, RotationWatch*);
+static void dry_run_ahead(const FileOps&, const AgentChannel&, const Metrics&,
+                          RotationWatch*);
+static DrainProgress drain_candidates(const BarnConf&, const FileOps&, const AgentChannel&,
+                                      const Metrics&, const ShippingSlots&,
+                                      const FileNameList&);
+
+// How often a drain reports its progress.
+static const int DRAIN_REPORT_SECONDS = 10;
+// How long svlogd gets to rotate 'current' out for a drain.
+static const int DRAIN_ROTATE_SECONDS = 10;
+// How often a paused agent or a back off checks whether to go on.
+static const auto WAIT_CHECK_INTERVAL = chrono::milliseconds(200);
 
 
 /*
@@ -35,67 +83,200 @@ static void sleep_it(const BarnConf&);
  *   - Query for outstanding candidate files to ship: using rsync dry-run
  *   - Sync unshipped files (files later than latest file on target) to target
  *   - Wait for a change to the source directory using inotify
+ * Runs until asked to drain (see drain.h), returning the exit status, or
+ * until upgraded (see handoff.h).
  */
-void barn_agent_main(const BarnConf& barn_conf) {
-  scoped_ptr<Metrics> metrics(create_metrics(barn_conf));
+int barn_agent_main(const BarnConf& barn_conf) {
+  const auto executable = executable_path();
+  // Before the channels are named after the host.
+  AgentHandoff handoff;
+  const bool handed_over = take_handoff(barn_conf, &handoff);
+
+  scoped_ptr<CgroupThrottling> throttling(
+        barn_conf.cgroup.empty() ? nullptr : new CgroupThrottling(barn_conf.cgroup));
+  scoped_ptr<Metrics> metrics(create_metrics(barn_conf, handed_over ? &handoff : nullptr));
   scoped_ptr<ChannelSelector<AgentChannel>> channel_selector(create_channel_selector(barn_conf));
+  scoped_ptr<ShippingSlots> shipping_slots(
+        create_shipping_slots(barn_conf, handed_over ? &handoff : nullptr));
   auto fileops = FileOps();
 
+  set_flight_recorder_dump(
+        join_path(barn_conf.flight_recorder_dir, "barn-agent-flight." +
+                  barn_conf.service_name + "." + barn_conf.category + ".bin"),
+        "barn-agent " + barn_conf.service_name + ":" + barn_conf.category);
+  enable_flight_recorder_signal_handlers();
+  // Only time in rounds counts (see FlightWait), with room for rounds
+  // shipping a backlog.
+  if (barn_conf.stall_rounds > 0)
+    std::thread(run_stall_watchdog,
+                barn_conf.stall_rounds * std::max(barn_conf.freshness_target, 1) +
+                barn_conf.max_backoff_seconds).detach();
+
+  // Served from the start, paused as the agent upgraded from was.
+  status_identity(barn_conf.service_name, barn_conf.category);
+  if (handed_over)
+    set_control_paused(handoff.paused);
+  const bool control_socket = !barn_conf.control_socket.empty() &&
+                              start_control_socket(barn_conf.control_socket);
+  if (!barn_conf.control_socket.empty() && !control_socket)
+    LOG(WARNING) << "Running without a control socket";
+  ControlSocketCleanup remove_control_socket(control_socket ? barn_conf.control_socket : "");
+
+  enable_trace_dump_signal_handler();
+  if (barn_conf.trace || !barn_conf.trace_file.empty()) {
+    tracing_enabled = true;
+    std::thread(run_trace_exporter, barn_conf.trace_file, barn_conf.trace_dump_dir,
+                "barn-agent " + barn_conf.service_name + ":" + barn_conf.category).detach();
+  }
+
+  // Reloaded between rounds, so a round never sees half a configuration.
+  BarnConf conf(barn_conf);
+  int64_t config_mtime = 0;
+  if (!conf.config_file.empty()) {
+    config_mtime = modification_time(conf.config_file);
+    enable_reload_signal_handler();
+  }
+
+  ShipScheduler scheduler(conf.freshness_target, conf.sleep_seconds,
+                          conf.max_backoff_seconds);
+  RotationWatch rotation_watch(conf.prewarm_seconds);
+  enable_drain_signal_handler();
+  enable_upgrade_signal_handler();
+
+  if (handed_over) {
+    channel_selector->restore_health({handoff.primary_ok, handoff.last_heartbeat_time});
+    scheduler.restore_failure_streak(handoff.failure_streak);
+    if (!handoff.dry_run_target.empty())
+      rotation_watch.dry_run_done(handoff.dry_run_target, handoff.dry_run_on_target);
+    // Unless a file rotated during the upgrade, finish the wait the agent
+    // upgraded from was in.
+    const auto rotated = fileops.list_log_directory(conf.source_dir);
+    if ((rotated.empty() ? "" : rotated.back()) == handoff.newest_file)
+      scheduler.set_unfinished_wait(
+            wait_for_next_round(fileops, channel_selector->current(), *metrics,
+                                handoff.unfinished_wait, &rotation_watch));
+  }
+
   while (true) {
-    dispatch_new_logs(barn_conf, fileops, *channel_selector, *metrics);
+    if (conf.drain || drain_was_requested())
+      return drain_logs(conf, fileops, *channel_selector, *metrics, *shipping_slots);
+    if (take_upgrade_request()) {
+      upgrade(conf, executable, fileops, *channel_selector, scheduler, rotation_watch,
+              *metrics, *shipping_slots);
+      // Still here, so finish the wait the upgrade cut short.
+      scheduler.set_unfinished_wait(
+            wait_for_next_round(fileops, channel_selector->current(), *metrics,
+                                scheduler.unfinished_wait(), &rotation_watch));
+      continue;
+    }
+
+    // Before pausing, as a reload asked for ends the pause's wait too.
+    if (!conf.config_file.empty()) {
+      reload_if_asked(&conf, channel_selector, &config_mtime);
+      scheduler.configure(conf.freshness_target, conf.sleep_seconds,
+                          conf.max_backoff_seconds);
+      rotation_watch.configure(conf.prewarm_seconds);
+    }
+
+    // Commands from the control socket, see control_socket.h.
+    if (control_paused()) {
+      LOG(INFO) << "Paused";
+      status_activity(AgentActivity::Paused);
+      FlightWait waiting;
+      take_wake_up();
+      while (control_paused() && !waits_interrupted())
+        this_thread::sleep_for(WAIT_CHECK_INTERVAL);
+      continue;
+    }
+    take_wake_up();
+    if (take_switch_request() && !channel_selector->switch_channel())
+      LOG(WARNING) << "Not switching channels as asked, there is no backup";
+
+    const auto round_start = chrono::steady_clock::now();
+    flight_record(FlightEventType::RoundStart);
+    const auto decision = ship_round(conf, fileops, *channel_selector, *metrics, scheduler,
+                                     *shipping_slots, &rotation_watch);
     channel_selector->send_metrics(*metrics);
+    if (throttling)
+      throttling->report(*metrics);
+    // Before the wait, which may last until the next rotation.
+    metrics->flush();
+    flight_record(FlightEventType::RoundEnd, millis_since(round_start));
+    flight_round_completed();
+    status_round_done();
+    scheduler.set_unfinished_wait(
+          wait_for_next_round(fileops, channel_selector->current(), *metrics, decision,
+                              &rotation_watch));
   }
 }
 
 
 /*
  * A single iteration of barn-agent.
- * Work out what logs to ship, ship them, wait.
+ * Work out what logs to ship, ship them, wait as 'scheduler' decides.
  */
 void dispatch_new_logs(const BarnConf& barn_conf,
                        const FileOps &fileops,
                        ChannelSelector<AgentChannel>& channel_selector,
-                       const Metrics& metrics) {
+                       const Metrics& metrics,
+                       ShipScheduler& scheduler,
+                       const ShippingSlots& slots,
+                       RotationWatch* rotation_watch) {
+  const auto decision = ship_round(barn_conf, fileops, channel_selector, metrics, scheduler,
+                                   slots, rotation_watch);
+  scheduler.set_unfinished_wait(wait_for_next_round(
+        fileops, channel_selector.current(), metrics, decision, rotation_watch));
+}
+
+/*
+ * Work out what logs to ship and ship them. Returns how 'scheduler' decides
+ * to wait for the next round.
+ */
+ScheduleDecision ship_round(const BarnConf& barn_conf,
+                            const FileOps &fileops,
+                            ChannelSelector<AgentChannel>& channel_selector,
+                            const Metrics& metrics,
+                            ShipScheduler& scheduler,
+                            const ShippingSlots& slots,
+                            RotationWatch* rotation_watch) {
+  TraceSpan round("round");
   AgentChannel channel = channel_selector.pick_channel();
+  status_channel(channel.rsync_target, !channel_selector.health().primary_ok);
 
   // TODO: we could consider retaining the last shipped file. That
   // would save a lot of requerying to the destination server each time.
-  auto logs_to_ship = query_candidates(fileops, channel, metrics);
+  auto logs_to_ship = query_candidates(fileops, channel, metrics, rotation_watch);
 
   if (isFailure(logs_to_ship)) {
     LOG(ERROR) << "Syncing Error to " << channel.rsync_target <<
                    ":" << error(logs_to_ship);
-    sleep_it(barn_conf);
-    return;
+    flight_record(FlightEventType::Error, 0, 0, "failed to get sync list");
+    status_error("failed to list the files to ship to " + channel.rsync_target);
+    return scheduler.after_round(RoundOutcome::Failed, metrics);
   }
 
-  auto num_shipped = ship_candidates(fileops, channel, metrics, get(logs_to_ship));
+  auto num_shipped = ship_candidates(barn_conf, fileops, channel, metrics, scheduler,
+                                     slots, get(std::move(logs_to_ship)));
 
   if (isFailure(num_shipped)) {
     LOG(ERROR) << "ERROR: Shipment failure to " << channel.rsync_target;
-    // On error, sleep to prevent error-spins
-    sleep_it(barn_conf);
-    return;
+    flight_record(FlightEventType::Error, 0, 0, "failed to ship any file");
+    status_error("failed to ship any file to " + channel.rsync_target);
+    // Back off to prevent error-spins
+    return scheduler.after_round(RoundOutcome::Failed, metrics);
   }
 
-  if (get(num_shipped) > 0) {
-    // If no file is shipped, wait for a change on directory.
-    // If any file is shipped, sleep, then check again for change to
-    // make sure in the meantime no new file is generated.
-    // TODO after using inotify API directly, there is no need for this
-    //   as the change notifications will be waiting in the inotify fd
-    sleep_it(barn_conf);
-  } else {
-    LOG(INFO) << "Waiting for directory change...";
-    fileops.wait_for_new_file_in_directory(
-          channel.source_dir, barn_conf.sleep_seconds);
-  }
+  // If any file is shipped, check again straight away: the backlog may not
+  // be drained, or new files may have rotated in the meantime. Otherwise
+  // wait for a change on directory.
+  const auto outcome = get(num_shipped) > 0 ? RoundOutcome::Shipped : RoundOutcome::CaughtUp;
 
   // If shipping round gets this far it means we managed to ship at least
   // 'some' of the outstanding files to the destination. Don't want to failover
   // unless necessary so heartbeat the current channel even if we didn't manage
   // to ship 'all' outstanding files.
   channel_selector.heartbeat();
+  return scheduler.after_round(outcome, metrics);
 }
 
 
@@ -105,14 +286,38 @@ void dispatch_new_logs(const BarnConf& barn_conf,
  * Uses rsync dry run to list all local log files found that are older
  * than the latest log file on the destination host.
  */
-Validation<FileNameList> query_candidates(const FileOps& fileops, const AgentChannel& channel, const Metrics& metrics) {
-  auto existing_files = fileops.list_log_directory(channel.source_dir);
+Validation<FileNameList> query_candidates(const FileOps& fileops, const AgentChannel& channel,
+                                          const Metrics& metrics, RotationWatch* rotation_watch) {
+  TraceSpan query("query_candidates");
+  status_activity(AgentActivity::Querying);
+  FileNameList existing_files;
+  {
+    TraceSpan list("list_log_directory");
+    existing_files = fileops.list_log_directory(channel.source_dir);
+  }
 
   // TODO: use boost filesystem path/file instead of string
 
-  Validation<FileNameList> files_not_on_server = fileops.log_files_not_on_target(
-        channel.source_dir, existing_files,
-        channel.rsync_target);
+  // Nothing but the agent ships to the target, so what a dry run ahead of
+  // the rotation found there still is.
+  Validation<FileNameList> files_not_on_server;
+  FileNameList on_target;
+  if (rotation_watch && rotation_watch->take_on_target(channel.rsync_target, &on_target)) {
+    FileNameList not_on_target;
+    set_difference(existing_files.begin(), existing_files.end(),
+                   on_target.begin(), on_target.end(), back_inserter(not_on_target));
+    files_not_on_server = std::move(not_on_target);
+    metrics.send_metric(RoundsWithoutDryRun, 1);
+  } else {
+    const auto dry_run_start = chrono::steady_clock::now();
+    {
+      TraceSpan dry_run("dry_run");
+      files_not_on_server = fileops.log_files_not_on_target(
+            channel.source_dir, existing_files,
+            channel.rsync_target);
+    }
+    metrics.record_value(DryRunLatency, millis_since(dry_run_start));
+  }
 
   BarnError *err = boost::get<BarnError>(&files_not_on_server);
   if (err != 0) {
@@ -125,17 +330,30 @@ Validation<FileNameList> query_candidates(const FileOps& fileops, const AgentCha
 
   // Given that a client is retaining arbitrarily long history of files
   // this tries to detect which files are already on the server, and only
-  // syncs the ones that are timestamped later than the most recent file
-  // on the server. This is done by deducing the gap between what's existing
-  // locally and what's missing on the server. Example:
-  // 
+  // syncs the ones that are timestamped later than the shipped mark (see
+  // shipment_plan.h). Without a mark yet, it's the most recent file on the
+  // server, deduced from the gap between what's existing locally and what's
+  // missing on the server. Example:
+  //
   //  local:  {t1, t2, t3, t4, t5, t6}
   //  sync candidates: {t1, t2, t5, t6}
   //  remote: {t3, t4}                 // deduced from sync candidates
   //  we'll ship: {t5, t6} since {t1, t2} are less than the what's on the server {t3, t4}
   //
-  FileNameList logs_to_ship = tail_intersection(existing_files, get(files_not_on_server));
+  // The mark then keeps track of gaps left by shipping out of order.
+  string shipped_mark;
+  if (!fileops.read_shipped_mark(channel.source_dir, channel.rsync_target, &shipped_mark)) {
+    shipped_mark = contiguous_shipped_mark(existing_files, get(files_not_on_server));
+    if (!fileops.write_shipped_mark(channel.source_dir, channel.rsync_target, shipped_mark))
+      LOG(WARNING) << "Failed to keep the shipped mark in " << channel.source_dir
+                   << ", catch up will ship oldest first";
+  }
+  FileNameList logs_to_ship = unshipped_files(get(files_not_on_server), shipped_mark);
+  add_pinned_candidates(fileops, channel, existing_files, shipped_mark, &logs_to_ship);
   metrics.send_metric(FilesToShip, logs_to_ship.size());
+  flight_record(FlightEventType::Candidates, logs_to_ship.size(), existing_files.size());
+  report_lag(fileops, channel, metrics,
+             existing_files, get(files_not_on_server), logs_to_ship);
   LOG(INFO) << "Querying " << channel.source_dir
             << " with " << existing_files.size()
             << " log files: " << logs_to_ship.size() << " log files to ship";
@@ -143,53 +361,122 @@ Validation<FileNameList> query_candidates(const FileOps& fileops, const AgentCha
     LOG(WARNING) << "Warning about to ship all log files from " << channel.source_dir;
     metrics.send_metric(FullDirectoryShip, 1);
   }
-  return logs_to_ship;
+  return std::move(logs_to_ship);
 }
 
 
 /*
  * Ship candidates to channel destination.
+ * Oldest first, unless more than --catch_up_files are behind: then ship that
+ * many per round, newest first while backfilling older ones (see
+ * plan_shipment), so the next round picks up files rotated meanwhile first.
  * Returns number of files from candidates that have managed to be shipped
- * or BarnError if no files could be shipped.
+ * or BarnError if no files could be shipped. A reload, drain or upgrade
+ * asked for while waiting for a shipping slot ends the round early.
  */
 Validation<int> ship_candidates(
-        const FileOps& fileops, const AgentChannel& channel,
-        const Metrics& metrics, vector<string> candidates) {
+        const BarnConf& barn_conf, const FileOps& fileops,
+        const AgentChannel& channel, const Metrics& metrics,
+        const ShipScheduler& scheduler, const ShippingSlots& slots,
+        vector<string> candidates) {
   const int candidates_size = candidates.size();
   if (!candidates_size) {
+    metrics.send_metric(CatchingUp, 0);
     return 0;
   }
-  LOG(INFO) << "Shipping : " << candidates_size << " files";
+  TraceSpan ship("ship_candidates");
   sort(candidates.begin(), candidates.end());
 
+  // Shipping out of order is only safe with a mark to remember the gaps.
+  string shipped_mark;
+  const bool has_mark = fileops.read_shipped_mark(channel.source_dir, channel.rsync_target,
+                                                  &shipped_mark);
+  const bool catching_up = has_mark && barn_conf.catch_up_files > 0 &&
+                           candidates_size > barn_conf.catch_up_files;
+  metrics.send_metric(CatchingUp, catching_up);
+
+  FileNameList catch_up_plan;
+  if (catching_up) {
+    vector<uintmax_t> sizes;
+    for (auto& el : candidates)
+      sizes.push_back(fileops.file_size(join_path(channel.source_dir, el)));
+    catch_up_plan = plan_shipment(candidates, sizes, barn_conf.backfill_share);
+    catch_up_plan.resize(barn_conf.catch_up_files);
+    LOG(INFO) << "Catching up on " << candidates_size << " files, newest first";
+  }
+  const FileNameList& plan = catching_up ? catch_up_plan : candidates;
+  const int plan_size = plan.size();
+  LOG(INFO) << "Shipping : " << plan_size << " files";
+
+  const auto pinned = pin_candidates(barn_conf, fileops, channel, metrics, candidates);
+
   auto num_lost_during_ship(0);
   auto num_shipped(0);
+  uintmax_t page_cache_bytes = 0;
+  FileNameList done;
 
-  for (const string& el : candidates) {
-    const auto file_path = join_path(channel.source_dir, el);
+  int number = 0;
+  bool interrupted = false;
+  for (const string& el : plan) {
+    const bool is_pinned = pinned.count(el) > 0;
+    const auto file_path = is_pinned ? pin_path(channel.source_dir, el)
+                                     : join_path(channel.source_dir, el);
     LOG(INFO) << "Rsyncing " << file_path << " to " << channel.rsync_target;
 
-    if (!fileops.ship_file(file_path, channel.rsync_target)) {
+    const auto slot_wait_start = chrono::steady_clock::now();
+    ShippingSlot slot(slots, fileops.file_size(file_path), true);
+    metrics.record_value(SlotWaitLatency, millis_since(slot_wait_start));
+    if (!slot.held()) {
+      // The rest waits for the next round, after the signal is handled.
+      LOG(INFO) << "Stopped waiting for a shipping slot, interrupted";
+      interrupted = true;
+      break;
+    }
+
+    TraceSpan ship_span("ship_file");
+    status_shipping(file_path, fileops.file_size(file_path), ++number, plan_size);
+    const auto ship_start = chrono::steady_clock::now();
+    const bool shipped = fileops.ship_file(file_path, channel.rsync_target);
+    status_shipped();
+    if (!shipped) {
       LOG(WARNING) << "Rsync failed to transfer log file " << file_path;
+      status_error("rsync failed to transfer " + file_path);
 
       if (!fileops.file_exists(file_path)) {
         LOG(ERROR) << "Lost data! Couldn't ship log since it got rotated in the meantime";
+        flight_record(FlightEventType::Error, 0, 0, "rotated before shipping");
+        status_error("lost " + file_path + ", rotated before shipping");
         num_lost_during_ship += 1;
+        done.push_back(el);
       } else {
         // Failed to ship, but file still exists, stop and retry in next iteration
         break;
       }
     } else {
+        metrics.record_value(ShipLatency, millis_since(ship_start));
+        metrics.record_value(ShipFileSize, fileops.file_size(file_path));
+        // Only once on the target, a failed ship is retried.
+        if (barn_conf.drop_page_cache)
+          page_cache_bytes += fileops.drop_from_page_cache(file_path);
+        if (is_pinned)
+          fileops.unpin_file(channel.source_dir, el);
+        const auto rotated = tai64n_unix_seconds(el);
+        if (rotated >= 0)
+          scheduler.shipped(rotated, time(0), metrics);
         num_shipped++;
+        done.push_back(el);
     }
   }
-  if (num_shipped < candidates_size) {
-    LOG(WARNING) << "failed to ship " << (candidates_size-num_shipped) << " files";
+  if (num_shipped < plan_size && !interrupted) {
+    LOG(WARNING) << "failed to ship " << (plan_size-num_shipped) << " files";
   }
   if (num_shipped > 0) {
     LOG(INFO) << "successfully shipped " << num_shipped << " files";
   }
   metrics.send_metric(NumFilesShipped, num_shipped);
+  if (barn_conf.drop_page_cache)
+    metrics.send_metric(PageCacheBytes, page_cache_bytes);
+  flight_record(FlightEventType::Shipped, num_shipped, num_lost_during_ship);
 
   metrics.send_metric(LostDuringShip, num_lost_during_ship);
 
@@ -201,60 +488,549 @@ Validation<int> ship_candidates(
     metrics.send_metric(RotatedDuringShip, num_rotated_during_ship);
   }
 
-  if (num_shipped == 0) return BarnError("Failed to ship any logs");
+  if (has_mark) {
+    const auto advanced = advance_shipped_mark(shipped_mark, candidates, done, current_logs);
+    if (advanced != shipped_mark &&
+        !fileops.write_shipped_mark(channel.source_dir, channel.rsync_target, advanced))
+      LOG(WARNING) << "Failed to keep the shipped mark in " << channel.source_dir;
+  }
+
+  if (num_shipped == 0 && !interrupted) return BarnError("Failed to ship any logs");
   return num_shipped;
 }
 
 /*
- * Sleep for a random period of time.
- * As we cannot put a fair scheduler on rsync, we simulate one here by just
- * making the agents play nice and give up the shared resource (in this case the
- * destination filesystem) for a period.
+ * Report how far behind shipping is as of this round's query, from the
+ * tai64n timestamps svlogd names rotated files with: the age of the oldest
+ * file still to ship (0 if there's none), the age of the newest file already
+ * on the target, and the bytes still to ship.
  */
-void sleep_it(const BarnConf& barn_conf)  {
-  // Random sleep to stop barn-agents on the same host getting in sync.
-  if (barn_conf.sleep_seconds > 0) {
-    int sleep_seconds = barn_conf.sleep_seconds/2 + (rand() % barn_conf.sleep_seconds);
-    LOG(INFO) << "Sleeping for " << sleep_seconds << " seconds...";
-    sleep(sleep_seconds);
+void report_lag(const FileOps& fileops, const AgentChannel& channel,
+                const Metrics& metrics, const FileNameList& existing_files,
+                const FileNameList& files_not_on_server,
+                const FileNameList& logs_to_ship) {
+  const int64_t now = time(0);
+
+  // Both sorted, searched rather than copied into sets as they can be long.
+  int64_t newest_shipped = -1;
+  for (auto& el : existing_files) {
+    if (!binary_search(files_not_on_server.begin(), files_not_on_server.end(), el))
+      newest_shipped = std::max(newest_shipped, tai64n_unix_seconds(el));
+  }
+  if (newest_shipped >= 0)
+    metrics.send_metric(NewestShippedAge, std::max(now - newest_shipped, int64_t(0)));
+
+  int64_t oldest_unshipped = -1;
+  string oldest_label;
+  uintmax_t backlog_bytes = 0;
+  for (auto& el : logs_to_ship) {
+    const int64_t rotated = tai64n_unix_seconds(el);
+    if (rotated >= 0 && (oldest_unshipped < 0 || rotated < oldest_unshipped)) {
+      oldest_unshipped = rotated;
+      oldest_label = el;
+    }
+    backlog_bytes += fileops.file_size(join_path(channel.source_dir, el));
   }
+  metrics.send_metric(OldestUnshippedAge,
+                      oldest_unshipped < 0 ? 0 : std::max(now - oldest_unshipped, int64_t(0)));
+  metrics.send_metric(BacklogBytes, backlog_bytes);
+  status_backlog(logs_to_ship.size(), backlog_bytes, oldest_label);
 }
 
 /*
- * Setup primary and optionally backup ChannelSelector from configuration.
+ * Pinned files (see pin_candidates) that svlogd already pruned are still to
+ * ship unless they're older than the shipped mark, pins that aren't
+ * needed any more are released.
  */
-ChannelSelector<AgentChannel>* create_channel_selector(const BarnConf& barn_conf) {
-  AgentChannel primary;
-  primary.rsync_target = get_rsync_target(
-        barn_conf.primary_rsync_addr,
-        barn_conf.remote_rsync_namespace,
+void add_pinned_candidates(const FileOps& fileops, const AgentChannel& channel,
+                           const FileNameList& existing_files, const string& shipped_mark,
+                           FileNameList* logs_to_ship) {
+  // Both sorted, searched rather than copied into sets as they can be long.
+  const auto to_ship_end = logs_to_ship->size();
+  bool added = false;
+
+  for (auto& name : fileops.list_pinned(channel.source_dir)) {
+    if (binary_search(logs_to_ship->begin(), logs_to_ship->begin() + to_ship_end, name))
+      continue;
+    if (!binary_search(existing_files.begin(), existing_files.end(), name) &&
+        name > shipped_mark) {
+      LOG(INFO) << "Shipping " << name << " from its pin, it was pruned";
+      logs_to_ship->push_back(name);
+      added = true;
+    } else {
+      fileops.unpin_file(channel.source_dir, name);
+    }
+  }
+  if (added)
+    sort(logs_to_ship->begin(), logs_to_ship->end());
+}
+
+/*
+ * Hardlink candidates into the pin directory, oldest (first to be pruned)
+ * first, while they fit in --pin_budget_mb. Shipping then reads the pin, so
+ * svlogd pruning the file meanwhile doesn't lose it. Returns the pinned
+ * candidates.
+ */
+set<string> pin_candidates(const BarnConf& barn_conf, const FileOps& fileops,
+                           const AgentChannel& channel, const Metrics& metrics,
+                           const FileNameList& candidates) {
+  const auto already_pinned = fileops.list_pinned(channel.source_dir);
+  set<string> pinned(already_pinned.begin(), already_pinned.end());
+  uintmax_t pinned_bytes = 0;
+  for (auto& name : pinned)
+    pinned_bytes += fileops.file_size(pin_path(channel.source_dir, name));
+
+  const uintmax_t budget = uintmax_t(barn_conf.pin_budget_mb) * 1024 * 1024;
+  int unpinned = 0;
+  for (auto& name : candidates) {
+    if (pinned.count(name) || barn_conf.pin_budget_mb == 0)
+      continue;
+    const auto size = fileops.file_size(join_path(channel.source_dir, name));
+    if (pinned_bytes + size <= budget && fileops.pin_file(channel.source_dir, name)) {
+      pinned.insert(name);
+      pinned_bytes += size;
+    } else {
+      ++unpinned;
+    }
+  }
+  metrics.send_metric(PinnedBytes, pinned_bytes);
+  metrics.send_metric(UnpinnedCandidates, unpinned);
+  return pinned;
+}
+
+/*
+ * Start the next round as 'decision' says.
+ * Errors back off for a random period of time: as we cannot put a fair
+ * scheduler on rsync, this makes the agents play nice and give up the shared
+ * resource (in this case the destination filesystem) for a period. With
+ * --host_coordinator the agents of a host also take turns through shipping
+ * slots (see host_coordinator.h).
+ * Returns what is left of the wait if an upgrade or a command on the control
+ * socket cut it short (see handoff.h, control_socket.h), flushing 'metrics'
+ * first, NextRound::Now otherwise.
+ */
+ScheduleDecision wait_for_next_round(const FileOps& fileops, const AgentChannel& channel,
+                                     const Metrics& metrics, ScheduleDecision decision,
+                                     RotationWatch* rotation_watch) {
+  const ScheduleDecision over = {NextRound::Now, 0};
+  if (decision.next == NextRound::OnNewFile) {
+    LOG(INFO) << "Waiting for directory change...";
+    status_activity(AgentActivity::Waiting);
+    TraceSpan wait("wait_for_new_file");
+    const auto wait_start = chrono::steady_clock::now();
+    // Until the dry run ahead of the rotation is due, predicting again every
+    // 'seconds' as the growth of 'current' changes.
+    bool rotated = false;
+    int due_in;
+    while (!rotated && rotation_watch && !waits_interrupted() &&
+           (due_in = rotation_watch->dry_run_due_in(fileops, channel.source_dir)) >= 0) {
+      if (due_in == 0) {
+        dry_run_ahead(fileops, channel, metrics, rotation_watch);
+        break;
+      }
+      FlightWait waiting;
+      rotated = fileops.wait_for_new_file_within(channel.source_dir,
+                                                 min(due_in, max(decision.seconds, 1)));
+    }
+    if (!rotated && !waits_interrupted()) {
+      FlightWait waiting;
+      rotated = fileops.wait_for_new_file_in_directory(channel.source_dir, decision.seconds);
+    }
+    metrics.record_value(WaitLatency, millis_since(wait_start));
+    // An interrupted inotifywait fails, a rotation meanwhile still counts.
+    if (!rotated && waits_interrupted()) {
+      metrics.flush();
+      return decision;
+    }
+  } else if (decision.next == NextRound::AfterBackoff && decision.seconds > 0) {
+    LOG(INFO) << "Backing off for " << decision.seconds << " seconds...";
+    status_activity(AgentActivity::BackingOff);
+    TraceSpan sleep_span("sleep");
+    // In steps rather than one sleep, as signals and control commands may
+    // be taken by other threads.
+    FlightWait waiting;
+    const auto until = chrono::steady_clock::now() + chrono::seconds(decision.seconds);
+    while (!waits_interrupted() && chrono::steady_clock::now() < until)
+      this_thread::sleep_for(WAIT_CHECK_INTERVAL);
+    const auto left = chrono::duration_cast<chrono::seconds>(
+          until - chrono::steady_clock::now()).count();
+    if (left > 0 && waits_interrupted()) {
+      metrics.flush();
+      return {NextRound::AfterBackoff, int(left)};
+    }
+  }
+  return over;
+}
+
+/*
+ * Ship every log retained in the source directory as fast as allowed and
+ * return the agent's exit status (see drain.h). Files failing to ship are
+ * retried, backing off, until --drain_seconds have passed.
+ */
+int drain_logs(const BarnConf& barn_conf, const FileOps& fileops,
+               ChannelSelector<AgentChannel>& channel_selector,
+               const Metrics& metrics, const ShippingSlots& slots) {
+  TraceSpan drain("drain");
+  status_activity(AgentActivity::Draining);
+  LOG(INFO) << "Draining " << barn_conf.source_dir << ", "
+            << barn_conf.drain_parallelism << " files at a time";
+  if (!rotate_current(barn_conf.source_dir, DRAIN_ROTATE_SECONDS))
+    LOG(WARNING) << "Failed to rotate current out of " << barn_conf.source_dir
+                 << ", its lines are left behind";
+
+  const auto deadline = chrono::steady_clock::now() + chrono::seconds(barn_conf.drain_seconds);
+  int backoff = max(barn_conf.sleep_seconds, 1);
+  int left = -1;  // Unknown until listed
+  while (true) {
+    const AgentChannel channel = channel_selector.pick_channel();
+    status_channel(channel.rsync_target, !channel_selector.health().primary_ok);
+    auto candidates = query_candidates(fileops, channel, metrics, nullptr);
+    status_activity(AgentActivity::Draining);
+    if (isFailure(candidates)) {
+      LOG(ERROR) << "Failed to list the files left to drain to " << channel.rsync_target
+                 << ": " << error(candidates);
+      status_error("failed to list the files left to drain to " + channel.rsync_target);
+    } else {
+      left = get(candidates).size();
+      if (left == 0)
+        break;
+      const auto progress = drain_candidates(barn_conf, fileops, channel, metrics, slots,
+                                             get(candidates));
+      left = progress.failed;
+      if (progress.shipped > 0)
+        channel_selector.heartbeat();
+      // Again straight away, for files rotated meanwhile.
+      if (progress.failed == 0 && chrono::steady_clock::now() < deadline)
+        continue;
+    }
+    if (chrono::steady_clock::now() + chrono::seconds(backoff) > deadline)
+      break;
+    LOG(INFO) << "Retrying the drain in " << backoff << " seconds...";
+    {
+      FlightWait waiting;
+      sleep(backoff);
+    }
+    backoff = min(backoff * 2, max(barn_conf.max_backoff_seconds, 1));
+  }
+
+  metrics.send_metric(DrainFilesLeft, max(left, 0));
+  metrics.flush();
+  if (left == 0) {
+    LOG(INFO) << "Drained " << barn_conf.source_dir;
+    return EXIT_DRAINED;
+  }
+  LOG(ERROR) << "Gave up draining " << barn_conf.source_dir << " with "
+             << (left < 0 ? string("an unknown number of") : to_string(left))
+             << " files left";
+  return EXIT_UNSHIPPED_LEFT;
+}
+
+/*
+ * Ship 'candidates' at --drain_parallelism at once, reporting progress on
+ * the way, then release their pins and advance the shipped mark.
+ */
+DrainProgress drain_candidates(const BarnConf& barn_conf, const FileOps& fileops,
+                               const AgentChannel& channel, const Metrics& metrics,
+                               const ShippingSlots& slots, const FileNameList& candidates) {
+  TraceSpan ship("drain_candidates");
+  const auto pinned = fileops.list_pinned(channel.source_dir);
+  vector<bool> is_pinned;
+  vector<string> paths;
+  vector<uintmax_t> sizes;
+  for (auto& name : candidates) {
+    is_pinned.push_back(binary_search(pinned.begin(), pinned.end(), name));
+    paths.push_back(is_pinned.back() ? pin_path(channel.source_dir, name)
+                                     : join_path(channel.source_dir, name));
+    sizes.push_back(fileops.file_size(paths.back()));
+  }
+  LOG(INFO) << "Draining " << candidates.size() << " files to " << channel.rsync_target;
+
+  vector<DrainOutcome> outcomes;
+  DrainProgress progress;
+  {
+    // A single slot for all of them: a coordinator counts agents, not files.
+    // Not interruptible, a drain already is the last thing the agent does.
+    ShippingSlot slot(slots, accumulate(sizes.begin(), sizes.end(), uintmax_t(0)));
+    progress = ship_in_parallel(
+          fileops, paths, sizes, channel.rsync_target, barn_conf.drain_parallelism,
+          DRAIN_REPORT_SECONDS,
+          [&](const DrainProgress& now) {
+            LOG(INFO) << "Drained " << now.shipped << "/" << now.files << " files ("
+                      << now.bytes_shipped / 1024 << "/" << now.bytes / 1024 << " KB), "
+                      << now.failed << " failed, " << now.lost << " lost";
+            metrics.send_metric(DrainFilesLeft, now.files - now.shipped - now.lost);
+            metrics.send_metric(DrainBytesLeft, now.bytes - now.bytes_shipped);
+            metrics.flush();
+          },
+          &outcomes);
+  }
+
+  uintmax_t page_cache_bytes = 0;
+  FileNameList done;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (outcomes[i] == DrainOutcome::Shipped) {
+      if (barn_conf.drop_page_cache)
+        page_cache_bytes += fileops.drop_from_page_cache(paths[i]);
+      if (is_pinned[i])
+        fileops.unpin_file(channel.source_dir, candidates[i]);
+      done.push_back(candidates[i]);
+    } else if (outcomes[i] == DrainOutcome::Lost) {
+      LOG(ERROR) << "Lost data! Couldn't ship " << paths[i] << " since it got rotated in the meantime";
+      done.push_back(candidates[i]);
+    }
+  }
+  metrics.send_metric(NumFilesShipped, progress.shipped);
+  metrics.send_metric(LostDuringShip, progress.lost);
+  if (barn_conf.drop_page_cache)
+    metrics.send_metric(PageCacheBytes, page_cache_bytes);
+  flight_record(FlightEventType::Shipped, progress.shipped, progress.lost);
+
+  string shipped_mark;
+  if (fileops.read_shipped_mark(channel.source_dir, channel.rsync_target, &shipped_mark)) {
+    const auto advanced = advance_shipped_mark(shipped_mark, candidates, done,
+                                               fileops.list_log_directory(channel.source_dir));
+    if (advanced != shipped_mark &&
+        !fileops.write_shipped_mark(channel.source_dir, channel.rsync_target, advanced))
+      LOG(WARNING) << "Failed to keep the shipped mark in " << channel.source_dir;
+  }
+  return progress;
+}
+
+/*
+ * Dry run just before a rotation, for the round after it (see rotation.h).
+ */
+void dry_run_ahead(const FileOps& fileops, const AgentChannel& channel,
+                   const Metrics& metrics, RotationWatch* rotation_watch) {
+  TraceSpan dry_run("dry_run_ahead");
+  const auto existing_files = fileops.list_log_directory(channel.source_dir);
+  const auto dry_run_start = chrono::steady_clock::now();
+  const auto not_on_target = fileops.log_files_not_on_target(
+        channel.source_dir, existing_files, channel.rsync_target);
+  metrics.record_value(DryRunLatency, millis_since(dry_run_start));
+  if (isFailure(not_on_target))
+    return;
+
+  const auto& missing = get(not_on_target);
+  FileNameList on_target;
+  set_difference(existing_files.begin(), existing_files.end(),
+                 missing.begin(), missing.end(), back_inserter(on_target));
+  rotation_watch->dry_run_done(channel.rsync_target, on_target);
+  metrics.send_metric(DryRunsAhead, 1);
+}
+
+/*
+ * Channel shipping the configured source to 'rsync_addr'.
+ */
+static AgentChannel make_channel(const BarnConf& barn_conf,
+                                 const string& rsync_addr,
+                                 const string& rsync_namespace) {
+  AgentChannel channel;
+  channel.rsync_target = get_rsync_target(
+        rsync_addr,
+        rsync_namespace,
         barn_conf.service_name,
         barn_conf.category);
-  primary.source_dir = barn_conf.source_dir;
+  channel.source_dir = barn_conf.source_dir;
+  return channel;
+}
+
+/*
+ * Setup primary and optionally backup ChannelSelector from configuration.
+ */
+ChannelSelector<AgentChannel>* create_channel_selector(const BarnConf& barn_conf) {
+  auto primary = make_channel(barn_conf, barn_conf.primary_rsync_addr,
+                              barn_conf.remote_rsync_namespace);
 
   if (barn_conf.seconds_before_failover == 0) {
     return new SingleChannelSelector<AgentChannel>(primary);
   } else {
-    AgentChannel backup;
-    backup.rsync_target = get_rsync_target(
-          barn_conf.secondary_rsync_addr,
-          barn_conf.remote_rsync_namespace_backup,
-          barn_conf.service_name,
-          barn_conf.category);
-    backup.source_dir = barn_conf.source_dir;
+    auto backup = make_channel(barn_conf, barn_conf.secondary_rsync_addr,
+                               barn_conf.remote_rsync_namespace_backup);
     return new FailoverChannelSelector<AgentChannel>(
                     primary, backup, barn_conf.seconds_before_failover);
   }
 }
 
 /*
- * Setup sending metrics to barn-agent-monitor if configured.
+ * In nanoseconds, 0 if 'path' can't be stat'ed.
+ */
+int64_t modification_time(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return 0;
+  return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/*
+ * Reload the config file on SIGHUP or when it changed since 'config_mtime'.
+ * A valid configuration replaces 'conf' as a whole and updates the channels
+ * in place, so the health of the primary carries over. An invalid one is
+ * logged and ignored.
+ */
+void reload_if_asked(BarnConf* conf,
+                     scoped_ptr<ChannelSelector<AgentChannel>>& channel_selector,
+                     int64_t* config_mtime) {
+  const auto mtime = modification_time(conf->config_file);
+  if (!take_reload_request() && mtime == *config_mtime)
+    return;
+  *config_mtime = mtime;
+
+  auto reloaded = reload_configuration(*conf);
+  if (isFailure(reloaded)) {
+    LOG(ERROR) << "Keeping current configuration, failed to reload "
+               << conf->config_file << ": " << error(reloaded);
+    flight_record(FlightEventType::Error, 0, 0, "config reload failed");
+    return;
+  }
+
+  const auto next = get(std::move(reloaded));
+  if ((next.seconds_before_failover == 0) != (conf->seconds_before_failover == 0)) {
+    channel_selector.reset(create_channel_selector(next));
+  } else {
+    channel_selector->update_channels(
+          make_channel(next, next.primary_rsync_addr, next.remote_rsync_namespace),
+          make_channel(next, next.secondary_rsync_addr, next.remote_rsync_namespace_backup),
+          next.seconds_before_failover);
+  }
+  *conf = next;
+  LOG(INFO) << "Reloaded configuration from " << conf->config_file;
+}
+
+/*
+ * Setup sending metrics to statsd or barn-agent-monitor if configured, on
+ * the statsd socket of the agent upgraded from if 'handoff' has one for the
+ * same --statsd_addr. Metrics that can't be set up don't stop shipping: a
+ * statsd that doesn't resolve falls back to the monitor, or to none.
  */
-Metrics* create_metrics(const BarnConf& barn_conf) {
-  if (barn_conf.monitor_port > 0) {
+Metrics* create_metrics(const BarnConf& barn_conf, const AgentHandoff* handoff) {
+  const bool take_over = handoff && handoff->statsd_fd >= 0 &&
+                         !handoff->statsd_addr.empty() &&
+                         handoff->statsd_addr == barn_conf.statsd_addr;
+  if (handoff && handoff->statsd_fd >= 0 && !take_over) {
+    LOG(INFO) << "Not taking over statsd at " << handoff->statsd_resolved
+              << ", --statsd_addr changed";
+    close(handoff->statsd_fd);
+  }
+  if (!barn_conf.statsd_addr.empty()) {
+    if (take_over) {
+      try {
+        return new StatsdMetrics(barn_conf.statsd_addr, barn_conf.statsd_prefix,
+                                 barn_conf.statsd_max_datagram,
+                                 barn_conf.service_name, barn_conf.category,
+                                 handoff->statsd_resolved, handoff->statsd_fd);
+      } catch (const std::exception& e) {
+        LOG(WARNING) << "Failed to take over statsd at " << handoff->statsd_resolved
+                     << ": " << e.what();
+        close(handoff->statsd_fd);
+      }
+    }
+    try {
+      return new StatsdMetrics(barn_conf.statsd_addr, barn_conf.statsd_prefix,
+                               barn_conf.statsd_max_datagram,
+                               barn_conf.service_name, barn_conf.category);
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Failed to set up statsd at " << barn_conf.statsd_addr << ": " << e.what()
+                 << (barn_conf.monitor_port > 0 ? ", reporting to the monitor"
+                                                : ", metrics reporting disabled");
+    }
+  }
+  if (barn_conf.monitor_port > 0 && !barn_conf.metrics_shm.empty()) {
+    try {
+      return new ShmReport(barn_conf.metrics_shm, barn_conf.monitor_port,
+                           barn_conf.service_name, barn_conf.category);
+    } catch (const std::runtime_error& e) {
+      LOG(ERROR) << e.what() << ", sending metrics as datagrams";
+      return new LocalReport(barn_conf.monitor_port, barn_conf.service_name,
+                             barn_conf.category);
+    }
+  } else if (barn_conf.monitor_port > 0) {
     return new LocalReport(barn_conf.monitor_port, barn_conf.service_name,
                            barn_conf.category);
   } else {
     return new NoOpMetrics();
   }
 }
+
+/*
+ * Share shipping slots with the host's other agents if configured, in the
+ * coordinator entry of the agent upgraded from if 'handoff' has one.
+ */
+ShippingSlots* create_shipping_slots(const BarnConf& barn_conf, const AgentHandoff* handoff) {
+  if (!barn_conf.host_coordinator.empty()) {
+    try {
+      return new HostCoordinator(barn_conf.host_coordinator,
+                                 barn_conf.host_max_shipping, barn_conf.ship_weight,
+                                 handoff ? handoff->coordinator_entry : -1);
+    } catch (const std::runtime_error& e) {
+      LOG(ERROR) << e.what() << ", shipping without coordination";
+    }
+  }
+  return new UnlimitedShipping();
+}
+
+/*
+ * Read the state handed over by the agent upgraded from (see handoff.h) if
+ * there is one, false if there is none or it can't be used.
+ */
+bool take_handoff(const BarnConf& barn_conf, AgentHandoff* handoff) {
+  if (barn_conf.handoff_fd < 0)
+    return false;
+  auto handed = read_handoff(barn_conf.handoff_fd);
+  if (isFailure(handed)) {
+    LOG(WARNING) << "Starting afresh, " << error(handed);
+    return false;
+  }
+  *handoff = get(std::move(handed));
+  if (!handoff->host_name.empty())
+    use_host_name(handoff->host_name);
+  LOG(INFO) << "Upgraded, taking over where the previous agent left off";
+  return true;
+}
+
+/*
+ * Hand the agent's state over to the binary it was started from (see
+ * handoff.h). Only returns if that fails, the agent then runs on.
+ */
+void upgrade(const BarnConf& conf, const string& executable, const FileOps& fileops,
+             const ChannelSelector<AgentChannel>& channel_selector,
+             const ShipScheduler& scheduler, const RotationWatch& rotation_watch,
+             const Metrics& metrics, const ShippingSlots& slots) {
+  AgentHandoff handoff;
+  handoff.host_name = local_host_name();
+  const auto health = channel_selector.health();
+  handoff.primary_ok = health.primary_ok;
+  handoff.last_heartbeat_time = health.last_heartbeat_time;
+  handoff.failure_streak = scheduler.failure_streak();
+  handoff.unfinished_wait = scheduler.unfinished_wait();
+  const auto rotated = fileops.list_log_directory(conf.source_dir);
+  handoff.newest_file = rotated.empty() ? "" : rotated.back();
+  if (!rotation_watch.pending_dry_run(&handoff.dry_run_target, &handoff.dry_run_on_target))
+    handoff.dry_run_target.clear();
+  vector<int> inherited;
+  handoff.statsd_fd = -1;
+  if (auto* statsd = dynamic_cast<const StatsdMetrics*>(&metrics)) {
+    handoff.statsd_addr = conf.statsd_addr;
+    handoff.statsd_resolved = statsd->resolved_address();
+    handoff.statsd_fd = statsd->socket_fd();
+    inherited.push_back(handoff.statsd_fd);
+  }
+  auto* coordinator = dynamic_cast<const HostCoordinator*>(&slots);
+  handoff.coordinator_entry = coordinator ? coordinator->entry() : -1;
+  handoff.paused = control_paused();
+
+  const int fd = write_handoff(handoff);
+  if (fd < 0) {
+    LOG(ERROR) << "Not upgrading, failed to write the state to hand over: " << strerror(errno);
+    return;
+  }
+  inherited.push_back(fd);
+  LOG(INFO) << "Upgrading to " << executable;
+  metrics.flush();
+  flush_async_logging();
+  exec_upgrade(executable, upgrade_command_line(conf.command_line, fd), inherited);
+
+  const int exec_errno = errno;
+  close(fd);
+  LOG(ERROR) << "Not upgrading, failed to run " << executable << ": " << strerror(exec_errno);
+  flight_record(FlightEventType::Error, 0, 0, "upgrade failed");
+}
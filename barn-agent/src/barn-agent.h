@@ -12,8 +12,11 @@
 #include "channel_selector.h"
 #include "helpers.h"
 #include "files.h"
+#include "host_coordinator.h"
 #include "metrics.h"
 #include "params.h"
+#include "rotation.h"
+#include "scheduler.h"
 
 /*
  * A channel is an abstraction over a source and a destination. This allows
@@ -24,13 +27,41 @@ struct AgentChannel {
   std::string rsync_target;  // The full rsync path name. e.g. rsync://80.80.80:80:1000/barn_logs/foo
 };
 
-void barn_agent_main(const BarnConf& barn_conf);
+struct AgentHandoff;
+
+inline std::string flight_channel_name(const AgentChannel& channel) {
+  return channel.rsync_target;
+}
+
+int barn_agent_main(const BarnConf& barn_conf);
 
 // public for testing
 void dispatch_new_logs(const BarnConf& barn_conf,
                        const FileOps &rsync,
                        ChannelSelector<AgentChannel>& channel_selector,
-                       const Metrics& metrics);
+                       const Metrics& metrics,
+                       ShipScheduler& scheduler,
+                       const ShippingSlots& slots = UnlimitedShipping(),
+                       RotationWatch* rotation_watch = nullptr);
+
+// The round of dispatch_new_logs without its wait, returning how to wait.
+ScheduleDecision ship_round(const BarnConf& barn_conf,
+                            const FileOps& fileops,
+                            ChannelSelector<AgentChannel>& channel_selector,
+                            const Metrics& metrics,
+                            ShipScheduler& scheduler,
+                            const ShippingSlots& slots,
+                            RotationWatch* rotation_watch);
+
+// Metrics as configured, see handoff.h for 'handoff', nullptr if none.
+Metrics* create_metrics(const BarnConf& barn_conf, const AgentHandoff* handoff);
+
+// Ship everything retained and return the exit status, see drain.h.
+int drain_logs(const BarnConf& barn_conf,
+               const FileOps& fileops,
+               ChannelSelector<AgentChannel>& channel_selector,
+               const Metrics& metrics,
+               const ShippingSlots& slots = UnlimitedShipping());
 
 
 
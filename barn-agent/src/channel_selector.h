@@ -1,10 +1,26 @@
 #ifndef CHANNEL_SELECTOR_H
 #define CHANNEL_SELECTOR_H
 
+#include <string>
+
+#include "flight_recorder.h"
 #include "metrics.h"
 #include "params.h"
 
 
+/*
+ * Which channel a selector is on and since when, handed over to the
+ * upgraded agent (see handoff.h).
+ */
+struct ChannelHealth {
+  bool primary_ok;
+  time_t last_heartbeat_time;
+};
+
+// What flight records name a channel by (see flight_recorder.h), overloaded
+// for the channels that have a name.
+template <class T> std::string flight_channel_name(const T&) { return ""; }
+
 template <class T> class ChannelSelector {
 public:
   virtual void heartbeat() = 0;
@@ -12,6 +28,17 @@ public:
   virtual T current() const = 0;
   virtual void send_metrics(const Metrics&) const {}
 
+  // Point at new channels (e.g. after a config reload), keeping track of
+  // which one is healthy.
+  virtual void update_channels(const T& primary, const T& secondary,
+                               int seconds_before_failover) = 0;
+
+  virtual ChannelHealth health() const { return {true, 0}; }
+  virtual void restore_health(const ChannelHealth& health) {}
+
+  // Move to the other channel as if this one failed, false without one.
+  virtual bool switch_channel() { return false; }
+
   virtual ~ChannelSelector() {}
 };
 
@@ -24,6 +51,11 @@ public:
   T pick_channel() override { return channel; }
   T current() const override { return channel; }
 
+  void update_channels(const T& primary, const T& secondary,
+                       int seconds_before_failover) override {
+    channel = primary;
+  }
+
 private:
   T channel;
 };
@@ -73,6 +105,33 @@ public:
         m.send_metric(FailedOverAgents, 1);
   }
 
+  void update_channels(const T& primary, const T& secondary,
+                       int seconds_before_failover) override {
+    assert(seconds_before_failover > 0);
+    this->primary = primary;
+    this->secondary = secondary;
+    this->seconds_before_failover = seconds_before_failover;
+  }
+
+  ChannelHealth health() const override {
+    return {primary_ok, last_heartbeat_time};
+  }
+
+  void restore_health(const ChannelHealth& health) override {
+    primary_ok = health.primary_ok;
+    last_heartbeat_time = health.last_heartbeat_time;
+  }
+
+  bool switch_channel() override {
+    LOG(WARNING) << "!!Channel: switching to " << (primary_ok ? "backup" : "primary")
+                 << " as asked";
+    primary_ok = !primary_ok;
+    record_switch();
+    // Stay there until the failover period is up.
+    last_heartbeat_time = now_in_seconds();
+    return true;
+  }
+
   void heartbeat() override {
     if (primary_ok) {
         last_heartbeat_time = now_in_seconds();
@@ -89,6 +148,7 @@ public:
       // too long, perform failover
       LOG(ERROR) << "!!Channel: error primary down for too long, failing to backup";
       primary_ok = false;
+      record_switch();
       last_heartbeat_time = now;
     // TODO: set failback seconds independent of failover
     } else if (time_since_heartbeat < seconds_before_failover) {
@@ -97,6 +157,7 @@ public:
       // on secondary for long enough, try primary again
       LOG(WARNING) << "!!Channel: trying to fail back to primary from backup";
       primary_ok = true;
+      record_switch();
       last_heartbeat_time = now;
     }
     return current();
@@ -117,6 +178,12 @@ protected:
   time_t last_heartbeat_time;
 
 private:
+    // Switched to the channel now current, named by its target.
+    void record_switch() const {
+      flight_record(FlightEventType::ChannelSwitch, primary_ok ? 0 : 1, 0,
+                    flight_channel_name(current()).c_str());
+    }
+
     T primary, secondary;
     bool primary_ok;
     time_t seconds_before_failover;
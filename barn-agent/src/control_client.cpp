@@ -0,0 +1,81 @@
+/*
+ * Talking to an agent's control socket, see control_client.h.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control_client.h"
+
+using namespace std;
+
+// An agent busy for longer than this counts as unreachable.
+static const int REPLY_TIMEOUT_SECONDS = 5;
+
+/**/
+bool control_request(const string& socket_path, const string& command,
+                     string* reply, string* problem) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    *problem = "socket path too long";
+    return false;
+  }
+  strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    *problem = strerror(errno);
+    return false;
+  }
+  struct timeval timeout = {REPLY_TIMEOUT_SECONDS, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    *problem = strerror(errno);
+    close(fd);
+    return false;
+  }
+
+  const string line = command + "\n";
+  if (write(fd, line.data(), line.size()) != (ssize_t)line.size()) {
+    *problem = strerror(errno);
+    close(fd);
+    return false;
+  }
+  reply->clear();
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      *problem = strerror(errno);
+      close(fd);
+      return false;
+    }
+    reply->append(buffer, n);
+  }
+  close(fd);
+  return true;
+}
+
+/**/
+map<string, string> parse_status_reply(const string& reply) {
+  map<string, string> fields;
+  istringstream in(reply);
+  string line;
+  while (getline(in, line)) {
+    const auto separator = line.find(' ');
+    if (separator == string::npos)
+      fields[line] = "";
+    else
+      fields[line.substr(0, separator)] = line.substr(separator + 1);
+  }
+  return fields;
+}
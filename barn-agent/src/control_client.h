@@ -0,0 +1,21 @@
+#ifndef CONTROL_CLIENT_H
+#define CONTROL_CLIENT_H
+/*
+ * Talking to an agent's control socket (see control_socket.h), for
+ * barn-agentctl. Doesn't log, so it links without the rest of the agent.
+ */
+
+#include <map>
+#include <string>
+
+/*
+ * Send 'command' to the agent listening on 'socket_path' and return its
+ * reply. False with 'problem' set if the agent can't be reached.
+ */
+bool control_request(const std::string& socket_path, const std::string& command,
+                     std::string* reply, std::string* problem);
+
+// The "name value" lines of a status reply.
+std::map<std::string, std::string> parse_status_reply(const std::string& reply);
+
+#endif
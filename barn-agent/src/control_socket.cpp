@@ -0,0 +1,271 @@
+/*
+ * The agent's control socket, see control_socket.h.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+#include "control_socket.h"
+#include "helpers.h"
+#include "params.h"
+#include "sighandle.h"
+
+using namespace std;
+
+// Longest command line read, and how long a client gets to send it.
+static const size_t MAX_COMMAND_BYTES = 256;
+static const int COMMAND_TIMEOUT_SECONDS = 1;
+
+static mutex status_mutex;
+static ControlStatus status = {"", 0, AgentActivity::Starting, "", false, 0, 0, "", "", 0,
+                               0, 0, 0, "", 0, 0};
+static atomic<bool> paused(false);
+static atomic<bool> switch_requested(false);
+
+/**/
+const char* activity_name(AgentActivity activity) {
+  switch (activity) {
+    case AgentActivity::Starting: return "starting";
+    case AgentActivity::Querying: return "querying";
+    case AgentActivity::Shipping: return "shipping";
+    case AgentActivity::Waiting: return "waiting";
+    case AgentActivity::BackingOff: return "backing_off";
+    case AgentActivity::Paused: return "paused";
+    case AgentActivity::Draining: return "draining";
+  }
+  return "unknown";
+}
+
+/**/
+string format_status(const ControlStatus& status, int64_t now) {
+  ostringstream out;
+  out << "agent " << status.agent << "\n"
+      << "pid " << status.pid << "\n"
+      << "activity " << activity_name(status.activity) << "\n"
+      << "channel " << status.channel << "\n"
+      << "on_backup " << status.on_backup << "\n"
+      << "backlog_files " << status.backlog_files << "\n"
+      << "backlog_bytes " << status.backlog_bytes << "\n"
+      << "oldest_unshipped " << status.oldest_unshipped << "\n";
+  const auto oldest = tai64n_unix_seconds(status.oldest_unshipped);
+  if (oldest >= 0)
+    out << "oldest_unshipped_age " << max<int64_t>(now - oldest, 0) << "\n";
+  out << "in_flight " << status.in_flight << "\n";
+  if (!status.in_flight.empty()) {
+    out << "in_flight_bytes " << status.in_flight_bytes << "\n"
+        << "in_flight_number " << status.in_flight_number << "\n"
+        << "round_files " << status.round_files << "\n"
+        << "in_flight_seconds " << max<int64_t>(now - status.in_flight_since, 0) << "\n";
+  }
+  out << "last_error " << status.last_error << "\n";
+  if (!status.last_error.empty())
+    out << "last_error_age " << max<int64_t>(now - status.last_error_time, 0) << "\n";
+  out << "rounds " << status.rounds << "\n";
+  return out.str();
+}
+
+/**/
+void status_identity(const string& service_name, const string& category) {
+  lock_guard<mutex> lock(status_mutex);
+  status.agent = service_name + ":" + category;
+  status.pid = getpid();
+}
+
+/**/
+void status_activity(AgentActivity activity) {
+  lock_guard<mutex> lock(status_mutex);
+  status.activity = activity;
+}
+
+/**/
+void status_channel(const string& rsync_target, bool on_backup) {
+  lock_guard<mutex> lock(status_mutex);
+  status.channel = rsync_target;
+  status.on_backup = on_backup;
+}
+
+/**/
+void status_backlog(int files, uintmax_t bytes, const string& oldest_unshipped) {
+  lock_guard<mutex> lock(status_mutex);
+  status.backlog_files = files;
+  status.backlog_bytes = bytes;
+  status.oldest_unshipped = oldest_unshipped;
+}
+
+/**/
+void status_shipping(const string& path, uintmax_t bytes, int number, int round_files) {
+  const int64_t now = time(0);
+  lock_guard<mutex> lock(status_mutex);
+  status.activity = AgentActivity::Shipping;
+  status.in_flight = path;
+  status.in_flight_bytes = bytes;
+  status.in_flight_number = number;
+  status.round_files = round_files;
+  status.in_flight_since = now;
+}
+
+/**/
+void status_shipped() {
+  lock_guard<mutex> lock(status_mutex);
+  status.in_flight.clear();
+}
+
+/**/
+void status_error(const string& what) {
+  const int64_t now = time(0);
+  lock_guard<mutex> lock(status_mutex);
+  status.last_error = what;
+  status.last_error_time = now;
+}
+
+/**/
+void status_round_done() {
+  lock_guard<mutex> lock(status_mutex);
+  status.rounds++;
+}
+
+/**/
+ControlStatus current_status() {
+  lock_guard<mutex> lock(status_mutex);
+  return status;
+}
+
+/**/
+bool control_paused() {
+  return paused;
+}
+
+/**/
+void set_control_paused(bool pause) {
+  paused = pause;
+}
+
+/**/
+bool take_switch_request() {
+  return switch_requested.exchange(false);
+}
+
+/**/
+string handle_control_command(const string& command) {
+  if (command == "status")
+    return format_status(current_status(), time(0));
+  if (command == "pause") {
+    if (!paused.exchange(true)) {
+      LOG(INFO) << "Pausing, asked on the control socket";
+      wake_up();
+    }
+    return "ok\n";
+  }
+  if (command == "resume") {
+    if (paused.exchange(false)) {
+      LOG(INFO) << "Resuming, asked on the control socket";
+      wake_up();
+    }
+    return "ok\n";
+  }
+  if (command == "round") {
+    if (paused)
+      return "error: paused\n";
+    wake_up();
+    return "ok\n";
+  }
+  if (command == "switch") {
+    switch_requested = true;
+    return "ok\n";
+  }
+  return "error: unknown command '" + command + "'\n";
+}
+
+/*
+ * Read the command line of a connection, "" if there is none in time.
+ */
+static string read_command(int connection) {
+  string command;
+  char c;
+  while (command.size() < MAX_COMMAND_BYTES) {
+    const auto n = read(connection, &c, 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0 || c == '\n')
+      break;
+    command += c;
+  }
+  if (!command.empty() && command.back() == '\r')
+    command.pop_back();
+  return command;
+}
+
+static void write_fully(int fd, const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const auto n = write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    written += n;
+  }
+}
+
+static void serve(int listening) {
+  while (true) {
+    const int connection = accept4(listening, nullptr, nullptr, SOCK_CLOEXEC);
+    if (connection < 0) {
+      if (errno != EINTR && errno != ECONNABORTED)
+        this_thread::sleep_for(chrono::seconds(1));
+      continue;
+    }
+    // A client that doesn't send its command doesn't hold up the next.
+    struct timeval timeout = {COMMAND_TIMEOUT_SECONDS, 0};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    write_fully(connection, handle_control_command(read_command(connection)));
+    close(connection);
+  }
+}
+
+/**/
+bool start_control_socket(const string& path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    LOG(ERROR) << "Control socket path too long: " << path;
+    return false;
+  }
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+  const int listening = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listening < 0) {
+    LOG(ERROR) << "Failed to create the control socket: " << strerror(errno);
+    return false;
+  }
+  // Left behind by an agent killed before it could remove it.
+  unlink(path.c_str());
+  if (bind(listening, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listening, 16) != 0) {
+    LOG(ERROR) << "Failed to listen on control socket " << path << ": " << strerror(errno);
+    close(listening);
+    return false;
+  }
+  chmod(path.c_str(), 0660);
+  thread(serve, listening).detach();
+  return true;
+}
+
+/**/
+ControlSocketCleanup::~ControlSocketCleanup() {
+  if (!path.empty())
+    unlink(path.c_str());
+}
@@ -0,0 +1,107 @@
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+/*
+ * A Unix domain socket (--control_socket) telling what the agent is doing
+ * and taking commands, see barn-agentctl. A connection sends one command
+ * line and gets the reply until the agent closes it:
+ *   status  "name value" lines (see ControlStatus)
+ *   pause   stop starting rounds, the round under way finishes
+ *   resume  start rounds again
+ *   round   start the next round now instead of waiting
+ *   switch  ship to the other channel (with --backup-addr) from the next
+ *           round
+ * Commands are answered "ok" or "error: why".
+ *
+ * The main loop posts what it's doing with the status_*() calls, each only
+ * copying a few fields under a lock. The socket is served from a thread of
+ * its own, and commands are only flags the main loop picks up between
+ * rounds.
+ */
+
+#include <cstdint>
+#include <string>
+
+enum class AgentActivity {
+  Starting,
+  Querying,    // Dry run for what to ship
+  Shipping,
+  Waiting,     // For the next rotation
+  BackingOff,  // After errors
+  Paused,
+  Draining     // See drain.h
+};
+
+const char* activity_name(AgentActivity activity);
+
+/*
+ * What the agent reports, "name value" lines in this order (times served as
+ * ages, e.g. oldest_unshipped_age).
+ */
+struct ControlStatus {
+  std::string agent;             // service:category
+  int pid;
+  AgentActivity activity;
+  std::string channel;           // rsync target shipped to
+  bool on_backup;
+  int backlog_files;             // As of the last query
+  uintmax_t backlog_bytes;
+  std::string oldest_unshipped;  // tai64n label of the oldest, "" if none
+  std::string in_flight;         // Path of the file being shipped, "" if none
+  uintmax_t in_flight_bytes;
+  int in_flight_number;          // 1 based, of 'round_files' this round
+  int round_files;
+  int64_t in_flight_since;       // Unix seconds
+  std::string last_error;        // "" if there was none
+  int64_t last_error_time;       // Unix seconds
+  int64_t rounds;
+};
+
+// The status as served at 'now' (unix seconds): ages instead of times.
+std::string format_status(const ControlStatus& status, int64_t now);
+
+// Post what the agent is up to.
+void status_identity(const std::string& service_name, const std::string& category);
+void status_activity(AgentActivity activity);
+void status_channel(const std::string& rsync_target, bool on_backup);
+void status_backlog(int files, uintmax_t bytes, const std::string& oldest_unshipped);
+void status_shipping(const std::string& path, uintmax_t bytes, int number, int round_files);
+void status_shipped();
+void status_error(const std::string& what);
+void status_round_done();
+
+// A copy of the status posted so far.
+ControlStatus current_status();
+
+/*
+ * Listen on 'path' (replacing a stale socket) and serve it on a thread of
+ * its own. False if it can't listen.
+ */
+bool start_control_socket(const std::string& path);
+
+/*
+ * Removes the socket at 'path' ("" for none) when it goes out of scope, so
+ * an agent that exits doesn't leave a stale one behind. An upgrade execs
+ * without it, the new agent listens on the path again.
+ */
+class ControlSocketCleanup {
+public:
+  explicit ControlSocketCleanup(const std::string& path): path(path) {}
+  ~ControlSocketCleanup();
+
+private:
+  const std::string path;
+};
+
+// Answer 'command', as the socket does.
+std::string handle_control_command(const std::string& command);
+
+// Whether 'pause' was asked for and 'resume' wasn't since.
+bool control_paused();
+
+// Pause or resume, e.g. as handed over on upgrade.
+void set_control_paused(bool paused);
+
+// Returns whether 'switch' was asked for since the last call.
+bool take_switch_request();
+
+#endif
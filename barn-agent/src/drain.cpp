@@ -0,0 +1,185 @@
+/*
+ * Draining a log directory, see drain.h.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <signal.h>
+#include <sstream>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "drain.h"
+#include "helpers.h"
+
+using namespace std;
+
+// How often to look whether svlogd rotated 'current' yet.
+static const int ROTATION_POLL_MILLIS = 100;
+
+/**/
+DrainProgress ship_in_parallel(const FileOps& fileops, const vector<string>& paths,
+                               const vector<uintmax_t>& sizes,
+                               const string& rsync_target, int parallelism,
+                               int report_seconds,
+                               const function<void(const DrainProgress&)>& report,
+                               vector<DrainOutcome>* outcomes) {
+  outcomes->assign(paths.size(), DrainOutcome::Pending);
+  DrainProgress progress = {(int)paths.size(), 0, 0, 0, 0, 0};
+  for (auto size : sizes)
+    progress.bytes += size;
+
+  // Workers only take the next path and record its outcome, the caller
+  // reports progress.
+  mutex progress_mutex;
+  condition_variable finished;
+  atomic<size_t> next(0);
+  const int worker_count = min<int>(max(parallelism, 1), paths.size());
+  int running = worker_count;
+
+  auto ship = [&]() {
+    size_t i;
+    while ((i = next++) < paths.size()) {
+      DrainOutcome outcome = DrainOutcome::Shipped;
+      if (!fileops.ship_file(paths[i], rsync_target))
+        outcome = fileops.file_exists(paths[i]) ? DrainOutcome::Failed : DrainOutcome::Lost;
+
+      lock_guard<mutex> lock(progress_mutex);
+      (*outcomes)[i] = outcome;
+      if (outcome == DrainOutcome::Shipped) {
+        progress.shipped++;
+        progress.bytes_shipped += sizes[i];
+      } else if (outcome == DrainOutcome::Failed) {
+        progress.failed++;
+      } else {
+        progress.lost++;
+      }
+    }
+    lock_guard<mutex> lock(progress_mutex);
+    if (--running == 0)
+      finished.notify_one();
+  };
+
+  vector<thread> workers;
+  for (int i = 0; i < worker_count; ++i)
+    workers.push_back(thread(ship));
+
+  {
+    unique_lock<mutex> lock(progress_mutex);
+    while (running > 0) {
+      if (!finished.wait_for(lock, chrono::seconds(max(report_seconds, 1)),
+                             [&] { return running == 0; })) {
+        const auto snapshot = progress;
+        lock.unlock();
+        report(snapshot);
+        lock.lock();
+      }
+    }
+  }
+  for (auto& worker : workers)
+    worker.join();
+  report(progress);
+  return progress;
+}
+
+/**/
+int lock_holder(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return 0;
+
+  // e.g. "1: FLOCK  ADVISORY  WRITE 1234 08:02:131 0 EOF", waiters for a
+  // lock have "->" after the number.
+  ifstream locks("/proc/locks");
+  string line;
+  while (getline(locks, line)) {
+    istringstream fields(line);
+    string number, type, mode, access, device_inode;
+    int pid;
+    if (!(fields >> number >> type) || type == "->")
+      continue;
+    if (!(fields >> mode >> access >> pid >> device_inode))
+      continue;
+    unsigned int major_number, minor_number;
+    unsigned long long inode;
+    if (sscanf(device_inode.c_str(), "%x:%x:%llu", &major_number, &minor_number, &inode) != 3)
+      continue;
+    if (inode == st.st_ino && major_number == major(st.st_dev) &&
+        minor_number == minor(st.st_dev))
+      return pid > 0 ? pid : -1;
+  }
+  return 0;
+}
+
+/*
+ * Size and inode of 'path', false if it can't be stat'ed.
+ */
+static bool stat_file(const string& path, off_t* size, ino_t* inode) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+  *size = st.st_size;
+  *inode = st.st_ino;
+  return true;
+}
+
+/*
+ * Rename 'current' like svlogd rotates it, holding the directory's lock so
+ * an svlogd starting meanwhile waits.
+ */
+static bool rename_current(const string& log_directory) {
+  const auto lock = join_path(log_directory, "lock");
+  const int fd = open(lock.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return false;
+  bool renamed = false;
+  if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const auto rotated = join_path(log_directory, tai64n_label(now.tv_sec, now.tv_nsec) + ".s");
+    renamed = rename(join_path(log_directory, "current").c_str(), rotated.c_str()) == 0;
+    // svlogd marks files it's done with executable.
+    if (renamed)
+      chmod(rotated.c_str(), 0744);
+  }
+  close(fd);
+  return renamed;
+}
+
+/**/
+bool rotate_current(const string& log_directory, int timeout_seconds) {
+  const auto current = join_path(log_directory, "current");
+  off_t size;
+  ino_t inode;
+  if (!stat_file(current, &size, &inode) || size == 0)
+    return true;
+
+  const int svlogd = lock_holder(join_path(log_directory, "lock"));
+  if (svlogd == 0)
+    return rename_current(log_directory);
+
+  // svlogd moves a non-empty 'current' aside and starts a new one.
+  if (svlogd < 0 || kill(svlogd, SIGALRM) != 0)
+    return false;
+  const auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout_seconds);
+  while (chrono::steady_clock::now() < deadline) {
+    off_t now_size;
+    ino_t now_inode;
+    if (!stat_file(current, &now_size, &now_inode) || now_inode != inode || now_size == 0)
+      return true;
+    this_thread::sleep_for(chrono::milliseconds(ROTATION_POLL_MILLIS));
+  }
+  return false;
+}
@@ -0,0 +1,63 @@
+#ifndef DRAIN_H
+#define DRAIN_H
+/*
+ * Draining a log directory before the host goes away: instead of waiting
+ * for rotations, 'current' is rotated out, every retained file is shipped
+ * on several rsyncs at once and the agent exits with a status telling
+ * whether anything is left behind. Started by --drain or SIGQUIT.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "files.h"
+
+// Exit statuses of a drained agent.
+static const int EXIT_DRAINED = 0;
+static const int EXIT_UNSHIPPED_LEFT = 3;
+
+enum class DrainOutcome : char {
+  Pending,
+  Shipped,
+  Failed,  // Still there, to retry
+  Lost     // Gone before it could be shipped
+};
+
+struct DrainProgress {
+  int files;
+  int shipped;
+  int failed;
+  int lost;
+  uintmax_t bytes;
+  uintmax_t bytes_shipped;
+};
+
+/*
+ * Ship 'paths' (of 'sizes' bytes) to 'rsync_target', 'parallelism' at a
+ * time. 'report' gets the progress every 'report_seconds' and once done, on
+ * the calling thread. 'outcomes' gets what became of each path.
+ */
+DrainProgress ship_in_parallel(const FileOps& fileops, const std::vector<std::string>& paths,
+                               const std::vector<uintmax_t>& sizes,
+                               const std::string& rsync_target, int parallelism,
+                               int report_seconds,
+                               const std::function<void(const DrainProgress&)>& report,
+                               std::vector<DrainOutcome>* outcomes);
+
+/*
+ * Pid holding a lock on the file at 'path' as listed in /proc/locks, 0 if
+ * there is none, -1 if its holder is in another pid namespace.
+ */
+int lock_holder(const std::string& path);
+
+/*
+ * Rotate the lines of 'current' in 'log_directory' out into a file of its
+ * own. A running svlogd (holding the directory's 'lock') is asked to with
+ * SIGALRM, waiting up to 'timeout_seconds' for it; without one 'current' is
+ * renamed the way svlogd would. True if 'current' is empty by then.
+ */
+bool rotate_current(const std::string& log_directory, int timeout_seconds);
+
+#endif
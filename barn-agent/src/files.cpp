@@ -3,7 +3,13 @@
  */
 
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -11,16 +17,29 @@
 
 #include "files.h"
 #include "helpers.h"
+#include "page_cache.h"
 #include "process.h"
 #include "rsync.h"
+#include "sighandle.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
 
+/*
+ * Stands in for inotifywait where there is none. False if the wait was cut
+ * short, as an interrupted inotifywait fails (see waits_interrupted).
+ */
+static bool sleep_unless_interrupted(int seconds) {
+  const auto until = chrono::steady_clock::now() + chrono::seconds(seconds);
+  while (!waits_interrupted() && chrono::steady_clock::now() < until)
+    this_thread::sleep_for(chrono::milliseconds(200));
+  return !waits_interrupted();
+}
+
 /*
  * List all file names (no path) in path.
  */
-static vector<string> list_file_names(string directory_path) {
+static vector<string> list_file_names(const string& directory_path) {
   const fs::path path(directory_path);
   const fs::directory_iterator end;
   vector<string> file_names;
@@ -34,10 +53,22 @@ static vector<string> list_file_names(string directory_path) {
 }
 
 /**/
-bool FileOps::file_exists(std::string file_path) const {
+bool FileOps::file_exists(const std::string& file_path) const {
   return fs::exists(fs::path(file_path));
 }
 
+/**/
+uintmax_t FileOps::file_size(const std::string& file_path) const {
+  boost::system::error_code ec;
+  const auto size = fs::file_size(fs::path(file_path), ec);
+  return ec ? 0 : size;
+}
+
+/**/
+uintmax_t FileOps::drop_from_page_cache(const std::string& path) const {
+  return ::drop_from_page_cache(path);
+}
+
 /**/
 bool FileOps::wait_for_new_file_in_directory(const std::string& directory,
                                              int sleep_seconds) const {
@@ -55,11 +86,38 @@ bool FileOps::wait_for_new_file_in_directory(const std::string& directory,
                              ("-q")
                              ("-e")
                              ("moved_to")
-                             (directory + "/")).first == 0;
+                             (directory + "/"),
+        true).first == 0;
   } catch (const boost::filesystem::filesystem_error& ex) {
     LOG(INFO) << "You appear not having inotifywait, sleeping instead." << ex.what();
-    sleep(sleep_seconds);
-    return true;
+    return sleep_unless_interrupted(sleep_seconds);
+  }
+}
+
+/**/
+bool FileOps::wait_for_new_file_within(const std::string& directory,
+                                       int timeout_seconds) const {
+  // inotifywait takes a timeout of 0 as none.
+  if (timeout_seconds <= 0)
+    return false;
+  try {
+    return run_command("inotifywait",
+        boost::assign::list_of<std::string>("inotifywait")
+                             ("--exclude")
+                             ("'\\.u'")
+                             ("--exclude")
+                             ("'lock'")
+                             ("--exclude")
+                             ("'current'")
+                             ("--timeout")
+                             (std::to_string(timeout_seconds))
+                             ("-q")
+                             ("-e")
+                             ("moved_to")
+                             (directory + "/"),
+        true).first == 0;
+  } catch (const boost::filesystem::filesystem_error& ex) {
+    return sleep_unless_interrupted(timeout_seconds);
   }
 }
 
@@ -69,17 +127,91 @@ bool FileOps::wait_for_new_file_in_directory(const std::string& directory,
  * Returns empty list if EMERGENCY_STOP_FILENAME ("STOP_SHIPPING") is found
  * in the directory (emergency break switch).
  */
-FileNameList FileOps::list_log_directory(std::string directory_path) const {
+FileNameList FileOps::list_log_directory(const std::string& directory_path) const {
   auto file_names = list_file_names(directory_path);
   FileNameList svlogd_files;
-  for (vector<string>::const_iterator it = file_names.begin(); it < file_names.end(); ++it) {
-    if (is_svlogd_filename(*it)) {
-      svlogd_files.push_back(*it);
-    }
+  svlogd_files.reserve(file_names.size());
+  for (vector<string>::iterator it = file_names.begin(); it < file_names.end(); ++it) {
     if (*it == EMERGENCY_STOP_FILENAME) {
         LOG(WARNING) << "file STOP_SHIPPING found, disabling log shipping";
         return FileNameList();
     }
+    if (is_svlogd_filename(*it)) {
+      svlogd_files.push_back(std::move(*it));
+    }
   }
   return svlogd_files;
 }
+
+/*
+ * Named after an FNV-1a hash of the target, which unlike std::hash stays the
+ * same across builds, so an upgraded agent finds the marks.
+ */
+string shipped_mark_path(const string& directory, const string& rsync_target) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : rsync_target) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  char suffix[20];
+  snprintf(suffix, sizeof(suffix), ".%016llx", (unsigned long long)hash);
+  return join_path(directory, SHIPPED_MARK_FILENAME) + suffix;
+}
+
+/**/
+bool FileOps::read_shipped_mark(const std::string& directory, const std::string& rsync_target,
+                                std::string* mark) const {
+  ifstream in(shipped_mark_path(directory, rsync_target).c_str());
+  if (!in)
+    return false;
+  mark->clear();
+  getline(in, *mark);
+  return true;
+}
+
+/*
+ * Written to a temporary file and renamed, so a crash leaves the old or
+ * the new mark.
+ */
+bool FileOps::write_shipped_mark(const std::string& directory, const std::string& rsync_target,
+                                 const std::string& mark) const {
+  const auto path = shipped_mark_path(directory, rsync_target);
+  const auto temporary = path + ".tmp";
+  {
+    ofstream out(temporary.c_str(), ios::trunc);
+    out << mark << '\n';
+    out.close();
+    if (out.fail())
+      return false;
+  }
+  return rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+/**/
+bool FileOps::pin_file(const std::string& directory, const std::string& name) const {
+  const auto pins = join_path(directory, PIN_DIRECTORY);
+  if (mkdir(pins.c_str(), 0700) != 0 && errno != EEXIST)
+    return false;
+  return link(join_path(directory, name).c_str(), pin_path(directory, name).c_str()) == 0 ||
+         errno == EEXIST;
+}
+
+/**/
+void FileOps::unpin_file(const std::string& directory, const std::string& name) const {
+  unlink(pin_path(directory, name).c_str());
+}
+
+/**/
+FileNameList FileOps::list_pinned(const std::string& directory) const {
+  const auto pins = join_path(directory, PIN_DIRECTORY);
+  boost::system::error_code ec;
+  if (!fs::is_directory(fs::path(pins), ec))
+    return FileNameList();
+
+  FileNameList pinned;
+  for (auto& name : list_file_names(pins)) {
+    if (is_svlogd_filename(name))
+      pinned.push_back(name);
+  }
+  return pinned;
+}
@@ -19,6 +19,14 @@
 // cause barn-agent to stop shipping from that directory.
 #define EMERGENCY_STOP_FILENAME "STOP_SHIPPING"
 
+// Where the shipped marks (see shipment_plan.h) of a log directory are kept,
+// one per target, followed by a hash of the target (see shipped_mark_path).
+#define SHIPPED_MARK_FILENAME ".barn-shipped"
+
+// Spool of hardlinks to candidates, so svlogd pruning them doesn't lose
+// them before they're shipped.
+#define PIN_DIRECTORY ".barn-pin"
+
 /*
  * Class for file related operations including remote (rsync) file ops.
  * Mix of rsync operations and filesystem operations could be split up. For
@@ -28,9 +36,34 @@ class FileOps {
 public:
   virtual bool wait_for_new_file_in_directory(const std::string& directory,
                                               int sleep_seconds) const;
-  virtual bool file_exists(std::string path) const;
+  // Like wait_for_new_file_in_directory, but give up after 'timeout_seconds':
+  // false if no file rotated in time. Without inotify it can't tell, it
+  // sleeps and returns true.
+  virtual bool wait_for_new_file_within(const std::string& directory,
+                                        int timeout_seconds) const;
+  virtual bool file_exists(const std::string& path) const;
+
+  // Size in bytes of the file at 'path', or 0 if it can't be read.
+  virtual uintmax_t file_size(const std::string& path) const;
+
+  virtual FileNameList list_log_directory(const std::string& directory_path) const;
+
+  // Drop the file at 'path' from the page cache, returning how many of its
+  // bytes were cached (see page_cache.h).
+  virtual uintmax_t drop_from_page_cache(const std::string& path) const;
+
+  // Read the shipped mark of a log directory for 'rsync_target', false if
+  // it has none.
+  virtual bool read_shipped_mark(const std::string& directory, const std::string& rsync_target,
+                                 std::string* mark) const;
+  virtual bool write_shipped_mark(const std::string& directory, const std::string& rsync_target,
+                                  const std::string& mark) const;
 
-  virtual FileNameList list_log_directory(std::string directory_path) const;
+  // Hardlink log file 'name' of 'directory' into its PIN_DIRECTORY, true if
+  // it is pinned (or already was).
+  virtual bool pin_file(const std::string& directory, const std::string& name) const;
+  virtual void unpin_file(const std::string& directory, const std::string& name) const;
+  virtual FileNameList list_pinned(const std::string& directory) const;
 
   // The following are in rsync.cpp
 
@@ -45,7 +78,14 @@ public:
                         const std::string& rsync_target) const;
 };
 
-bool file_exists(std::string path);
+bool file_exists(const std::string& path);
+
+/*
+ * The shipped mark of 'directory' for 'rsync_target'. A backup channel (see
+ * channel_selector.h) holds other files than the primary, so each target
+ * has its own.
+ */
+std::string shipped_mark_path(const std::string& directory, const std::string& rsync_target);
 
 // TODO: perhaps use boost filesystem for all this path/file stuff.
 inline std::string join_path(const std::string& dir, const std::string& file) {
@@ -55,17 +95,20 @@ inline std::string join_path(const std::string& dir, const std::string& file) {
         return dir + file;
 }
 
+// Where 'name' of log 'directory' is pinned.
+inline std::string pin_path(const std::string& directory, const std::string& name) {
+  return join_path(join_path(directory, PIN_DIRECTORY), name);
+}
+
 /*
  * Returns 'dir' prepended to all file names in 'files'.
  */
 inline std::vector<std::string> join_path(
         const std::string& dir, const std::vector<std::string>& files) {
-  std::vector <std::string> result;
-  result.resize(files.size());
-  std::transform(
-        files.begin(), files.end(),
-        result.begin(),
-        [&dir](std::string f) -> std::string { return join_path(dir, f); });
+  std::vector<std::string> result;
+  result.reserve(files.size());
+  for (auto& file : files)
+    result.push_back(join_path(dir, file));
   return result;
 }
 
@@ -0,0 +1,200 @@
+/*
+ * Flight recorder, see flight_recorder.h.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "flight_recorder.h"
+
+using namespace std;
+
+static FlightEvent ring[FLIGHT_RECORDER_SIZE];
+static std::atomic<uint64_t> next_sequence(1);
+
+// Prepared up front so dumping from a signal handler doesn't allocate.
+static char dump_path[4096];
+static FlightDumpHeader dump_header;
+
+static std::atomic<int64_t> last_round_completed(time(0));
+static std::atomic<bool> waiting_between_rounds(false);
+
+static int64_t wall_clock_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void flight_record(FlightEventType type, int64_t a, int64_t b, const char* text) {
+  const uint64_t sequence = next_sequence.fetch_add(1, memory_order_relaxed);
+  FlightEvent& event = ring[(sequence - 1) % FLIGHT_RECORDER_SIZE];
+
+  __atomic_store_n(&event.sequence, 0, __ATOMIC_RELAXED);
+  atomic_thread_fence(memory_order_release);
+  event.time_us = wall_clock_us();
+  event.a = a;
+  event.b = b;
+  event.type = (uint32_t)type;
+  strncpy(event.text, text, FLIGHT_TEXT_SIZE - 1);
+  event.text[FLIGHT_TEXT_SIZE - 1] = '\0';
+  __atomic_store_n(&event.sequence, sequence, __ATOMIC_RELEASE);
+}
+
+void set_flight_recorder_dump(const string& path, const string& process_name) {
+  strncpy(dump_path, path.c_str(), sizeof(dump_path) - 1);
+  memcpy(dump_header.magic, FLIGHT_DUMP_MAGIC, sizeof(dump_header.magic));
+  dump_header.event_size = sizeof(FlightEvent);
+  dump_header.event_count = FLIGHT_RECORDER_SIZE;
+  strncpy(dump_header.process_name, process_name.c_str(),
+          sizeof(dump_header.process_name) - 1);
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+  const char* remaining = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t written = write(fd, remaining, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    remaining += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool dump_flight_recorder() {
+  if (!dump_path[0])
+    return false;
+  const int saved_errno = errno;
+
+  // Only async signal safe calls from here on.
+  FlightDumpHeader header = dump_header;
+  header.dump_time_us = wall_clock_us();
+  header.pid = getpid();
+
+  bool ok = false;
+  int fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    ok = write_all(fd, &header, sizeof(header)) && write_all(fd, ring, sizeof(ring));
+    ok = close(fd) == 0 && ok;
+  }
+  errno = saved_errno;
+  return ok;
+}
+
+void flight_round_completed() {
+  last_round_completed.store(time(0), memory_order_relaxed);
+}
+
+void flight_waiting(bool waiting) {
+  // The stall clock starts again once the wait is over.
+  last_round_completed.store(time(0), memory_order_relaxed);
+  waiting_between_rounds.store(waiting, memory_order_relaxed);
+}
+
+int64_t flight_stalled_seconds() {
+  if (waiting_between_rounds.load(memory_order_relaxed))
+    return 0;
+  return max<int64_t>(time(0) - last_round_completed.load(memory_order_relaxed), 0);
+}
+
+void run_stall_watchdog(int stall_seconds) {
+  int64_t dumped_for = -1;
+  while (true) {
+    this_thread::sleep_for(chrono::seconds(1));
+    const int64_t last_round = last_round_completed.load(memory_order_relaxed);
+    const int64_t stalled_for = flight_stalled_seconds();
+    if (stalled_for < stall_seconds || dumped_for == last_round)
+      continue;
+
+    flight_record(FlightEventType::Stall, stalled_for);
+    dump_flight_recorder();
+    dumped_for = last_round;
+  }
+}
+
+bool read_flight_dump(const string& path, FlightDumpHeader* header,
+                      vector<FlightEvent>* events) {
+  ifstream in(path.c_str(), ios::binary);
+  if (!in.read(reinterpret_cast<char*>(header), sizeof(*header)) ||
+      memcmp(header->magic, FLIGHT_DUMP_MAGIC, sizeof(header->magic)) != 0 ||
+      header->event_size != sizeof(FlightEvent))
+    return false;
+  header->process_name[sizeof(header->process_name) - 1] = '\0';
+
+  events->clear();
+  FlightEvent event;
+  for (uint32_t i = 0; i < header->event_count; ++i) {
+    if (!in.read(reinterpret_cast<char*>(&event), sizeof(event)))
+      return false;
+    event.text[FLIGHT_TEXT_SIZE - 1] = '\0';
+    if (event.sequence != 0)
+      events->push_back(event);
+  }
+  sort(events->begin(), events->end(), [](const FlightEvent& x, const FlightEvent& y) {
+    return x.sequence < y.sequence;
+  });
+  return true;
+}
+
+string format_flight_event(const FlightEvent& event) {
+  char when[64];
+  const time_t seconds = event.time_us / 1000000;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+  ostringstream oss;
+  oss << when << '.';
+  oss.width(6);
+  oss.fill('0');
+  oss << event.time_us % 1000000 << ' ';
+
+  switch ((FlightEventType)event.type) {
+  case FlightEventType::RoundStart:
+    oss << "round_start";
+    break;
+  case FlightEventType::Candidates:
+    oss << "candidates to_ship=" << event.a << " local=" << event.b;
+    break;
+  case FlightEventType::Shipped:
+    oss << "shipped files=" << event.a << " lost=" << event.b;
+    break;
+  case FlightEventType::RoundEnd:
+    oss << "round_end duration_ms=" << event.a;
+    break;
+  case FlightEventType::ChildExit:
+    oss << "child_exit pid=" << event.a << " status=" << event.b;
+    break;
+  case FlightEventType::ChannelSwitch:
+    oss << "channel_switch backup=" << event.a;
+    break;
+  case FlightEventType::Error:
+    oss << "error";
+    break;
+  case FlightEventType::Stall:
+    oss << "stall seconds=" << event.a;
+    break;
+  case FlightEventType::FatalSignal:
+    oss << "fatal_signal signal=" << event.a;
+    break;
+  default:
+    oss << "unknown type=" << event.type << " a=" << event.a << " b=" << event.b;
+  }
+  if (event.text[0])
+    oss << " \"" << event.text << '"';
+  return oss.str();
+}
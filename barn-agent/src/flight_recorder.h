@@ -0,0 +1,98 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+/*
+ * Flight recorder: a fixed size binary ring of recent agent events that is
+ * always on, and dumped to disk on SIGUSR1, when the agent stalls or when it
+ * dies from a fatal signal. Decode dumps with the barn-flight-decode tool.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+static const int FLIGHT_RECORDER_SIZE = 4096;
+static const int FLIGHT_TEXT_SIZE = 36;
+static const char FLIGHT_DUMP_MAGIC[8] = {'B', 'A', 'R', 'N', 'F', 'R', '0', '1'};
+
+enum class FlightEventType : uint32_t {
+  RoundStart = 1,
+  Candidates,     // a: files to ship, b: local log files
+  Shipped,        // a: files shipped, b: files lost during ship
+  RoundEnd,       // a: round duration in ms
+  ChildExit,      // a: pid, b: exit status, text: command
+  ChannelSwitch,  // a: 1 if now on the backup channel, text: target
+  Error,          // text: what failed
+  Stall,          // a: seconds since the last completed round
+  FatalSignal     // a: signal number
+};
+
+/*
+ * A single event, as kept in memory and written to dumps.
+ */
+struct FlightEvent {
+  uint64_t sequence;  // 1 based order of recording, 0 if empty or being written
+  int64_t time_us;    // Wall clock
+  int64_t a;
+  int64_t b;
+  uint32_t type;      // FlightEventType
+  char text[FLIGHT_TEXT_SIZE];
+};
+
+/*
+ * Dump file header, followed by FLIGHT_RECORDER_SIZE FlightEvents in ring
+ * order (sort by sequence to get recording order).
+ */
+struct FlightDumpHeader {
+  char magic[8];
+  uint32_t event_size;
+  uint32_t event_count;
+  int64_t dump_time_us;
+  int32_t pid;
+  char process_name[64];
+};
+
+// Cheap enough to call on every event: an atomic increment, a clock read
+// and a copy into the ring. Safe from any thread.
+void flight_record(FlightEventType type, int64_t a = 0, int64_t b = 0,
+                   const char* text = "");
+
+// Where dumps go and how they are labeled. Not thread safe, call at start up.
+void set_flight_recorder_dump(const std::string& path, const std::string& process_name);
+
+// Write the ring to the dump path. Async signal safe.
+bool dump_flight_recorder();
+
+// Tell the stall watchdog a round completed.
+void flight_round_completed();
+
+// Tell the stall watchdog the agent starts or stops waiting between rounds.
+void flight_waiting(bool waiting);
+
+/*
+ * Marks the agent as waiting (for a rotation, a back off or a resume) while
+ * in scope.
+ */
+class FlightWait {
+public:
+  FlightWait() { flight_waiting(true); }
+  ~FlightWait() { flight_waiting(false); }
+};
+
+// Seconds since the last round completed or wait ended, 0 while waiting.
+int64_t flight_stalled_seconds();
+
+/*
+ * Runs forever: if no round completes within 'stall_seconds', records a
+ * Stall event and dumps the recorder, once per stall. Waiting between
+ * rounds doesn't count, however long it takes.
+ */
+void run_stall_watchdog(int stall_seconds);
+
+// Read a dump written by dump_flight_recorder, events in recording order.
+bool read_flight_dump(const std::string& path, FlightDumpHeader* header,
+                      std::vector<FlightEvent>* events);
+
+// One line per event, e.g. "2019-11-01 12:50:38.123456 candidates to_ship=2 local=10"
+std::string format_flight_event(const FlightEvent& event);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * Upgrading a running agent in place, see handoff.h.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "handoff.h"
+
+using namespace std;
+
+static const string HANDOFF_HEADER = "barn-agent-handoff";
+static const string HANDOFF_FD_OPTION = "--handoff_fd";
+static const set<string> NUMERIC_FIELDS = {
+  "primary_ok", "last_heartbeat_time", "failure_streak", "next_round", "wait_seconds",
+  "statsd_fd", "coordinator_entry", "paused"
+};
+
+/**/
+string serialize_handoff(const AgentHandoff& handoff) {
+  ostringstream out;
+  out << HANDOFF_HEADER << " " << HANDOFF_VERSION << "\n"
+      << "host_name " << handoff.host_name << "\n"
+      << "primary_ok " << handoff.primary_ok << "\n"
+      << "last_heartbeat_time " << handoff.last_heartbeat_time << "\n"
+      << "failure_streak " << handoff.failure_streak << "\n"
+      << "next_round " << (int)handoff.unfinished_wait.next << "\n"
+      << "wait_seconds " << handoff.unfinished_wait.seconds << "\n"
+      << "newest_file " << handoff.newest_file << "\n"
+      << "statsd_addr " << handoff.statsd_addr << "\n"
+      << "statsd_resolved " << handoff.statsd_resolved << "\n"
+      << "statsd_fd " << handoff.statsd_fd << "\n"
+      << "coordinator_entry " << handoff.coordinator_entry << "\n"
+      << "paused " << handoff.paused << "\n";
+  if (!handoff.dry_run_target.empty()) {
+    out << "dry_run_target " << handoff.dry_run_target << "\n";
+    for (auto& name : handoff.dry_run_on_target)
+      out << "on_target " << name << "\n";
+  }
+  return out.str();
+}
+
+/*
+ * 'value' as an int, false if it isn't one.
+ */
+static bool parse_int(const string& value, long long* number) {
+  if (value.empty())
+    return false;
+  char* end;
+  errno = 0;
+  *number = strtoll(value.c_str(), &end, 10);
+  return *end == '\0' && errno == 0;
+}
+
+/**/
+Validation<AgentHandoff> parse_handoff(const string& serialized) {
+  istringstream in(serialized);
+  string line;
+  if (!getline(in, line) || line.compare(0, HANDOFF_HEADER.size() + 1, HANDOFF_HEADER + " ") != 0)
+    return BarnError("not a handed over agent state");
+  long long version;
+  if (!parse_int(line.substr(HANDOFF_HEADER.size() + 1), &version) || version != HANDOFF_VERSION)
+    return BarnError("handed over state of version " + line.substr(HANDOFF_HEADER.size() + 1) +
+                     ", expected " + to_string(HANDOFF_VERSION));
+
+  AgentHandoff handoff = {"", true, time(0), 0, {NextRound::Now, 0}, "", "", {}, "", "", -1, -1,
+                          false};
+  // Names the version doesn't know are skipped, numbers must be numbers.
+  while (getline(in, line)) {
+    const auto separator = line.find(' ');
+    const auto name = line.substr(0, separator);
+    const auto value = separator == string::npos ? "" : line.substr(separator + 1);
+    long long number = 0;
+    if (NUMERIC_FIELDS.count(name) && !parse_int(value, &number))
+      return BarnError("bad handed over " + name + ": '" + value + "'");
+
+    if (name == "host_name") {
+      handoff.host_name = value;
+    } else if (name == "primary_ok") {
+      handoff.primary_ok = number != 0;
+    } else if (name == "last_heartbeat_time") {
+      handoff.last_heartbeat_time = number;
+    } else if (name == "failure_streak") {
+      handoff.failure_streak = number;
+    } else if (name == "next_round") {
+      if (number < (int)NextRound::Now || number > (int)NextRound::AfterBackoff)
+        return BarnError("bad handed over next_round: " + value);
+      handoff.unfinished_wait.next = (NextRound)number;
+    } else if (name == "wait_seconds") {
+      handoff.unfinished_wait.seconds = max<long long>(number, 0);
+    } else if (name == "newest_file") {
+      handoff.newest_file = value;
+    } else if (name == "statsd_addr") {
+      handoff.statsd_addr = value;
+    } else if (name == "statsd_resolved") {
+      handoff.statsd_resolved = value;
+    } else if (name == "statsd_fd") {
+      handoff.statsd_fd = number;
+    } else if (name == "coordinator_entry") {
+      handoff.coordinator_entry = number;
+    } else if (name == "paused") {
+      handoff.paused = number != 0;
+    } else if (name == "dry_run_target") {
+      handoff.dry_run_target = value;
+    } else if (name == "on_target") {
+      handoff.dry_run_on_target.push_back(value);
+    }
+  }
+  return std::move(handoff);
+}
+
+/**/
+int write_handoff(const AgentHandoff& handoff) {
+  // Without MFD_CLOEXEC, the exec'd agent inherits it.
+  const int fd = syscall(SYS_memfd_create, "barn-agent-handoff", 0);
+  if (fd < 0)
+    return -1;
+  const auto serialized = serialize_handoff(handoff);
+  size_t written = 0;
+  while (written < serialized.size()) {
+    const auto n = write(fd, serialized.data() + written, serialized.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      close(fd);
+      return -1;
+    }
+    written += n;
+  }
+  return fd;
+}
+
+/**/
+Validation<AgentHandoff> read_handoff(int fd) {
+  string serialized;
+  char buffer[65536];
+  off_t offset = 0;
+  ssize_t n;
+  while ((n = pread(fd, buffer, sizeof(buffer), offset)) != 0) {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      const auto problem = BarnError("failed to read handed over state: ") + strerror(errno);
+      close(fd);
+      return problem;
+    }
+    serialized.append(buffer, n);
+    offset += n;
+  }
+  close(fd);
+  return parse_handoff(serialized);
+}
+
+/**/
+string executable_path() {
+  char path[PATH_MAX];
+  const auto length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (length <= 0)
+    return "";
+  string executable(path, length);
+  static const string DELETED = " (deleted)";
+  if (executable.size() > DELETED.size() &&
+      executable.compare(executable.size() - DELETED.size(), DELETED.size(), DELETED) == 0)
+    executable.resize(executable.size() - DELETED.size());
+  return executable;
+}
+
+/**/
+vector<string> upgrade_command_line(const vector<string>& command_line, int handoff_fd) {
+  vector<string> upgraded;
+  for (size_t i = 0; i < command_line.size(); ++i) {
+    // Handed over to this agent when it was upgraded to.
+    if (command_line[i].compare(0, HANDOFF_FD_OPTION.size() + 1, HANDOFF_FD_OPTION + "=") == 0)
+      continue;
+    if (command_line[i] == HANDOFF_FD_OPTION) {
+      ++i;
+      continue;
+    }
+    upgraded.push_back(command_line[i]);
+  }
+  upgraded.push_back(HANDOFF_FD_OPTION + "=" + to_string(handoff_fd));
+  return upgraded;
+}
+
+/**/
+void exec_upgrade(const string& executable, const vector<string>& command_line,
+                  const vector<int>& inherited_fds) {
+  vector<int> flags;
+  for (int fd : inherited_fds) {
+    flags.push_back(fcntl(fd, F_GETFD));
+    fcntl(fd, F_SETFD, flags.back() & ~FD_CLOEXEC);
+  }
+
+  vector<char*> argv;
+  argv.push_back(const_cast<char*>(executable.c_str()));
+  for (auto& arg : command_line)
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(nullptr);
+  execv(executable.c_str(), argv.data());
+
+  const int exec_errno = errno;
+  for (size_t i = 0; i < inherited_fds.size(); ++i)
+    fcntl(inherited_fds[i], F_SETFD, flags[i]);
+  errno = exec_errno;
+}
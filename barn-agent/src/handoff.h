@@ -0,0 +1,83 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+/*
+ * Upgrading a running agent in place. On SIGALRM the agent finishes the
+ * round it's in (so no transfer is cut short and shipped again), writes its
+ * state into a memfd and execs the binary it was started from, which may
+ * have been replaced since, with the same arguments and --handoff_fd. The
+ * new binary keeps the pid, so svlogd, runit and the host coordinator don't
+ * notice, and picks up where the old one left off:
+ *   - the host name rsync targets are named after, without 'hostname -f'
+ *   - the health of the channels (see channel_selector.h)
+ *   - the error streak and the rest of the wait for the next round (see
+ *     scheduler.h), rather than starting a round with a dry run
+ *   - a dry run done ahead of the next rotation (see rotation.h)
+ *   - the resolved statsd address and its socket, unless --statsd_addr
+ *     changed
+ *   - its entry in the host coordinator
+ *   - whether it was paused on the control socket (see control_socket.h)
+ * The shipped mark (see shipment_plan.h) is on disk already.
+ *
+ * If the exec fails the agent logs it and runs on.
+ */
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "helpers.h"
+#include "scheduler.h"
+
+// Bump when fields change meaning, a newer agent ignores older state.
+static const int HANDOFF_VERSION = 1;
+
+struct AgentHandoff {
+  std::string host_name;
+  bool primary_ok;
+  time_t last_heartbeat_time;
+  int failure_streak;
+  ScheduleDecision unfinished_wait;
+  std::string newest_file;       // Newest log file as the wait was cut short
+  std::string dry_run_target;    // "" without a dry run ahead of the rotation
+  FileNameList dry_run_on_target;
+  std::string statsd_addr;       // --statsd_addr the socket was resolved from
+  std::string statsd_resolved;   // "" without statsd
+  int statsd_fd;
+  int coordinator_entry;         // -1 without a host coordinator
+  bool paused;
+};
+
+// One 'name value' line per field, file names one per line.
+std::string serialize_handoff(const AgentHandoff& handoff);
+
+Validation<AgentHandoff> parse_handoff(const std::string& serialized);
+
+/*
+ * Write 'handoff' into a memfd the exec'd agent inherits, returning its fd
+ * or -1 on failure.
+ */
+int write_handoff(const AgentHandoff& handoff);
+
+// Read the state handed over through 'fd' and close it.
+Validation<AgentHandoff> read_handoff(int fd);
+
+/*
+ * Path of the binary this process runs, to exec again on upgrade. Taken at
+ * start up, as once the package is upgraded /proc/self/exe points at the
+ * deleted old binary.
+ */
+std::string executable_path();
+
+// 'command_line' (without the program name) passing 'handoff_fd'.
+std::vector<std::string> upgrade_command_line(const std::vector<std::string>& command_line,
+                                              int handoff_fd);
+
+/*
+ * Replace this process with 'executable' run with 'command_line', keeping
+ * 'inherited_fds' open. Returns (with errno set) only if it fails.
+ */
+void exec_upgrade(const std::string& executable, const std::vector<std::string>& command_line,
+                  const std::vector<int>& inherited_fds);
+
+#endif
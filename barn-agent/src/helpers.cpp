@@ -3,6 +3,9 @@
  */
 
 #include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -14,22 +17,51 @@
 using namespace std;
 
 /**/
-const vector<string> split(string str, char delim) {
+vector<string> split(const string& str, char delim) {
   vector<string> tokens;
   boost::split(tokens, str, boost::is_any_of(string(1, delim)));
   return tokens;
 }
 
 /**/
-const vector<string> prepend_each(vector<string> vec, string prefix) {
-  vector<string> new_vec;
-
+vector<string> prepend_each(vector<string> vec, const string& prefix) {
   for (string& el : vec)
-    new_vec.push_back(prefix + el);
+    el.insert(0, prefix);
+  return vec;
+}
+
+
+/*
+ * '@' followed by 16 hex digits of TAI64 seconds (2^62 + 10 + unix seconds,
+ * ignoring leap seconds like svlogd does) and 8 of nanoseconds.
+ */
+static const uint64_t TAI64_UNIX_EPOCH = (uint64_t(1) << 62) + 10;
+
+int64_t tai64n_unix_seconds(const string& name) {
+  static const size_t LABEL_SIZE = 1 + 16 + 8;
 
-  return new_vec;
+  if (name.size() < LABEL_SIZE || name[0] != '@')
+    return -1;
+  uint64_t tai64 = 0;
+  for (size_t i = 1; i < LABEL_SIZE; ++i) {
+    const char c = name[i];
+    if (!isxdigit((unsigned char)c))
+      return -1;
+    if (i <= 16)
+      tai64 = (tai64 << 4) | (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+  }
+  if (tai64 < TAI64_UNIX_EPOCH || tai64 - TAI64_UNIX_EPOCH > (uint64_t)INT64_MAX)
+    return -1;
+  return tai64 - TAI64_UNIX_EPOCH;
 }
 
+/**/
+string tai64n_label(int64_t unix_seconds, uint32_t nanoseconds) {
+  char label[1 + 16 + 8 + 1];
+  snprintf(label, sizeof(label), "@%016llx%08x",
+           (unsigned long long)(TAI64_UNIX_EPOCH + unix_seconds), nanoseconds);
+  return label;
+}
 
 /*
  * Given two sorted vectors, returns the number of elements
@@ -4,6 +4,8 @@
  * Some general helper/utility functions for barn-agent.
  */
 
+#include <chrono>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <boost/lambda/lambda.hpp>
@@ -15,13 +17,30 @@ typedef std::vector<FileName> FileNameList;
 typedef std::string BarnError;
 
 
-const std::vector<std::string> split(std::string str, char delim);
-const std::vector<std::string> prepend_each(std::vector<std::string> vec, std::string prefix);
+std::vector<std::string> split(const std::string& str, char delim);
+std::vector<std::string> prepend_each(std::vector<std::string> vec, const std::string& prefix);
+
+/*
+ * Unix time (seconds) of the tai64n label svlogd names rotated files with
+ * (e.g. '@400000005dbc2a1e0f1d2b3c.s'), or -1 if 'name' doesn't start with one.
+ */
+int64_t tai64n_unix_seconds(const std::string& name);
+
+// The tai64n label svlogd would name a file rotated at that time.
+std::string tai64n_label(int64_t unix_seconds, uint32_t nanoseconds);
 
 int count_missing(const std::vector<std::string>& small, const std::vector<std::string>& big);
 std::vector<std::string> tail_intersection(const std::vector<std::string>& A,
                                            const std::vector<std::string>& B);
 
+/*
+ * Milliseconds elapsed on the monotonic clock since 'start'.
+ */
+inline int64_t millis_since(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
 /*
  * This tries to be a poor man's Scala's scalaz's Validation class.
  */
@@ -36,28 +55,35 @@ std::ostream& operator <<(std::ostream& out, Validation<T> const& rhs) {
 
 /*
  * Similar to Validation in scalaz.
+ * The accessors take and return references, so checking a result doesn't
+ * copy what it holds (e.g. a directory listing).
  */
-template<typename T> bool isFailure(Validation<T> v) {
-  BarnError* error_value = boost::get<BarnError>(&v);
-  return error_value != 0;
+template<typename T> bool isFailure(const Validation<T>& v) {
+  return boost::get<BarnError>(&v) != 0;
 }
 
 /*
  * If Validation is not 'isFailure', returns the non-error part.
  */
-template<typename T> T get(Validation<T> v) {
+template<typename T> const T& get(const Validation<T>& v) {
+  assert(!isFailure(v));
+  return *boost::get<T>(&v);
+}
+
+/*
+ * Moves the non-error part out of a Validation that's done with.
+ */
+template<typename T> T get(Validation<T>&& v) {
   assert(!isFailure(v));
-  T* success_value = boost::get<T>(&v);
-  return *success_value;
+  return std::move(*boost::get<T>(&v));
 }
 
 /*
  * If Validation is 'isFailure', returns error part.
  */
-template<typename T> BarnError error(Validation<T> v) {
+template<typename T> const BarnError& error(const Validation<T>& v) {
   assert(isFailure(v));
-  BarnError* error_value = boost::get<BarnError>(&v);
-  return *error_value;
+  return *boost::get<BarnError>(&v);
 }
 
 #endif
@@ -0,0 +1,134 @@
+/*
+ * HDR (high dynamic range) histogram for latencies and sizes.
+ */
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include "histogram.h"
+
+using namespace std;
+
+Histogram::Histogram()
+  : total_count(0), total_sum(0),
+    min_value(numeric_limits<int64_t>::max()), max_value(0) {}
+
+/*
+ * Values below SUB_BUCKET_COUNT map to themselves. Above that the index is
+ * (bucket << SUB_BUCKET_BITS) | sub_bucket where 'bucket' is the position of
+ * the most significant bit and 'sub_bucket' the next SUB_BUCKET_BITS bits.
+ */
+int Histogram::bucket_index(uint64_t value) {
+  if (value < (uint64_t)SUB_BUCKET_COUNT)
+    return (int)value;
+  const int msb = 63 - __builtin_clzll(value);
+  const int shift = msb - SUB_BUCKET_BITS;
+  const int sub_bucket = (int)((value >> shift) & (SUB_BUCKET_COUNT - 1));
+  return ((shift + 1) << SUB_BUCKET_BITS) | sub_bucket;
+}
+
+/*
+ * Largest value that maps to bucket 'index'.
+ */
+uint64_t Histogram::bucket_upper_bound(int index) {
+  const int bucket = index >> SUB_BUCKET_BITS;
+  const uint64_t sub_bucket = index & (SUB_BUCKET_COUNT - 1);
+  if (bucket == 0)
+    return sub_bucket;
+  const int shift = bucket - 1;
+  const uint64_t lower = (SUB_BUCKET_COUNT | sub_bucket) << shift;
+  return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void Histogram::record(int64_t value) {
+  if (value < 0)
+    value = 0;
+  const int index = bucket_index(value);
+  if (index >= (int)counts.size())
+    counts.resize(index + 1, 0);
+  counts[index]++;
+  total_count++;
+  total_sum += value;
+  min_value = std::min(min_value, value);
+  max_value = std::max(max_value, value);
+}
+
+void Histogram::merge(const Histogram& other) {
+  if (other.counts.size() > counts.size())
+    counts.resize(other.counts.size(), 0);
+  for (size_t i = 0; i < other.counts.size(); ++i)
+    counts[i] += other.counts[i];
+  total_count += other.total_count;
+  total_sum += other.total_sum;
+  min_value = std::min(min_value, other.min_value);
+  max_value = std::max(max_value, other.max_value);
+}
+
+void Histogram::clear() {
+  *this = Histogram();
+}
+
+int64_t Histogram::percentile(double percentile) const {
+  if (total_count == 0)
+    return 0;
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  int64_t rank = (int64_t)((percentile / 100.0) * total_count + 0.5);
+  rank = std::max(rank, int64_t(1));
+
+  int64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen >= rank)
+      return std::min((int64_t)bucket_upper_bound(i), max_value);
+  }
+  return max_value;
+}
+
+string Histogram::serialize() const {
+  ostringstream oss;
+  oss << total_count << ' ' << total_sum << ' ' << min() << ' ' << max();
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i])
+      oss << ' ' << i << ':' << counts[i];
+  }
+  return oss.str();
+}
+
+bool Histogram::deserialize(const string& serialized) {
+  clear();
+  istringstream iss(serialized);
+  int64_t count, sum, min, max;
+  if (!(iss >> count >> sum >> min >> max))
+    return false;
+
+  string bucket;
+  int64_t bucket_total = 0;
+  while (iss >> bucket) {
+    int index;
+    uint64_t bucket_count;
+    char colon;
+    istringstream bss(bucket);
+    if (!(bss >> index >> colon >> bucket_count) || colon != ':' ||
+        index < 0 || index > bucket_index(numeric_limits<uint64_t>::max())) {
+      clear();
+      return false;
+    }
+    if (index >= (int)counts.size())
+      counts.resize(index + 1, 0);
+    counts[index] += bucket_count;
+    bucket_total += bucket_count;
+  }
+  if (bucket_total != count) {
+    clear();
+    return false;
+  }
+  total_count = count;
+  total_sum = sum;
+  if (count) {
+    min_value = min;
+    max_value = max;
+  }
+  return true;
+}
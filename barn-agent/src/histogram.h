@@ -0,0 +1,60 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+/*
+ * HDR (high dynamic range) histogram for latencies and sizes.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Log-linear bucketed histogram in the style of HdrHistogram.
+ * Values are bucketed by their most significant bit, and each power of two
+ * range is split into 2^SUB_BUCKET_BITS linear sub-buckets. This keeps the
+ * relative error of any reported percentile below 1% for every value between
+ * 0 and 2^63 while only costing a shift and an increment per recorded value.
+ *
+ * Storage grows lazily up to the largest value recorded, and only non-empty
+ * buckets are serialized, so sparse histograms stay small on the wire.
+ */
+class Histogram {
+public:
+  static const int SUB_BUCKET_BITS = 7;
+  static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+
+  Histogram();
+
+  // Negative values are recorded as zero.
+  void record(int64_t value);
+  void merge(const Histogram& other);
+  void clear();
+
+  // Returns the (upper bound of the bucket of the) value below which
+  // 'percentile' percent of the recorded values fall. 0 if empty.
+  int64_t percentile(double percentile) const;
+
+  int64_t count() const { return total_count; }
+  int64_t sum() const { return total_sum; }
+  int64_t min() const { return total_count ? min_value : 0; }
+  int64_t max() const { return total_count ? max_value : 0; }
+  bool empty() const { return total_count == 0; }
+
+  // Compact text form: "count sum min max index:count index:count ..."
+  std::string serialize() const;
+  // Returns false (leaving the histogram cleared) on malformed input.
+  bool deserialize(const std::string& serialized);
+
+  // public for testing
+  static int bucket_index(uint64_t value);
+  static uint64_t bucket_upper_bound(int index);
+
+private:
+  std::vector<uint64_t> counts;
+  int64_t total_count;
+  int64_t total_sum;
+  int64_t min_value;
+  int64_t max_value;
+};
+
+#endif
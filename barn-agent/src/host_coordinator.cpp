@@ -0,0 +1,276 @@
+/*
+ * Host wide shipping coordinator, see host_coordinator.h.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <set>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+
+#include "host_coordinator.h"
+#include "sighandle.h"
+
+using namespace std;
+
+// Bump when CoordinatorLayout changes.
+static const uint32_t COORDINATOR_MAGIC = 0xba4ec002;
+static const uint32_t COORDINATOR_INITIALIZING = 1;
+
+// Waiters re-check this often, in case an agent died without waking them
+// or their wait was interrupted.
+static const long WAIT_NANOSECONDS = 200 * 1000 * 1000;
+
+// Entries held by the coordinators of this process, by file and index. An
+// entry of this pid held by none was left by the agent it was exec'd from.
+typedef tuple<dev_t, ino_t, int> HeldEntry;
+static mutex held_mutex;
+static multiset<HeldEntry> held_entries;
+
+static HeldEntry held_entry(int fd, int index) {
+  struct stat file;
+  fstat(fd, &file);
+  return make_tuple(file.st_dev, file.st_ino, index);
+}
+
+static bool is_alive(pid_t pid) {
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+/*
+ * A new file is all zeroes. The first agent to map it initializes the
+ * process shared mutex and condition, the others wait for it to finish.
+ */
+static bool initialize(CoordinatorLayout* layout) {
+  uint32_t expected = 0;
+  if (__atomic_compare_exchange_n(&layout->magic, &expected, COORDINATOR_INITIALIZING,
+                                  false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&layout->mutex, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&layout->changed, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    __atomic_store_n(&layout->magic, COORDINATOR_MAGIC, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  for (int i = 0; i < 1000; ++i) {
+    const uint32_t magic = __atomic_load_n(&layout->magic, __ATOMIC_ACQUIRE);
+    if (magic != COORDINATOR_INITIALIZING)
+      return magic == COORDINATOR_MAGIC;
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  return false;
+}
+
+HostCoordinator::HostCoordinator(const string& path, int max_shipping, double weight,
+                                 int handed_over)
+    : fd(-1), layout(0), self(0) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    throw runtime_error("Failed to open host coordinator " + path + ": " + strerror(errno));
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (st.st_size < (off_t)sizeof(CoordinatorLayout) &&
+       ftruncate(fd, sizeof(CoordinatorLayout)) != 0)) {
+    close(fd);
+    throw runtime_error("Failed to size host coordinator " + path + ": " + strerror(errno));
+  }
+
+  void* mapped = mmap(0, sizeof(CoordinatorLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    close(fd);
+    throw runtime_error("Failed to map host coordinator " + path + ": " + strerror(errno));
+  }
+  layout = static_cast<CoordinatorLayout*>(mapped);
+
+  if (!initialize(layout)) {
+    munmap(layout, sizeof(CoordinatorLayout));
+    close(fd);
+    throw runtime_error("Incompatible host coordinator " + path);
+  }
+
+  lock();
+  forget_dead_agents();
+  // An agent upgraded in place (see handoff.h) keeps its pid, so its entry
+  // and place in the queue are still there. Without the entry handed over
+  // (e.g. the handoff was rejected), it's the one of its pid.
+  if (handed_over >= 0 && handed_over < COORDINATOR_MAX_AGENTS &&
+      layout->agents[handed_over].pid == getpid())
+    self = &layout->agents[handed_over];
+  {
+    lock_guard<mutex> held(held_mutex);
+    for (int i = 0; !self && i < COORDINATOR_MAX_AGENTS; ++i) {
+      if (layout->agents[i].pid == getpid() && !held_entries.count(held_entry(fd, i)))
+        self = &layout->agents[i];
+    }
+  }
+  if (self) {
+    self->state = (uint32_t)AgentShipState::Idle;
+    self->weight = weight;
+    self->max_shipping = max_shipping;
+  } else {
+    for (auto& agent : layout->agents) {
+      if (agent.pid == 0) {
+        self = &agent;
+        break;
+      }
+    }
+    if (self) {
+      self->pid = getpid();
+      self->state = (uint32_t)AgentShipState::Idle;
+      self->weight = weight;
+      self->finish_tag = layout->virtual_time;
+      self->max_shipping = max_shipping;
+    }
+  }
+  unlock();
+
+  if (!self) {
+    munmap(layout, sizeof(CoordinatorLayout));
+    close(fd);
+    throw runtime_error("No room for another agent in host coordinator " + path);
+  }
+  lock_guard<mutex> held(held_mutex);
+  held_entries.insert(held_entry(fd, entry()));
+}
+
+int HostCoordinator::entry() const {
+  return self - layout->agents;
+}
+
+HostCoordinator::~HostCoordinator() {
+  {
+    lock_guard<mutex> held(held_mutex);
+    held_entries.erase(held_entries.find(held_entry(fd, entry())));
+  }
+  lock();
+  self->pid = 0;
+  self->state = (uint32_t)AgentShipState::Idle;
+  pthread_cond_broadcast(&layout->changed);
+  unlock();
+  munmap(layout, sizeof(CoordinatorLayout));
+  close(fd);
+}
+
+void HostCoordinator::lock() const {
+  if (pthread_mutex_lock(&layout->mutex) == EOWNERDEAD) {
+    // Its owner died, the state it protects is made consistent again
+    // by forgetting dead agents.
+    pthread_mutex_consistent(&layout->mutex);
+    forget_dead_agents();
+  }
+}
+
+void HostCoordinator::unlock() const {
+  pthread_mutex_unlock(&layout->mutex);
+}
+
+/*
+ * Frees the slots of agents that died, including any slot they were
+ * shipping with.
+ */
+void HostCoordinator::forget_dead_agents() const {
+  for (auto& agent : layout->agents) {
+    if (agent.pid != 0 && agent.pid != getpid() && !is_alive(agent.pid)) {
+      agent.pid = 0;
+      agent.state = (uint32_t)AgentShipState::Idle;
+    }
+  }
+}
+
+/*
+ * Whether a slot is free and this agent's request finishes first among the
+ * waiting ones. The host has as many slots as the agent allowing the fewest.
+ */
+bool HostCoordinator::is_next() const {
+  int shipping = 0;
+  int max_shipping = self->max_shipping;
+  for (auto& agent : layout->agents) {
+    if (agent.pid == 0)
+      continue;
+    max_shipping = min(max_shipping, agent.max_shipping);
+    if (agent.state == (uint32_t)AgentShipState::Shipping)
+      ++shipping;
+    else if (agent.state == (uint32_t)AgentShipState::Waiting && &agent != self &&
+             (agent.finish_tag < self->finish_tag ||
+              (agent.finish_tag == self->finish_tag && &agent < self)))
+      return false;
+  }
+  return shipping < max_shipping;
+}
+
+bool HostCoordinator::acquire(int64_t bytes, bool interruptible) const {
+  lock();
+  // Idle agents don't bank credit: a request starts no earlier than the
+  // one currently being served.
+  const double previous_finish_tag = self->finish_tag;
+  const double start_tag = max(layout->virtual_time, self->finish_tag);
+  self->finish_tag = start_tag + max<int64_t>(bytes, 1) / self->weight;
+  self->state = (uint32_t)AgentShipState::Waiting;
+
+  while (!is_next()) {
+    if (interruptible && waits_interrupted()) {
+      // As if it never asked, so waiters behind it may go.
+      self->finish_tag = previous_finish_tag;
+      self->state = (uint32_t)AgentShipState::Idle;
+      pthread_cond_broadcast(&layout->changed);
+      unlock();
+      return false;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += WAIT_NANOSECONDS;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    if (pthread_cond_timedwait(&layout->changed, &layout->mutex, &deadline) == EOWNERDEAD)
+      pthread_mutex_consistent(&layout->mutex);
+    forget_dead_agents();
+  }
+
+  self->state = (uint32_t)AgentShipState::Shipping;
+  layout->virtual_time = max(layout->virtual_time, start_tag);
+  unlock();
+  return true;
+}
+
+void HostCoordinator::release() const {
+  lock();
+  self->state = (uint32_t)AgentShipState::Idle;
+  pthread_cond_broadcast(&layout->changed);
+  unlock();
+}
+
+int HostCoordinator::waiting() const {
+  lock();
+  int count = 0;
+  for (auto& agent : layout->agents) {
+    if (agent.pid != 0 && agent.state == (uint32_t)AgentShipState::Waiting)
+      ++count;
+  }
+  unlock();
+  return count;
+}
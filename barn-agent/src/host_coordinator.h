@@ -0,0 +1,121 @@
+#ifndef HOST_COORDINATOR_H
+#define HOST_COORDINATOR_H
+/*
+ * Host wide coordination of shipping between the agents of a host.
+ * Instead of every agent shipping whenever its round comes up, agents ask a
+ * memory mapped coordinator (e.g. under /dev/shm) for a shipping slot before
+ * each file. Slots are granted by weighted fair queuing, so a heavily
+ * weighted category (e.g. 'errors') gets ahead of a big 'main' backlog, and
+ * at most a host wide number of agents ship at once.
+ */
+
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+
+/*
+ * Gates the shipping of files. acquire() blocks until a file of 'bytes'
+ * may be shipped, each successful acquire() is followed by a release(). An
+ * 'interruptible' acquire() gives up, returning false, once a reload, a
+ * drain or an upgrade is asked for (see waits_interrupted).
+ */
+class ShippingSlots {
+public:
+  virtual bool acquire(int64_t bytes, bool interruptible) const = 0;
+  virtual void release() const = 0;
+  virtual ~ShippingSlots() {}
+};
+
+/*
+ * Ship whenever ready, as agents without a coordinator do.
+ */
+class UnlimitedShipping : public ShippingSlots {
+public:
+  bool acquire(int64_t bytes, bool interruptible) const override { return true; }
+  void release() const override {}
+};
+
+/*
+ * Holds a slot for its lifetime, if it got one (see held).
+ */
+class ShippingSlot {
+public:
+  ShippingSlot(const ShippingSlots& slots, int64_t bytes, bool interruptible = false)
+    : slots(slots), got(slots.acquire(bytes, interruptible)) {}
+  ~ShippingSlot() {
+    if (got)
+      slots.release();
+  }
+
+  ShippingSlot(const ShippingSlot&) = delete;
+  ShippingSlot& operator=(const ShippingSlot&) = delete;
+
+  // False if an interruptible wait for the slot gave up.
+  bool held() const { return got; }
+
+private:
+  const ShippingSlots& slots;
+  const bool got;
+};
+
+static const int COORDINATOR_MAX_AGENTS = 256;
+
+enum class AgentShipState : uint32_t { Idle, Waiting, Shipping };
+
+struct CoordinatedAgent {
+  int32_t pid;          // 0 if free
+  uint32_t state;       // AgentShipState
+  double weight;
+  double finish_tag;    // Virtual time this agent's last request finishes at
+  int32_t max_shipping; // --host_max_shipping of this agent
+};
+
+/*
+ * Everything is only read or written under 'mutex', which is robust so an
+ * agent dying while holding it doesn't wedge the host.
+ */
+struct CoordinatorLayout {
+  uint32_t magic;       // Set (atomically) once mutex and condition are initialized
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  double virtual_time;  // Start tag of the last granted request
+  CoordinatedAgent agents[COORDINATOR_MAX_AGENTS];
+};
+
+/*
+ * One agent's handle on the shared coordinator.
+ */
+class HostCoordinator : public ShippingSlots {
+public:
+  // Throws std::runtime_error if the file can't be opened or mapped, holds
+  // an incompatible layout or has no room for another agent. Every agent
+  // on a host should use the same 'max_shipping', the smallest of the
+  // running agents applies.
+  // An upgraded agent takes over the entry 'handed_over' of its pid, or
+  // without one the entry of its pid no coordinator of the process holds.
+  HostCoordinator(const std::string& path, int max_shipping, double weight,
+                  int handed_over = -1);
+  ~HostCoordinator();
+
+  bool acquire(int64_t bytes, bool interruptible) const override;
+  void release() const override;
+
+  // Agents currently waiting for a slot.
+  int waiting() const;
+
+  // Index of this agent's entry in the agents.
+  int entry() const;
+
+private:
+  void lock() const;
+  void unlock() const;
+  void forget_dead_agents() const;
+  bool is_next() const;
+
+  int fd;
+  CoordinatorLayout* layout;
+  CoordinatedAgent* self;
+};
+
+#endif
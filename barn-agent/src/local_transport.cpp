@@ -0,0 +1,161 @@
+/*
+ * Shipping to a local directory, see local_transport.h.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "files.h"
+#include "local_transport.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+static const size_t COPY_CHUNK_BYTES = 1 << 20;
+
+/**/
+Validation<FileNameList> local_files_not_on_target(const string& log_directory,
+                                                   const FileNameList& files,
+                                                   const string& target_directory) {
+  struct stat target_dir;
+  if (stat(target_directory.c_str(), &target_dir) != 0 && errno != ENOENT)
+    return BarnError("Can't read " + target_directory + ": " + strerror(errno));
+
+  FileNameList missing;
+  for (auto& file : files) {
+    struct stat local, remote;
+    // Vanished since listed, as rsync ignores them.
+    if (stat(join_path(log_directory, file).c_str(), &local) != 0)
+      continue;
+    if (stat(join_path(target_directory, file).c_str(), &remote) != 0 ||
+        remote.st_size != local.st_size ||
+        remote.st_mtime != local.st_mtime) {
+      missing.push_back(file);
+    }
+  }
+  sort(missing.begin(), missing.end());
+  return std::move(missing);
+}
+
+/*
+ * Plain copy of what's left of 'in' from 'offset' on.
+ */
+static bool read_write_copy(int in, int out, off_t offset) {
+  vector<char> buffer(COPY_CHUNK_BYTES);
+  for (;;) {
+    const ssize_t got = pread(in, buffer.data(), buffer.size(), offset);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return got == 0;
+    for (ssize_t put = 0; put < got;) {
+      const ssize_t n = write(out, buffer.data() + put, got - put);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      put += n;
+    }
+    offset += got;
+  }
+}
+
+/*
+ * Copy all of 'in' to the empty 'out', sharing extents or staying in the
+ * kernel where possible.
+ */
+static bool copy_contents(int in, int out, off_t size) {
+  if (ioctl(out, FICLONE, in) == 0)
+    return true;
+
+  off_t offset = 0;
+  while (offset < size) {
+    const ssize_t n = copy_file_range(in, &offset, out, nullptr,
+                                      size - offset, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                  errno == EOPNOTSUPP)) {
+      break;  // Not between these filesystems, copy the rest by hand.
+    }
+    if (n < 0)
+      return false;
+    if (n == 0)
+      return true;  // Source shrank, ship what's there as rsync would.
+  }
+  if (lseek(out, offset, SEEK_SET) != offset)
+    return false;
+  return read_write_copy(in, out, offset);
+}
+
+/**/
+bool copy_to_local_target(const string& file_path, const string& target_directory) {
+  boost::system::error_code ec;
+  fs::create_directories(target_directory, ec);
+  if (ec) {
+    LOG(WARNING) << "Can't create " << target_directory << ": " << ec.message();
+    return false;
+  }
+
+  const int in = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    LOG(WARNING) << "Can't open " << file_path << ": " << strerror(errno);
+    return false;
+  }
+  struct stat source;
+  if (fstat(in, &source) != 0) {
+    close(in);
+    return false;
+  }
+  // Larger readahead when copying by hand.
+  posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  // Dot prefixed, like rsync's temporary files, so collectors skip it.
+  const string name = fs::path(file_path).filename().string();
+  const string destination = join_path(target_directory, name);
+  string temporary = join_path(target_directory, "." + name + ".XXXXXX");
+  const int out = mkostemp(&temporary[0], O_CLOEXEC);
+  if (out < 0) {
+    LOG(WARNING) << "Can't create a file in " << target_directory << ": " << strerror(errno);
+    close(in);
+    return false;
+  }
+
+  const struct timespec times[2] = {source.st_atim, source.st_mtim};
+  bool ok = copy_contents(in, out, source.st_size) &&
+            fchmod(out, source.st_mode & 0777) == 0 &&
+            fsync(out) == 0 &&
+            futimens(out, times) == 0;
+  // Synced, so the copy's pages are clean and can go: the source is dropped
+  // by the caller once shipped (see page_cache.h).
+  if (ok)
+    posix_fadvise(out, 0, 0, POSIX_FADV_DONTNEED);
+  if (close(out) != 0)
+    ok = false;
+  close(in);
+
+  if (!ok || rename(temporary.c_str(), destination.c_str()) != 0) {
+    LOG(WARNING) << "Failed to copy " << file_path << " to " << destination
+                 << ": " << strerror(errno);
+    unlink(temporary.c_str());
+    return false;
+  }
+
+  // Make the rename durable too.
+  const int dir = open(target_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir >= 0) {
+    fsync(dir);
+    close(dir);
+  }
+  return true;
+}
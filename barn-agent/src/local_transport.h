@@ -0,0 +1,44 @@
+#ifndef LOCAL_TRANSPORT_H
+#define LOCAL_TRANSPORT_H
+/*
+ * Shipping to a directory, for agents on the collector's host or with its
+ * spool mounted over a shared filesystem. A target address of
+ * file:///srv/barn makes get_rsync_target lay files out under /srv/barn the
+ * way the rsync daemon would under its module paths:
+ *   file:///srv/barn/barn_logs/myapp@main@myapp_host.mydomain.com/
+ * and FileOps then copies files there directly instead of running rsync.
+ */
+
+#include <string>
+
+#include "helpers.h"
+
+static const std::string local_protocol = "file://";
+
+inline bool is_local_target(const std::string& target) {
+  return target.compare(0, local_protocol.size(), local_protocol) == 0;
+}
+
+// The directory a file:// target points at.
+inline std::string local_target_directory(const std::string& target) {
+  return target.substr(local_protocol.size());
+}
+
+/*
+ * Like an rsync dry run: 'files' of 'log_directory' that 'target_directory'
+ * lacks, or holds with another size or modification time. Sorted.
+ */
+Validation<FileNameList> local_files_not_on_target(const std::string& log_directory,
+                                                   const FileNameList& files,
+                                                   const std::string& target_directory);
+
+/*
+ * Copy 'file_path' into 'target_directory' (created if needed) keeping its
+ * modification time. The copy is written to a temporary file, synced and
+ * renamed into place, so readers never see a partial file. Data is shared
+ * with the source where the filesystem can (FICLONE), otherwise copied in
+ * the kernel (copy_file_range), falling back to read/write.
+ */
+bool copy_to_local_target(const std::string& file_path, const std::string& target_directory);
+
+#endif
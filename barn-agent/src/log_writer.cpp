@@ -0,0 +1,361 @@
+/*
+ * Asynchronous logging, see log_writer.h.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <unistd.h>
+
+#include "log_writer.h"
+
+using namespace std;
+
+// Write out once this much is formatted, even if more is queued.
+static const size_t LOG_BATCH_BYTES = 64 * 1024;
+static const int WRITER_IDLE_MILLIS = 1000;
+static const char TRUNCATED[] = " [truncated]";
+
+/**/
+bool parse_log_when_full(const string& name, LogWhenFull* when_full) {
+  if (name == "drop")
+    *when_full = LogWhenFull::Drop;
+  else if (name == "block")
+    *when_full = LogWhenFull::Block;
+  else
+    return false;
+  return true;
+}
+
+/*
+ * Smallest power of two of at least 'n'.
+ */
+static size_t round_up_to_power_of_two(size_t n) {
+  size_t size = 1;
+  while (size < n)
+    size <<= 1;
+  return size;
+}
+
+LogRing::LogRing(size_t lines)
+    : slots(round_up_to_power_of_two(max<size_t>(lines, 2))),
+      mask(slots.size() - 1), enqueue_position(0), dequeue_position(0) {
+  for (size_t i = 0; i < slots.size(); ++i)
+    slots[i].sequence.store(i, memory_order_relaxed);
+}
+
+bool LogRing::try_push(el::Level level, const string& message, uint32_t suppressed) {
+  Slot* slot;
+  size_t position = enqueue_position.load(memory_order_relaxed);
+  while (true) {
+    slot = &slots[position & mask];
+    const size_t sequence = slot->sequence.load(memory_order_acquire);
+    const auto lag = (intptr_t)sequence - (intptr_t)position;
+    if (lag == 0) {
+      // Free, claim it unless another producer was faster.
+      if (enqueue_position.compare_exchange_weak(position, position + 1,
+                                                 memory_order_relaxed))
+        break;
+    } else if (lag < 0) {
+      // Still holds the line of a lap ago.
+      return false;
+    } else {
+      position = enqueue_position.load(memory_order_relaxed);
+    }
+  }
+
+  slot->level = level;
+  slot->suppressed = suppressed;
+  if (message.size() <= LOG_LINE_BYTES) {
+    slot->length = message.size();
+    memcpy(slot->text, message.data(), message.size());
+  } else {
+    const size_t kept = LOG_LINE_BYTES - (sizeof(TRUNCATED) - 1);
+    memcpy(slot->text, message.data(), kept);
+    memcpy(slot->text + kept, TRUNCATED, sizeof(TRUNCATED) - 1);
+    slot->length = LOG_LINE_BYTES;
+  }
+  slot->sequence.store(position + 1, memory_order_release);
+  return true;
+}
+
+LogRing::Slot* LogRing::front() {
+  Slot* slot = &slots[dequeue_position & mask];
+  if (slot->sequence.load(memory_order_acquire) != dequeue_position + 1)
+    return nullptr;
+  return slot;
+}
+
+void LogRing::release() {
+  slots[dequeue_position & mask].sequence.store(dequeue_position + slots.size(),
+                                                memory_order_release);
+  ++dequeue_position;
+}
+
+LogRateLimiter::LogRateLimiter(int lines_per_second)
+    : lines_per_second(lines_per_second) {
+  for (auto& site : sites) {
+    site.second.store(-1, memory_order_relaxed);
+    site.lines.store(0, memory_order_relaxed);
+    site.suppressed.store(0, memory_order_relaxed);
+  }
+}
+
+bool LogRateLimiter::admit(const string& file, int line, int64_t second,
+                           uint32_t* suppressed) {
+  *suppressed = 0;
+  if (lines_per_second <= 0)
+    return true;
+
+  Site& site = sites[(hash<string>()(file) ^ (size_t)line * 0x9e3779b9) % LOG_RATE_SITES];
+  int64_t last = site.second.load(memory_order_relaxed);
+  // Whoever moves the site to a new second starts its count over. Racing
+  // threads may let a line or two more through, which is fine.
+  if (last != second && site.second.compare_exchange_strong(last, second))
+    site.lines.store(0, memory_order_relaxed);
+  if (site.lines.fetch_add(1, memory_order_relaxed) >= lines_per_second) {
+    site.suppressed.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+  *suppressed = site.suppressed.exchange(0, memory_order_relaxed);
+  return true;
+}
+
+uint64_t LogRateLimiter::take_suppressed() {
+  uint64_t total = 0;
+  if (lines_per_second <= 0)
+    return total;
+  for (auto& site : sites)
+    total += site.suppressed.exchange(0, memory_order_relaxed);
+  return total;
+}
+
+AsyncLogWriter::AsyncLogWriter(const string& prefix, size_t lines, int rate_limit,
+                               LogWhenFull when_full, int fd)
+    : prefix(prefix), when_full(when_full), fd(fd), ring(lines),
+      rate_limiter(rate_limit), written(0), dropped(0),
+      writer_idle(false), stopping(false) {
+  writer = thread(&AsyncLogWriter::run, this);
+}
+
+AsyncLogWriter::~AsyncLogWriter() {
+  stopping = true;
+  wake_writer();
+  writer.join();
+}
+
+/*
+ * Only locks when the writer waits for lines, so it can't miss the wake up
+ * between finding the ring empty and waiting.
+ */
+void AsyncLogWriter::wake_writer() {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!writer_idle.load(memory_order_relaxed))
+    return;
+  { lock_guard<mutex> lock(idle_mutex); }
+  idle.notify_one();
+}
+
+void AsyncLogWriter::log(el::Level level, const string& file, int line,
+                         const string& message) {
+  const int64_t second = chrono::duration_cast<chrono::seconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+  uint32_t suppressed;
+  if (!rate_limiter.admit(file, line, second, &suppressed))
+    return;
+
+  const bool may_drop = when_full == LogWhenFull::Drop &&
+      level != el::Level::Warning && level != el::Level::Error &&
+      level != el::Level::Fatal;
+  while (!ring.try_push(level, message, suppressed)) {
+    if (may_drop) {
+      dropped.fetch_add(1 + suppressed, memory_order_relaxed);
+      return;
+    }
+    wake_writer();
+    this_thread::sleep_for(chrono::microseconds(100));
+  }
+  wake_writer();
+
+  // easylogging aborts right after a FATAL line.
+  if (level == el::Level::Fatal)
+    flush();
+}
+
+void AsyncLogWriter::flush() {
+  // Lines are taken off in order, so once that many are, the ones claimed
+  // by now are too.
+  const uint64_t target = ring.claimed();
+  while (written.load(memory_order_acquire) < target) {
+    wake_writer();
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+}
+
+/*
+ * Level as easylogging writes it.
+ */
+static const char* level_name(el::Level level) {
+  switch (level) {
+    case el::Level::Debug: return "DEBUG";
+    case el::Level::Info: return "INFO ";
+    case el::Level::Warning: return "WARN ";
+    case el::Level::Error: return "ERROR";
+    case el::Level::Fatal: return "FATAL";
+    case el::Level::Verbose: return "VER";
+    case el::Level::Trace: return "TRACE";
+    default: return "";
+  }
+}
+
+void AsyncLogWriter::append_line(const char* level, const char* text, size_t length,
+                                 uint32_t suppressed, string* batch) const {
+  batch->append(level);
+  batch->push_back(' ');
+  batch->append(prefix);
+  batch->append(" : ");
+  batch->append(text, length);
+  if (suppressed > 0) {
+    batch->append(" (");
+    batch->append(to_string(suppressed));
+    batch->append(" more suppressed by log_rate_limit)");
+  }
+  batch->push_back('\n');
+}
+
+/*
+ * Lines about lines that didn't make it.
+ */
+void AsyncLogWriter::append_reports(string* batch) {
+  const uint64_t lost = dropped.exchange(0, memory_order_relaxed);
+  if (lost > 0) {
+    const auto text = "Dropped " + to_string(lost) + " log lines, the log buffer was full";
+    append_line(level_name(el::Level::Warning), text.data(), text.size(), 0, batch);
+  }
+  const uint64_t suppressed = rate_limiter.take_suppressed();
+  if (suppressed > 0) {
+    const auto text = "Suppressed " + to_string(suppressed) + " log lines by log_rate_limit";
+    append_line(level_name(el::Level::Warning), text.data(), text.size(), 0, batch);
+  }
+}
+
+/*
+ * Write all of 'data', false if 'fd' fails.
+ */
+static bool write_all(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+void AsyncLogWriter::run() {
+  string batch;
+  batch.reserve(LOG_BATCH_BYTES + LOG_LINE_BYTES + 256);
+  auto last_report = chrono::steady_clock::now();
+  while (true) {
+    batch.clear();
+    uint64_t lines = 0;
+    LogRing::Slot* slot;
+    while (batch.size() < LOG_BATCH_BYTES && (slot = ring.front())) {
+      append_line(level_name(slot->level), slot->text, slot->length, slot->suppressed, &batch);
+      ring.release();
+      ++lines;
+    }
+    const auto now = chrono::steady_clock::now();
+    if (lines == 0 || now - last_report >= chrono::milliseconds(WRITER_IDLE_MILLIS)) {
+      append_reports(&batch);
+      last_report = now;
+    }
+    // Nowhere else to report a failing stdout to, the lines are lost.
+    write_all(fd, batch.data(), batch.size());
+    written.fetch_add(lines, memory_order_release);
+    if (lines > 0)
+      continue;
+
+    if (stopping)
+      return;
+    unique_lock<mutex> lock(idle_mutex);
+    writer_idle = true;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!ring.front() && !stopping)
+      idle.wait_for(lock, chrono::milliseconds(WRITER_IDLE_MILLIS));
+    writer_idle = false;
+  }
+}
+
+/**/
+void* AsyncLogWriter::operator new(size_t size) {
+  void* writer;
+  if (posix_memalign(&writer, alignof(AsyncLogWriter), size) != 0)
+    throw bad_alloc();
+  return writer;
+}
+
+/**/
+void AsyncLogWriter::operator delete(void* writer) {
+  free(writer);
+}
+
+static unique_ptr<AsyncLogWriter> async_log_writer;
+
+/*
+ * Hands LOG() lines of every logger to async_log_writer.
+ */
+class AsyncLogDispatch : public el::LogDispatchCallback {
+protected:
+  void handle(const el::LogDispatchData* data) override {
+    const el::LogMessage* message = data->logMessage();
+    if (async_log_writer)
+      async_log_writer->log(message->level(), message->file(), message->line(),
+                            message->message());
+  }
+};
+
+static const char* ASYNC_DISPATCH_ID = "AsyncLogDispatch";
+static const char* DEFAULT_DISPATCH_ID = "DefaultLogDispatchCallback";
+
+/*
+ * Turn easylogging's own formatting and output on or off.
+ */
+static void enable_default_dispatch(bool enabled) {
+  auto* dispatch = el::Helpers::logDispatchCallback<el::base::DefaultLogDispatchCallback>(
+        DEFAULT_DISPATCH_ID);
+  if (dispatch)
+    dispatch->setEnabled(enabled);
+}
+
+/**/
+void start_async_logging(const string& prefix, const BarnConf& barn_conf) {
+  LogWhenFull when_full = LogWhenFull::Drop;
+  parse_log_when_full(barn_conf.log_when_full, &when_full);
+  async_log_writer.reset(new AsyncLogWriter(prefix, barn_conf.log_buffer_lines,
+                                            barn_conf.log_rate_limit, when_full,
+                                            STDOUT_FILENO));
+  el::Helpers::installLogDispatchCallback<AsyncLogDispatch>(ASYNC_DISPATCH_ID);
+  enable_default_dispatch(false);
+}
+
+/**/
+void stop_async_logging() {
+  el::Helpers::uninstallLogDispatchCallback<AsyncLogDispatch>(ASYNC_DISPATCH_ID);
+  enable_default_dispatch(true);
+  async_log_writer.reset();
+}
+
+/**/
+void flush_async_logging() {
+  if (async_log_writer)
+    async_log_writer->flush();
+}
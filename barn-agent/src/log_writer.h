@@ -0,0 +1,158 @@
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+/*
+ * Asynchronous logging. easylogging++ formats and writes every line on the
+ * thread that logs it, so a round shipping a backlog (a line per file) pays
+ * for a format pass and a write to stdout per file.
+ *
+ * With --async_logging, LOG() hands the message to a lock-free ring instead
+ * and returns; a writer thread adds the level and prefix and writes lines to
+ * stdout in batches. LOG() call sites stay as they are.
+ *
+ * Each LOG() statement may be limited to --log_rate_limit lines a second,
+ * suppressed lines are counted and reported. When the ring is full,
+ * --log_when_full tells whether lines are dropped or wait for room.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "params.h"
+
+static const size_t LOG_LINE_BYTES = 1000;
+static const int LOG_RATE_SITES = 256;
+
+enum class LogWhenFull {
+  Drop,   // Drop INFO (and lower) lines, warnings and errors wait for room
+  Block   // Every line waits for room
+};
+
+// "drop" or "block", false if neither.
+bool parse_log_when_full(const std::string& name, LogWhenFull* when_full);
+
+/*
+ * Lines queued for the writer, a bounded multi-producer queue (Vyukov's)
+ * with a single consumer.
+ */
+class LogRing {
+public:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    el::Level level;
+    uint32_t suppressed;   // Lines of the same statement rate limited before it
+    uint32_t length;
+    char text[LOG_LINE_BYTES];
+  };
+
+  // Room for at least 'lines', rounded up to a power of two.
+  explicit LogRing(size_t lines);
+
+  // Copy a line in, false if the ring is full. Long lines are truncated.
+  bool try_push(el::Level level, const std::string& message, uint32_t suppressed);
+
+  // The oldest line, or nullptr if there is none. Only the consumer calls
+  // this, and release() once done with the slot.
+  Slot* front();
+  void release();
+
+  size_t capacity() const { return slots.size(); }
+
+  // Lines pushed or being pushed so far.
+  size_t claimed() const { return enqueue_position.load(std::memory_order_acquire); }
+
+private:
+  std::vector<Slot> slots;
+  const size_t mask;
+  alignas(64) std::atomic<size_t> enqueue_position;
+  alignas(64) size_t dequeue_position;
+};
+
+/*
+ * Per LOG() statement limit of lines a second, shared by the statements
+ * that hash alike.
+ */
+class LogRateLimiter {
+public:
+  // At most 'lines_per_second' lines per statement, 0 for no limit.
+  explicit LogRateLimiter(int lines_per_second);
+
+  // Whether the line of 'file':'line' logged during 'second' goes out. If so,
+  // 'suppressed' is set to the statement's lines suppressed since the last.
+  bool admit(const std::string& file, int line, int64_t second, uint32_t* suppressed);
+
+  // Suppressed lines not reported with a later line yet, resetting them.
+  uint64_t take_suppressed();
+
+private:
+  struct Site {
+    std::atomic<int64_t> second;
+    std::atomic<int> lines;
+    std::atomic<uint32_t> suppressed;
+  };
+
+  const int lines_per_second;
+  Site sites[LOG_RATE_SITES];
+};
+
+/*
+ * The ring, the limiter and the writer thread draining them into 'fd'.
+ */
+class AsyncLogWriter {
+public:
+  // Lines are written as "LEVEL 'prefix' : message", like the synchronous
+  // format.
+  AsyncLogWriter(const std::string& prefix, size_t lines, int rate_limit,
+                 LogWhenFull when_full, int fd);
+  // Writes out what's queued first.
+  ~AsyncLogWriter();
+
+  // Queue a line. Returns once it is in the ring, dropped or suppressed.
+  void log(el::Level level, const std::string& file, int line, const std::string& message);
+
+  // Wait until every line queued so far is written.
+  void flush();
+
+  // The ring's positions are cache line aligned, which plain new doesn't
+  // honour before C++17.
+  static void* operator new(size_t size);
+  static void operator delete(void* writer);
+
+private:
+  void run();
+  void wake_writer();
+  void append_line(const char* level, const char* text, size_t length,
+                   uint32_t suppressed, std::string* batch) const;
+  void append_reports(std::string* batch);
+
+  const std::string prefix;
+  const LogWhenFull when_full;
+  const int fd;
+  LogRing ring;
+  LogRateLimiter rate_limiter;
+  std::atomic<uint64_t> written;  // Lines taken off the ring and written
+  std::atomic<uint64_t> dropped;
+  std::atomic<bool> writer_idle;
+  std::atomic<bool> stopping;
+  std::mutex idle_mutex;
+  std::condition_variable idle;
+  std::thread writer;
+};
+
+/*
+ * Route LOG() of every logger through an AsyncLogWriter to stdout instead of
+ * easylogging's own output. Not thread safe, call at start up.
+ */
+void start_async_logging(const std::string& prefix, const BarnConf& barn_conf);
+
+// Back to synchronous logging, once what's queued is written.
+void stop_async_logging();
+
+// Wait until what's queued is written, if logging asynchronously.
+void flush_async_logging();
+
+#endif
@@ -1,8 +1,10 @@
 #include <string>
 
 #include "barn-agent.h"
+#include "log_writer.h"
 #include "monitor/barn-agent-monitor.h"
 #include "params.h"
+#include "resource_limits.h"
 #include "sighandle.h"
 
 _INITIALIZE_EASYLOGGINGPP
@@ -15,8 +17,8 @@ _INITIALIZE_EASYLOGGINGPP
 int main(int argc, char* argv[]) {
   const BarnConf barn_conf = parse_command_line(argc, argv);
 
-  // Enable a signal handler that given child_pid_global global variable
-  // it propagates the SIGTERM signal.
+  // Enable a signal handler that propagates SIGTERM to the running
+  // children.
   enable_kill_child_signal_handler();
 
   // seed rand
@@ -31,8 +33,17 @@ int main(int argc, char* argv[]) {
             "%level : %msg");
      barn_agent_local_monitor_main(barn_conf);
    } else {
+     const auto prefix = "[" + barn_conf.service_name + ":" + barn_conf.category + "]";
      el::Loggers::reconfigureAllLoggers(el::ConfigurationType::Format,
-             "%level [" + barn_conf.service_name + ":" + barn_conf.category + "] : %msg");
-     barn_agent_main(barn_conf);
+             "%level " + prefix + " : %msg");
+     // Before any thread (e.g. the async log writer) starts, so they all
+     // inherit the priorities.
+     apply_resource_limits(barn_conf);
+     if (barn_conf.async_logging)
+       start_async_logging(prefix, barn_conf);
+     const int status = barn_agent_main(barn_conf);
+     if (barn_conf.async_logging)
+       stop_async_logging();
+     return status;
    }
 }
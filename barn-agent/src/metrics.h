@@ -1,9 +1,14 @@
 #ifndef METRICS_H
 #define METRICS_H
 
-#include <boost/assign/list_of.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
 #include <vector>
 
+#include <boost/assign/list_of.hpp>
+
 static const std::string FilesToShip        ("barn_files_to_ship");
 static const std::string FailedToGetSyncList("barn_failed_to_get_sync_list");
 static const std::string FullDirectoryShip  ("barn_shipping_entire_log_directory");
@@ -12,9 +17,84 @@ static const std::string LostDuringShip     ("barn_lost_during_ship");
 static const std::string NumFilesShipped    ("barn_files_shipped");
 static const std::string TimeSinceSuccess   ("time_since_success");
 static const std::string FailedOverAgents   ("failed_over_agents");
+static const std::string OldestUnshippedAge ("barn_oldest_unshipped_age_seconds");
+static const std::string NewestShippedAge   ("barn_newest_shipped_age_seconds");
+static const std::string BacklogBytes       ("barn_backlog_bytes");
+static const std::string RoundsBackToBack   ("barn_rounds_back_to_back");
+static const std::string RoundsWaitingForFile("barn_rounds_waiting_for_file");
+static const std::string RoundsBackingOff   ("barn_rounds_backing_off");
+static const std::string BackoffSeconds     ("barn_backoff_seconds");
+static const std::string CatchingUp         ("barn_catching_up");
+static const std::string PinnedBytes        ("barn_pinned_bytes");
+static const std::string UnpinnedCandidates ("barn_unpinned_candidates");
+static const std::string PageCacheBytes     ("barn_page_cache_bytes");
+static const std::string CpuThrottledPeriods("barn_cpu_throttled_periods");
+static const std::string CpuThrottledMs     ("barn_cpu_throttled_ms");
+static const std::string IoStalledMs        ("barn_io_stalled_ms");
+static const std::string DryRunsAhead       ("barn_dry_runs_ahead_of_rotation");
+static const std::string RoundsWithoutDryRun("barn_rounds_without_dry_run");
+static const std::string FreshnessTargetMissed("barn_freshness_target_missed");
+static const std::string DrainFilesLeft     ("barn_drain_files_left");
+static const std::string DrainBytesLeft     ("barn_drain_bytes_left");
+
+// Timers, recorded per observation and reported as percentiles.
+static const std::string ShipLatency        ("barn_ship_latency_ms");
+static const std::string ShipFileSize       ("barn_ship_file_bytes");
+static const std::string DryRunLatency      ("barn_dry_run_latency_ms");
+static const std::string WaitLatency        ("barn_wait_latency_ms");
+static const std::string SlotWaitLatency    ("barn_ship_slot_wait_ms");
+static const std::string ShipFreshness      ("barn_ship_freshness_seconds");
+
+/*
+ * How the values of a metric combine within a report interval.
+ */
+enum class MetricType {
+  Counter,   // Events since the last report, summed
+  Gauge,     // Current state, last value per agent, summed over agents
+  MaxGauge,  // Current state, largest value reported
+  MinGauge,  // Current state, smallest value reported
+  Timer      // Observations (latencies, sizes), summarized as percentiles
+};
+
+// Metrics not listed here are counters.
+static const std::map<std::string, MetricType> MetricTypes =
+  boost::assign::map_list_of(FilesToShip,        MetricType::Gauge)
+                            (TimeSinceSuccess,   MetricType::MaxGauge)
+                            (FailedOverAgents,   MetricType::Gauge)
+                            (OldestUnshippedAge, MetricType::MaxGauge)
+                            (NewestShippedAge,   MetricType::MaxGauge)
+                            (BacklogBytes,       MetricType::MaxGauge)
+                            (BackoffSeconds,     MetricType::MaxGauge)
+                            (CatchingUp,         MetricType::Gauge)
+                            (PinnedBytes,        MetricType::Gauge)
+                            (UnpinnedCandidates, MetricType::Gauge)
+                            (PageCacheBytes,     MetricType::Gauge)
+                            (DrainFilesLeft,     MetricType::Gauge)
+                            (DrainBytesLeft,     MetricType::Gauge)
+                            (ShipLatency,        MetricType::Timer)
+                            (ShipFileSize,       MetricType::Timer)
+                            (DryRunLatency,      MetricType::Timer)
+                            (WaitLatency,        MetricType::Timer)
+                            (SlotWaitLatency,    MetricType::Timer)
+                            (ShipFreshness,      MetricType::Timer);
+
+inline MetricType metric_type(const std::string& key) {
+  auto found = MetricTypes.find(key);
+  return found == MetricTypes.end() ? MetricType::Counter : found->second;
+}
+
+inline bool is_gauge(MetricType type) {
+  return type == MetricType::Gauge || type == MetricType::MaxGauge ||
+         type == MetricType::MinGauge;
+}
+
+inline bool is_gauge(const std::string& key) {
+  return is_gauge(metric_type(key));
+}
 
 // These metrics will be published as zero if not reported
-// (it is necessary for ganlia that values be zeroed).
+// (it is necessary for ganlia that values be zeroed). Timers can't be
+// listed here, they are only published once observed.
 static const std::vector<std::string> DefaultZeroMetrics =
   boost::assign::list_of(FilesToShip)
                         (FailedToGetSyncList)
@@ -22,7 +102,7 @@ static const std::vector<std::string> DefaultZeroMetrics =
                         (RotatedDuringShip)
                         (NumFilesShipped)
                         (LostDuringShip)
-                        (FullDirectoryShip)
+                        (FreshnessTargetMissed)
                         (FailedOverAgents);
 
 /*
@@ -38,7 +118,16 @@ class Metrics {
     : service_name(service_name),
       category(category) {}
 
-  virtual void send_metric(const std::string& key, int value) const = 0;
+  // Report a counter or gauge, see MetricTypes.
+  virtual void send_metric(const std::string& key, int64_t value) const = 0;
+
+  // Record a single observation (e.g. a latency or a size) into the
+  // timer 'key'. Implementations should keep this cheap, as it is called
+  // on the shipping path, and only send accumulated histograms on flush().
+  virtual void record_value(const std::string& key, int64_t value) const {}
+
+  // Send anything buffered by the implementation. Called once per round.
+  virtual void flush() const {}
 
   virtual ~Metrics() {}
 };
@@ -49,7 +138,7 @@ class Metrics {
 class NoOpMetrics : public Metrics {
 public:
   NoOpMetrics() : Metrics("", "") {}
-  virtual void send_metric(const std::string& key, int value) const override {}
+  virtual void send_metric(const std::string& key, int64_t value) const override {}
 };
 
 #endif
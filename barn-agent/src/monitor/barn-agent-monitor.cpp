@@ -1,16 +1,22 @@
+#include <algorithm>
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <utility>
 
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
-#include <boost/circular_buffer.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread/mutex.hpp>
 
 #include "barn-agent-monitor.h"
+#include "histogram.h"
 #include "monitor/ganglia.h"
 #include "monitor/localreport.h"
+#include "monitor/prometheus.h"
+#include "monitor/shmreport.h"
 
 using namespace std;
 using boost::posix_time::seconds;
@@ -18,66 +24,269 @@ using boost::bind;
 using boost::asio::io_service;
 
 typedef boost::asio::deadline_timer Timer;
-typedef boost::circular_buffer<pair<string, int>> MetricRepo;
 
-map<string, int> aggregate(boost::circular_buffer<pair<string, int>> buffer);
+map<string, int64_t> summarize(const HistogramRepo& histograms);
 
 const int report_interval_seconds = 30;
-const int max_metrics_per_interval = 1000;
+const size_t max_streams = 1000;
+const int stream_expiry_intervals = 10;
 
-void addDefaultMetrics(MetricRepo& metrics) {
-  for (auto& el : DefaultZeroMetrics)
-    metrics.push_back(make_pair(el, 0));
+MetricAggregator::MetricAggregator(size_t max_streams, int stream_expiry_intervals)
+  : max_streams(max_streams),
+    stream_expiry_intervals(stream_expiry_intervals),
+    overflowed(false) {}
+
+Stream MetricAggregator::admit(const string& service_name, const string& category) {
+  const Stream stream(service_name, category);
+  auto known = streams.find(stream);
+  if (known == streams.end()) {
+    if (streams.size() >= max_streams) {
+      if (!overflowed)
+        LOG(ERROR) << "Tracking too many streams (" << max_streams
+                   << "), folding " << service_name << ":" << category
+                   << " and any further ones into " << OverflowStream.first;
+      overflowed = true;
+      streams[OverflowStream] = 0;
+      return OverflowStream;
+    }
+    known = streams.insert(make_pair(stream, 0)).first;
+  }
+  known->second = 0;
+  return stream;
+}
+
+/*
+ * Fold 'value' into 'aggregated', which was 'seen' before in this interval.
+ */
+static void aggregate(MetricType type, bool seen, int64_t value, int64_t* aggregated) {
+  if (!seen) {
+    *aggregated = value;
+    return;
+  }
+  switch (type) {
+  case MetricType::Gauge:
+    *aggregated = value;
+    break;
+  case MetricType::MaxGauge:
+    *aggregated = std::max(*aggregated, value);
+    break;
+  case MetricType::MinGauge:
+    *aggregated = std::min(*aggregated, value);
+    break;
+  default:
+    *aggregated += value;
+  }
+}
+
+/*
+ * How values of one key from several agents combine: the agents' last
+ * values of a gauge add up, max and min gauges stay max and min.
+ */
+static MetricType across_agents(MetricType type) {
+  return type == MetricType::Gauge ? MetricType::Counter : type;
+}
+
+void MetricAggregator::add(const Report& report) {
+  current.types[report.key] = report.type;
+
+  if (report.service_name.empty()) {
+    // Only older agents send unlabeled reports, and never timers.
+    if (report.type == MetricType::Counter) {
+      current.totals[report.key] += report.value;
+    } else if (is_gauge(report.type)) {
+      auto found = unlabeled_gauges.find(report.key);
+      const bool seen = found != unlabeled_gauges.end();
+      // Several agents may send the same unlabeled gauge.
+      aggregate(across_agents(report.type), seen, report.value,
+                &unlabeled_gauges[report.key]);
+    }
+    return;
+  }
+
+  const auto stream = admit(report.service_name, report.category);
+  const auto series = make_tuple(stream.first, stream.second, report.key);
+  if (report.type == MetricType::Timer) {
+    current.histograms[series].record(report.value);
+    return;
+  }
+  if (report.type == MetricType::Counter)
+    current.totals[report.key] += report.value;
+
+  auto found = current.series.find(series);
+  const bool seen = found != current.series.end();
+  aggregate(report.type, seen, report.value, &current.series[series]);
+}
+
+/*
+ * Gauge totals can only be worked out once the interval is complete, from
+ * the final value of each stream.
+ */
+void MetricAggregator::add_gauges_to_totals(Interval& interval) {
+  map<string, int64_t> gauge_totals;
+  auto add_gauge = [&](const string& key, int64_t value) {
+    auto found = gauge_totals.find(key);
+    aggregate(across_agents(interval.types[key]), found != gauge_totals.end(),
+              value, &gauge_totals[key]);
+  };
+
+  for (auto& el : unlabeled_gauges)
+    add_gauge(el.first, el.second);
+  unlabeled_gauges.clear();
+
+  for (auto& el : interval.series) {
+    if (is_gauge(interval.types[get<2>(el.first)]))
+      add_gauge(get<2>(el.first), el.second);
+  }
+  for (auto& el : gauge_totals)
+    interval.totals[el.first] = el.second;
+}
+
+void MetricAggregator::add(const HistogramReport& report) {
+  current.types[report.key] = MetricType::Timer;
+  const auto stream = admit(report.service_name, report.category);
+  current.histograms[make_tuple(stream.first, stream.second, report.key)]
+    .merge(report.histogram);
 }
 
-void timer_action(Timer* timer, MetricRepo* metrics, boost::mutex* repo_mutex) {
-  MetricRepo metrics_copy;
+Interval MetricAggregator::take() {
+  Interval interval;
+  swap(interval, current);
+  overflowed = false;
+  add_gauges_to_totals(interval);
+
+  for (auto& key : DefaultZeroMetrics) {
+    interval.totals[key] += 0;
+    interval.types.insert(make_pair(key, metric_type(key)));
+  }
 
-  if (metrics->full()) {
-    LOG(ERROR) << "metrics buffer full";
+  for (auto it = streams.begin(); it != streams.end();) {
+    for (auto& key : DefaultZeroMetrics)
+      interval.series[make_tuple(it->first.first, it->first.second, key)] += 0;
+    if (++it->second > stream_expiry_intervals)
+      streams.erase(it++);
+    else
+      ++it;
   }
+  return interval;
+}
+
+void timer_action(Timer* timer, MetricAggregator* aggregator,
+                  boost::mutex* repo_mutex, PrometheusExporter* exporter,
+                  MetricsSegment* segment) {
+  Interval interval;
 
   {
     boost::mutex::scoped_lock lock(*repo_mutex);
-    metrics_copy = *metrics;
-    metrics->clear();
-    addDefaultMetrics(*metrics);
+    if (segment)
+      segment->collect([&](const Report& report) { aggregator->add(report); });
+    interval = aggregator->take();
   }
 
-  for (auto &m : aggregate(metrics_copy)) {
+  if (exporter)
+    exporter->publish(render_exposition(interval));
+
+  map<string, int64_t> aggregated(interval.totals);
+  for (auto& el : interval.series)
+    aggregated[get<2>(el.first) + "." + get<0>(el.first) + "." + get<1>(el.first)] =
+      el.second;
+  for (auto &h : summarize(interval.histograms))
+    aggregated.insert(h);
+
+  for (auto &m : aggregated) {
     cout << "Reporting externally: " << m.first << " -> " << m.second << endl;
     report_ganglia(metric_group, m.first, m.second);
   }
 
   timer->expires_at(timer->expires_at() + seconds(report_interval_seconds));
-  timer->async_wait(bind(timer_action, timer, metrics, repo_mutex));
+  timer->async_wait(bind(timer_action, timer, aggregator, repo_mutex, exporter,
+                         segment));
 }
 
 // Listens for string-key,integer-value broadcasts over UDP and
 // aggregrates them for 30 seconds before re-broadcasting to ganglia.
-// TODO: Consider replacing with statsd
+// Agents can bypass the monitor and report to statsd (see --statsd_addr).
 void barn_agent_local_monitor_main(const BarnConf& barn_conf) {
-  auto metrics = MetricRepo(max_metrics_per_interval);
+  MetricAggregator aggregator(max_streams, stream_expiry_intervals);
   boost::mutex mutex;
 
+  // Scrapes are served from the exposition rendered at the last report
+  // interval, so they never contend with UDP ingest for 'mutex'.
+  boost::scoped_ptr<PrometheusExporter> exporter;
+  std::thread http_thread;
+  if (barn_conf.prometheus_port > 0) {
+    exporter.reset(new PrometheusExporter());
+    const PrometheusExporter* scraped = exporter.get();
+    const int port = barn_conf.prometheus_port;
+    http_thread = std::thread([scraped, port]() { scraped->serve(port); });
+  }
+
+  // Agents sharing the segment are read at every report interval.
+  boost::scoped_ptr<MetricsSegment> segment;
+  if (!barn_conf.metrics_shm.empty()) {
+    try {
+      segment.reset(new MetricsSegment(barn_conf.metrics_shm));
+    } catch (const std::runtime_error& e) {
+      LOG(ERROR) << e.what() << ", only receiving metrics as datagrams";
+    }
+  }
+
   io_service io;
   Timer timer(io, seconds(0));
-  timer.async_wait(bind(timer_action, &timer, &metrics, &mutex));
+  timer.async_wait(bind(timer_action, &timer, &aggregator, &mutex, exporter.get(),
+                        segment.get()));
   std::thread t(boost::bind(&io_service::run, &io));
 
   receive_reports(barn_conf.monitor_port, [&](const Report& new_report) {
     boost::mutex::scoped_lock lock(mutex);
-    metrics.push_back(new_report);
-    // cout << "Individual report received: " << new_report.serialize() << endl;
+    aggregator.add(new_report);
+  }, [&](const HistogramReport& new_report) {
+    boost::mutex::scoped_lock lock(mutex);
+    aggregator.add(new_report);
   });
 }
 
-map<string, int> aggregate(boost::circular_buffer<pair<string, int>> buffer) {
-  map<string, int> aggregated;
+/*
+ * Turn each stream's histograms into percentile metrics, named
+ * <key>_<percentile>.<service>.<category>, and derive the stream's shipping
+ * throughput from its shipped bytes and time spent shipping.
+ */
+map<string, int64_t> summarize(const HistogramRepo& histograms) {
+  map<string, int64_t> summarized;
+
+  for (auto& el : histograms) {
+    const string& key = get<2>(el.first);
+    const Histogram& histogram = el.second;
+    const string suffix = "." + get<0>(el.first) + "." + get<1>(el.first);
 
-  for (auto element : buffer)
-    aggregated[element.first] += element.second;
+    for (auto& p : ReportedPercentiles)
+      summarized[key + "_" + p.first + suffix] = histogram.percentile(p.second);
+    summarized[key + "_max" + suffix] = histogram.max();
+  }
 
-  return aggregated;
+  for (auto& el : ship_throughput(histograms))
+    summarized[ShipThroughput + "." + el.first.first + "." + el.first.second] =
+      el.second;
+
+  return summarized;
 }
 
+map<pair<string, string>, int64_t> ship_throughput(const HistogramRepo& histograms) {
+  map<pair<string, string>, pair<int64_t, int64_t>> bytes_and_millis;
+  map<pair<string, string>, int64_t> throughput;
+
+  for (auto& el : histograms) {
+    const auto stream = make_pair(get<0>(el.first), get<1>(el.first));
+    const string& key = get<2>(el.first);
+    if (key == ShipFileSize)
+      bytes_and_millis[stream].first += el.second.sum();
+    else if (key == ShipLatency)
+      bytes_and_millis[stream].second += el.second.sum();
+  }
+
+  for (auto& el : bytes_and_millis) {
+    if (el.second.second > 0)
+      throughput[el.first] = el.second.first * 1000 / el.second.second;
+  }
+
+  return throughput;
+}
@@ -1,12 +1,85 @@
 #ifndef MONITOR_MAIN
 #define MONITOR_MAIN
 
+#include <map>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "barn-agent.h"
+#include "monitor/localreport.h"
 
 const std::string metric_group("barn-agent");
 
+static const std::string ShipThroughput("barn_ship_bytes_per_second");
+
+// Histograms are exported as these percentiles, plus the max.
+static const std::vector<std::pair<std::string, double>> ReportedPercentiles =
+  boost::assign::list_of(std::make_pair(std::string("p50"), 50.0))
+                        (std::make_pair(std::string("p90"), 90.0))
+                        (std::make_pair(std::string("p99"), 99.0));
+
+// (service_name, category) of a single agent.
+typedef std::pair<std::string, std::string> Stream;
+// (service_name, category, key) -> value aggregated over the interval.
+typedef std::map<std::tuple<std::string, std::string, std::string>, int64_t> SeriesRepo;
+
+// Streams beyond the cardinality limit are folded into this one.
+static const Stream OverflowStream("_overflow", "_overflow");
+
+/*
+ * Everything received during one report interval.
+ */
+struct Interval {
+  std::map<std::string, int64_t> totals;     // Host totals by key
+  SeriesRepo series;                          // Per stream values
+  HistogramRepo histograms;                   // Per stream timers
+  std::map<std::string, MetricType> types;    // Type of each key above
+};
+
+/*
+ * Aggregates reports per series (service, category, key) as they arrive
+ * according to their MetricType: counters are summed, gauges keep the
+ * last, largest or smallest value, timers are merged into histograms.
+ * Host totals sum counters and last value gauges over the streams, and
+ * take the largest or smallest value of max and min gauges.
+ * The number of streams tracked is capped at 'max_streams', reports from
+ * further streams only count towards OverflowStream. Streams that haven't
+ * reported for 'stream_expiry_intervals' are forgotten, until then their
+ * DefaultZeroMetrics are published as zero like the host totals are.
+ */
+class MetricAggregator {
+public:
+  MetricAggregator(size_t max_streams, int stream_expiry_intervals);
+
+  void add(const Report& report);
+  void add(const HistogramReport& report);
+
+  // Returns the interval aggregated so far and starts a new one.
+  Interval take();
+
+private:
+  Stream admit(const std::string& service_name, const std::string& category);
+  void add_gauges_to_totals(Interval& interval);
+
+  const size_t max_streams;
+  const int stream_expiry_intervals;
+  // Known streams -> number of intervals since they last reported.
+  std::map<Stream, int> streams;
+  Interval current;
+  // Gauges of agents that don't report service and category, by key.
+  std::map<std::string, int64_t> unlabeled_gauges;
+  bool overflowed;
+};
+
+/*
+ * Bytes per second shipped by each (service_name, category) stream, derived
+ * from its shipped file sizes and the time spent shipping them.
+ */
+std::map<std::pair<std::string, std::string>, int64_t>
+ship_throughput(const HistogramRepo& histograms);
+
 void barn_agent_local_monitor_main(const BarnConf& barn_conf);
 
 #endif
@@ -1,3 +1,4 @@
+#include <cstdint>
 #include <string>
 
 #include <boost/assign/list_of.hpp>
@@ -11,9 +12,11 @@ using namespace std;
 
 bool report_ganglia(std::string group,
                     std::string metric,
-                    int value) {
+                    int64_t value) {
 
-  const auto int_size_flag = "int32";
+  // gmetric has no 64 bit integer type, a double holds up to 2^53 exactly.
+  const auto int_size_flag =
+    value >= INT32_MIN && value <= INT32_MAX ? "int32" : "double";
 
   try {
     auto result = run_command(gmetric_command_name,
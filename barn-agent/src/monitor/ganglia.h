@@ -1,13 +1,14 @@
 #ifndef GANGLIA_H
 #define GANGLIA_H
 
+#include <cstdint>
 #include <string>
 
 const std::string gmetric_command_name("gmetric");
 
 bool report_ganglia(std::string group,
                     std::string metric,
-                    int value);
+                    int64_t value);
 
 #endif
 
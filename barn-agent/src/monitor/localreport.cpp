@@ -1,39 +1,126 @@
+#include <map>
 #include <sstream>
 #include <string>
 
 #include <boost/array.hpp>
+#include <boost/assign/list_of.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
 #include "localreport.h"
+#include "params.h"
 
 using namespace std;
 
 static void send_datagram(int port, std::string message);
 static void receive_datagrams(int port, function<void(const string&)> handler);
 
-void LocalReport::send_metric(const std::string& key, int value) const {
-  static const auto SERIALIZATION_DELIM = ' ';
+static const auto SERIALIZATION_DELIM = ' ';
+static const auto TYPE_SEPARATOR = '|';
+// First token of a datagram carrying a histogram rather than a single value.
+static const string HISTOGRAM_TAG("#hist");
+
+void LocalReport::send_metric(const std::string& key, int64_t value) const {
+  if (metric_type(key) == MetricType::Timer)
+    record_value(key, value);
+  else
+    send_datagram(port, serialize_report(Report(key, value, service_name, category)));
+}
+
+void LocalReport::record_value(const std::string& key, int64_t value) const {
+  histograms[key].record(value);
+}
+
+/*
+ * Send each histogram recorded since the last flush as one datagram:
+ *   #hist service category key <Histogram::serialize()>
+ */
+void LocalReport::flush() const {
+  for (auto& el : histograms) {
+    if (el.second.empty())
+      continue;
+    std::ostringstream oss;
+    oss << HISTOGRAM_TAG << SERIALIZATION_DELIM << service_name
+        << SERIALIZATION_DELIM << category
+        << SERIALIZATION_DELIM << el.first
+        << SERIALIZATION_DELIM << el.second.serialize();
+    send_datagram(port, oss.str());
+    el.second.clear();
+  }
+}
+
+static const map<MetricType, string> TYPE_NAMES =
+  boost::assign::map_list_of(MetricType::Counter,  "c")
+                            (MetricType::Gauge,    "g")
+                            (MetricType::MaxGauge, "max")
+                            (MetricType::MinGauge, "min")
+                            (MetricType::Timer,    "ms");
+
+std::string serialize_report(const Report& report) {
   std::ostringstream oss;
 
-  oss << key << SERIALIZATION_DELIM << value;
+  oss << report.key << SERIALIZATION_DELIM << report.value
+      << TYPE_SEPARATOR << TYPE_NAMES.at(report.type);
+  if (!report.service_name.empty())
+    oss << SERIALIZATION_DELIM << report.service_name
+        << SERIALIZATION_DELIM << report.category;
 
-  send_datagram(port, oss.str());
+  return oss.str();
 }
 
-static Report deserialize(const std::string& serialized) {
+Report deserialize_report(const std::string& serialized) {
   std::istringstream iss(serialized);
 
-  string key;
-  int value;
+  string key, value_and_type, service_name, category;
+  iss >> key >> value_and_type >> service_name >> category;
+
+  std::istringstream vss(value_and_type);
+  int64_t value = 0;
+  vss >> value;
 
-  iss >> key >> value;
+  Report report(key, value, service_name, category);
+  string type_name;
+  if (vss.get() == TYPE_SEPARATOR && vss >> type_name) {
+    for (auto& el : TYPE_NAMES) {
+      if (el.second == type_name)
+        report.type = el.first;
+    }
+  }
+  return report;
+}
+
+static bool deserialize_histogram(const std::string& serialized,
+                                  HistogramReport* report) {
+  std::istringstream iss(serialized);
+  string tag;
+
+  if (!(iss >> tag >> report->service_name >> report->category >> report->key))
+    return false;
+
+  string histogram;
+  getline(iss, histogram);
+  return report->histogram.deserialize(histogram);
+}
+
+static void dispatch_datagram(const string& datagram,
+                              function<void(const Report&)> handler,
+                              function<void(const HistogramReport&)> histogram_handler) {
+  if (datagram.compare(0, HISTOGRAM_TAG.size(), HISTOGRAM_TAG) != 0) {
+    handler(deserialize_report(datagram));
+    return;
+  }
 
-  return Report(key, value);
+  HistogramReport report;
+  if (deserialize_histogram(datagram, &report))
+    histogram_handler(report);
+  else
+    LOG(WARNING) << "Dropping malformed histogram report";
 }
 
-void receive_reports(int port, function<void(const Report&)> handler) {
-  receive_datagrams(port, bind(handler, bind(deserialize, _1)));
+void receive_reports(int port,
+                     function<void(const Report&)> handler,
+                     function<void(const HistogramReport&)> histogram_handler) {
+  receive_datagrams(port, bind(dispatch_datagram, _1, handler, histogram_handler));
 }
 
 void send_datagram(int port, std::string message) {
@@ -52,7 +139,9 @@ void receive_datagrams(int port, function<void(const string&)> handler) {
   using namespace boost;
   using namespace boost::asio;
   using namespace boost::asio::ip;
-  static const int buffer_size = 250;
+  // Histogram reports can be large, allow for anything that fits in
+  // a loopback datagram.
+  static const int buffer_size = 65507;
 
   io_service io_service;
   udp::socket socket(io_service, udp::endpoint(udp::v4(), port));
@@ -1,14 +1,55 @@
 #ifndef LOCALREPORT_H
 #define LOCALREPORT_H
 
+#include <functional>
+#include <map>
 #include <string>
+#include <tuple>
 #include <utility>
 
+#include "histogram.h"
 #include "metrics.h"
 
-typedef std::pair<std::string, int> Report;
+/*
+ * A single metric value sent by an agent. Agents older than per-stream
+ * reporting only send key and value, and leave service_name and category
+ * empty. The type defaults to the one in MetricTypes.
+ */
+struct Report {
+  std::string key;
+  int64_t value;
+  std::string service_name;
+  std::string category;
+  MetricType type;
 
-void receive_reports(int port, std::function<void(const Report&)> handler);
+  Report(const std::string& key, int64_t value,
+         const std::string& service_name = "",
+         const std::string& category = "")
+    : key(key), value(value), service_name(service_name), category(category),
+      type(metric_type(key)) {}
+};
+
+// Wire format: "key value|type service_name category", where type is one of
+// c, g, max, min, ms and "|type" may be missing. public for testing
+std::string serialize_report(const Report& report);
+Report deserialize_report(const std::string& serialized);
+
+/*
+ * A histogram accumulated by a single agent over one or more rounds.
+ */
+struct HistogramReport {
+  std::string service_name;
+  std::string category;
+  std::string key;
+  Histogram histogram;
+};
+
+// (service_name, category, key) -> histogram
+typedef std::map<std::tuple<std::string, std::string, std::string>, Histogram> HistogramRepo;
+
+void receive_reports(int port,
+                     std::function<void(const Report&)> handler,
+                     std::function<void(const HistogramReport&)> histogram_handler);
 
 class LocalReport : public Metrics {
 public:
@@ -19,7 +60,13 @@ public:
           std::string category)
     : Metrics(service_name, category), port(port) {}
 
-  virtual void send_metric(const std::string& key, int value) const;
+  virtual void send_metric(const std::string& key, int64_t value) const;
+  virtual void record_value(const std::string& key, int64_t value) const;
+  virtual void flush() const;
+
+private:
+  // Histograms recorded since the last flush, by metric key.
+  mutable std::map<std::string, Histogram> histograms;
 };
 
 #endif
@@ -0,0 +1,244 @@
+/*
+ * Prometheus metrics endpoint, see prometheus.h.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "monitor/prometheus.h"
+#include "params.h"
+
+using namespace std;
+
+static const string CONTENT_TYPE("text/plain; version=0.0.4");
+static const size_t MAX_REQUEST_SIZE = 8192;
+
+/*
+ * Metric names may only contain [a-zA-Z0-9_:] and not start with a digit.
+ * Colons are left to recording rules.
+ */
+static string metric_name(const string& key) {
+  string name(key);
+  for (auto& c : name) {
+    if (!isalnum((unsigned char)c) && c != '_')
+      c = '_';
+  }
+  if (name.empty() || isdigit((unsigned char)name[0]))
+    name = "_" + name;
+  return name;
+}
+
+static string label_value(const string& value) {
+  string escaped;
+  for (auto c : value) {
+    if (c == '\\' || c == '"')
+      escaped += '\\';
+    if (c == '\n')
+      escaped += "\\n";
+    else
+      escaped += c;
+  }
+  return escaped;
+}
+
+static string stream_labels(const string& service_name, const string& category) {
+  return "service=\"" + label_value(service_name) +
+         "\",category=\"" + label_value(category) + "\"";
+}
+
+static string total_aggregation(MetricType type) {
+  if (type == MetricType::MaxGauge)
+    return "max";
+  if (type == MetricType::MinGauge)
+    return "min";
+  return "sum";
+}
+
+string render_exposition(const Interval& interval) {
+  ostringstream out;
+  const HistogramRepo& histograms = interval.histograms;
+
+  for (auto& el : interval.totals) {
+    auto type = interval.types.find(el.first);
+    const auto name = metric_name(el.first) + "_host";
+    const auto aggregation = total_aggregation(
+          type == interval.types.end() ? metric_type(el.first) : type->second);
+    out << "# TYPE " << name << " gauge\n"
+        << name << "{agg=\"" << aggregation << "\"} " << el.second << "\n";
+  }
+
+  // Samples of one metric family have to be contiguous.
+  map<string, vector<SeriesRepo::const_iterator>> series_by_key;
+  for (auto it = interval.series.begin(); it != interval.series.end(); ++it)
+    series_by_key[get<2>(it->first)].push_back(it);
+
+  for (auto& family : series_by_key) {
+    const auto name = metric_name(family.first);
+    out << "# TYPE " << name << " gauge\n";
+    for (auto& it : family.second)
+      out << name << "{" << stream_labels(get<0>(it->first), get<1>(it->first))
+          << "} " << it->second << "\n";
+  }
+
+  map<string, vector<HistogramRepo::const_iterator>> by_key;
+  for (auto it = histograms.begin(); it != histograms.end(); ++it)
+    by_key[get<2>(it->first)].push_back(it);
+
+  for (auto& family : by_key) {
+    const auto name = metric_name(family.first);
+    out << "# TYPE " << name << " summary\n";
+    for (auto& it : family.second) {
+      const auto labels = stream_labels(get<0>(it->first), get<1>(it->first));
+      const Histogram& histogram = it->second;
+      for (auto& p : ReportedPercentiles)
+        out << name << "{" << labels << ",quantile=\"" << p.second / 100 << "\"} "
+            << histogram.percentile(p.second) << "\n";
+      out << name << "_sum{" << labels << "} " << histogram.sum() << "\n"
+          << name << "_count{" << labels << "} " << histogram.count() << "\n";
+    }
+    out << "# TYPE " << name << "_max gauge\n";
+    for (auto& it : family.second)
+      out << name << "_max{" << stream_labels(get<0>(it->first), get<1>(it->first))
+          << "} " << it->second.max() << "\n";
+  }
+
+  const auto throughput = ship_throughput(histograms);
+  if (!throughput.empty()) {
+    const auto name = metric_name(ShipThroughput);
+    out << "# TYPE " << name << " gauge\n";
+    for (auto& el : throughput)
+      out << name << "{" << stream_labels(el.first.first, el.first.second)
+          << "} " << el.second << "\n";
+  }
+
+  return out.str();
+}
+
+PrometheusExporter::PrometheusExporter()
+  : exposition(make_shared<const string>()) {}
+
+void PrometheusExporter::publish(const string& rendered) {
+  auto next = make_shared<const string>(rendered);
+  boost::mutex::scoped_lock lock(mutex);
+  exposition.swap(next);
+}
+
+shared_ptr<const string> PrometheusExporter::current() const {
+  boost::mutex::scoped_lock lock(mutex);
+  return exposition;
+}
+
+static string http_response(const string& status, const string& body) {
+  ostringstream oss;
+  oss << "HTTP/1.0 " << status << "\r\n"
+      << "Content-Type: " << CONTENT_TYPE << "\r\n"
+      << "Content-Length: " << body.size() << "\r\n"
+      << "Connection: close\r\n\r\n"
+      << body;
+  return oss.str();
+}
+
+/*
+ * Wait until 'socket' is ready for 'events' (POLLIN, POLLOUT), false if
+ * 'deadline' passes first.
+ */
+static bool wait_ready(boost::asio::ip::tcp::socket& socket, short events,
+                       chrono::steady_clock::time_point deadline) {
+  while (true) {
+    const auto left = chrono::duration_cast<chrono::milliseconds>(
+          deadline - chrono::steady_clock::now()).count();
+    if (left <= 0)
+      return false;
+    struct pollfd ready = {socket.native_handle(), events, 0};
+    const int n = poll(&ready, 1, left);
+    if (n > 0)
+      return true;
+    if (n < 0 && errno != EINTR)
+      return false;
+  }
+}
+
+/*
+ * Read the request line and headers from non-blocking 'socket', "" if the
+ * client doesn't send them by 'deadline' or sends too much.
+ */
+static string read_request(boost::asio::ip::tcp::socket& socket,
+                           chrono::steady_clock::time_point deadline) {
+  string request;
+  char chunk[1024];
+  while (request.find("\r\n\r\n") == string::npos) {
+    if (request.size() > MAX_REQUEST_SIZE || !wait_ready(socket, POLLIN, deadline))
+      return "";
+    boost::system::error_code error;
+    const auto n = socket.read_some(boost::asio::buffer(chunk), error);
+    if (error == boost::asio::error::would_block)
+      continue;
+    if (error)
+      return "";
+    request.append(chunk, n);
+  }
+  return request;
+}
+
+/*
+ * Write 'response' to non-blocking 'socket', giving up at 'deadline'.
+ */
+static void write_response(boost::asio::ip::tcp::socket& socket, const string& response,
+                           chrono::steady_clock::time_point deadline) {
+  size_t written = 0;
+  while (written < response.size() && wait_ready(socket, POLLOUT, deadline)) {
+    boost::system::error_code error;
+    written += socket.write_some(
+          boost::asio::buffer(response.data() + written, response.size() - written), error);
+    if (error && error != boost::asio::error::would_block)
+      return;
+  }
+}
+
+void PrometheusExporter::serve(int port, int request_timeout_seconds) const {
+  using namespace boost::asio;
+  using namespace boost::asio::ip;
+
+  try {
+    io_service io;
+    tcp::acceptor acceptor(io, tcp::endpoint(tcp::v4(), port));
+
+    while (true) {
+      tcp::socket socket(io);
+      acceptor.accept(socket);
+      // Don't let a stalled client hold up the next scrape for long: the
+      // socket doesn't block, it's read and written as poll() says it can.
+      socket.non_blocking(true);
+      const auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::seconds(request_timeout_seconds);
+      const auto request = read_request(socket, deadline);
+      if (request.empty()) {
+        LOG(WARNING) << "Dropped a metrics scrape without a request in time";
+        continue;
+      }
+
+      istringstream request_stream(request);
+      string method, path;
+      request_stream >> method >> path;
+
+      string response;
+      if (method != "GET")
+        response = http_response("405 Method Not Allowed", "");
+      else if (path != "/metrics")
+        response = http_response("404 Not Found", "");
+      else
+        response = http_response("200 OK", *current());
+      write_response(socket, response, deadline);
+    }
+  } catch (std::exception& e) {
+    LOG(ERROR) << "Metrics endpoint on port " << port << " failed: " << e.what();
+  }
+}
@@ -0,0 +1,41 @@
+#ifndef PROMETHEUS_H
+#define PROMETHEUS_H
+
+#include <memory>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+#include "monitor/barn-agent-monitor.h"
+
+/*
+ * Render one report interval in the Prometheus text exposition format.
+ * Per stream values are labeled by service and category, histograms are
+ * exported as summaries. Host totals are <key>_host, labeled with how they
+ * are aggregated (agg="sum", or "max" and "min" for max and min gauges), so
+ * they don't add up with the streams.
+ */
+std::string render_exposition(const Interval& interval);
+
+/*
+ * Serves the last published exposition over HTTP (GET /metrics).
+ * Rendering happens once per report interval in publish(), a scrape only
+ * copies a pointer to the current rendering so it never waits on ingest.
+ */
+class PrometheusExporter {
+public:
+  PrometheusExporter();
+
+  void publish(const std::string& exposition);
+  std::shared_ptr<const std::string> current() const;
+
+  // Accept and answer scrapes on 'port' forever, one at a time. A client
+  // gets 'request_timeout_seconds' to send its request and read the answer.
+  void serve(int port, int request_timeout_seconds = 5) const;
+
+private:
+  mutable boost::mutex mutex;
+  std::shared_ptr<const std::string> exposition;
+};
+
+#endif
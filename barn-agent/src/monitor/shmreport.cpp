@@ -0,0 +1,204 @@
+/*
+ * Metrics shared through a mapped file, see shmreport.h.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "monitor/shmreport.h"
+#include "params.h"
+
+using namespace std;
+
+// Bump when ShmLayout changes, so mismatched agents and monitor refuse
+// to share a segment instead of misreading it.
+static const uint32_t SHM_MAGIC = 0xba4e0002;
+
+static_assert(ATOMIC_LONG_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2 &&
+              ATOMIC_INT_LOCK_FREE == 2,
+              "shared memory metrics need lock free atomics");
+
+static void copy_name(char* destination, const string& name, size_t size) {
+  strncpy(destination, name.c_str(), size - 1);
+  destination[size - 1] = '\0';
+}
+
+static bool name_equals(const char* name, const string& other, size_t size) {
+  return strncmp(name, other.c_str(), size - 1) == 0;
+}
+
+MetricsSegment::MetricsSegment(const string& path) : fd(-1), layout(0) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    throw runtime_error("Failed to open metrics segment " + path + ": " + strerror(errno));
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (st.st_size < (off_t)sizeof(ShmLayout) && ftruncate(fd, sizeof(ShmLayout)) != 0)) {
+    close(fd);
+    throw runtime_error("Failed to size metrics segment " + path + ": " + strerror(errno));
+  }
+
+  void* mapped = mmap(0, sizeof(ShmLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    close(fd);
+    throw runtime_error("Failed to map metrics segment " + path + ": " + strerror(errno));
+  }
+  layout = static_cast<ShmLayout*>(mapped);
+
+  // A new file is all zeroes, which is a valid empty segment.
+  uint32_t expected = 0;
+  layout->magic.compare_exchange_strong(expected, SHM_MAGIC);
+  if (layout->magic.load() != SHM_MAGIC) {
+    munmap(layout, sizeof(ShmLayout));
+    close(fd);
+    throw runtime_error("Incompatible metrics segment " + path);
+  }
+  layout->slot_count = SHM_MAX_SLOTS;
+}
+
+MetricsSegment::~MetricsSegment() {
+  munmap(layout, sizeof(ShmLayout));
+  close(fd);
+}
+
+bool MetricsSegment::is_alive(pid_t pid) const {
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+ShmSlot* MetricsSegment::claim(const string& service_name, const string& category,
+                               pid_t pid) {
+  // Pick up where a previous agent for the same stream left off, so its
+  // counters which weren't collected yet aren't lost.
+  for (auto& slot : layout->slots) {
+    if (!slot.ready.load(memory_order_acquire) ||
+        !name_equals(slot.service_name, service_name, SHM_NAME_SIZE) ||
+        !name_equals(slot.category, category, SHM_NAME_SIZE))
+      continue;
+    int32_t owner = slot.owner_pid.load();
+    if (owner == pid)
+      return &slot;
+    if (owner > 0 && !is_alive(owner) &&
+        slot.owner_pid.compare_exchange_strong(owner, pid))
+      return &slot;
+  }
+
+  for (auto& slot : layout->slots) {
+    int32_t free_slot = 0;
+    if (!slot.owner_pid.compare_exchange_strong(free_slot, pid))
+      continue;
+    copy_name(slot.service_name, service_name, SHM_NAME_SIZE);
+    copy_name(slot.category, category, SHM_NAME_SIZE);
+    slot.entry_count.store(0);
+    slot.ready.store(1, memory_order_release);
+    return &slot;
+  }
+  return 0;
+}
+
+ShmEntry* MetricsSegment::entry(ShmSlot* slot, const string& key, MetricType type) {
+  const uint32_t count = slot->entry_count.load(memory_order_acquire);
+  for (uint32_t i = 0; i < count; ++i) {
+    if (name_equals(slot->entries[i].key, key, SHM_KEY_SIZE))
+      return &slot->entries[i];
+  }
+  if (count >= (uint32_t)SHM_MAX_ENTRIES || key.size() >= (size_t)SHM_KEY_SIZE)
+    return 0;
+
+  ShmEntry* added = &slot->entries[count];
+  copy_name(added->key, key, SHM_KEY_SIZE);
+  added->type = (uint8_t)type;
+  added->value.store(type == MetricType::MaxGauge || type == MetricType::MinGauge
+                     ? SHM_UNSET : 0);
+  slot->entry_count.store(count + 1, memory_order_release);
+  return added;
+}
+
+void MetricsSegment::collect(function<void(const Report&)> handler) {
+  for (auto& slot : layout->slots) {
+    if (!slot.ready.load(memory_order_acquire))
+      continue;
+    int32_t owner = slot.owner_pid.load();
+    if (owner <= 0)
+      continue;
+
+    const string service_name(slot.service_name);
+    const string category(slot.category);
+    const uint32_t count = slot.entry_count.load(memory_order_acquire);
+    for (uint32_t i = 0; i < count; ++i) {
+      ShmEntry& entry = slot.entries[i];
+      const auto type = (MetricType)entry.type;
+      int64_t value;
+      if (type == MetricType::Gauge)
+        value = entry.value.load();
+      else if (type == MetricType::Counter)
+        value = entry.value.exchange(0);
+      else if ((value = entry.value.exchange(SHM_UNSET)) == SHM_UNSET)
+        continue;
+
+      Report report(entry.key, value, service_name, category);
+      report.type = type;
+      handler(report);
+    }
+
+    // The agent is gone and everything it counted has been collected.
+    if (!is_alive(owner) && slot.owner_pid.compare_exchange_strong(owner, -1)) {
+      LOG(INFO) << "Reclaiming metrics slot of " << service_name << ":" << category
+                << " (pid " << owner << ")";
+      slot.ready.store(0);
+      slot.entry_count.store(0);
+      memset(slot.service_name, 0, SHM_NAME_SIZE);
+      memset(slot.category, 0, SHM_NAME_SIZE);
+      slot.owner_pid.store(0);
+    }
+  }
+}
+
+ShmReport::ShmReport(const string& path, int port,
+                     string service_name, string category)
+  : LocalReport(port, service_name, category),
+    segment(path),
+    slot(segment.claim(service_name, category, getpid())) {
+  if (!slot)
+    LOG(WARNING) << "No free slot in metrics segment " << path
+                 << ", sending metrics as datagrams";
+}
+
+ShmReport::~ShmReport() {}
+
+void ShmReport::send_metric(const string& key, int64_t value) const {
+  const auto type = metric_type(key);
+  auto cached = entries.find(key);
+  if (cached == entries.end() && slot && type != MetricType::Timer)
+    cached = entries.insert(make_pair(key, segment.entry(slot, key, type))).first;
+
+  ShmEntry* entry = cached == entries.end() ? 0 : cached->second;
+  if (!entry) {
+    LocalReport::send_metric(key, value);
+    return;
+  }
+
+  int64_t current = entry->value.load(memory_order_relaxed);
+  switch (type) {
+  case MetricType::Counter:
+    entry->value.fetch_add(value, memory_order_relaxed);
+    break;
+  case MetricType::MaxGauge:
+    while ((current == SHM_UNSET || current < value) &&
+           !entry->value.compare_exchange_weak(current, value, memory_order_relaxed)) {}
+    break;
+  case MetricType::MinGauge:
+    while ((current == SHM_UNSET || current > value) &&
+           !entry->value.compare_exchange_weak(current, value, memory_order_relaxed)) {}
+    break;
+  default:
+    entry->value.store(value, memory_order_relaxed);
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef SHMREPORT_H
+#define SHMREPORT_H
+/*
+ * Metrics shared between agents and the monitor through a memory mapped
+ * file (e.g. under /dev/shm) instead of datagrams.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <sys/types.h>
+
+#include "monitor/localreport.h"
+
+static const int SHM_MAX_SLOTS = 256;
+static const int SHM_MAX_ENTRIES = 32;
+static const int SHM_NAME_SIZE = 64;
+static const int SHM_KEY_SIZE = 48;
+
+struct ShmEntry {
+  char key[SHM_KEY_SIZE];
+  std::atomic<int64_t> value;  // SHM_UNSET for max/min gauges not reported yet
+  uint8_t type;                // MetricType
+};
+
+static const int64_t SHM_UNSET = INT64_MIN;
+
+/*
+ * One agent's metrics. Only the agent owning the slot adds entries, the
+ * monitor only reads, or drains counters with an atomic exchange.
+ */
+struct ShmSlot {
+  std::atomic<int32_t> owner_pid;  // 0 if free
+  std::atomic<uint32_t> ready;     // names written, slot may be read
+  char service_name[SHM_NAME_SIZE];
+  char category[SHM_NAME_SIZE];
+  std::atomic<uint32_t> entry_count;
+  ShmEntry entries[SHM_MAX_ENTRIES];
+};
+
+struct ShmLayout {
+  std::atomic<uint32_t> magic;
+  uint32_t slot_count;
+  ShmSlot slots[SHM_MAX_SLOTS];
+};
+
+/*
+ * The mapped segment. All state lives in the file, so counters that were
+ * added while no monitor was running are reported by the next one.
+ */
+class MetricsSegment {
+public:
+  // Throws std::runtime_error if the file can't be opened or mapped, or
+  // holds an incompatible layout.
+  explicit MetricsSegment(const std::string& path);
+  ~MetricsSegment();
+
+  /*
+   * Agent side: claim a slot for (service_name, category), reusing the slot
+   * a dead agent for the same stream left behind. Returns 0 if full.
+   */
+  ShmSlot* claim(const std::string& service_name, const std::string& category,
+                 pid_t pid);
+  // Returns the entry for 'key' in 'slot', adding it if needed. 0 if full.
+  ShmEntry* entry(ShmSlot* slot, const std::string& key, MetricType type);
+
+  /*
+   * Monitor side: report every slot's gauges, and the counter increments
+   * and max/min gauges since the last collect(), then free the slots of
+   * agents that have died.
+   */
+  void collect(std::function<void(const Report&)> handler);
+
+private:
+  bool is_alive(pid_t pid) const;
+
+  int fd;
+  ShmLayout* layout;
+};
+
+/*
+ * Agent side of the segment. Values are published with a single atomic
+ * store (gauges), add (counters) or compare and swap (max/min gauges),
+ * timers and anything that doesn't fit in the segment still go out as
+ * datagrams through LocalReport.
+ */
+class ShmReport : public LocalReport {
+public:
+  ShmReport(const std::string& path, int port,
+            std::string service_name, std::string category);
+  virtual ~ShmReport();
+
+  virtual void send_metric(const std::string& key, int64_t value) const override;
+
+private:
+  mutable MetricsSegment segment;
+  ShmSlot* slot;
+  mutable std::map<std::string, ShmEntry*> entries;
+};
+
+#endif
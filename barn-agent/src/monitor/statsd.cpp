@@ -0,0 +1,113 @@
+/*
+ * Reporting to statsd, see statsd.h.
+ */
+
+#include <sstream>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "monitor/statsd.h"
+#include "params.h"
+
+using namespace std;
+using boost::asio::ip::udp;
+
+struct StatsdMetrics::Connection {
+  boost::asio::io_service io_service;
+  udp::socket socket;
+  udp::endpoint endpoint;
+
+  Connection() : socket(io_service) {}
+};
+
+/*
+ * statsd uses '.' to build its namespace and ':', '|' and '@' as
+ * separators, keep those out of the names we derive from user input.
+ */
+static string statsd_name(const string& name) {
+  string sanitized(name);
+  for (auto& c : sanitized) {
+    if (c == ':' || c == '|' || c == '@' || c == '.' || isspace((unsigned char)c))
+      c = '_';
+  }
+  return sanitized;
+}
+
+StatsdMetrics::StatsdMetrics(const string& statsd_addr,
+                             const string& prefix,
+                             int max_datagram,
+                             string service_name,
+                             string category,
+                             const string& resolved,
+                             int socket_fd)
+  : Metrics(service_name, category),
+    connection(new Connection()),
+    metric_prefix(prefix + "." + statsd_name(service_name) + "."
+                  + statsd_name(category) + "."),
+    max_datagram(max_datagram) {
+  const auto& addr = resolved.empty() ? statsd_addr : resolved;
+  const auto separator = addr.rfind(':');
+  const auto host = addr.substr(0, separator);
+  const auto port = separator == string::npos ? "8125" : addr.substr(separator + 1);
+
+  if (resolved.empty()) {
+    udp::resolver resolver(connection->io_service);
+    connection->endpoint = *resolver.resolve(udp::resolver::query(udp::v4(), host, port));
+  } else {
+    connection->endpoint = udp::endpoint(boost::asio::ip::address_v4::from_string(host),
+                                         (unsigned short)stoi(port));
+  }
+  if (socket_fd >= 0)
+    connection->socket.assign(udp::v4(), socket_fd);
+  else
+    connection->socket.open(udp::v4());
+  buffer.reserve(max_datagram);
+}
+
+string StatsdMetrics::resolved_address() const {
+  return connection->endpoint.address().to_string() + ":" +
+         to_string(connection->endpoint.port());
+}
+
+int StatsdMetrics::socket_fd() const {
+  return connection->socket.native_handle();
+}
+
+StatsdMetrics::~StatsdMetrics() {
+  flush();
+}
+
+void StatsdMetrics::send_metric(const string& key, int64_t value) const {
+  const auto type = metric_type(key);
+  send_line(key, value, type == MetricType::Timer ? "ms" : is_gauge(type) ? "g" : "c");
+}
+
+void StatsdMetrics::record_value(const string& key, int64_t value) const {
+  send_line(key, value, "ms");
+}
+
+void StatsdMetrics::send_line(const string& key, int64_t value, const char* type) const {
+  ostringstream line;
+  // statsd reads a leading '-' on a gauge as a decrement.
+  if (*type == 'g' && value < 0)
+    value = 0;
+  line << metric_prefix << statsd_name(key) << ':' << value << '|' << type;
+  const auto serialized = line.str();
+
+  if (!buffer.empty() && buffer.size() + 1 + serialized.size() > max_datagram)
+    flush();
+  if (!buffer.empty())
+    buffer += '\n';
+  buffer += serialized;
+}
+
+void StatsdMetrics::flush() const {
+  if (buffer.empty())
+    return;
+  boost::system::error_code ec;
+  connection->socket.send_to(boost::asio::buffer(buffer), connection->endpoint, 0, ec);
+  if (ec)
+    LOG(WARNING) << "Failed to send metrics to statsd: " << ec.message();
+  buffer.clear();
+}
@@ -0,0 +1,51 @@
+#ifndef STATSD_H
+#define STATSD_H
+
+#include <memory>
+#include <string>
+
+#include "metrics.h"
+
+/*
+ * Reports metrics straight to a statsd daemon using its line protocol:
+ *   <prefix>.<service>.<category>.<key>:<value>|<c|g|ms>
+ * Lines are buffered and sent batched into datagrams of at most
+ * 'max_datagram' bytes, either when the next line would not fit or on
+ * flush(). Like statsd itself this is fire and forget: send errors are
+ * logged and the batch is dropped.
+ */
+class StatsdMetrics : public Metrics {
+public:
+  // An upgraded agent passes the 'resolved' address ("ip:port") and the
+  // 'socket_fd' it was handed instead of looking 'statsd_addr' up again.
+  StatsdMetrics(const std::string& statsd_addr,
+                const std::string& prefix,
+                int max_datagram,
+                std::string service_name,
+                std::string category,
+                const std::string& resolved = "",
+                int socket_fd = -1);
+  virtual ~StatsdMetrics();
+
+  // The address statsd_addr resolved to, as "ip:port".
+  std::string resolved_address() const;
+  int socket_fd() const;
+
+  // Counters, gauges or timers depending on the key's MetricType. statsd
+  // gauges keep the last value, there is no max or min gauge to map to.
+  virtual void send_metric(const std::string& key, int64_t value) const override;
+  // Sent as statsd timers, which statsd summarizes as a distribution.
+  virtual void record_value(const std::string& key, int64_t value) const override;
+  virtual void flush() const override;
+
+private:
+  void send_line(const std::string& key, int64_t value, const char* type) const;
+
+  struct Connection;
+  std::unique_ptr<Connection> connection;
+  const std::string metric_prefix;
+  const size_t max_datagram;
+  mutable std::string buffer;
+};
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Page cache control, see page_cache.h.
+ */
+
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "page_cache.h"
+
+using namespace std;
+
+/**/
+uintmax_t resident_bytes(int fd, uintmax_t size) {
+  if (size == 0)
+    return 0;
+  // Mapping doesn't read anything in, mincore only looks at the cache.
+  void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+    return 0;
+
+  const uintmax_t page = sysconf(_SC_PAGESIZE);
+  vector<unsigned char> pages((size + page - 1) / page);
+  uintmax_t resident = 0;
+  if (mincore(mapped, size, pages.data()) == 0) {
+    for (size_t i = 0; i < pages.size(); ++i) {
+      if (pages[i] & 1)
+        resident += i + 1 < pages.size() ? page : size - i * page;
+    }
+  }
+  munmap(mapped, size);
+  return resident;
+}
+
+/**/
+uintmax_t drop_from_page_cache(const string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  uintmax_t resident = 0;
+  if (fstat(fd, &st) == 0) {
+    resident = resident_bytes(fd, st.st_size);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+  close(fd);
+  return resident;
+}
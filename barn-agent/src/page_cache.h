@@ -0,0 +1,24 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+/*
+ * Keeping shipped logs out of the page cache. Shipping a backlog reads every
+ * file once; left cached those pages evict the hot pages of the applications
+ * on the host (e.g. a database) for nothing, so once a file is on the
+ * target it is dropped from the cache.
+ */
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Bytes of the first 'size' bytes of open file 'fd' in the page cache.
+ */
+uintmax_t resident_bytes(int fd, uintmax_t size);
+
+/*
+ * Drop the file at 'path' from the page cache, returning how many of its
+ * bytes were cached. Dirty pages (not yet written back) stay.
+ */
+uintmax_t drop_from_page_cache(const std::string& path);
+
+#endif
@@ -2,52 +2,249 @@
  * Command line handling.
  */
 
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <string.h>
+#include <vector>
 
 #include <boost/program_options.hpp>
 
+#include "local_transport.h"
+#include "log_writer.h"
 #include "params.h"
+#include "sighandle.h"
 
 using namespace std;
 
 namespace po = boost::program_options;
 
+/*
+ * Options of barn-agent, parsed into 'conf'.
+ */
+static void add_options(po::options_description& desc, BarnConf& conf) {
+  desc.add_options()
+      ("help,h",
+        "produce help message")
+      ("config", po::value<string>(&conf.config_file),
+        "read options from this file too (one 'name = value' per line, command line options take precedence), reloaded on SIGHUP or when it changes")
+      ("target-addr,m", po::value<string>(&conf.primary_rsync_addr),
+        "target barn-master's host:port address, or file:///spool/dir to copy into a local or shared directory")
+      ("backup-addr,b", po::value<string>(&conf.secondary_rsync_addr),
+        "optional barn-master backup host:port (or file://) address, see '--seconds_before_failover'")
+      ("source,s", po::value<string>(&conf.source_dir),
+        "source log directory")
+      ("service-name,n", po::value<string>(&conf.service_name),
+        "name of the service who owns the log directory")
+      ("category,c", po::value<string>(&conf.category),
+        "additional sub-namespace per service")
+      ("monitor_port", po::value<int>(&conf.monitor_port)->default_value(0),
+        "additional sub-namespace per service")
+      ("metrics_shm", po::value<string>(&conf.metrics_shm),
+        "share metrics with the monitor through this memory mapped file (e.g. /dev/shm/barn-agent-metrics) instead of datagrams, agents still need monitor_port")
+      ("statsd_addr", po::value<string>(&conf.statsd_addr),
+        "report metrics directly to a statsd daemon at host:port instead of a barn-agent monitor")
+      ("statsd_prefix", po::value<string>(&conf.statsd_prefix)->default_value("barn"),
+        "prefix of metric names sent to statsd, followed by service name and category")
+      ("statsd_max_datagram", po::value<int>(&conf.statsd_max_datagram)->default_value(1432),
+        "batch statsd lines into datagrams of at most this many bytes (fit the path MTU)")
+      ("seconds_before_failover", po::value<int>(&conf.seconds_before_failover)->default_value(0),
+        "how long before failing over to the backup barn-hdfs node (--backup-addr), 0 to disable")
+      ("sleep_seconds,i", po::value<int>(&conf.sleep_seconds)->default_value(5),
+        "how long to back off after a first error, doubling on each further one up to --max_backoff_seconds")
+      ("max_backoff_seconds", po::value<int>(&conf.max_backoff_seconds)->default_value(300),
+        "longest back off after repeated errors")
+      ("freshness_target", po::value<int>(&conf.freshness_target)->default_value(10),
+        "aim to ship files within this many seconds of their rotation, reported as barn_freshness_target_missed otherwise")
+      ("remote_rsync_namespace", po::value<string>(&conf.remote_rsync_namespace)->default_value("barn_logs"),
+        "Rsync module name on the destination barn-hdfs module")
+      ("remote_rsync_namespace_backup", po::value<string>(&conf.remote_rsync_namespace_backup)->default_value("barn_backup_logs"),
+        "Rsync module name on the backup barn-hdfs module")
+      ("control_socket", po::value<string>(&conf.control_socket),
+        "serve what the agent is doing on this Unix socket (e.g. /run/barn-agent/myapp-main.sock) and take pause, resume, round and switch commands on it, see barn-agentctl")
+      ("flight_recorder_dir", po::value<string>(&conf.flight_recorder_dir)->default_value("/tmp"),
+        "directory the flight recorder of recent events is dumped into, on SIGUSR1, stalls and crashes (decode with barn-flight-decode)")
+      ("stall_rounds", po::value<int>(&conf.stall_rounds)->default_value(10),
+        "dump the flight recorder if a round runs for longer than this many times --freshness_target plus --max_backoff_seconds (waits between rounds don't count), 0 to disable")
+      ("trace", po::value<bool>(&conf.trace)->default_value(false),
+        "record where time goes in each round, 'kill -USR2' dumps it as a Chrome trace (chrome://tracing, ui.perfetto.dev)")
+      ("trace_file", po::value<string>(&conf.trace_file),
+        "record like --trace and continuously append the trace events to this file")
+      ("trace_dump_dir", po::value<string>(&conf.trace_dump_dir)->default_value("/tmp"),
+        "directory traces are dumped into on SIGUSR2")
+      ("async_logging", po::value<bool>(&conf.async_logging)->default_value(false),
+        "format and write log lines from a background thread, so logging doesn't hold up shipping (lines still queued are lost if the agent is killed)")
+      ("log_buffer_lines", po::value<int>(&conf.log_buffer_lines)->default_value(1024),
+        "with --async_logging, how many lines may wait to be written")
+      ("log_rate_limit", po::value<int>(&conf.log_rate_limit)->default_value(0),
+        "with --async_logging, log at most this many lines a second from each log statement and count the rest, 0 for no limit")
+      ("log_when_full", po::value<string>(&conf.log_when_full)->default_value("drop"),
+        "with --async_logging, when --log_buffer_lines are waiting 'drop' INFO lines (warnings and errors wait) or 'block' until there is room")
+      ("prewarm_seconds", po::value<int>(&conf.prewarm_seconds)->default_value(2),
+        "when caught up, do the next dry run this many seconds before svlogd is predicted to rotate (from the 's' and 't' lines of its config and the growth of 'current'), so the round after the rotation can skip it, 0 to disable")
+      ("catch_up_files", po::value<int>(&conf.catch_up_files)->default_value(0),
+        "when more files than this are behind (e.g. after an outage), ship this many per round newest first, 0 to always ship oldest first. Only for collectors that take files out of order: barn-hdfs skips and deletes files older than the newest it has put into HDFS")
+      ("backfill_share", po::value<double>(&conf.backfill_share)->default_value(0.2),
+        "when catching up, share of the bytes shipped oldest first to fill older gaps")
+      ("pin_budget_mb", po::value<int>(&conf.pin_budget_mb)->default_value(256),
+        "hardlink candidates into .barn-pin in the log directory until shipped, so svlogd pruning them can't lose them, up to this many MB in total, 0 to disable")
+      ("drop_page_cache", po::value<bool>(&conf.drop_page_cache)->default_value(true),
+        "drop files from the page cache once shipped, so shipping a backlog doesn't evict the host's applications from it")
+      ("drain", po::value<bool>(&conf.drain)->default_value(false),
+        "don't wait for rotations: rotate 'current' out, ship every retained file and exit, 0 once all are shipped, 3 if some are left after --drain_seconds ('kill -QUIT' drains a running agent)")
+      ("drain_parallelism", po::value<int>(&conf.drain_parallelism)->default_value(4),
+        "when draining, ship this many files at once (with --host_coordinator, on a single slot)")
+      ("drain_seconds", po::value<int>(&conf.drain_seconds)->default_value(600),
+        "when draining, give up retrying files that fail to ship after this many seconds")
+      ("handoff_fd", po::value<int>(&conf.handoff_fd)->default_value(-1),
+        "set by an agent upgrading itself on SIGALRM: the file descriptor it handed its state over in")
+      ("io_class", po::value<string>(&conf.io_class),
+        "I/O scheduling class of the agent and its rsync children, 'idle' or 'best-effort' (see --io_level), by default the one it's started with")
+      ("io_level", po::value<int>(&conf.io_level)->default_value(7),
+        "with --io_class best-effort, the priority from 0 (highest) to 7 (lowest)")
+      ("nice", po::value<int>(&conf.nice)->default_value(0),
+        "CPU niceness of the agent and its rsync children, 0 to keep the one it's started with")
+      ("cgroup", po::value<string>(&conf.cgroup),
+        "move the agent into this cgroup v2 directory (e.g. /sys/fs/cgroup/barn-agent/myapp-main), created if needed")
+      ("cgroup_io_max", po::value<string>(&conf.cgroup_io_max),
+        "with --cgroup, its io.max limits, one 'MAJ:MIN rbps=... wbps=...' per device, comma separated")
+      ("cgroup_cpu_max", po::value<string>(&conf.cgroup_cpu_max),
+        "with --cgroup, its cpu.max limit as '$QUOTA $PERIOD' microseconds, e.g. '20000 100000' for 20% of a CPU")
+      ("host_coordinator", po::value<string>(&conf.host_coordinator),
+        "share shipping slots with the host's other agents through this file (e.g. /dev/shm/barn-agent-slots) instead of shipping whenever ready")
+      ("host_max_shipping", po::value<int>(&conf.host_max_shipping)->default_value(2),
+        "with --host_coordinator, how many agents of the host may ship at once")
+      ("ship_weight", po::value<double>(&conf.ship_weight)->default_value(1),
+        "with --host_coordinator, this agent's share of shipping slots relative to others, e.g. 100 for an 'errors' category to ship ahead of 'main' backlogs")
+      ("monitor_mode", po::value<bool>(&conf.monitor_mode)->default_value(false),
+        "Listens on udp://localhost:monitor_port/. In this mode the rest of options are unused.")
+      ("prometheus_port", po::value<int>(&conf.prometheus_port)->default_value(0),
+        "In monitor_mode, serve aggregated metrics on http://0.0.0.0:prometheus_port/metrics, 0 to disable");
+}
+
+/*
+ * Parse command line 'args', then the config file they name if any.
+ * Throws on parse errors.
+ */
+static void store_options(const vector<string>& args,
+                          const po::options_description& desc,
+                          po::variables_map& vm) {
+  po::store(po::command_line_parser(args).options(desc).run(), vm);
+  if (vm.count("config")) {
+    const auto config_file = vm["config"].as<string>();
+    ifstream config(config_file.c_str());
+    if (!config)
+      throw runtime_error("can't read config file " + config_file);
+    po::store(po::parse_config_file(config, desc), vm);
+  }
+  po::notify(vm);
+}
+
+/*
+ * Problems with failover settings, or "" if there are none.
+ */
+static string failover_error(const BarnConf& conf) {
+  if (conf.seconds_before_failover > 0 && conf.secondary_rsync_addr.empty())
+    return "seconds_before_failover needs a backup-addr";
+  if (conf.seconds_before_failover != 0 && conf.seconds_before_failover <= 60)
+    return "seconds_before_failover less than one minute, this would cause failovers too quickly.";
+  return "";
+}
+
+/*
+ * Problems with resource isolation settings, or "" if there are none.
+ */
+static string resource_limits_error(const BarnConf& conf) {
+  if (!conf.io_class.empty() && conf.io_class != "idle" && conf.io_class != "best-effort")
+    return "io_class must be 'idle' or 'best-effort'";
+  if (conf.io_level < 0 || conf.io_level > 7)
+    return "io_level must be within 0 and 7";
+  if (conf.nice < -20 || conf.nice > 19)
+    return "nice must be within -20 and 19";
+  if (conf.cgroup.empty() && (!conf.cgroup_io_max.empty() || !conf.cgroup_cpu_max.empty()))
+    return "cgroup_io_max and cgroup_cpu_max need a cgroup";
+  return "";
+}
+
+/*
+ * Problems with drain settings, or "" if there are none.
+ */
+static string drain_error(const BarnConf& conf) {
+  if (conf.drain_parallelism < 1 || conf.drain_parallelism > MAX_TRACKED_CHILDREN / 2)
+    return "drain_parallelism must be within 1 and " + to_string(MAX_TRACKED_CHILDREN / 2);
+  if (conf.drain_seconds < 0)
+    return "drain_seconds can't be negative";
+  return "";
+}
+
+/*
+ * Problems with logging settings, or "" if there are none.
+ */
+static string logging_error(const BarnConf& conf) {
+  LogWhenFull when_full;
+  if (!parse_log_when_full(conf.log_when_full, &when_full))
+    return "log_when_full must be 'drop' or 'block'";
+  if (conf.log_buffer_lines <= 0)
+    return "log_buffer_lines must be positive";
+  if (conf.log_rate_limit < 0)
+    return "log_rate_limit can't be negative";
+  return "";
+}
+
+/*
+ * Problems with the target addresses, or "" if there are none.
+ */
+static string address_error(const BarnConf& conf) {
+  for (auto* addr : {&conf.primary_rsync_addr, &conf.secondary_rsync_addr}) {
+    if (!is_local_target(*addr))
+      continue;
+    const auto directory = local_target_directory(*addr);
+    if (directory.empty() || directory[0] != '/' ||
+        directory.find_first_not_of('/') == string::npos) {
+      return "file:// addresses need an absolute directory other than /, e.g. file:///srv/barn";
+    }
+  }
+  return "";
+}
+
+/*
+ * Problems with any option, or "" if there are none. Checked both on
+ * startup and on reload.
+ */
+static BarnError validate_configuration(const BarnConf& conf) {
+  if (conf.sleep_seconds < 0)
+    return "sleep_seconds can't be negative";
+  if (conf.max_backoff_seconds < 0)
+    return "max_backoff_seconds can't be negative";
+  if (conf.freshness_target <= 0)
+    return "freshness_target must be positive";
+  if (conf.pin_budget_mb < 0)
+    return "pin_budget_mb can't be negative";
+  if (conf.prewarm_seconds < 0)
+    return "prewarm_seconds can't be negative";
+  if (conf.catch_up_files < 0 || conf.backfill_share < 0 || conf.backfill_share > 1)
+    return "catch_up_files can't be negative, backfill_share must be within 0 and 1";
+  if (conf.host_max_shipping <= 0 || conf.ship_weight <= 0)
+    return "host_max_shipping and ship_weight must be positive";
+  for (auto problem : {failover_error(conf), address_error(conf), resource_limits_error(conf),
+                       logging_error(conf), drain_error(conf)}) {
+    if (!problem.empty())
+      return problem;
+  }
+  return "";
+}
+
 /**/
 const BarnConf parse_command_line(int argc, char* argv[]) {
   try {
     BarnConf conf;
+    conf.command_line = vector<string>(argv + 1, argv + argc);
 
     po::options_description desc("Allowed options");
-    desc.add_options()
-        ("help,h",
-          "produce help message")
-        ("target-addr,m", po::value<string>(&conf.primary_rsync_addr),
-          "target barn-master's host:port address")
-        ("backup-addr,b", po::value<string>(&conf.secondary_rsync_addr),
-          "optional barn-master backup host:port address, see '--seconds_before_failover'")
-        ("source,s", po::value<string>(&conf.source_dir),
-          "source log directory")
-        ("service-name,n", po::value<string>(&conf.service_name),
-          "name of the service who owns the log directory")
-        ("category,c", po::value<string>(&conf.category),
-          "additional sub-namespace per service")
-        ("monitor_port", po::value<int>(&conf.monitor_port)->default_value(0),
-          "additional sub-namespace per service")
-        ("seconds_before_failover", po::value<int>(&conf.seconds_before_failover)->default_value(0),
-          "how long before failing over to the backup barn-hdfs node (--backup-addr), 0 to disable")
-        ("sleep_seconds,i", po::value<int>(&conf.sleep_seconds)->default_value(5),
-          "how long to sleep between actions such as a succesful ship and the next one")
-        ("remote_rsync_namespace", po::value<string>(&conf.remote_rsync_namespace)->default_value("barn_logs"),
-          "Rsync module name on the destination barn-hdfs module")
-        ("remote_rsync_namespace_backup", po::value<string>(&conf.remote_rsync_namespace_backup)->default_value("barn_backup_logs"),
-          "Rsync module name on the backup barn-hdfs module")
-        ("monitor_mode", po::value<bool>(&conf.monitor_mode)->default_value(false),
-          "Listens on udp://localhost:monitor_port/. In this mode the rest of options are unused.");
+    add_options(desc, conf);
 
     po::variables_map vm;
-    po::store(po::parse_command_line(argc, argv, desc), vm);
-    po::notify(vm);
+    store_options(conf.command_line, desc, vm);
 
     bool show_desc = false;
 
@@ -58,7 +255,7 @@ const BarnConf parse_command_line(int argc, char* argv[]) {
                 vm["service-name"].empty() || vm["category"].empty())) {
       cerr << "ERROR: options 'target-addr', 'source', 'service-name', 'category' are all required" << endl;
       show_desc = true;
-    } else if (!conf.monitor_mode && conf.monitor_port <= 0) {
+    } else if (!conf.monitor_mode && conf.monitor_port <= 0 && conf.statsd_addr.empty()) {
       cerr << "WARN: No monitor_port specified, metrics reporting disabled" << endl;
     } else if (conf.monitor_mode && conf.monitor_port <= 0) {
       cerr << "ERROR: option 'monitor_port' is required in monitor_mode" << endl;
@@ -76,8 +273,9 @@ const BarnConf parse_command_line(int argc, char* argv[]) {
         exit(1);
     }
 
-    if (conf.seconds_before_failover != 0 && conf.seconds_before_failover <= 60) {
-      cerr << "FATAL: seconds_before_failover less than one minute, this would cause failovers too quickly." << endl;
+    const auto problem = validate_configuration(conf);
+    if (!problem.empty()) {
+      cerr << "FATAL: " << problem << endl;
       exit(1);
     }
 
@@ -91,3 +289,63 @@ const BarnConf parse_command_line(int argc, char* argv[]) {
   }
 }
 
+/*
+ * The first restart only option that differs between 'a' and 'b', or "".
+ */
+static string restart_only_change(const BarnConf& a, const BarnConf& b) {
+  if (a.source_dir != b.source_dir) return "source";
+  if (a.service_name != b.service_name) return "service-name";
+  if (a.category != b.category) return "category";
+  if (a.monitor_mode != b.monitor_mode) return "monitor_mode";
+  if (a.monitor_port != b.monitor_port) return "monitor_port";
+  if (a.prometheus_port != b.prometheus_port) return "prometheus_port";
+  if (a.metrics_shm != b.metrics_shm) return "metrics_shm";
+  if (a.statsd_addr != b.statsd_addr) return "statsd_addr";
+  if (a.statsd_prefix != b.statsd_prefix) return "statsd_prefix";
+  if (a.statsd_max_datagram != b.statsd_max_datagram) return "statsd_max_datagram";
+  if (a.control_socket != b.control_socket) return "control_socket";
+  if (a.flight_recorder_dir != b.flight_recorder_dir) return "flight_recorder_dir";
+  if (a.stall_rounds != b.stall_rounds) return "stall_rounds";
+  if (a.trace != b.trace) return "trace";
+  if (a.trace_file != b.trace_file) return "trace_file";
+  if (a.trace_dump_dir != b.trace_dump_dir) return "trace_dump_dir";
+  if (a.async_logging != b.async_logging) return "async_logging";
+  if (a.log_buffer_lines != b.log_buffer_lines) return "log_buffer_lines";
+  if (a.log_rate_limit != b.log_rate_limit) return "log_rate_limit";
+  if (a.log_when_full != b.log_when_full) return "log_when_full";
+  if (a.drain != b.drain) return "drain";
+  if (a.host_coordinator != b.host_coordinator) return "host_coordinator";
+  if (a.host_max_shipping != b.host_max_shipping) return "host_max_shipping";
+  if (a.ship_weight != b.ship_weight) return "ship_weight";
+  if (a.io_class != b.io_class) return "io_class";
+  if (a.io_level != b.io_level) return "io_level";
+  if (a.nice != b.nice) return "nice";
+  if (a.cgroup != b.cgroup) return "cgroup";
+  if (a.cgroup_io_max != b.cgroup_io_max) return "cgroup_io_max";
+  if (a.cgroup_cpu_max != b.cgroup_cpu_max) return "cgroup_cpu_max";
+  return "";
+}
+
+Validation<BarnConf> reload_configuration(const BarnConf& current) {
+  BarnConf conf;
+  conf.command_line = current.command_line;
+  po::options_description desc;
+  add_options(desc, conf);
+
+  try {
+    po::variables_map vm;
+    store_options(conf.command_line, desc, vm);
+  } catch (exception& e) {
+    return BarnError(e.what());
+  }
+
+  if (conf.primary_rsync_addr.empty())
+    return BarnError("target-addr is required");
+  const auto problem = validate_configuration(conf);
+  if (!problem.empty())
+    return problem;
+  const auto changed = restart_only_change(current, conf);
+  if (!changed.empty())
+    return BarnError(changed + " can only be changed by restarting");
+  return std::move(conf);
+}
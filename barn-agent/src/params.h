@@ -6,6 +6,9 @@
  */
 
 #include <string>
+#include <vector>
+
+#include "helpers.h"
 
 #define _ELPP_DISABLE_DEFAULT_CRASH_HANDLING
 #include "easylogging++.h"
@@ -14,6 +17,8 @@
  * Contains parsed command line params passed to barn-agent.
  */
 struct BarnConf {
+  std::vector<std::string> command_line;  // Arguments barn-agent was started with
+  std::string config_file;  // Optional file with more options, reloadable
   std::string primary_rsync_addr;   // primary remote rsync daemon's address
   std::string secondary_rsync_addr; // secondary remote rsync daemon's address
   std::string source_dir; // Source of local log files
@@ -21,8 +26,43 @@ struct BarnConf {
   std::string category;  // Category (as secondary name)
   bool monitor_mode; // Run barn-agent in monitor mode to accept stats
   int monitor_port;  // Port to bind to send or receive stats (based on monitor_mode
+  int prometheus_port;  // Port to serve /metrics on in monitor_mode, 0 to disable
+  std::string metrics_shm;  // File (e.g. in /dev/shm) agents and monitor share metrics through
+  std::string statsd_addr;  // host:port of a statsd daemon to report to directly
+  std::string statsd_prefix;  // Prefix of all metric names sent to statsd
+  int statsd_max_datagram;  // Largest datagram to batch statsd lines into
   int seconds_before_failover;  // How long to allow for failure on primary_rsync_addr before failing over to secondary_rsync_addr
-  int sleep_seconds;  // Minimum time to sleep between sync rounds.
+  int sleep_seconds;  // Back off after a first error
+  int max_backoff_seconds;  // Longest back off after repeated errors
+  int freshness_target;  // Seconds within rotation files should be shipped
+  int prewarm_seconds;  // Dry run this long before predicted rotations, 0 to not
+  int catch_up_files;  // Ship newest first, this many per round, when more are behind
+  double backfill_share;  // Share of bytes shipped oldest first when catching up
+  int pin_budget_mb;  // Largest total size of candidates pinned against pruning
+  bool drop_page_cache;  // Drop shipped files from the page cache
+  bool drain;  // Ship everything retained and exit instead of running on
+  int drain_parallelism;  // Files shipped at once when draining
+  int drain_seconds;  // Give up draining after this long
+  int handoff_fd;  // State handed over by the agent upgraded from, -1 if none
+  std::string io_class;  // I/O scheduling class ("idle" or "best-effort"), "" to inherit
+  int io_level;  // Priority within the best-effort class, 0 (highest) to 7
+  int nice;  // CPU niceness, 0 to inherit
+  std::string cgroup;  // cgroup v2 directory to run in, "" to stay put
+  std::string cgroup_io_max;  // io.max lines of 'cgroup', comma separated
+  std::string cgroup_cpu_max;  // cpu.max of 'cgroup'
+  std::string host_coordinator;  // File (e.g. in /dev/shm) agents share shipping slots through
+  int host_max_shipping;  // Agents of the host allowed to ship at once
+  double ship_weight;  // Share of shipping slots relative to the host's other agents
+  std::string control_socket;  // Unix socket serving status and commands, "" for none
+  std::string flight_recorder_dir;  // Directory the flight recorder dumps into
+  int stall_rounds;  // Dump the flight recorder if no round completes in stall_rounds * sleep_seconds
+  bool trace;  // Record spans of each round, dumped on SIGUSR2
+  std::string trace_file;  // Continuously append recorded spans to this file
+  std::string trace_dump_dir;  // Directory SIGUSR2 dumps traces into
+  bool async_logging;  // Write log lines from a background thread
+  int log_buffer_lines;  // Lines queued for that thread at most
+  int log_rate_limit;  // Lines a second per LOG statement, 0 for no limit
+  std::string log_when_full;  // "drop" or "block" lines when the queue is full
   std::string remote_rsync_namespace;  // Destination rsync module name ("barn_logs").
   std::string remote_rsync_namespace_backup;  // Destination rsync backup module name ("barn_backup_logs").
 };
@@ -30,4 +70,11 @@ struct BarnConf {
 
 const BarnConf parse_command_line(int argc, char* argv[]);
 
+/*
+ * Parse 'current.command_line' and its config file again. Fails if the
+ * result isn't valid, or changes options that need a restart (identity of
+ * the agent, metrics and debugging outputs).
+ */
+Validation<BarnConf> reload_configuration(const BarnConf& current);
+
 #endif
@@ -12,8 +12,10 @@
 #include <boost/process.hpp>
 #include <boost/thread/thread.hpp>
 
+#include "flight_recorder.h"
 #include "process.h"
 #include "sighandle.h"
+#include "trace.h"
 
 using namespace std;
 namespace bp = boost::process;
@@ -33,13 +35,17 @@ const std::string get_host_name() {
  * Run a command 'cmd' and return its exit status and stdout.
  * 'args' should be the command line args including the command name.
  *
- * Not thread safe due to set_child_pid.
+ * An 'interruptible' command is ended by a reload, a drain, an upgrade or a
+ * wake up request (see sighandle.h).
  *
  * Doesn't defend against errant programs so cmd should be a simple program
  * that doesn't print too much to stdout.
  */
 const pair<int, string> run_command(const string& cmd,
-                                    const vector<string>& args) {
+                                    const vector<string>& args,
+                                    bool interruptible) {
+  const string span_name = "run_command " + cmd;
+  TraceSpan span(span_name.c_str());
   string exec = bp::find_executable_in_path(cmd);
 
   bp::posix_context ctx;
@@ -52,14 +58,22 @@ const pair<int, string> run_command(const string& cmd,
   bp::posix_child child = bp::posix_launch(exec, args, ctx);
 
   // TODO: get rid of this way of handling child process death.
-  set_child_pid(child.get_id());
+  set_child_pid(child.get_id(), interruptible);
+  // Asked before it could be ended.
+  if (interruptible && waits_interrupted())
+    kill(child.get_id(), SIGTERM);
 
   bp::pistream &is = child.get_stdout();
   string std_out (istreambuf_iterator<char>(is), (istreambuf_iterator<char>()));
 
-  auto result = make_pair(child.wait().exit_status(), std_out);
+  // Like a shell, a child ended by a signal (e.g. an interrupted wait) exits
+  // with 128 + the signal.
+  const bp::posix_status status = child.wait();
+  auto result = make_pair(status.exited() ? status.exit_status() : 128 + status.term_signal(),
+                          std_out);
+  flight_record(FlightEventType::ChildExit, child.get_id(), result.first, cmd.c_str());
 
-  unset_child_pid();
+  unset_child_pid(child.get_id());
 
   return result;
 }
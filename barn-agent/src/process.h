@@ -8,7 +8,8 @@
 #include <vector>
 
 const std::pair<int, std::string> run_command(const std::string& cmd,
-                                              const std::vector<std::string>& args);
+                                              const std::vector<std::string>& args,
+                                              bool interruptible = false);
 const std::string get_host_name();
 
 #endif
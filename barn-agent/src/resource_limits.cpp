@@ -0,0 +1,175 @@
+/*
+ * Resource isolation of the agent, see resource_limits.h.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include "files.h"
+#include "helpers.h"
+#include "resource_limits.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+// From linux/ioprio.h, which glibc has no wrapper for.
+static const int IOPRIO_WHO_PROCESS = 1;
+static const int IOPRIO_CLASS_SHIFT = 13;
+static const int IOPRIO_CLASS_BE = 2;
+static const int IOPRIO_CLASS_IDLE = 3;
+
+/**/
+void set_io_priority(const string& io_class, int level) {
+  int ioprio;
+  if (io_class == "idle") {
+    ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+  } else if (io_class == "best-effort") {
+    ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | level;
+  } else {
+    throw runtime_error("unknown io_class " + io_class);
+  }
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0)
+    throw runtime_error(string("can't set I/O priority: ") + strerror(errno));
+}
+
+/**/
+void set_niceness(int nice) {
+  if (setpriority(PRIO_PROCESS, 0, nice) != 0)
+    throw runtime_error(string("can't set niceness: ") + strerror(errno));
+}
+
+/*
+ * Write 'value' to control file 'name' of 'cgroup' in a single write, as
+ * the kernel parses each write on its own.
+ */
+static void write_cgroup_file(const string& cgroup, const string& name,
+                              const string& value) {
+  const auto path = join_path(cgroup, name);
+  const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  const bool written = fd >= 0 &&
+      write(fd, value.data(), value.size()) == (ssize_t)value.size();
+  const int saved = errno;
+  if (fd >= 0)
+    close(fd);
+  if (!written)
+    throw runtime_error("can't write '" + value + "' to " + path + ": " + strerror(saved));
+}
+
+/*
+ * Let 'cgroup' use 'controller', which its parent has to hand down.
+ */
+static void enable_controller(const string& cgroup, const string& controller) {
+  const auto parent = fs::path(cgroup).parent_path().string();
+  try {
+    write_cgroup_file(parent, "cgroup.subtree_control", "+" + controller);
+  } catch (const std::runtime_error& e) {
+    // Already enabled by whoever set up the parent, or the limits fail below.
+    LOG(WARNING) << e.what();
+  }
+}
+
+/**/
+void enter_cgroup(const string& cgroup, const string& io_max, const string& cpu_max) {
+  boost::system::error_code ec;
+  fs::create_directories(cgroup, ec);
+  if (ec)
+    throw runtime_error("can't create cgroup " + cgroup + ": " + ec.message());
+
+  if (!io_max.empty()) {
+    enable_controller(cgroup, "io");
+    // One line per device, e.g. "8:0 rbps=20971520,8:16 rbps=20971520".
+    for (auto& device : split(io_max, ','))
+      write_cgroup_file(cgroup, "io.max", device);
+  }
+  if (!cpu_max.empty()) {
+    enable_controller(cgroup, "cpu");
+    write_cgroup_file(cgroup, "cpu.max", cpu_max);
+  }
+  // Moves every thread, children follow.
+  write_cgroup_file(cgroup, "cgroup.procs", to_string(getpid()));
+}
+
+/**/
+void apply_resource_limits(const BarnConf& barn_conf) {
+  try {
+    if (!barn_conf.cgroup.empty()) {
+      enter_cgroup(barn_conf.cgroup, barn_conf.cgroup_io_max, barn_conf.cgroup_cpu_max);
+      LOG(INFO) << "Running in cgroup " << barn_conf.cgroup;
+    }
+  } catch (const std::runtime_error& e) {
+    LOG(ERROR) << e.what() << ", running without cgroup limits";
+  }
+  try {
+    if (!barn_conf.io_class.empty())
+      set_io_priority(barn_conf.io_class, barn_conf.io_level);
+  } catch (const std::runtime_error& e) {
+    LOG(ERROR) << e.what();
+  }
+  try {
+    if (barn_conf.nice != 0)
+      set_niceness(barn_conf.nice);
+  } catch (const std::runtime_error& e) {
+    LOG(ERROR) << e.what();
+  }
+}
+
+/*
+ * Value of 'key' in a "key value" per line file, 0 if missing.
+ */
+static int64_t read_keyed_value(const string& path, const string& key) {
+  ifstream in(path.c_str());
+  string name;
+  int64_t value;
+  while (in >> name >> value) {
+    if (name == key)
+      return value;
+  }
+  return 0;
+}
+
+/*
+ * The total= of the "some" line of a pressure file, 0 if missing.
+ */
+static int64_t read_pressure_total(const string& path) {
+  ifstream in(path.c_str());
+  string line;
+  while (getline(in, line)) {
+    if (line.compare(0, 5, "some ") != 0)
+      continue;
+    const auto total = line.find("total=");
+    if (total != string::npos)
+      return strtoll(line.c_str() + total + 6, nullptr, 10);
+  }
+  return 0;
+}
+
+/**/
+CgroupStats read_cgroup_stats(const string& cgroup) {
+  CgroupStats stats;
+  const auto cpu_stat = join_path(cgroup, "cpu.stat");
+  stats.throttled_periods = read_keyed_value(cpu_stat, "nr_throttled");
+  stats.throttled_usec = read_keyed_value(cpu_stat, "throttled_usec");
+  stats.io_stall_usec = read_pressure_total(join_path(cgroup, "io.pressure"));
+  return stats;
+}
+
+CgroupThrottling::CgroupThrottling(const string& cgroup)
+    : cgroup(cgroup), last(read_cgroup_stats(cgroup)) {}
+
+void CgroupThrottling::report(const Metrics& metrics) {
+  const auto now = read_cgroup_stats(cgroup);
+  metrics.send_metric(CpuThrottledPeriods, now.throttled_periods - last.throttled_periods);
+  metrics.send_metric(CpuThrottledMs, now.throttled_usec / 1000 - last.throttled_usec / 1000);
+  metrics.send_metric(IoStalledMs, now.io_stall_usec / 1000 - last.io_stall_usec / 1000);
+  last = now;
+}
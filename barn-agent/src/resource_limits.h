@@ -0,0 +1,53 @@
+#ifndef RESOURCE_LIMITS_H
+#define RESOURCE_LIMITS_H
+/*
+ * Keeping the agent (and the rsync children it runs) from competing with
+ * the services whose logs it ships: I/O scheduling class, CPU niceness and
+ * an optional cgroup v2 with io.max/cpu.max limits of its own.
+ *
+ * Priorities are per thread on Linux and inherited by threads and children
+ * created later, so they are applied first thing, before any thread starts.
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "metrics.h"
+#include "params.h"
+
+/*
+ * Apply --io_class/--io_level, --nice and --cgroup. A setting that can't be
+ * applied is logged and the agent runs without it.
+ */
+void apply_resource_limits(const BarnConf& barn_conf);
+
+// Throw std::runtime_error if the setting can't be applied.
+void set_io_priority(const std::string& io_class, int level);
+void set_niceness(int nice);
+void enter_cgroup(const std::string& cgroup, const std::string& io_max,
+                  const std::string& cpu_max);
+
+// Cumulative throttling of a cgroup, from its cpu.stat and io.pressure.
+struct CgroupStats {
+  int64_t throttled_periods;  // cpu.max periods the cgroup ran out of quota in
+  int64_t throttled_usec;     // Time spent throttled by cpu.max
+  int64_t io_stall_usec;      // Time some of its tasks waited for I/O
+};
+
+CgroupStats read_cgroup_stats(const std::string& cgroup);
+
+/*
+ * Reports the throttling of a cgroup since the previous report.
+ */
+class CgroupThrottling {
+public:
+  explicit CgroupThrottling(const std::string& cgroup);
+
+  void report(const Metrics& metrics);
+
+private:
+  std::string cgroup;
+  CgroupStats last;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Rotation prediction, see rotation.h.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "files.h"
+#include "helpers.h"
+#include "rotation.h"
+
+using namespace std;
+
+// svlogd's own default, see svlogd(8).
+static const int64_t SVLOGD_DEFAULT_MAX_SIZE = 99999;
+
+// Weight of the latest sample in the growth rate.
+static const double GROWTH_SMOOTHING = 0.5;
+
+/**/
+SvlogdLimits parse_svlogd_config(const string& config) {
+  SvlogdLimits limits = {SVLOGD_DEFAULT_MAX_SIZE, 0};
+  istringstream lines(config);
+  string line;
+  while (getline(lines, line)) {
+    if (line.size() < 2 || !isdigit(line[1]))
+      continue;
+    if (line[0] == 's')
+      limits.max_size = strtoll(line.c_str() + 1, nullptr, 10);
+    else if (line[0] == 't')
+      limits.max_age_seconds = strtoll(line.c_str() + 1, nullptr, 10);
+  }
+  return limits;
+}
+
+/**/
+SvlogdLimits read_svlogd_limits(const string& log_directory) {
+  ifstream in(join_path(log_directory, "config").c_str());
+  return parse_svlogd_config(string(istreambuf_iterator<char>(in),
+                                    istreambuf_iterator<char>()));
+}
+
+RotationPredictor::RotationPredictor()
+    : last_sample(-1), last_size(0), bytes_per_second(0) {}
+
+int64_t RotationPredictor::seconds_until_rotation(const SvlogdLimits& limits, int64_t now,
+                                                  uintmax_t size, int64_t last_rotation) {
+  // A smaller 'current' rotated in between, only its growth since counts.
+  if (last_sample >= 0 && now > last_sample && size >= last_size) {
+    const double rate = double(size - last_size) / (now - last_sample);
+    bytes_per_second = bytes_per_second == 0
+        ? rate
+        : GROWTH_SMOOTHING * rate + (1 - GROWTH_SMOOTHING) * bytes_per_second;
+  }
+  if (now != last_sample || size < last_size) {
+    last_sample = now;
+    last_size = size;
+  }
+
+  int64_t until = -1;
+  if (limits.max_size > 0 && bytes_per_second > 0) {
+    const double left = max<double>(limits.max_size - double(size), 0);
+    until = int64_t(left / bytes_per_second);
+  }
+  // svlogd doesn't rotate an empty 'current' on age.
+  if (limits.max_age_seconds > 0 && last_rotation >= 0 && size > 0) {
+    const int64_t by_age = max<int64_t>(last_rotation + limits.max_age_seconds - now, 0);
+    until = until < 0 ? by_age : min(until, by_age);
+  }
+  return until;
+}
+
+RotationWatch::RotationWatch(int lead_seconds)
+    : lead_seconds(lead_seconds), has_dry_run(false) {}
+
+void RotationWatch::configure(int lead_seconds) {
+  this->lead_seconds = lead_seconds;
+}
+
+int RotationWatch::dry_run_due_in(const FileOps& fileops, const string& log_directory) {
+  if (lead_seconds <= 0)
+    return -1;
+  const auto rotated = fileops.list_log_directory(log_directory);
+  const int64_t last_rotation = rotated.empty() ? -1 : tai64n_unix_seconds(rotated.back());
+  const auto until = predictor.seconds_until_rotation(
+        read_svlogd_limits(log_directory), time(0),
+        fileops.file_size(join_path(log_directory, "current")), last_rotation);
+  if (until < 0)
+    return -1;
+  return (int)min<int64_t>(max<int64_t>(until - lead_seconds, 0), INT32_MAX);
+}
+
+void RotationWatch::dry_run_done(const string& rsync_target, const FileNameList& on_target) {
+  has_dry_run = true;
+  dry_run_target = rsync_target;
+  dry_run_on_target = on_target;
+}
+
+bool RotationWatch::take_on_target(const string& rsync_target, FileNameList* on_target) {
+  const bool usable = has_dry_run && dry_run_target == rsync_target;
+  if (usable)
+    on_target->swap(dry_run_on_target);
+  has_dry_run = false;
+  dry_run_on_target.clear();
+  return usable;
+}
+
+bool RotationWatch::pending_dry_run(string* rsync_target, FileNameList* on_target) const {
+  if (!has_dry_run)
+    return false;
+  *rsync_target = dry_run_target;
+  *on_target = dry_run_on_target;
+  return true;
+}
@@ -0,0 +1,86 @@
+#ifndef ROTATION_H
+#define ROTATION_H
+/*
+ * Predicting svlogd rotations, to do the round's dry run just before the
+ * next file rotates rather than after. svlogd rotates 'current' once it
+ * reaches the size of the 's' line of the log directory's 'config', or is
+ * older than its 't' line; the size limit is reached at the rate 'current'
+ * has been growing at.
+ *
+ * A dry run done just before the rotation tells which files the target
+ * already has. The round after the rotation then only ships what's new
+ * instead of paying for another dry run (a connection, a handshake and a
+ * listing) first.
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "files.h"
+#include "helpers.h"
+
+// svlogd's rotation limits, 0 if there is none.
+struct SvlogdLimits {
+  int64_t max_size;         // 's', 99999 unless configured
+  int64_t max_age_seconds;  // 't'
+};
+
+SvlogdLimits parse_svlogd_config(const std::string& config);
+
+// Limits of the svlogd writing to 'log_directory'.
+SvlogdLimits read_svlogd_limits(const std::string& log_directory);
+
+/*
+ * Estimates when 'current' rotates from how fast it grows.
+ */
+class RotationPredictor {
+public:
+  RotationPredictor();
+
+  // Seconds from 'now' until svlogd rotates 'current' of 'size' bytes, last
+  // rotated at 'last_rotation' (-1 if unknown), unix seconds. Negative if
+  // it can't tell. Each call is a sample of the growth rate.
+  int64_t seconds_until_rotation(const SvlogdLimits& limits, int64_t now,
+                                 uintmax_t size, int64_t last_rotation);
+
+private:
+  int64_t last_sample;     // Time of the previous sample, -1 before the first
+  uintmax_t last_size;
+  double bytes_per_second; // Smoothed growth rate, 0 if unknown
+};
+
+/*
+ * Times dry runs ahead of rotations and keeps their outcome for the next
+ * round.
+ */
+class RotationWatch {
+public:
+  // Dry run 'lead_seconds' before rotations, 0 to never.
+  explicit RotationWatch(int lead_seconds);
+
+  void configure(int lead_seconds);
+
+  // Seconds until the dry run is due for 'log_directory', 0 if it's due
+  // already, negative if the next rotation can't be predicted.
+  int dry_run_due_in(const FileOps& fileops, const std::string& log_directory);
+
+  // Remember the files of 'rsync_target' as of a dry run.
+  void dry_run_done(const std::string& rsync_target, const FileNameList& on_target);
+
+  // The files of 'rsync_target' remembered since the last call, false if
+  // there are none (for that target).
+  bool take_on_target(const std::string& rsync_target, FileNameList* on_target);
+
+  // The dry run remembered for the next round, without taking it. False if
+  // there is none.
+  bool pending_dry_run(std::string* rsync_target, FileNameList* on_target) const;
+
+private:
+  int lead_seconds;
+  RotationPredictor predictor;
+  bool has_dry_run;
+  std::string dry_run_target;
+  FileNameList dry_run_on_target;
+};
+
+#endif
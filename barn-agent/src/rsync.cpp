@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "helpers.h"
+#include "local_transport.h"
 #include "rsync.h"
 #include "process.h"
 
@@ -36,20 +37,38 @@ static const auto RSYNC_FLAGS = boost::assign::list_of<std::string>
  *   rsync://134.170.185.46:5555/barn_logs/myapp@main@myapp_host.mydomain.com
  * ...with everything up the last '/' being rsync specific and the end filename
  * being specific to barn-hdfs which will parse out the name from it.
+ * A file:// destination (see local_transport.h) gets the same layout.
  */
 const std::string get_rsync_target(
     const string& destination_host_addr,
     const string& remote_rsync_namespace,
     const string& service_name,
     const string& category) {
-  static const auto host_name = get_host_name(); //TODO: make me better
   static const auto TOKEN_SEPARATOR = "@";
 
-  return rsync_protocol + destination_host_addr
+  const auto destination = is_local_target(destination_host_addr)
+      ? destination_host_addr.substr(0, destination_host_addr.find_last_not_of('/') + 1)
+      : rsync_protocol + destination_host_addr;
+  return destination
        + RSYNC_PATH_SEPARATOR + remote_rsync_namespace
        + RSYNC_PATH_SEPARATOR + service_name
        + TOKEN_SEPARATOR + category
-       + TOKEN_SEPARATOR + host_name + RSYNC_PATH_SEPARATOR;
+       + TOKEN_SEPARATOR + local_host_name() + RSYNC_PATH_SEPARATOR;
+}
+
+// Looked up once, unless handed over by the agent upgraded from.
+static string host_name;
+
+/**/
+const string& local_host_name() {
+  if (host_name.empty())
+    host_name = get_host_name();
+  return host_name;
+}
+
+/**/
+void use_host_name(const string& name) {
+  host_name = name;
 }
 
 /*
@@ -73,14 +92,13 @@ static const pair<int, string> do_rsync(const vector<string>& args) {
  * Returns the list of logs (files beginning with '@') that need to
  * be transferred.
  */
-static const vector<string> get_rsync_candidates(string rsync_output) {
-  const auto lines = split(rsync_output, '\n');
+static vector<string> get_rsync_candidates(const string& rsync_output) {
+  auto lines = split(rsync_output, '\n');
   vector<string> svlogd_files;
 
-  for (vector<string>::const_iterator it = lines.begin(); it < lines.end(); ++it) {
-    if (is_svlogd_filename(*it)) {
-      svlogd_files.push_back(*it);
-    }
+  for (auto& line : lines) {
+    if (is_svlogd_filename(line))
+      svlogd_files.push_back(std::move(line));
   }
   return svlogd_files;
 }
@@ -96,6 +114,10 @@ Validation<FileNameList> FileOps::log_files_not_on_target(
     return FileNameList();
   }
 
+  if (is_local_target(rsync_target))
+    return local_files_not_on_target(log_directory, files,
+                                     local_target_directory(rsync_target));
+
   auto file_paths = join_path(log_directory, files);
 
   const auto rsync_dry_run =
@@ -114,7 +136,7 @@ Validation<FileNameList> FileOps::log_files_not_on_target(
 
   auto missing_files = get_rsync_candidates(rsync_output.second);
   sort(missing_files.begin(), missing_files.end());
-  return missing_files;
+  return std::move(missing_files);
 }
 
 /*
@@ -124,6 +146,9 @@ Validation<FileNameList> FileOps::log_files_not_on_target(
  * sense to ship one by one as it makes failure recover easier)
  */
 bool FileOps::ship_file(const string& file_path, const string& rsync_target) const {
+  if (is_local_target(rsync_target))
+    return copy_to_local_target(file_path, local_target_directory(rsync_target));
+
   const auto rsync_wet_run = list_of<string>(rsync_executable_name)
                                             .range(RSYNC_FLAGS)
                                             (file_path)
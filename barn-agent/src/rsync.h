@@ -18,6 +18,13 @@ const std::string get_rsync_target(const std::string& destination_host_addr,
                                    const std::string& service_name,
                                    const std::string& category);
 
+// 'hostname -f', as rsync targets are named after it.
+const std::string& local_host_name();
+
+// Name rsync targets after 'name' instead, e.g. the host name an upgraded
+// agent was handed (see handoff.h).
+void use_host_name(const std::string& name);
+
 /*
  * Identify a file as a log file. In svlogd all rotated log files are are
  * tai64n timestamp prepended with an '@'.
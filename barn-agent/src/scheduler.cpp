@@ -0,0 +1,63 @@
+/*
+ * Round scheduling, see scheduler.h.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "scheduler.h"
+
+using namespace std;
+
+ShipScheduler::ShipScheduler(int freshness_target_seconds, int backoff_seconds,
+                             int max_backoff_seconds)
+    : consecutive_failures(0), unfinished{NextRound::Now, 0} {
+  configure(freshness_target_seconds, backoff_seconds, max_backoff_seconds);
+}
+
+void ShipScheduler::configure(int freshness_target_seconds, int backoff_seconds,
+                              int max_backoff_seconds) {
+  this->freshness_target_seconds = freshness_target_seconds;
+  this->backoff_seconds = backoff_seconds;
+  this->max_backoff_seconds = max(max_backoff_seconds, backoff_seconds);
+}
+
+int ShipScheduler::backoff_limit() const {
+  int64_t limit = backoff_seconds;
+  for (int i = 1; i < consecutive_failures && limit < max_backoff_seconds; ++i)
+    limit *= 2;
+  return (int)min<int64_t>(limit, max_backoff_seconds);
+}
+
+ScheduleDecision ShipScheduler::after_round(RoundOutcome outcome, const Metrics& metrics) {
+  ScheduleDecision decision;
+  if (outcome == RoundOutcome::Failed) {
+    ++consecutive_failures;
+    // Between half and all of the limit, so agents failing together
+    // (e.g. on a collector outage) don't retry together.
+    const int limit = backoff_limit();
+    decision.next = NextRound::AfterBackoff;
+    decision.seconds = limit > 0 ? limit / 2 + rand() % (limit - limit / 2 + 1) : 0;
+    metrics.send_metric(RoundsBackingOff, 1);
+  } else {
+    consecutive_failures = 0;
+    if (outcome == RoundOutcome::Shipped) {
+      decision.next = NextRound::Now;
+      decision.seconds = 0;
+      metrics.send_metric(RoundsBackToBack, 1);
+    } else {
+      decision.next = NextRound::OnNewFile;
+      decision.seconds = freshness_target_seconds;
+      metrics.send_metric(RoundsWaitingForFile, 1);
+    }
+  }
+  metrics.send_metric(BackoffSeconds, decision.next == NextRound::AfterBackoff ? decision.seconds : 0);
+  return decision;
+}
+
+void ShipScheduler::shipped(int64_t rotated_at, int64_t now, const Metrics& metrics) const {
+  const int64_t freshness = max<int64_t>(now - rotated_at, 0);
+  metrics.record_value(ShipFreshness, freshness);
+  if (freshness > freshness_target_seconds)
+    metrics.send_metric(FreshnessTargetMissed, 1);
+}
@@ -0,0 +1,69 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+/*
+ * Decides when the next round starts, working from a freshness target
+ * ("ship within N seconds of rotation") rather than fixed sleeps:
+ *   - after shipping, go again straight away: the backlog drains back to
+ *     back and files rotated meanwhile are picked up
+ *   - when caught up, wait for the next rotation
+ *   - only back off after errors, exponentially
+ */
+
+#include <cstdint>
+
+#include "metrics.h"
+
+enum class RoundOutcome {
+  Failed,    // Couldn't list candidates or ship any of them
+  Shipped,   // Shipped at least one file
+  CaughtUp   // Nothing to ship
+};
+
+enum class NextRound {
+  Now,
+  OnNewFile,    // When a file rotates, polling every 'seconds' without inotify
+  AfterBackoff  // In 'seconds'
+};
+
+struct ScheduleDecision {
+  NextRound next;
+  int seconds;
+};
+
+class ShipScheduler {
+public:
+  ShipScheduler(int freshness_target_seconds, int backoff_seconds,
+                int max_backoff_seconds);
+
+  // Change targets (e.g. after a config reload), keeping the error streak.
+  void configure(int freshness_target_seconds, int backoff_seconds,
+                 int max_backoff_seconds);
+
+  // What to do after a round, reported as metrics.
+  ScheduleDecision after_round(RoundOutcome outcome, const Metrics& metrics);
+
+  // Report the freshness achieved by shipping a file rotated at 'rotated_at'
+  // (unix seconds) at 'now'.
+  void shipped(int64_t rotated_at, int64_t now, const Metrics& metrics) const;
+
+  // Upper bound of the next back off, before jitter.
+  int backoff_limit() const;
+
+  // Failed rounds in a row, handed over on upgrade (see handoff.h).
+  int failure_streak() const { return consecutive_failures; }
+  void restore_failure_streak(int failures) { consecutive_failures = failures; }
+
+  // What is left of a wait for the next round cut short by an upgrade, for
+  // the upgraded agent to finish. NextRound::Now if the wait was over.
+  ScheduleDecision unfinished_wait() const { return unfinished; }
+  void set_unfinished_wait(ScheduleDecision rest) { unfinished = rest; }
+
+private:
+  int freshness_target_seconds;
+  int backoff_seconds;
+  int max_backoff_seconds;
+  int consecutive_failures;
+  ScheduleDecision unfinished;
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Shipment planning, see shipment_plan.h.
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "shipment_plan.h"
+
+using namespace std;
+
+string contiguous_shipped_mark(const FileNameList& local, const FileNameList& missing) {
+  FileNameList on_server;
+  set_difference(local.begin(), local.end(), missing.begin(), missing.end(),
+                 back_inserter(on_server));
+  return on_server.empty() ? "" : on_server.back();
+}
+
+FileNameList unshipped_files(const FileNameList& missing, const string& shipped_mark) {
+  return FileNameList(upper_bound(missing.begin(), missing.end(), shipped_mark),
+                      missing.end());
+}
+
+FileNameList plan_shipment(const FileNameList& candidates,
+                           const vector<uintmax_t>& sizes,
+                           double backfill_share) {
+  FileNameList plan;
+  double backfill_bytes = 0;
+  double planned_bytes = 0;
+
+  // 'oldest' and 'newest' close in on each other from both ends.
+  size_t oldest = 0, newest = candidates.size();
+  while (oldest < newest) {
+    size_t next;
+    if (backfill_bytes < backfill_share * planned_bytes) {
+      next = oldest++;
+      backfill_bytes += sizes[next];
+    } else {
+      next = --newest;
+    }
+    planned_bytes += sizes[next];
+    plan.push_back(candidates[next]);
+  }
+  return plan;
+}
+
+string advance_shipped_mark(const string& shipped_mark,
+                            const FileNameList& candidates,
+                            const FileNameList& done,
+                            const FileNameList& local) {
+  const set<string> done_set(done.begin(), done.end());
+  string first_pending;
+  for (auto& candidate : candidates) {
+    if (!done_set.count(candidate)) {
+      first_pending = candidate;
+      break;
+    }
+  }
+
+  auto covered = [&](const string& name) {
+    if (first_pending.empty())
+      return !candidates.empty() && name <= candidates.back();
+    return name < first_pending;
+  };
+
+  string mark = shipped_mark;
+  for (auto* names : {&local, &done}) {
+    for (auto& name : *names) {
+      if (covered(name) && name > mark)
+        mark = name;
+    }
+  }
+  return mark;
+}
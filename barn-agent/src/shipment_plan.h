@@ -0,0 +1,54 @@
+#ifndef SHIPMENT_PLAN_H
+#define SHIPMENT_PLAN_H
+/*
+ * What to ship and in which order.
+ *
+ * Which local files the server already has is tracked with a "shipped
+ * mark": the name of a local file such that it and every older file have
+ * been shipped. Files newer than the mark that the server is missing are
+ * still to ship, wherever they fall, so files may arrive out of order (see
+ * plan_shipment) without older gaps being mistaken for shipped ones.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "helpers.h"
+
+/*
+ * The mark implied by a server holding a contiguous suffix of 'local',
+ * which is all barn-agent knew before it kept a mark: the newest local file
+ * the server has ("" if it has none). All arguments sorted.
+ */
+std::string contiguous_shipped_mark(const FileNameList& local, const FileNameList& missing);
+
+/*
+ * Files of 'missing' (sorted) newer than 'shipped_mark'.
+ */
+FileNameList unshipped_files(const FileNameList& missing, const std::string& shipped_mark);
+
+/*
+ * Order 'candidates' (sorted, with their sizes) for shipping newest first,
+ * interleaving the oldest ones so they make up about 'backfill_share' of
+ * the bytes shipped.
+ *
+ * Example, equally sized files and a share of 0.25:
+ *   candidates: {t1, t2, t3, t4, t5, t6, t7, t8}
+ *   plan:       {t8, t1, t7, t6, t5, t2, t4, t3}
+ */
+FileNameList plan_shipment(const FileNameList& candidates,
+                           const std::vector<uintmax_t>& sizes,
+                           double backfill_share);
+
+/*
+ * The mark after shipping 'done' (shipped, or gone) of 'candidates': the
+ * newest of 'local' and 'done' older than every candidate still to ship, or
+ * up to the newest candidate if none is left. Never moves backwards.
+ */
+std::string advance_shipped_mark(const std::string& shipped_mark,
+                                 const FileNameList& candidates,
+                                 const FileNameList& done,
+                                 const FileNameList& local);
+
+#endif
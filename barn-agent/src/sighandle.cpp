@@ -2,22 +2,29 @@
  * Basic signal handling code that should really be replaced.
  */
 
+#include <atomic>
 #include <stdio.h>
 #include <unistd.h>
 
+#include "flight_recorder.h"
 #include "sighandle.h"
 
-static const int INVALID_PID = -1;
+static const int NO_PID = 0;
 
-// Declared in sighandle.h as extern, here is the once-only definition of
-// the extern variable.
-volatile sig_atomic_t child_pid_global = INVALID_PID;
+// Children currently running, NO_PID in free slots. Lock-free atomics, so
+// safe to read from signal handlers.
+static std::atomic<int> child_pids[MAX_TRACKED_CHILDREN];
+// The child a drain request ends, NO_PID if none.
+static std::atomic<int> interruptible_pid(NO_PID);
 
 struct sigaction sa, old;
 
 static void kill_child_handler(int ignore) {
-  if (child_pid_global != INVALID_PID)
-    kill(child_pid_global, SIGTERM);
+  for (auto& pid : child_pids) {
+    const int child = pid.load();
+    if (child != NO_PID)
+      kill(child, SIGTERM);
+  }
 
   // Unset the signal handler to the default
   // so the next kill signal will do the default kill.
@@ -32,10 +39,153 @@ void enable_kill_child_signal_handler() {
   sigaction(SIGTERM, &sa, &old);
 }
 
-void set_child_pid(int pid) {
-  child_pid_global = pid;
+static volatile sig_atomic_t trace_dump_requested = 0;
+
+static void trace_dump_handler(int ignore) {
+  trace_dump_requested = 1;
+}
+
+void enable_trace_dump_signal_handler() {
+  struct sigaction dump;
+  dump.sa_handler = trace_dump_handler;
+  sigemptyset(&dump.sa_mask);
+  dump.sa_flags = SA_RESTART;
+  sigaction(SIGUSR2, &dump, 0);
+}
+
+bool take_trace_dump_request() {
+  if (!trace_dump_requested)
+    return false;
+  trace_dump_requested = 0;
+  return true;
+}
+
+static void flight_dump_handler(int ignore) {
+  dump_flight_recorder();
+}
+
+static void fatal_signal_handler(int signal) {
+  flight_record(FlightEventType::FatalSignal, signal);
+  dump_flight_recorder();
+  // The handler was reset to the default on entry, die from the signal.
+  raise(signal);
+}
+
+void enable_flight_recorder_signal_handlers() {
+  struct sigaction dump;
+  dump.sa_handler = flight_dump_handler;
+  sigemptyset(&dump.sa_mask);
+  dump.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &dump, 0);
+
+  struct sigaction fatal;
+  fatal.sa_handler = fatal_signal_handler;
+  sigemptyset(&fatal.sa_mask);
+  fatal.sa_flags = SA_RESETHAND | SA_NODEFER;
+  for (int signal : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT})
+    sigaction(signal, &fatal, 0);
+}
+
+void set_child_pid(int pid, bool interruptible) {
+  for (auto& slot : child_pids) {
+    int free = NO_PID;
+    if (slot.compare_exchange_strong(free, pid))
+      break;
+  }
+  if (interruptible)
+    interruptible_pid = pid;
+}
+
+void unset_child_pid(int pid) {
+  int interrupted = pid;
+  interruptible_pid.compare_exchange_strong(interrupted, NO_PID);
+  for (auto& slot : child_pids) {
+    int child = pid;
+    if (slot.compare_exchange_strong(child, NO_PID))
+      break;
+  }
+}
+
+static void end_interruptible_child() {
+  const int child = interruptible_pid.load();
+  if (child != NO_PID)
+    kill(child, SIGTERM);
+}
+
+static volatile sig_atomic_t reload_requested = 0;
+
+static void reload_handler(int ignore) {
+  reload_requested = 1;
+  end_interruptible_child();
+}
+
+void enable_reload_signal_handler() {
+  struct sigaction reload;
+  reload.sa_handler = reload_handler;
+  sigemptyset(&reload.sa_mask);
+  reload.sa_flags = SA_RESTART;
+  sigaction(SIGHUP, &reload, 0);
+}
+
+bool take_reload_request() {
+  if (!reload_requested)
+    return false;
+  reload_requested = 0;
+  return true;
+}
+
+static volatile sig_atomic_t drain_requested = 0;
+static volatile sig_atomic_t upgrade_requested = 0;
+
+static void drain_handler(int ignore) {
+  drain_requested = 1;
+  end_interruptible_child();
+}
+
+void enable_drain_signal_handler() {
+  struct sigaction drain;
+  drain.sa_handler = drain_handler;
+  sigemptyset(&drain.sa_mask);
+  // Sleeps between rounds end all the same, see signal(7).
+  drain.sa_flags = SA_RESTART;
+  sigaction(SIGQUIT, &drain, 0);
+}
+
+bool drain_was_requested() {
+  return drain_requested;
+}
+
+static void upgrade_handler(int ignore) {
+  upgrade_requested = 1;
+  end_interruptible_child();
+}
+
+void enable_upgrade_signal_handler() {
+  struct sigaction upgrade;
+  upgrade.sa_handler = upgrade_handler;
+  sigemptyset(&upgrade.sa_mask);
+  upgrade.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &upgrade, 0);
+}
+
+bool take_upgrade_request() {
+  if (!upgrade_requested)
+    return false;
+  upgrade_requested = 0;
+  return true;
+}
+
+static std::atomic<bool> woken(false);
+
+void wake_up() {
+  woken = true;
+  end_interruptible_child();
+}
+
+bool take_wake_up() {
+  return woken.exchange(false);
 }
 
-void unset_child_pid() {
-  child_pid_global = INVALID_PID;
+bool waits_interrupted() {
+  return reload_requested || drain_requested || upgrade_requested || woken;
 }
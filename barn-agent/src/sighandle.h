@@ -6,13 +6,12 @@
 
 #include <signal.h>
 
-extern volatile sig_atomic_t child_pid_global;
+// Children tracked at once, more than a drain runs in parallel.
+static const int MAX_TRACKED_CHILDREN = 64;
 
 /*
- * Sets a signal handler that upon SIGTERM propagates the signal to a child PID
- * and subsequently kills itself. There are better ways to propagate signal
- * to child processes without a need for a global variable that is both
- * unclean design and limited to only one child.
+ * Sets a signal handler that upon SIGTERM propagates the signal to the
+ * running children (see set_child_pid) and subsequently kills itself.
  *
  * TODO: make it unnecessary to manually propagate signal which is error prone.
  *
@@ -20,14 +19,82 @@ extern volatile sig_atomic_t child_pid_global;
 void enable_kill_child_signal_handler();
 
 /*
- * Sets child_pid_global variable with the pid currently being run.
+ * Track child 'pid' until unset_child_pid, from any thread. A reload, a
+ * drain, an upgrade or a wake up request (see waits_interrupted) ends an
+ * 'interruptible' child, e.g. one waiting for the next rotation.
  */
-void set_child_pid(int pid);
+void set_child_pid(int pid, bool interruptible = false);
+
+void unset_child_pid(int pid);
+
+/*
+ * Sets a SIGUSR2 handler that asks for the trace ring to be dumped (see
+ * trace.h). The handler only sets a flag, the dump happens on the trace
+ * exporter thread.
+ */
+void enable_trace_dump_signal_handler();
+
+/*
+ * Returns whether a trace dump was asked for since the last call.
+ */
+bool take_trace_dump_request();
+
+/*
+ * Sets handlers that dump the flight recorder (see flight_recorder.h) on
+ * SIGUSR1, and on fatal signals (SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT)
+ * before dying from them as before.
+ */
+void enable_flight_recorder_signal_handlers();
+
+/*
+ * Sets a SIGHUP handler that asks for the config file to be reloaded
+ * between rounds, ending an interruptible wait for the next round.
+ */
+void enable_reload_signal_handler();
+
+/*
+ * Returns whether a reload was asked for since the last call.
+ */
+bool take_reload_request();
+
+/*
+ * Sets a SIGQUIT handler that asks the agent to drain (see drain.h), ending
+ * an interruptible wait for the next round.
+ */
+void enable_drain_signal_handler();
+
+/*
+ * Returns whether a drain was asked for.
+ */
+bool drain_was_requested();
+
+/*
+ * Sets a SIGALRM handler that asks the agent to upgrade (see handoff.h),
+ * ending an interruptible wait for the next round.
+ */
+void enable_upgrade_signal_handler();
+
+/*
+ * Returns whether an upgrade was asked for since the last call.
+ */
+bool take_upgrade_request();
+
+/*
+ * Ends an interruptible wait for the next round, from any thread (e.g. for
+ * a command on the control socket, see control_socket.h).
+ */
+void wake_up();
+
+/*
+ * Returns whether wake_up() was called since the last call.
+ */
+bool take_wake_up();
 
 /*
- * Unsets child_pid_global variable.
+ * Returns whether interruptible children are ended, as a reload, a drain,
+ * an upgrade or a wake up was asked for.
  */
-void unset_child_pid();
+bool waits_interrupted();
 #endif
 
 
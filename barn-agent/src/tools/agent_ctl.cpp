@@ -0,0 +1,176 @@
+/*
+ * barn-agentctl: ask the barn-agents of a host what they are doing, or tell
+ * them to pause, resume, start a round or switch channels (see
+ * --control_socket).
+ *
+ *   barn-agentctl COMMAND [SOCKET|DIRECTORY...]
+ *
+ * Directories (/run/barn-agent by default) stand for the *.sock sockets in
+ * them. 'status' prints a line per agent.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <dirent.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "control_client.h"
+
+using namespace std;
+
+static const string DEFAULT_SOCKET_DIRECTORY = "/run/barn-agent";
+static const string SOCKET_SUFFIX = ".sock";
+
+static vector<string> sockets_in(const string& directory) {
+  vector<string> sockets;
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return sockets;
+  while (struct dirent* entry = readdir(dir)) {
+    const string name = entry->d_name;
+    if (name.size() > SOCKET_SUFFIX.size() &&
+        name.compare(name.size() - SOCKET_SUFFIX.size(), SOCKET_SUFFIX.size(), SOCKET_SUFFIX) == 0)
+      sockets.push_back(directory + "/" + name);
+  }
+  closedir(dir);
+  sort(sockets.begin(), sockets.end());
+  return sockets;
+}
+
+static string human_bytes(const string& bytes) {
+  double value = strtod(bytes.c_str(), nullptr);
+  static const char* units[] = {"B", "K", "M", "G", "T"};
+  int unit = 0;
+  while (value >= 1024 && unit < 4) {
+    value /= 1024;
+    unit++;
+  }
+  ostringstream out;
+  out << fixed << setprecision(unit == 0 || value >= 10 ? 0 : 1) << value << units[unit];
+  return out.str();
+}
+
+static string human_age(int64_t seconds) {
+  ostringstream out;
+  if (seconds < 120)
+    out << seconds << "s";
+  else if (seconds < 7200)
+    out << seconds / 60 << "m";
+  else if (seconds < 2 * 86400)
+    out << seconds / 3600 << "h";
+  else
+    out << seconds / 86400 << "d";
+  return out.str();
+}
+
+static string field(const map<string, string>& status, const string& name) {
+  const auto found = status.find(name);
+  return found == status.end() ? "" : found->second;
+}
+
+static vector<string> status_row(const string& socket, const map<string, string>& status) {
+  const auto agent = field(status, "agent");
+  string channel = field(status, "channel");
+  if (field(status, "on_backup") == "1")
+    channel += " (backup)";
+
+  string in_flight = "-";
+  const auto path = field(status, "in_flight");
+  if (!path.empty()) {
+    in_flight = field(status, "in_flight_number") + "/" + field(status, "round_files") + " " +
+                path.substr(path.rfind('/') + 1) + " " +
+                human_bytes(field(status, "in_flight_bytes")) + " " +
+                human_age(atoll(field(status, "in_flight_seconds").c_str()));
+  }
+  string last_error = field(status, "last_error");
+  if (last_error.empty())
+    last_error = "-";
+  else
+    last_error = human_age(atoll(field(status, "last_error_age").c_str())) + " ago: " + last_error;
+
+  return {agent.empty() ? socket : agent,
+          field(status, "activity"),
+          channel.empty() ? "-" : channel,
+          field(status, "backlog_files") + " / " + human_bytes(field(status, "backlog_bytes")),
+          field(status, "oldest_unshipped").empty()
+              ? "-" : human_age(atoll(field(status, "oldest_unshipped_age").c_str())),
+          in_flight,
+          last_error};
+}
+
+static void print_table(const vector<vector<string>>& rows) {
+  vector<size_t> widths;
+  for (auto& row : rows) {
+    widths.resize(max(widths.size(), row.size()));
+    for (size_t i = 0; i < row.size(); i++)
+      widths[i] = max(widths[i], row[i].size());
+  }
+  for (auto& row : rows) {
+    for (size_t i = 0; i < row.size(); i++) {
+      if (i + 1 == row.size())
+        cout << row[i];
+      else
+        cout << left << setw(widths[i] + 2) << row[i];
+    }
+    cout << endl;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " status|pause|resume|round|switch [SOCKET|DIRECTORY...]"
+         << endl;
+    return 1;
+  }
+  const string command = argv[1];
+
+  vector<string> sockets;
+  vector<string> where(argv + 2, argv + argc);
+  if (where.empty())
+    where.push_back(DEFAULT_SOCKET_DIRECTORY);
+  for (auto& path : where) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      const auto found = sockets_in(path);
+      sockets.insert(sockets.end(), found.begin(), found.end());
+    } else {
+      sockets.push_back(path);
+    }
+  }
+  if (sockets.empty()) {
+    cerr << "No agent sockets found" << endl;
+    return 1;
+  }
+
+  int exit_status = 0;
+  vector<vector<string>> rows = {
+    {"AGENT", "STATE", "CHANNEL", "BACKLOG", "OLDEST", "IN FLIGHT", "LAST ERROR"}
+  };
+  for (auto& socket : sockets) {
+    string reply, problem;
+    if (!control_request(socket, command, &reply, &problem)) {
+      cerr << socket << ": " << problem << endl;
+      exit_status = 1;
+      continue;
+    }
+    if (reply.compare(0, 6, "error:") == 0) {
+      cerr << socket << ": " << reply;
+      exit_status = 1;
+    } else if (command == "status") {
+      rows.push_back(status_row(socket, parse_status_reply(reply)));
+    } else {
+      cout << socket << ": " << reply;
+    }
+  }
+  if (command == "status" && rows.size() > 1)
+    print_table(rows);
+  return exit_status;
+}
@@ -0,0 +1,39 @@
+/*
+ * barn-flight-decode: print flight recorder dumps written by barn-agent
+ * (on SIGUSR1, stalls and crashes, see --flight_recorder_dir).
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "flight_recorder.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " DUMP..." << endl;
+    return 1;
+  }
+
+  int status = 0;
+  for (int i = 1; i < argc; i++) {
+    FlightDumpHeader header;
+    vector<FlightEvent> events;
+    if (!read_flight_dump(argv[i], &header, &events)) {
+      cerr << argv[i] << ": not a barn-agent flight recorder dump" << endl;
+      status = 1;
+      continue;
+    }
+
+    FlightEvent dumped = FlightEvent();
+    dumped.time_us = header.dump_time_us;
+    cout << "# " << argv[i] << ": " << header.process_name << " (pid " << header.pid
+         << "), " << events.size() << " events, dumped "
+         << format_flight_event(dumped).substr(0, 26) << endl;
+    for (auto& event : events)
+      cout << format_flight_event(event) << endl;
+  }
+  return status;
+}
@@ -0,0 +1,187 @@
+/*
+ * Span tracing, see trace.h.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "params.h"
+#include "sighandle.h"
+#include "trace.h"
+
+using namespace std;
+
+std::atomic<bool> tracing_enabled(false);
+
+/*
+ * Each slot is a seqlock: 'sequence' is odd while the slot is written, and
+ * 2 * (index + 1) once event number 'index' is complete. Readers copy the
+ * event and keep it only if the sequence was the same before and after.
+ */
+struct TraceSlot {
+  std::atomic<uint64_t> sequence;
+  TraceEvent event;
+};
+
+static TraceSlot ring[TRACE_RING_SIZE];
+static std::atomic<uint64_t> head(0);
+
+static const int EXPORT_INTERVAL_MILLIS = 1000;
+static const int DUMP_POLL_MILLIS = 100;
+
+int64_t trace_now_us() {
+  return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int32_t current_tid() {
+  static thread_local int32_t tid = syscall(SYS_gettid);
+  return tid;
+}
+
+void trace_record(const char* name, int64_t start_us, int64_t duration_us) {
+  const uint64_t index = head.fetch_add(1, memory_order_relaxed);
+  TraceSlot& slot = ring[index % TRACE_RING_SIZE];
+
+  slot.sequence.store(2 * index + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  strncpy(slot.event.name, name, TRACE_NAME_SIZE - 1);
+  slot.event.name[TRACE_NAME_SIZE - 1] = '\0';
+  slot.event.start_us = start_us;
+  slot.event.duration_us = duration_us;
+  slot.event.tid = current_tid();
+  slot.sequence.store(2 * (index + 1), memory_order_release);
+}
+
+uint64_t trace_cursor() {
+  return head.load(memory_order_acquire);
+}
+
+vector<TraceEvent> trace_events_since(uint64_t* from) {
+  const uint64_t end = trace_cursor();
+  if (end - *from > (uint64_t)TRACE_RING_SIZE)
+    *from = end - TRACE_RING_SIZE;
+
+  vector<TraceEvent> events;
+  for (; *from < end; ++*from) {
+    const TraceSlot& slot = ring[*from % TRACE_RING_SIZE];
+    const uint64_t expected = 2 * (*from + 1);
+    if (slot.sequence.load(memory_order_acquire) != expected)
+      continue;  // Still being written, or already overwritten
+    TraceEvent event = slot.event;
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.sequence.load(memory_order_relaxed) == expected)
+      events.push_back(event);
+  }
+  return events;
+}
+
+static string json_string(const string& value) {
+  string escaped("\"");
+  for (auto c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if ((unsigned char)c < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped + "\"";
+}
+
+string trace_event_json(const TraceEvent& event) {
+  ostringstream oss;
+  oss << "{\"name\":" << json_string(event.name)
+      << ",\"cat\":\"barn\",\"ph\":\"X\""
+      << ",\"ts\":" << event.start_us
+      << ",\"dur\":" << event.duration_us
+      << ",\"pid\":" << getpid()
+      << ",\"tid\":" << event.tid << "}";
+  return oss.str();
+}
+
+// Names the process in trace viewers.
+static string process_name_json(const string& process_name) {
+  ostringstream oss;
+  oss << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << getpid()
+      << ",\"args\":{\"name\":" << json_string(process_name) << "}}";
+  return oss.str();
+}
+
+bool dump_trace(const string& path, const string& process_name) {
+  uint64_t from = 0;
+  const auto events = trace_events_since(&from);
+
+  ofstream out(path.c_str(), ios::trunc);
+  out << "{\"traceEvents\":[\n" << process_name_json(process_name);
+  for (auto& event : events)
+    out << ",\n" << trace_event_json(event);
+  out << "\n]}\n";
+  out.close();
+  return !out.fail();
+}
+
+/*
+ * The trace file uses the JSON array format, which trace viewers accept
+ * without the closing ']', so events can be appended as they come.
+ */
+static void export_new_events(ofstream& out, uint64_t* cursor) {
+  const uint64_t expected = *cursor;
+  const auto events = trace_events_since(cursor);
+  if (*cursor - events.size() > expected)
+    LOG(WARNING) << "Trace ring overflowed, lost "
+                 << (*cursor - events.size() - expected) << " events";
+  for (auto& event : events)
+    out << trace_event_json(event) << ",\n";
+  out.flush();
+}
+
+void run_trace_exporter(const string& trace_file, const string& dump_dir,
+                        const string& process_name) {
+  ofstream out;
+  uint64_t cursor = trace_cursor();
+  if (!trace_file.empty()) {
+    out.open(trace_file.c_str(), ios::app);
+    if (!out) {
+      LOG(ERROR) << "Failed to open trace file " << trace_file;
+    } else {
+      out.seekp(0, ios::end);
+      if (out.tellp() == 0)
+        out << "[\n";
+      out << process_name_json(process_name) << ",\n";
+    }
+  }
+
+  int since_export = 0;
+  while (true) {
+    this_thread::sleep_for(chrono::milliseconds(DUMP_POLL_MILLIS));
+
+    if (take_trace_dump_request()) {
+      ostringstream path;
+      path << dump_dir << "/barn-agent-trace." << getpid() << "." << time(0) << ".json";
+      if (dump_trace(path.str(), process_name))
+        LOG(INFO) << "Dumped trace to " << path.str();
+      else
+        LOG(ERROR) << "Failed to dump trace to " << path.str();
+    }
+
+    since_export += DUMP_POLL_MILLIS;
+    if (out.is_open() && since_export >= EXPORT_INTERVAL_MILLIS) {
+      export_new_events(out, &cursor);
+      since_export = 0;
+    }
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H
+/*
+ * Lightweight tracing of where barn-agent spends its time.
+ * Completed spans are kept in a fixed size lock-free ring and exported in
+ * the Chrome trace-event JSON format (chrome://tracing, ui.perfetto.dev).
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+static const int TRACE_RING_SIZE = 4096;
+static const int TRACE_NAME_SIZE = 48;
+
+// Checked by every span, the only cost of tracing when it's off.
+extern std::atomic<bool> tracing_enabled;
+
+struct TraceEvent {
+  char name[TRACE_NAME_SIZE];
+  int64_t start_us;     // Monotonic clock
+  int64_t duration_us;
+  int32_t tid;
+};
+
+int64_t trace_now_us();
+
+// Add a completed span to the ring, overwriting the oldest one if full.
+// Safe to call from any thread.
+void trace_record(const char* name, int64_t start_us, int64_t duration_us);
+
+/*
+ * Records the time between construction and destruction as a span, if
+ * tracing was enabled at construction. 'name' must outlive the span.
+ */
+class TraceSpan {
+public:
+  explicit TraceSpan(const char* name)
+    : name(name),
+      start_us(tracing_enabled.load(std::memory_order_relaxed) ? trace_now_us() : -1) {}
+
+  ~TraceSpan() {
+    if (start_us >= 0)
+      trace_record(name, start_us, trace_now_us() - start_us);
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  const char* name;
+  const int64_t start_us;
+};
+
+// Position of the next event to be recorded.
+uint64_t trace_cursor();
+
+/*
+ * Events recorded from position 'from' that are still in the ring, oldest
+ * first. Advances 'from' past them.
+ */
+std::vector<TraceEvent> trace_events_since(uint64_t* from);
+
+// A single event as a trace-event JSON object ("ph":"X").
+std::string trace_event_json(const TraceEvent& event);
+
+// Write every event in the ring to 'path' as a complete JSON trace.
+bool dump_trace(const std::string& path, const std::string& process_name);
+
+/*
+ * Runs forever: appends new events to 'trace_file' every second unless it's
+ * empty, and dumps the ring into 'dump_dir' when the SIGUSR2 handler asks
+ * for it (see sighandle.h).
+ */
+void run_trace_exporter(const std::string& trace_file, const std::string& dump_dir,
+                        const std::string& process_name);
+
+#endif
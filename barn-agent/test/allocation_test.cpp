@@ -0,0 +1,176 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "barn-agent.h"
+
+/**
+ * Counts heap allocations, to check that the agent's own planning of a
+ * round follows what changed in the log directory rather than its size.
+ * Listing the directory and the rsync dry run (its argv, a path per file,
+ * and the parsing of its output) still cost a few allocations per file of
+ * the directory; they are stubbed out and not counted here.
+ */
+namespace {
+std::atomic<bool> counting(false);
+std::atomic<long> allocations(0);
+}
+
+void* operator new(size_t size) {
+  if (counting)
+    ++allocations;
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+namespace allocation_test
+{
+
+using namespace std;
+
+/*
+ * Log file names as long as svlogd's, too long for the short string
+ * optimization, so copying one allocates.
+ */
+string log_name(int i) {
+  char name[32];
+  snprintf(name, sizeof(name), "@40000000%016x.s", i);
+  return name;
+}
+
+FileNameList log_names(int from, int to) {
+  FileNameList names;
+  for (int i = from; i < to; ++i)
+    names.push_back(log_name(i));
+  return names;
+}
+
+/*
+ * A directory of 'files' files, the newest 'new_files' of which aren't on
+ * the target. Its results are built beforehand and moved out, so only the
+ * agent's own allocations are counted, not those of listing the directory
+ * or of the dry run.
+ */
+class PreparedFileOps : public FileOps {
+public:
+  PreparedFileOps(int files, int new_files)
+      : missing(log_names(files - new_files, files)),
+        mark(log_name(files - new_files - 1)) {
+    for (int i = 0; i < 2; ++i)
+      listings.push_back(log_names(0, files));
+  }
+
+  FileNameList list_log_directory(const string& directory) const override {
+    return std::move(listings.at(next_listing++));
+  }
+  Validation<FileNameList> log_files_not_on_target(
+        const string& directory, const FileNameList& files,
+        const string& target) const override {
+    return std::move(missing);
+  }
+  bool read_shipped_mark(const string& directory, const string& target,
+                         string* shipped_mark) const override {
+    *shipped_mark = mark;
+    return true;
+  }
+  bool write_shipped_mark(const string& directory, const string& target,
+                          const string& shipped_mark) const override {
+    return true;
+  }
+  bool ship_file(const string& file_path, const string& target) const override {
+    return true;
+  }
+  bool file_exists(const string& path) const override { return true; }
+  uintmax_t file_size(const string& path) const override { return 100; }
+  FileNameList list_pinned(const string& directory) const override { return FileNameList(); }
+
+  mutable vector<FileNameList> listings;
+  mutable size_t next_listing = 0;
+  mutable FileNameList missing;
+  string mark;
+};
+
+class AllocationTest : public ::testing::Test {
+public:
+  void SetUp() {
+    barn_conf.sleep_seconds = 0;
+    barn_conf.catch_up_files = 0;
+    barn_conf.backfill_share = 0.2;
+    barn_conf.pin_budget_mb = 0;
+    barn_conf.drop_page_cache = false;
+    channel.source_dir = "/log_dir/service";
+    channel.rsync_target = "rsync://collector:1000/barn_logs/svc@main@host/";
+  }
+
+  // Allocations of a round shipping 'new_files' out of 'files'.
+  long round_allocations(int files, int new_files) {
+    PreparedFileOps fileops(files, new_files);
+    SingleChannelSelector<AgentChannel> channel_selector(channel);
+    ShipScheduler scheduler(10, 0, 0);
+    NoOpMetrics metrics;
+
+    allocations = 0;
+    counting = true;
+    dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
+    counting = false;
+    return allocations;
+  }
+
+  BarnConf barn_conf;
+  AgentChannel channel;
+};
+
+TEST_F(AllocationTest, PlanningAllocationsFollowChanges) {
+  const long small = round_allocations(1000, 3);
+  const long large = round_allocations(20000, 3);
+  // Logging and such aside, planning copies nothing per file of the
+  // directory.
+  EXPECT_LT(large, small + 50) << "1000 files: " << small << ", 20000 files: " << large;
+
+  const long more_changes = round_allocations(20000, 30);
+  EXPECT_GT(more_changes, large);
+}
+
+TEST_F(AllocationTest, ValidationAccessorsDontCopy) {
+  Validation<FileNameList> listing = log_names(0, 1000);
+  Validation<FileNameList> failure = BarnError("failed to list");
+
+  allocations = 0;
+  counting = true;
+  const bool failed = isFailure(listing) || !isFailure(failure);
+  const size_t size = get(listing).size();
+  const size_t error_size = error(failure).size();
+  counting = false;
+
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(1000U, size);
+  EXPECT_LT(0U, error_size);
+  EXPECT_EQ(0, allocations);
+  EXPECT_EQ(&get(listing), &get(listing));
+}
+
+TEST_F(AllocationTest, MovesOutOfValidation) {
+  Validation<FileNameList> listing = log_names(0, 1000);
+  const auto* first = get(listing).front().data();
+
+  allocations = 0;
+  counting = true;
+  const FileNameList names = get(std::move(listing));
+  counting = false;
+
+  EXPECT_EQ(0, allocations);
+  EXPECT_EQ(first, names.front().data());
+}
+
+}
@@ -1,9 +1,20 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unistd.h>
 #include <unordered_map>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 #include "barn-agent.h"
+#include "drain.h"
+#include "flight_recorder.h"
+#include "monitor/localreport.h"
+#include "temp_dir.h"
 
 
 
@@ -20,13 +31,16 @@ using namespace testing;
 
 auto const SOURCE_DIRECTORY = "/log_dir/service";
 auto const RSYNC_TARGET     = "rsync_t";
+auto const BACKUP_TARGET    = "rsync_backup";
 
 auto const TEST_LOG_FILE = "test-file";
 auto const LOG_FILE_T0   = "test-file-1";
 auto const LOG_FILE_T1   = "test-file-2";
 auto const LOG_FILE_T2   = "test-file-3";
+auto const LOG_FILE_T3   = "test-file-4";
 
 static AgentChannel PRIMARY = AgentChannel();
+static AgentChannel BACKUP = AgentChannel();
 static const int FAILOVER_INTERVAL = 30;
 
 
@@ -43,7 +57,12 @@ class FakeFileOps : public FileOps {
 public:
   FileNameList* local_log_files;
   FileNameList* remote_log_files;
+  mutable FileNameList backup_log_files;  // Shipped to any other target
   bool shipping_ok = true;
+  mutable map<string, string> shipped_marks;  // By target
+  mutable set<string> pinned;
+  FileNameList prune_on_ship;
+  mutable mutex shipping;  // Drains ship on several threads
 
   FakeFileOps() {
     local_log_files = new FileNameList();
@@ -55,28 +74,75 @@ public:
         const FileNameList& files,
         const string& rsync_target) const override {
      FileNameList files_not_on_server;
+     FileNameList remote_files(*on_target(rsync_target));  // Shipped in any order
+     sort(remote_files.begin(), remote_files.end());
      set_difference(files.begin(), files.end(),
-                    remote_log_files->begin(), remote_log_files->end(),
+                    remote_files.begin(), remote_files.end(),
                     inserter(files_not_on_server, files_not_on_server.end()));
      return files_not_on_server;
   }
   virtual bool ship_file(const string& file_path,
                          const string& rsync_target) const override {
-     if (shipping_ok)
-        remote_log_files->push_back(file_name_from_path(file_path));
-     return shipping_ok;
+     lock_guard<mutex> lock(shipping);
+     // svlogd pruning files while shipping
+     for (auto& name : prune_on_ship)
+       local_log_files->erase(remove(local_log_files->begin(), local_log_files->end(), name),
+                              local_log_files->end());
+     const bool shipped = shipping_ok && file_exists(file_path);
+     if (shipped)
+        on_target(rsync_target)->push_back(file_name_from_path(file_path));
+     return shipped;
   }
 
-  virtual FileNameList list_log_directory(std::string directory_path) const override {
+  virtual FileNameList list_log_directory(const std::string& directory_path) const override {
     return *local_log_files;
   }
+  virtual bool wait_for_new_file_within(const string& directory, int timeout_seconds) const override {
+    return true;
+  }
   virtual bool wait_for_new_file_in_directory(const std::string& directory, int sleep_seconds) const override {
     return true;
   }
-  virtual bool file_exists(std::string file_path) const override {
+  virtual bool file_exists(const std::string& file_path) const override {
     string filename = file_name_from_path(file_path);
+    if (file_path == pin_path(SOURCE_DIRECTORY, filename))
+      return pinned.count(filename) > 0;
     return std::find(local_log_files->begin(), local_log_files->end(), filename) != local_log_files->end();
   }
+  virtual uintmax_t file_size(const std::string& file_path) const override {
+    return file_exists(file_path) ? 100 : 0;
+  }
+  virtual uintmax_t drop_from_page_cache(const string& path) const override {
+    return 0;
+  }
+  virtual bool read_shipped_mark(const string& directory, const string& rsync_target,
+                                 string* mark) const override {
+    const auto it = shipped_marks.find(rsync_target);
+    if (it == shipped_marks.end())
+      return false;
+    *mark = it->second;
+    return true;
+  }
+  virtual bool write_shipped_mark(const string& directory, const string& rsync_target,
+                                  const string& mark) const override {
+    shipped_marks[rsync_target] = mark;
+    return true;
+  }
+  virtual bool pin_file(const string& directory, const string& name) const override {
+    if (!file_exists(log_dir(name)))
+      return false;
+    pinned.insert(name);
+    return true;
+  }
+  virtual void unpin_file(const string& directory, const string& name) const override {
+    pinned.erase(name);
+  }
+  virtual FileNameList list_pinned(const string& directory) const override {
+    return FileNameList(pinned.begin(), pinned.end());
+  }
+  FileNameList* on_target(const string& rsync_target) const {
+    return rsync_target == RSYNC_TARGET ? remote_log_files : &backup_log_files;
+  }
   virtual ~FakeFileOps() {
     delete local_log_files;
     delete remote_log_files;
@@ -92,17 +158,23 @@ public:
 
 class FakeMetrics : public Metrics {
 public:
-  unordered_map<string, int> *sent = new unordered_map<string, int>();
+  unordered_map<string, int64_t> *sent = new unordered_map<string, int64_t>();
+  unordered_map<string, vector<int64_t>> *recorded = new unordered_map<string, vector<int64_t>>();
 
   FakeMetrics() : Metrics("", "") {
   };
 
-  virtual void send_metric(const string& key, int value) const {
+  virtual void send_metric(const string& key, int64_t value) const {
     (*sent)[key] = (*sent)[key] + value;
   }
 
+  virtual void record_value(const string& key, int64_t value) const {
+    (*recorded)[key].push_back(value);
+  }
+
   virtual ~FakeMetrics() {
     delete sent;
+    delete recorded;
   }
 };
 
@@ -112,11 +184,21 @@ public:
 
   void SetUp() {
     barn_conf.sleep_seconds = 0;
+    barn_conf.catch_up_files = 0;
+    barn_conf.backfill_share = 0.2;
+    barn_conf.pin_budget_mb = 0;
+    barn_conf.drop_page_cache = true;
+    barn_conf.source_dir = SOURCE_DIRECTORY;
+    barn_conf.drain_parallelism = 4;
+    barn_conf.drain_seconds = 0;
     PRIMARY.source_dir = SOURCE_DIRECTORY;
     PRIMARY.rsync_target = RSYNC_TARGET;
+    BACKUP.source_dir = SOURCE_DIRECTORY;
+    BACKUP.rsync_target = BACKUP_TARGET;
   }
 
   BarnConf barn_conf;
+  ShipScheduler scheduler = ShipScheduler(10, 0, 0);
   NoOpMetrics metrics;
   FakeMetrics recording_metrics;
   FakeChannelSelector channel_selector;
@@ -125,13 +207,13 @@ public:
 
 
 TEST_F(BarnAgentTest, TestNoOp) {
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
   EXPECT_EQ(0U, fileops.remote_log_files->size());
 }
 
 TEST_F(BarnAgentTest, ShipSingleFile) {
   fileops.local_log_files->push_back(TEST_LOG_FILE);
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
   EXPECT_EQ(1U, fileops.remote_log_files->size());
   EXPECT_EQ(TEST_LOG_FILE, fileops.remote_log_files->at(0));
 }
@@ -140,7 +222,7 @@ TEST_F(BarnAgentTest, ShipsAllFiles) {
   fileops.local_log_files->push_back(LOG_FILE_T0);
   fileops.local_log_files->push_back(LOG_FILE_T1);
   fileops.local_log_files->push_back(LOG_FILE_T2);
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
   EXPECT_EQ(3U, fileops.remote_log_files->size());
   EXPECT_EQ(LOG_FILE_T0, fileops.remote_log_files->at(0));
   EXPECT_EQ(LOG_FILE_T1, fileops.remote_log_files->at(1));
@@ -149,21 +231,21 @@ TEST_F(BarnAgentTest, ShipsAllFiles) {
 
 TEST_F(BarnAgentTest, DoesNotShipTwice) {
   fileops.local_log_files->push_back(TEST_LOG_FILE);
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
   EXPECT_EQ(1U, fileops.remote_log_files->size());
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
   EXPECT_EQ(1U, fileops.remote_log_files->size());
 }
 
 TEST_F(BarnAgentTest, ShipsNewFiles) {
   fileops.local_log_files->push_back(LOG_FILE_T0);
 
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
   EXPECT_EQ(1U, fileops.remote_log_files->size());
   EXPECT_EQ(LOG_FILE_T0, fileops.remote_log_files->at(0));
 
   fileops.local_log_files->push_back(LOG_FILE_T1);
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
   EXPECT_EQ(2U, fileops.remote_log_files->size());
   EXPECT_EQ(LOG_FILE_T1, fileops.remote_log_files->at(1));
 }
@@ -175,32 +257,191 @@ TEST_F(BarnAgentTest, ShipsLatestFilesOnly) {
 
   fileops.remote_log_files->push_back(LOG_FILE_T1);
 
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
   EXPECT_EQ(2U, fileops.remote_log_files->size());
   EXPECT_EQ(LOG_FILE_T1, fileops.remote_log_files->at(0));
   EXPECT_EQ(LOG_FILE_T2, fileops.remote_log_files->at(1));
 }
 
+TEST_F(BarnAgentTest, CatchesUpNewestFirst) {
+  barn_conf.catch_up_files = 2;
+  for (auto name : {"f1", "f2", "f3", "f4", "f5", "f6"})
+    fileops.local_log_files->push_back(name);
+  fileops.remote_log_files->push_back("f1");
+
+  for (int round = 0; round < 3; ++round)
+    dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
+  EXPECT_EQ(vector<string>({"f1", "f6", "f2", "f5", "f3", "f4"}),
+            *fileops.remote_log_files);
+  EXPECT_EQ("f4", fileops.shipped_marks[RSYNC_TARGET]);
+
+  // Nothing left behind, even with newer files on the server.
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
+  EXPECT_EQ(6U, fileops.remote_log_files->size());
+}
+
+TEST_F(BarnAgentTest, ShipsGapsBelowNewerFiles) {
+  // Shipped up to T0 by an earlier round, which then shipped T2 out of order.
+  fileops.write_shipped_mark(SOURCE_DIRECTORY, RSYNC_TARGET, LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T1);
+  fileops.local_log_files->push_back(LOG_FILE_T2);
+  fileops.remote_log_files->push_back(LOG_FILE_T2);
+
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
+  EXPECT_EQ(2U, fileops.remote_log_files->size());
+  EXPECT_EQ(LOG_FILE_T1, fileops.remote_log_files->at(1));
+}
+
+TEST_F(BarnAgentTest, FailbackShipsWhatTheBackupGot) {
+  FailoverChannelSelector<AgentChannel> failover(PRIMARY, BACKUP, FAILOVER_INTERVAL);
+  fileops.local_log_files->push_back(LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T1);
+  dispatch_new_logs(barn_conf, fileops, failover, metrics, scheduler);
+
+  // T2 only goes to the backup while failed over.
+  ASSERT_TRUE(failover.switch_channel());
+  fileops.local_log_files->push_back(LOG_FILE_T2);
+  dispatch_new_logs(barn_conf, fileops, failover, metrics, scheduler);
+  EXPECT_EQ(LOG_FILE_T2, fileops.shipped_marks[BACKUP_TARGET]);
+  EXPECT_EQ(LOG_FILE_T1, fileops.shipped_marks[RSYNC_TARGET]);
+
+  ASSERT_TRUE(failover.switch_channel());
+  fileops.local_log_files->push_back(LOG_FILE_T3);
+  dispatch_new_logs(barn_conf, fileops, failover, metrics, scheduler);
+  EXPECT_EQ(vector<string>({LOG_FILE_T0, LOG_FILE_T1, LOG_FILE_T2, LOG_FILE_T3}),
+            *fileops.remote_log_files);
+  EXPECT_EQ(LOG_FILE_T3, fileops.shipped_marks[RSYNC_TARGET]);
+}
+
+TEST_F(BarnAgentTest, RecordsTheTargetSwitchedTo) {
+  TempDir temp("agent_flight");
+  const string dump = temp.file("flight.bin");
+  set_flight_recorder_dump(dump, "barn_agent_test");
+  FailoverChannelSelector<AgentChannel> failover(PRIMARY, BACKUP, FAILOVER_INTERVAL);
+  ASSERT_TRUE(failover.switch_channel());
+  ASSERT_TRUE(dump_flight_recorder());
+
+  FlightDumpHeader header;
+  vector<FlightEvent> events;
+  ASSERT_TRUE(read_flight_dump(dump, &header, &events));
+  ASSERT_FALSE(events.empty());
+  EXPECT_EQ((uint32_t)FlightEventType::ChannelSwitch, events.back().type);
+  EXPECT_EQ(1, events.back().a);
+  EXPECT_EQ(string(BACKUP_TARGET), events.back().text);
+}
+
+TEST_F(BarnAgentTest, StatsdThatDoesNotResolveFallsBack) {
+  barn_conf.statsd_addr = "127.0.0.1:no_such_service";
+  barn_conf.statsd_prefix = "barn";
+  barn_conf.statsd_max_datagram = 1432;
+  barn_conf.service_name = "svc";
+  barn_conf.category = "main";
+  barn_conf.monitor_port = 0;
+  unique_ptr<Metrics> none(create_metrics(barn_conf, nullptr));
+  EXPECT_NE(nullptr, dynamic_cast<NoOpMetrics*>(none.get()));
+
+  barn_conf.monitor_port = 23635;
+  unique_ptr<Metrics> monitor(create_metrics(barn_conf, nullptr));
+  EXPECT_NE(nullptr, dynamic_cast<LocalReport*>(monitor.get()));
+}
+
+TEST_F(BarnAgentTest, PinsAgainstPruning) {
+  barn_conf.pin_budget_mb = 1;
+  fileops.local_log_files->push_back(LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T1);
+  fileops.local_log_files->push_back(LOG_FILE_T2);
+  fileops.prune_on_ship = {LOG_FILE_T0, LOG_FILE_T1};
+
+  dispatch_new_logs(barn_conf, fileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_EQ(3U, fileops.remote_log_files->size());
+  EXPECT_EQ(0, (*recording_metrics.sent)[LostDuringShip]);
+  EXPECT_TRUE(fileops.pinned.empty());
+}
+
+TEST_F(BarnAgentTest, LosesPrunedFilesWithoutPins) {
+  fileops.local_log_files->push_back(LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T1);
+  fileops.local_log_files->push_back(LOG_FILE_T2);
+  fileops.prune_on_ship = {LOG_FILE_T0, LOG_FILE_T1};
+
+  dispatch_new_logs(barn_conf, fileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_EQ(vector<string>({LOG_FILE_T2}), *fileops.remote_log_files);
+  EXPECT_EQ(2, (*recording_metrics.sent)[LostDuringShip]);
+}
+
+TEST_F(BarnAgentTest, ShipsOrphanPins) {
+  // Pinned by an earlier run, then pruned.
+  fileops.pinned.insert(LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T1);
+
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
+  EXPECT_EQ(vector<string>({LOG_FILE_T0, LOG_FILE_T1}), *fileops.remote_log_files);
+  EXPECT_TRUE(fileops.pinned.empty());
+}
+
+TEST_F(BarnAgentTest, ReleasesPinsOfShippedFiles) {
+  fileops.write_shipped_mark(SOURCE_DIRECTORY, RSYNC_TARGET, LOG_FILE_T1);
+  fileops.pinned.insert(LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T1);
+  fileops.remote_log_files->push_back(LOG_FILE_T1);
+
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
+  EXPECT_EQ(1U, fileops.remote_log_files->size());
+  EXPECT_TRUE(fileops.pinned.empty());
+}
+
 TEST_F(BarnAgentTest, ShipFailure) {
   fileops.local_log_files->push_back(TEST_LOG_FILE);
   fileops.shipping_ok = false;
 
-  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, channel_selector, metrics, scheduler);
+  EXPECT_EQ(0U, fileops.remote_log_files->size());
+}
+
+TEST_F(BarnAgentTest, DrainShipsEverything) {
+  fileops.local_log_files->push_back(LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T1);
+  fileops.local_log_files->push_back(LOG_FILE_T2);
+
+  EXPECT_EQ(EXIT_DRAINED, drain_logs(barn_conf, fileops, channel_selector, recording_metrics));
+  EXPECT_EQ(3U, fileops.remote_log_files->size());
+  EXPECT_EQ(LOG_FILE_T2, fileops.shipped_marks[RSYNC_TARGET]);
+  EXPECT_EQ(3, (*recording_metrics.sent)[NumFilesShipped]);
+  EXPECT_EQ(0, (*recording_metrics.sent)[DrainFilesLeft]);
+}
+
+TEST_F(BarnAgentTest, DrainReportsFilesLeft) {
+  fileops.local_log_files->push_back(LOG_FILE_T0);
+  fileops.local_log_files->push_back(LOG_FILE_T1);
+  fileops.shipping_ok = false;
+
+  EXPECT_EQ(EXIT_UNSHIPPED_LEFT,
+            drain_logs(barn_conf, fileops, channel_selector, recording_metrics));
   EXPECT_EQ(0U, fileops.remote_log_files->size());
+  EXPECT_EQ(0, (*recording_metrics.sent)[NumFilesShipped]);
 }
 
 
 class MockFileOps : public FileOps {
 public:
+  MOCK_CONST_METHOD2(wait_for_new_file_within, bool(const string&, int));
   MOCK_CONST_METHOD2(wait_for_new_file_in_directory,
         bool(const string&, int));
-  MOCK_CONST_METHOD1(file_exists, bool(string));
+  MOCK_CONST_METHOD1(file_exists, bool(const string&));
+  MOCK_CONST_METHOD1(file_size, uintmax_t(const string&));
 
   MOCK_CONST_METHOD2(ship_file, bool(const string&, const string&));
   MOCK_CONST_METHOD1(list_log_directory,
-        FileNameList(string));
+        FileNameList(const string&));
   MOCK_CONST_METHOD3(log_files_not_on_target,
         Validation<FileNameList>(const string&, const FileNameList&, const string&));
+  MOCK_CONST_METHOD3(read_shipped_mark, bool(const string&, const string&, string*));
+  MOCK_CONST_METHOD3(write_shipped_mark, bool(const string&, const string&, const string&));
+  MOCK_CONST_METHOD2(pin_file, bool(const string&, const string&));
+  MOCK_CONST_METHOD2(unpin_file, void(const string&, const string&));
+  MOCK_CONST_METHOD1(list_pinned, FileNameList(const string&));
+  MOCK_CONST_METHOD1(drop_from_page_cache, uintmax_t(const string&));
 };
 
 
@@ -222,6 +463,10 @@ protected:
       .WillByDefault(Return(true));
     ON_CALL(mfileops, file_exists(_))
       .WillByDefault(Return(true));
+    ON_CALL(mfileops, write_shipped_mark(_, _, _))
+      .WillByDefault(Return(true));
+    ON_CALL(mfileops, list_pinned(_))
+      .WillByDefault(Return(FileNameList()));
 
   }
 public:
@@ -232,7 +477,7 @@ public:
 TEST_F(MetricsSendingTest, TestNoOp) {
   EXPECT_CALL(mfileops, list_log_directory(_))
       .WillOnce(Return(FileNameList()));
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(0, (*recording_metrics.sent)[FailedToGetSyncList]);
   EXPECT_EQ(0, (*recording_metrics.sent)[FilesToShip]);
   EXPECT_EQ(0, (*recording_metrics.sent)[FullDirectoryShip]);
@@ -242,16 +487,162 @@ TEST_F(MetricsSendingTest, TestNoOp) {
 }
 
 TEST_F(MetricsSendingTest, TestSuccesfulShip) {
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(2, (*recording_metrics.sent)[FilesToShip]);
   EXPECT_EQ(2, (*recording_metrics.sent)[NumFilesShipped]);
   EXPECT_EQ(1, (*recording_metrics.sent)[FullDirectoryShip]);
 }
 
+TEST_F(MetricsSendingTest, TestShipHistograms) {
+  ON_CALL(mfileops, file_size(_))
+      .WillByDefault(Return(1024));
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_EQ(1U, (*recording_metrics.recorded)[DryRunLatency].size());
+  EXPECT_EQ(2U, (*recording_metrics.recorded)[ShipLatency].size());
+  EXPECT_EQ(vector<int64_t>({1024, 1024}), (*recording_metrics.recorded)[ShipFileSize]);
+  EXPECT_EQ(0U, (*recording_metrics.recorded)[WaitLatency].size());
+}
+
+TEST_F(MetricsSendingTest, TestSkipsDryRunAfterDryRunAhead) {
+  RotationWatch rotation_watch(2);
+  rotation_watch.dry_run_done(channel_selector.pick_channel().rsync_target, {LOG_FILE_T0});
+  EXPECT_CALL(mfileops, log_files_not_on_target(_, _, _)).Times(0);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler,
+                    UnlimitedShipping(), &rotation_watch);
+  EXPECT_EQ(1, (*recording_metrics.sent)[RoundsWithoutDryRun]);
+  EXPECT_EQ(1, (*recording_metrics.sent)[NumFilesShipped]);
+
+  // The next round dry runs again.
+  EXPECT_CALL(mfileops, log_files_not_on_target(_, _, _)).Times(1);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler,
+                    UnlimitedShipping(), &rotation_watch);
+}
+
+TEST_F(MetricsSendingTest, TestDropsShippedFromPageCache) {
+  ON_CALL(mfileops, drop_from_page_cache(_))
+      .WillByDefault(Return(4096));
+  EXPECT_CALL(mfileops, drop_from_page_cache(_)).Times(2);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_EQ(8192, (*recording_metrics.sent)[PageCacheBytes]);
+}
+
+TEST_F(MetricsSendingTest, TestKeepsUnshippedInPageCache) {
+  ON_CALL(mfileops, ship_file(_, _))
+      .WillByDefault(Return(false));
+  EXPECT_CALL(mfileops, drop_from_page_cache(_)).Times(0);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+
+  barn_conf.drop_page_cache = false;
+  ON_CALL(mfileops, ship_file(_, _))
+      .WillByDefault(Return(true));
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+}
+
+class CountingSlots : public ShippingSlots {
+public:
+  mutable vector<int64_t> acquired;
+  mutable int released = 0;
+
+  bool acquire(int64_t bytes, bool interruptible) const override {
+    acquired.push_back(bytes);
+    return true;
+  }
+  void release() const override { released++; }
+};
+
+TEST_F(MetricsSendingTest, TestShipsThroughSlots) {
+  ON_CALL(mfileops, file_size(_))
+      .WillByDefault(Return(1024));
+  CountingSlots slots;
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler, slots);
+  EXPECT_EQ(vector<int64_t>({1024, 1024}), slots.acquired);
+  EXPECT_EQ(2, slots.released);
+  EXPECT_EQ(2U, (*recording_metrics.recorded)[SlotWaitLatency].size());
+}
+
+// Give up waiting, as on a reload, drain or upgrade.
+class InterruptedSlots : public ShippingSlots {
+public:
+  mutable int released = 0;
+
+  bool acquire(int64_t bytes, bool interruptible) const override { return !interruptible; }
+  void release() const override { released++; }
+};
+
+TEST_F(MetricsSendingTest, TestInterruptedSlotWaitEndsTheRound) {
+  EXPECT_CALL(mfileops, ship_file(_, _)).Times(0);
+  InterruptedSlots slots;
+  const auto decision = ship_round(barn_conf, mfileops, channel_selector, recording_metrics,
+                                   scheduler, slots, nullptr);
+  // Not an error to back off from.
+  EXPECT_NE(NextRound::AfterBackoff, decision.next);
+  EXPECT_EQ(0, slots.released);
+}
+
+TEST_F(MetricsSendingTest, TestScheduling) {
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_EQ(1, (*recording_metrics.sent)[RoundsBackToBack]);
+  EXPECT_EQ(0, (*recording_metrics.sent)[RoundsWaitingForFile]);
+
+  EXPECT_CALL(mfileops, list_log_directory(_))
+      .WillOnce(Return(FileNameList()));
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_EQ(1, (*recording_metrics.sent)[RoundsWaitingForFile]);
+}
+
+TEST_F(MetricsSendingTest, TestShipRoundLeavesTheWait) {
+  EXPECT_CALL(mfileops, list_log_directory(_))
+      .WillOnce(Return(FileNameList()));
+  EXPECT_CALL(mfileops, wait_for_new_file_in_directory(_, _)).Times(0);
+  const auto decision = ship_round(barn_conf, mfileops, channel_selector, recording_metrics,
+                                   scheduler, UnlimitedShipping(), nullptr);
+  EXPECT_EQ(NextRound::OnNewFile, decision.next);
+  EXPECT_EQ(0U, (*recording_metrics.recorded)[WaitLatency].size());
+}
+
+TEST_F(MetricsSendingTest, TestWaitHistogram) {
+  EXPECT_CALL(mfileops, list_log_directory(_))
+      .WillOnce(Return(FileNameList()));
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_EQ(1U, (*recording_metrics.recorded)[WaitLatency].size());
+  EXPECT_EQ(0U, (*recording_metrics.recorded)[ShipLatency].size());
+}
+
+TEST_F(MetricsSendingTest, TestLag) {
+  // Rotated 300, 200 and 100 seconds ago, the oldest one already shipped.
+  const int64_t now = time(0);
+  FileNameList log_files;
+  for (int64_t age : {300, 200, 100}) {
+    char name[32];
+    snprintf(name, sizeof(name), "@%016llx00000000.s",
+             (unsigned long long)((1ULL << 62) + 10 + now - age));
+    log_files.push_back(name);
+  }
+  EXPECT_CALL(mfileops, list_log_directory(_))
+    .WillRepeatedly(Return(log_files));
+  EXPECT_CALL(mfileops, log_files_not_on_target(_, _, _))
+    .WillOnce(Return(FileNameList(log_files.begin() + 1, log_files.end())));
+  ON_CALL(mfileops, file_size(_))
+      .WillByDefault(Return(1024));
+
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_NEAR(300, (*recording_metrics.sent)[NewestShippedAge], 2);
+  EXPECT_NEAR(200, (*recording_metrics.sent)[OldestUnshippedAge], 2);
+  EXPECT_EQ(2048, (*recording_metrics.sent)[BacklogBytes]);
+}
+
+TEST_F(MetricsSendingTest, TestNoLagWhenCaughtUp) {
+  EXPECT_CALL(mfileops, log_files_not_on_target(_, _, _))
+    .WillOnce(Return(FileNameList()));
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
+  EXPECT_EQ(0, (*recording_metrics.sent)[OldestUnshippedAge]);
+  EXPECT_EQ(0, (*recording_metrics.sent)[BacklogBytes]);
+}
+
 TEST_F(MetricsSendingTest, TestFailedShip) {
   ON_CALL(mfileops, ship_file(_, _))
       .WillByDefault(Return(false));
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(2, (*recording_metrics.sent)[FilesToShip]);
   EXPECT_EQ(0, (*recording_metrics.sent)[NumFilesShipped]);
 }
@@ -261,7 +652,7 @@ TEST_F(MetricsSendingTest, TestPartialShip) {
     .WillOnce(Return(true));
   EXPECT_CALL(mfileops, ship_file(log_dir(LOG_FILE_T1), _))
     .WillOnce(Return(false));
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(2, (*recording_metrics.sent)[FilesToShip]);
   EXPECT_EQ(1, (*recording_metrics.sent)[NumFilesShipped]);
 }
@@ -269,7 +660,7 @@ TEST_F(MetricsSendingTest, TestPartialShip) {
 TEST_F(MetricsSendingTest, TestFailedToGetSyncList) {
   EXPECT_CALL(mfileops, log_files_not_on_target(_, _, _))
     .WillOnce(Return(BarnError("Failed to sync")));
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(1, (*recording_metrics.sent)[FailedToGetSyncList]);
 }
 
@@ -281,7 +672,7 @@ TEST_F(MetricsSendingTest, TestLostDuringShip) {
   EXPECT_CALL(mfileops, file_exists(log_dir(LOG_FILE_T0)))
     .WillOnce(Return(false));
 
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(1, (*recording_metrics.sent)[LostDuringShip]);
   EXPECT_EQ(0, (*recording_metrics.sent)[RotatedDuringShip]);
 }
@@ -297,7 +688,7 @@ TEST_F(MetricsSendingTest, TestRotatedDuringShip) {
     .WillOnce(Return(log_files))
     .WillOnce(Return(missing_log_files));
 
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(0, (*recording_metrics.sent)[LostDuringShip]);
   EXPECT_EQ(1, (*recording_metrics.sent)[RotatedDuringShip]);
 }
@@ -308,7 +699,7 @@ TEST_F(MetricsSendingTest, TestFullDirectoryShip) {
 
   EXPECT_CALL(mfileops, log_files_not_on_target(_, _, _))
     .WillOnce(Return(log_files));
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(0, (*recording_metrics.sent)[FullDirectoryShip]);
 
   log_files.clear();
@@ -316,7 +707,7 @@ TEST_F(MetricsSendingTest, TestFullDirectoryShip) {
   log_files.push_back(LOG_FILE_T1);
   EXPECT_CALL(mfileops, log_files_not_on_target(_, _, _))
     .WillOnce(Return(log_files));
-  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, channel_selector, recording_metrics, scheduler);
   EXPECT_EQ(1, (*recording_metrics.sent)[FullDirectoryShip]);
 }
 
@@ -328,6 +719,7 @@ public:
   MOCK_METHOD0(heartbeat, void());
   MOCK_CONST_METHOD0(current, AgentChannel());
   MOCK_METHOD0(pick_channel, AgentChannel());
+  MOCK_METHOD3(update_channels, void(const AgentChannel&, const AgentChannel&, int));
 };
 
 
@@ -352,6 +744,8 @@ protected:
         .WillByDefault(Return(true));
     ON_CALL(mfileops, file_exists(_))
         .WillByDefault(Return(true));
+    ON_CALL(mfileops, list_pinned(_))
+        .WillByDefault(Return(FileNameList()));
   }
 
 public:
@@ -363,13 +757,13 @@ public:
 TEST_F(ChannelSelectionTest, TestHeartbeatOnNoOp) {
   EXPECT_CALL(m_channel_selector, pick_channel()).WillOnce(Return(PRIMARY));
   EXPECT_CALL(m_channel_selector, heartbeat()).WillOnce(Return());
-  dispatch_new_logs(barn_conf, fileops, m_channel_selector, metrics);
+  dispatch_new_logs(barn_conf, fileops, m_channel_selector, metrics, scheduler);
 }
 
 TEST_F(ChannelSelectionTest, TestHeartbeatSuccessfulShip) {
   fileops.local_log_files->push_back(TEST_LOG_FILE);
   EXPECT_CALL(m_channel_selector, heartbeat()).WillOnce(Return());
-  dispatch_new_logs(barn_conf, fileops, m_channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, fileops, m_channel_selector, recording_metrics, scheduler);
 }
 
 // Tests that a 'flacky' channel is considered an active channel.
@@ -380,7 +774,7 @@ TEST_F(ChannelSelectionTest, TestHeartbeatPartialShip) {
       .WillOnce(Return(false));
   // Should still heartbeat
   EXPECT_CALL(m_channel_selector, heartbeat()).WillOnce(Return());
-  dispatch_new_logs(barn_conf, mfileops, m_channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, m_channel_selector, recording_metrics, scheduler);
 }
 
 TEST_F(ChannelSelectionTest, TestNoHeartbeatOnFailedShip) {
@@ -389,7 +783,7 @@ TEST_F(ChannelSelectionTest, TestNoHeartbeatOnFailedShip) {
       .WillOnce(Return(false));
   // Should not heartbeat
   EXPECT_CALL(m_channel_selector, heartbeat()).Times(0);
-  dispatch_new_logs(barn_conf, mfileops, m_channel_selector, recording_metrics);
+  dispatch_new_logs(barn_conf, mfileops, m_channel_selector, recording_metrics, scheduler);
 }
 
 }  // namespace barn_agent_test
@@ -131,3 +131,32 @@ TEST_F(ChannelSelectorTest, FullStory) {
 }
 
 
+TEST_F(ChannelSelectorTest, UpdateChannelsKeepsHealth) {
+  MockChannelSelector cs = MockChannelSelector();
+  cs.now = FAILOVER_INTERVAL + 1;
+  cs.pick_channel();
+  EXPECT_EQ(SECONDARY, cs.current());
+
+  cs.update_channels(3, 4, FAILOVER_INTERVAL * 2);
+  EXPECT_EQ(4, cs.current());
+  cs.now = FAILOVER_INTERVAL * 2;
+  EXPECT_EQ(4, cs.pick_channel());
+  cs.now = FAILOVER_INTERVAL * 3 + 1;
+  EXPECT_EQ(3, cs.pick_channel());
+}
+
+
+TEST_F(ChannelSelectorTest, SwitchesAsAsked) {
+  MockChannelSelector cs = MockChannelSelector();
+  EXPECT_TRUE(cs.switch_channel());
+  EXPECT_EQ(SECONDARY, cs.pick_channel());
+
+  // Stays on the backup for the failover period, then tries primary.
+  cs.now = FAILOVER_INTERVAL - 1;
+  EXPECT_EQ(SECONDARY, cs.pick_channel());
+  EXPECT_TRUE(cs.switch_channel());
+  EXPECT_EQ(PRIMARY, cs.pick_channel());
+
+  SingleChannelSelector<int> single(PRIMARY);
+  EXPECT_FALSE(single.switch_channel());
+}
@@ -0,0 +1,102 @@
+#include <string>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "control_client.h"
+#include "control_socket.h"
+#include "sighandle.h"
+#include "temp_dir.h"
+
+using namespace std;
+
+class ControlSocketTest : public ::testing::Test {
+public:
+  void TearDown() {
+    // Global to the process, like the agent's signals.
+    set_control_paused(false);
+    take_switch_request();
+    take_wake_up();
+  }
+};
+
+TEST_F(ControlSocketTest, FormatsAges) {
+  ControlStatus status = {"svc:main", 42, AgentActivity::Shipping,
+                          "rsync://10.0.0.1:1025/barn_logs/svc@main@host/", true,
+                          3, 3000, "@400000005dbc2a281d2b3c4f.s",
+                          "/logs/@400000005dbc2a321d2b3c4f.s", 1000, 2, 3, 1572612650,
+                          "rsync failed", 1572612600, 7};
+  const auto served = parse_status_reply(format_status(status, 1572612660));
+
+  EXPECT_EQ("svc:main", served.at("agent"));
+  EXPECT_EQ("shipping", served.at("activity"));
+  EXPECT_EQ("1", served.at("on_backup"));
+  EXPECT_EQ("3000", served.at("backlog_bytes"));
+  // Rotated at 1572612638.
+  EXPECT_EQ("22", served.at("oldest_unshipped_age"));
+  EXPECT_EQ("2", served.at("in_flight_number"));
+  EXPECT_EQ("10", served.at("in_flight_seconds"));
+  EXPECT_EQ("rsync failed", served.at("last_error"));
+  EXPECT_EQ("60", served.at("last_error_age"));
+  EXPECT_EQ("7", served.at("rounds"));
+
+  // Without a file in flight, errors or backlog, no ages of them.
+  status.in_flight = status.last_error = status.oldest_unshipped = "";
+  const auto idle = parse_status_reply(format_status(status, 1572612660));
+  EXPECT_EQ("", idle.at("in_flight"));
+  EXPECT_EQ(0U, idle.count("in_flight_seconds"));
+  EXPECT_EQ(0U, idle.count("last_error_age"));
+  EXPECT_EQ(0U, idle.count("oldest_unshipped_age"));
+}
+
+TEST_F(ControlSocketTest, PausesAndResumes) {
+  EXPECT_EQ("ok\n", handle_control_command("pause"));
+  EXPECT_TRUE(control_paused());
+  // Ends the wait for the next round, to pause right away.
+  EXPECT_TRUE(take_wake_up());
+  EXPECT_EQ("error: paused\n", handle_control_command("round"));
+  EXPECT_FALSE(take_wake_up());
+
+  EXPECT_EQ("ok\n", handle_control_command("resume"));
+  EXPECT_FALSE(control_paused());
+  EXPECT_TRUE(take_wake_up());
+  EXPECT_EQ("ok\n", handle_control_command("round"));
+  EXPECT_TRUE(take_wake_up());
+}
+
+TEST_F(ControlSocketTest, SwitchesOnce) {
+  EXPECT_FALSE(take_switch_request());
+  EXPECT_EQ("ok\n", handle_control_command("switch"));
+  // Between rounds, not in the middle of a wait.
+  EXPECT_FALSE(take_wake_up());
+  EXPECT_TRUE(take_switch_request());
+  EXPECT_FALSE(take_switch_request());
+
+  EXPECT_EQ("error: unknown command 'reboot'\n", handle_control_command("reboot"));
+}
+
+TEST_F(ControlSocketTest, ServesOverTheSocket) {
+  TempDir temp("control");
+  const string path = temp.file("agent.sock");
+  // A stale socket from a killed agent is replaced.
+  ASSERT_TRUE(start_control_socket(path));
+  ASSERT_TRUE(start_control_socket(path));
+  status_identity("svc", "main");
+  status_backlog(4, 4096, "");
+
+  string reply, problem;
+  ASSERT_TRUE(control_request(path, "status", &reply, &problem)) << problem;
+  const auto served = parse_status_reply(reply);
+  EXPECT_EQ("svc:main", served.at("agent"));
+  EXPECT_EQ(to_string(getpid()), served.at("pid"));
+  EXPECT_EQ("4", served.at("backlog_files"));
+
+  ASSERT_TRUE(control_request(path, "pause", &reply, &problem)) << problem;
+  EXPECT_EQ("ok\n", reply);
+  EXPECT_TRUE(control_paused());
+
+  // Removed as the agent exits.
+  { ControlSocketCleanup cleanup(path); }
+  EXPECT_NE(0, access(path.c_str(), F_OK));
+  EXPECT_FALSE(control_request(path, "status", &reply, &problem));
+  EXPECT_NE("", problem);
+}
@@ -0,0 +1,212 @@
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <signal.h>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+#include "drain.h"
+#include "files.h"
+#include "temp_dir.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+/*
+ * Ships slowly, counting how many ships overlap. Paths containing "fail"
+ * fail, those containing "gone" fail and don't exist.
+ */
+class OverlapFileOps : public FileOps {
+public:
+  bool ship_file(const string& file_path, const string& target) const override {
+    const int now = ++shipping;
+    int seen = most_at_once.load();
+    while (now > seen && !most_at_once.compare_exchange_weak(seen, now)) {}
+    this_thread::sleep_for(chrono::milliseconds(20));
+    --shipping;
+    return file_path.find("fail") == string::npos && file_path.find("gone") == string::npos;
+  }
+  bool file_exists(const string& path) const override {
+    return path.find("gone") == string::npos;
+  }
+
+  mutable atomic<int> shipping{0};
+  mutable atomic<int> most_at_once{0};
+};
+
+class DrainTest : public ::testing::Test {
+public:
+  void write_current(const string& contents) {
+    ofstream(join_path(directory, "current").c_str(), ios::trunc) << contents;
+  }
+
+  // The files svlogd would have rotated.
+  FileNameList rotated() {
+    FileOps fileops;
+    return fileops.list_log_directory(directory);
+  }
+
+  string contents(const string& name) {
+    ifstream in(join_path(directory, name).c_str());
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  }
+
+  TempDir temp{"drain"};
+  const string directory{temp.path};
+};
+
+TEST_F(DrainTest, ShipsInParallel) {
+  OverlapFileOps fileops;
+  vector<string> paths;
+  for (int i = 0; i < 12; ++i)
+    paths.push_back("/logs/@" + to_string(i));
+  paths[3] = "/logs/@fail";
+  paths[7] = "/logs/@gone";
+  const vector<uintmax_t> sizes(paths.size(), 10);
+
+  int reports = 0;
+  DrainProgress last = {};
+  vector<DrainOutcome> outcomes;
+  const auto progress = ship_in_parallel(
+        fileops, paths, sizes, "rsync_t", 4, 1,
+        [&](const DrainProgress& now) { ++reports; last = now; }, &outcomes);
+
+  EXPECT_EQ(4, fileops.most_at_once.load());
+  EXPECT_EQ(12, progress.files);
+  EXPECT_EQ(10, progress.shipped);
+  EXPECT_EQ(1, progress.failed);
+  EXPECT_EQ(1, progress.lost);
+  EXPECT_EQ(120U, progress.bytes);
+  EXPECT_EQ(100U, progress.bytes_shipped);
+  EXPECT_EQ(DrainOutcome::Failed, outcomes[3]);
+  EXPECT_EQ(DrainOutcome::Lost, outcomes[7]);
+  EXPECT_EQ(DrainOutcome::Shipped, outcomes[11]);
+  // At least the final report.
+  EXPECT_LE(1, reports);
+  EXPECT_EQ(10, last.shipped);
+}
+
+TEST_F(DrainTest, ShipsNothingWithoutFiles) {
+  OverlapFileOps fileops;
+  vector<DrainOutcome> outcomes;
+  const auto progress = ship_in_parallel(
+        fileops, {}, {}, "rsync_t", 4, 1, [](const DrainProgress&) {}, &outcomes);
+  EXPECT_EQ(0, progress.files);
+  EXPECT_EQ(0, fileops.most_at_once.load());
+}
+
+TEST_F(DrainTest, FindsLockHolder) {
+  const auto lock = join_path(directory, "lock");
+  const int fd = open(lock.c_str(), O_WRONLY | O_CREAT, 0600);
+  ASSERT_LE(0, fd);
+  EXPECT_EQ(0, lock_holder(lock));
+  ASSERT_EQ(0, flock(fd, LOCK_EX));
+  EXPECT_EQ(getpid(), lock_holder(lock));
+  close(fd);
+  EXPECT_EQ(0, lock_holder(lock));
+}
+
+TEST_F(DrainTest, RenamesCurrentWithoutSvlogd) {
+  write_current("last lines\n");
+  ASSERT_TRUE(rotate_current(directory, 1));
+
+  EXPECT_FALSE(fs::exists(join_path(directory, "current")));
+  const auto files = rotated();
+  ASSERT_EQ(1U, files.size());
+  EXPECT_EQ("last lines\n", contents(files[0]));
+  EXPECT_NEAR(time(0), tai64n_unix_seconds(files[0]), 5);
+  struct stat st;
+  stat(join_path(directory, files[0]).c_str(), &st);
+  EXPECT_EQ(0744U, st.st_mode & 0777);
+}
+
+TEST_F(DrainTest, LeavesEmptyCurrent) {
+  write_current("");
+  EXPECT_TRUE(rotate_current(directory, 1));
+  EXPECT_TRUE(fs::exists(join_path(directory, "current")));
+  EXPECT_TRUE(rotated().empty());
+
+  // Nothing to rotate without one either.
+  fs::remove(join_path(directory, "current"));
+  EXPECT_TRUE(rotate_current(directory, 1));
+}
+
+static volatile sig_atomic_t alarmed = 0;
+
+static void on_alarm(int) {
+  alarmed = 1;
+}
+
+TEST_F(DrainTest, AsksSvlogdToRotate) {
+  write_current("last lines\n");
+  int ready[2];
+  ASSERT_EQ(0, pipe(ready));
+  // No allocating in the child of a threaded process.
+  const auto lock = join_path(directory, "lock");
+  const auto current = join_path(directory, "current");
+  const auto rotated_current = join_path(directory, "@400000005dbc2a281d2b3c4f.s");
+
+  // Stands in for svlogd: holds the lock, rotates on SIGALRM.
+  const pid_t svlogd = fork();
+  ASSERT_LE(0, svlogd);
+  if (svlogd == 0) {
+    signal(SIGALRM, on_alarm);
+    const int fd = open(lock.c_str(), O_WRONLY | O_CREAT, 0600);
+    flock(fd, LOCK_EX);
+    if (write(ready[1], "x", 1) != 1)
+      _exit(1);
+    while (!alarmed)
+      usleep(1000);
+    rename(current.c_str(), rotated_current.c_str());
+    close(open(current.c_str(), O_WRONLY | O_CREAT, 0644));
+    _exit(0);
+  }
+  char x;
+  ASSERT_EQ(1, read(ready[0], &x, 1));
+  close(ready[0]);
+  close(ready[1]);
+
+  EXPECT_TRUE(rotate_current(directory, 5));
+  int status;
+  waitpid(svlogd, &status, 0);
+  EXPECT_EQ(vector<string>({"@400000005dbc2a281d2b3c4f.s"}), rotated());
+  EXPECT_EQ("last lines\n", contents("@400000005dbc2a281d2b3c4f.s"));
+}
+
+TEST_F(DrainTest, GivesUpOnSilentSvlogd) {
+  write_current("last lines\n");
+  int ready[2];
+  ASSERT_EQ(0, pipe(ready));
+  const auto lock = join_path(directory, "lock");
+
+  const pid_t svlogd = fork();
+  ASSERT_LE(0, svlogd);
+  if (svlogd == 0) {
+    signal(SIGALRM, SIG_IGN);
+    const int fd = open(lock.c_str(), O_WRONLY | O_CREAT, 0600);
+    flock(fd, LOCK_EX);
+    if (write(ready[1], "x", 1) != 1)
+      _exit(1);
+    pause();
+    _exit(0);
+  }
+  char x;
+  ASSERT_EQ(1, read(ready[0], &x, 1));
+  close(ready[0]);
+  close(ready[1]);
+
+  EXPECT_FALSE(rotate_current(directory, 1));
+  kill(svlogd, SIGKILL);
+  int status;
+  waitpid(svlogd, &status, 0);
+  EXPECT_TRUE(rotated().empty());
+}
@@ -0,0 +1,89 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "flight_recorder.h"
+#include "temp_dir.h"
+
+using namespace std;
+
+class FlightRecorderTest : public ::testing::Test {
+public:
+  void SetUp() {
+    set_flight_recorder_dump(path, "barn-agent svc:main");
+  }
+
+  vector<FlightEvent> dumped_events() {
+    FlightDumpHeader header;
+    vector<FlightEvent> events;
+    EXPECT_TRUE(dump_flight_recorder());
+    EXPECT_TRUE(read_flight_dump(path, &header, &events));
+    EXPECT_EQ(getpid(), header.pid);
+    EXPECT_EQ(string("barn-agent svc:main"), header.process_name);
+    return events;
+  }
+
+  TempDir temp{"flight"};
+  const string path{temp.file("flight.bin")};
+};
+
+TEST_F(FlightRecorderTest, DumpsEventsInOrder) {
+  flight_record(FlightEventType::Candidates, 2, 10);
+  flight_record(FlightEventType::ChildExit, 1234, 23, "rsync");
+
+  vector<FlightEvent> events = dumped_events();
+  ASSERT_LE(2U, events.size());
+  const FlightEvent& candidates = events[events.size() - 2];
+  const FlightEvent& child = events.back();
+  EXPECT_EQ((uint32_t)FlightEventType::Candidates, candidates.type);
+  EXPECT_EQ(2, candidates.a);
+  EXPECT_EQ(10, candidates.b);
+  EXPECT_EQ(candidates.sequence + 1, child.sequence);
+  EXPECT_EQ(string("rsync"), child.text);
+  EXPECT_LE(candidates.time_us, child.time_us);
+}
+
+TEST_F(FlightRecorderTest, KeepsNewestEvents) {
+  for (int i = 0; i < FLIGHT_RECORDER_SIZE + 5; i++)
+    flight_record(FlightEventType::RoundEnd, i);
+
+  vector<FlightEvent> events = dumped_events();
+  ASSERT_EQ((size_t)FLIGHT_RECORDER_SIZE, events.size());
+  EXPECT_EQ(5, events.front().a);
+  EXPECT_EQ(FLIGHT_RECORDER_SIZE + 4, events.back().a);
+}
+
+TEST_F(FlightRecorderTest, RejectsOtherFiles) {
+  FILE* f = fopen(path.c_str(), "w");
+  fputs("not a dump", f);
+  fclose(f);
+  FlightDumpHeader header;
+  vector<FlightEvent> events;
+  EXPECT_FALSE(read_flight_dump(path, &header, &events));
+}
+
+TEST_F(FlightRecorderTest, FormatsEvents) {
+  FlightEvent event = FlightEvent();
+  event.time_us = 1572612638123456LL;
+  event.type = (uint32_t)FlightEventType::ChildExit;
+  event.a = 1234;
+  event.b = 23;
+  snprintf(event.text, sizeof(event.text), "rsync");
+  EXPECT_EQ("2019-11-01 12:50:38.123456 child_exit pid=1234 status=23 \"rsync\"",
+            format_flight_event(event));
+}
+
+TEST_F(FlightRecorderTest, WaitingIsNoStall) {
+  flight_round_completed();
+  {
+    FlightWait waiting;
+    this_thread::sleep_for(chrono::milliseconds(2100));
+    EXPECT_EQ(0, flight_stalled_seconds());
+  }
+  // Counted again from the end of the wait.
+  EXPECT_GE(1, flight_stalled_seconds());
+}
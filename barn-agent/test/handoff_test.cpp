@@ -0,0 +1,92 @@
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "handoff.h"
+
+using namespace std;
+
+class HandoffTest : public ::testing::Test {
+public:
+  void SetUp() {
+    handoff.host_name = "host.example.com";
+    handoff.primary_ok = false;
+    handoff.last_heartbeat_time = 1500000000;
+    handoff.failure_streak = 3;
+    handoff.unfinished_wait = {NextRound::AfterBackoff, 17};
+    handoff.newest_file = "@400000005dbc2a281d2b3c4f.s";
+    handoff.dry_run_target = "rsync://10.0.0.1:1025/barn_logs/svc@main@host/";
+    handoff.dry_run_on_target = {"@400000005dbc2a1e0f1d2b3c.s", "@400000005dbc2a281d2b3c4f.s"};
+    handoff.statsd_addr = "statsd.example.com:8125";
+    handoff.statsd_resolved = "10.0.0.2:8125";
+    handoff.statsd_fd = 7;
+    handoff.coordinator_entry = 4;
+    handoff.paused = true;
+  }
+
+  static void expect_same(const AgentHandoff& expected, const AgentHandoff& actual) {
+    EXPECT_EQ(expected.host_name, actual.host_name);
+    EXPECT_EQ(expected.primary_ok, actual.primary_ok);
+    EXPECT_EQ(expected.last_heartbeat_time, actual.last_heartbeat_time);
+    EXPECT_EQ(expected.failure_streak, actual.failure_streak);
+    EXPECT_EQ(expected.unfinished_wait.next, actual.unfinished_wait.next);
+    EXPECT_EQ(expected.unfinished_wait.seconds, actual.unfinished_wait.seconds);
+    EXPECT_EQ(expected.newest_file, actual.newest_file);
+    EXPECT_EQ(expected.dry_run_target, actual.dry_run_target);
+    EXPECT_EQ(expected.dry_run_on_target, actual.dry_run_on_target);
+    EXPECT_EQ(expected.statsd_addr, actual.statsd_addr);
+    EXPECT_EQ(expected.statsd_resolved, actual.statsd_resolved);
+    EXPECT_EQ(expected.statsd_fd, actual.statsd_fd);
+    EXPECT_EQ(expected.coordinator_entry, actual.coordinator_entry);
+    EXPECT_EQ(expected.paused, actual.paused);
+  }
+
+  AgentHandoff handoff;
+};
+
+TEST_F(HandoffTest, RoundTrips) {
+  const auto parsed = parse_handoff(serialize_handoff(handoff));
+  ASSERT_FALSE(isFailure(parsed)) << error(parsed);
+  expect_same(handoff, get(parsed));
+}
+
+TEST_F(HandoffTest, PassesThroughMemfd) {
+  const int fd = write_handoff(handoff);
+  ASSERT_LE(0, fd);
+  const auto read = read_handoff(fd);
+  ASSERT_FALSE(isFailure(read)) << error(read);
+  expect_same(handoff, get(read));
+  // Closed once read.
+  EXPECT_EQ(-1, fcntl(fd, F_GETFD));
+}
+
+TEST_F(HandoffTest, SkipsUnknownFields) {
+  const auto parsed = parse_handoff("barn-agent-handoff 1\n"
+                                    "failure_streak 2\n"
+                                    "from_a_newer_agent whatever\n");
+  ASSERT_FALSE(isFailure(parsed)) << error(parsed);
+  EXPECT_EQ(2, get(parsed).failure_streak);
+  // Left out fields start afresh.
+  EXPECT_TRUE(get(parsed).primary_ok);
+  EXPECT_EQ(NextRound::Now, get(parsed).unfinished_wait.next);
+  EXPECT_EQ(-1, get(parsed).statsd_fd);
+  EXPECT_EQ(-1, get(parsed).coordinator_entry);
+  EXPECT_FALSE(get(parsed).paused);
+}
+
+TEST_F(HandoffTest, RejectsOtherVersionsAndBadNumbers) {
+  EXPECT_TRUE(isFailure(parse_handoff("")));
+  EXPECT_TRUE(isFailure(parse_handoff("barn-agent-handoff 2\n")));
+  EXPECT_TRUE(isFailure(parse_handoff("barn-agent-handoff 1\nfailure_streak many\n")));
+  EXPECT_TRUE(isFailure(parse_handoff("barn-agent-handoff 1\nnext_round 9\n")));
+}
+
+TEST_F(HandoffTest, PassesTheFdOnce) {
+  const vector<string> started = {"--source", "/var/log/svc", "--handoff_fd=5"};
+  EXPECT_EQ(vector<string>({"--source", "/var/log/svc", "--handoff_fd=9"}),
+            upgrade_command_line(started, 9));
+  EXPECT_EQ(vector<string>({"--source", "/var/log/svc", "--handoff_fd=9"}),
+            upgrade_command_line({"--handoff_fd", "5", "--source", "/var/log/svc"}, 9));
+}
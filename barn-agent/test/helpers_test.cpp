@@ -125,3 +125,26 @@ TEST_F(CountMissingTest, BarnCase) {
   int actual = count_missing(small, big);
   EXPECT_EQ(2, actual);
 }
+
+
+class Tai64nTest : public HelpersTest {
+};
+
+TEST_F(Tai64nTest, DecodesSvlogdNames) {
+  EXPECT_EQ(0, tai64n_unix_seconds("@400000000000000a00000000.s"));
+  EXPECT_EQ(1572612638, tai64n_unix_seconds("@400000005dbc2a281d2b3c4f.s"));
+  EXPECT_EQ(1572612638, tai64n_unix_seconds("@400000005DBC2A281D2B3C4F.u"));
+}
+
+TEST_F(Tai64nTest, LabelsLikeSvlogd) {
+  EXPECT_EQ("@400000005dbc2a281d2b3c4f", tai64n_label(1572612638, 0x1d2b3c4f));
+  EXPECT_EQ(1572612638, tai64n_unix_seconds(tai64n_label(1572612638, 0) + ".s"));
+}
+
+TEST_F(Tai64nTest, RejectsOtherNames) {
+  EXPECT_EQ(-1, tai64n_unix_seconds("current"));
+  EXPECT_EQ(-1, tai64n_unix_seconds("@40001"));
+  EXPECT_EQ(-1, tai64n_unix_seconds("@400000005dbc2a28xd2b3c4f.s"));
+  // Before the unix epoch
+  EXPECT_EQ(-1, tai64n_unix_seconds("@400000000000000000000000.s"));
+}
@@ -0,0 +1,80 @@
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "histogram.h"
+
+using namespace std;
+
+class HistogramTest : public ::testing::Test {
+};
+
+TEST_F(HistogramTest, Empty) {
+  Histogram h;
+  EXPECT_TRUE(h.empty());
+  EXPECT_EQ(0, h.percentile(50));
+  EXPECT_EQ(0, h.max());
+  EXPECT_EQ(0, h.min());
+}
+
+TEST_F(HistogramTest, SmallValuesAreExact) {
+  Histogram h;
+  for (int i = 1; i <= 100; i++)
+    h.record(i);
+  EXPECT_EQ(100, h.count());
+  EXPECT_EQ(5050, h.sum());
+  EXPECT_EQ(50, h.percentile(50));
+  EXPECT_EQ(90, h.percentile(90));
+  EXPECT_EQ(99, h.percentile(99));
+  EXPECT_EQ(100, h.percentile(100));
+  EXPECT_EQ(1, h.min());
+  EXPECT_EQ(100, h.max());
+}
+
+TEST_F(HistogramTest, LargeValuesWithinOnePercent) {
+  Histogram h;
+  for (int64_t i = 1; i <= 100000; i++)
+    h.record(i * 1000);
+  EXPECT_NEAR(50000000, h.percentile(50), 500000);
+  EXPECT_NEAR(99000000, h.percentile(99), 990000);
+  EXPECT_EQ(100000000, h.max());
+}
+
+TEST_F(HistogramTest, BucketBoundaries) {
+  vector<uint64_t> values = {0, 1, 127, 128, 129, 255, 256, 1000000,
+                             (uint64_t)numeric_limits<int64_t>::max()};
+  for (uint64_t v : values) {
+    int index = Histogram::bucket_index(v);
+    EXPECT_LE(v, Histogram::bucket_upper_bound(index));
+    if (index > 0) {
+      EXPECT_GT(v, Histogram::bucket_upper_bound(index - 1));
+    }
+  }
+}
+
+TEST_F(HistogramTest, MergeAndRoundTrip) {
+  Histogram a, b;
+  a.record(10);
+  a.record(20000);
+  b.record(5);
+  b.record(-3);
+  a.merge(b);
+  EXPECT_EQ(4, a.count());
+  EXPECT_EQ(0, a.min());
+  EXPECT_EQ(20000, a.max());
+
+  Histogram c;
+  ASSERT_TRUE(c.deserialize(a.serialize()));
+  EXPECT_EQ(a.count(), c.count());
+  EXPECT_EQ(a.sum(), c.sum());
+  EXPECT_EQ(a.percentile(75), c.percentile(75));
+  EXPECT_EQ(a.serialize(), c.serialize());
+}
+
+TEST_F(HistogramTest, RejectsMalformed) {
+  Histogram h;
+  EXPECT_FALSE(h.deserialize("garbage"));
+  EXPECT_FALSE(h.deserialize("2 10 5 5 5:1"));
+  EXPECT_TRUE(h.empty());
+}
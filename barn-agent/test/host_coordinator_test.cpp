@@ -0,0 +1,181 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "host_coordinator.h"
+#include "sighandle.h"
+#include "temp_dir.h"
+
+using namespace std;
+
+class HostCoordinatorTest : public ::testing::Test {
+public:
+  // Waits until 'count' agents wait for a slot.
+  void wait_for_waiters(const HostCoordinator& coordinator, int count) {
+    for (int i = 0; i < 2000 && coordinator.waiting() < count; ++i)
+      this_thread::sleep_for(chrono::milliseconds(1));
+    ASSERT_EQ(count, coordinator.waiting());
+  }
+
+  TempDir temp{"coordinator"};
+  const string path{temp.file("coordinator")};
+};
+
+TEST_F(HostCoordinatorTest, CapsConcurrentShipping) {
+  HostCoordinator first(path, 1, 1);
+  HostCoordinator second(path, 1, 1);
+  atomic<bool> shipped(false);
+
+  first.acquire(100, false);
+  thread other([&] {
+    ShippingSlot slot(second, 100);
+    shipped = true;
+  });
+  wait_for_waiters(first, 1);
+  EXPECT_FALSE(shipped);
+
+  first.release();
+  other.join();
+  EXPECT_TRUE(shipped);
+}
+
+TEST_F(HostCoordinatorTest, SmallestCapApplies) {
+  HostCoordinator first(path, 2, 1);
+  HostCoordinator second(path, 2, 1);
+  {
+    HostCoordinator strict(path, 1, 1);
+    atomic<bool> shipped(false);
+    first.acquire(100, false);
+    thread other([&] {
+      ShippingSlot slot(second, 100);
+      shipped = true;
+    });
+    wait_for_waiters(first, 1);
+    EXPECT_FALSE(shipped);
+    first.release();
+    other.join();
+  }
+
+  // Gone with the agent that asked for it.
+  ASSERT_TRUE(first.acquire(100, false));
+  ASSERT_TRUE(second.acquire(100, false));
+  EXPECT_EQ(0, first.waiting());
+  first.release();
+  second.release();
+}
+
+TEST_F(HostCoordinatorTest, InterruptedWaitGivesUp) {
+  HostCoordinator holder(path, 1, 1);
+  HostCoordinator waiter(path, 1, 1);
+  HostCoordinator behind(path, 1, 1);
+  holder.acquire(100, false);
+  atomic<bool> got(true);
+  thread interrupted([&] { got = waiter.acquire(100, true); });
+  wait_for_waiters(holder, 1);
+  thread patient([&] { ShippingSlot slot(behind, 100); });
+  wait_for_waiters(holder, 2);
+
+  // Like a reload, drain or upgrade being asked for.
+  wake_up();
+  interrupted.join();
+  take_wake_up();
+  EXPECT_FALSE(got);
+  EXPECT_EQ(1, holder.waiting());
+
+  holder.release();
+  patient.join();
+}
+
+TEST_F(HostCoordinatorTest, HeavierWeightGoesFirst) {
+  HostCoordinator holder(path, 1, 1);
+  HostCoordinator main_backlog(path, 1, 1);
+  HostCoordinator errors(path, 1, 100);
+  mutex order_lock;
+  vector<string> order;
+
+  holder.acquire(100, false);
+  thread main_thread([&] {
+    ShippingSlot slot(main_backlog, 1000);
+    lock_guard<mutex> guard(order_lock);
+    order.push_back("main");
+  });
+  wait_for_waiters(holder, 1);
+  thread errors_thread([&] {
+    ShippingSlot slot(errors, 1000);
+    lock_guard<mutex> guard(order_lock);
+    order.push_back("errors");
+  });
+  wait_for_waiters(holder, 2);
+
+  holder.release();
+  main_thread.join();
+  errors_thread.join();
+  ASSERT_EQ(2U, order.size());
+  EXPECT_EQ("errors", order[0]);
+  EXPECT_EQ("main", order[1]);
+}
+
+TEST_F(HostCoordinatorTest, DeadAgentsLoseTheirSlot) {
+  pid_t child = fork();
+  if (child == 0) {
+    HostCoordinator dying(path, 1, 1);
+    dying.acquire(100, false);
+    _exit(0);  // Without releasing
+  }
+  waitpid(child, 0, 0);
+
+  HostCoordinator survivor(path, 1, 1);
+  ShippingSlot slot(survivor, 100);
+  EXPECT_EQ(0, survivor.waiting());
+}
+
+TEST_F(HostCoordinatorTest, RejectsIncompatibleFile) {
+  FILE* file = fopen(path.c_str(), "w");
+  fputs("not a coordinator", file);
+  fclose(file);
+  EXPECT_THROW(HostCoordinator(path, 1, 1), runtime_error);
+}
+
+TEST_F(HostCoordinatorTest, UpgradedAgentKeepsItsEntry) {
+  HostCoordinator before(path, 1, 1);
+  HostCoordinator other(path, 1, 1);
+  EXPECT_NE(before.entry(), other.entry());
+
+  // Exec'd in place, the entry of the pid is still taken.
+  HostCoordinator after(path, 1, 1, before.entry());
+  EXPECT_EQ(before.entry(), after.entry());
+  // Not an entry of this pid, a new one.
+  HostCoordinator stray(path, 1, 1, 200);
+  EXPECT_NE(200, stray.entry());
+}
+
+TEST_F(HostCoordinatorTest, UpgradedAgentFindsItsEntryWithoutHandoff) {
+  HostCoordinator other(path, 1, 1);
+  // Left by the agent this one was exec'd from, which no coordinator of
+  // this process holds.
+  const int fd = open(path.c_str(), O_RDWR);
+  ASSERT_LE(0, fd);
+  auto* layout = static_cast<CoordinatorLayout*>(
+        mmap(0, sizeof(CoordinatorLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+  ASSERT_NE(MAP_FAILED, (void*)layout);
+  const int left_behind = other.entry() + 5;
+  layout->agents[left_behind].pid = getpid();
+
+  HostCoordinator after(path, 1, 1);
+  EXPECT_EQ(left_behind, after.entry());
+  // Held now, the next one is new.
+  HostCoordinator another(path, 1, 1);
+  EXPECT_NE(left_behind, another.entry());
+  EXPECT_NE(other.entry(), another.entry());
+  munmap(layout, sizeof(CoordinatorLayout));
+  close(fd);
+}
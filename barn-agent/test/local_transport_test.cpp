@@ -0,0 +1,98 @@
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+#include "files.h"
+#include "local_transport.h"
+#include "rsync.h"
+#include "temp_dir.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+class LocalTransportTest : public ::testing::Test {
+public:
+  void SetUp() {
+    source = temp.file("logs");
+    fs::create_directories(source);
+    target = "file://" + temp.path + "/spool/barn_logs/svc@main@host/";
+  }
+
+  void write_log(const string& name, const string& contents, time_t mtime) {
+    const auto path = join_path(source, name);
+    ofstream(path.c_str(), ios::trunc) << contents;
+    struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+    utimensat(AT_FDCWD, path.c_str(), times, 0);
+  }
+
+  string shipped(const string& name) {
+    ifstream in(join_path(local_target_directory(target), name).c_str());
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  }
+
+  FileOps fileops;
+  TempDir temp{"local_transport"};
+  string source, target;
+};
+
+TEST_F(LocalTransportTest, TargetKeepsRsyncLayout) {
+  const auto local = get_rsync_target("file:///srv/barn/", "barn_logs", "svc", "main");
+  const auto rsync = get_rsync_target("host:1000", "barn_logs", "svc", "main");
+  EXPECT_TRUE(is_local_target(local));
+  EXPECT_FALSE(is_local_target(rsync));
+  EXPECT_EQ("/srv/barn" + rsync.substr(string("rsync://host:1000").size()),
+            local_target_directory(local));
+}
+
+TEST_F(LocalTransportTest, ShipsIntoTargetDirectory) {
+  write_log("@1", "first\n", 1000);
+  ASSERT_TRUE(fileops.ship_file(join_path(source, "@1"), target));
+
+  EXPECT_EQ("first\n", shipped("@1"));
+  struct stat st;
+  ASSERT_EQ(0, stat(join_path(local_target_directory(target), "@1").c_str(), &st));
+  EXPECT_EQ(1000, st.st_mtime);
+
+  // Nothing but the published file is left behind.
+  int entries = 0;
+  for (fs::directory_iterator it(local_target_directory(target)), end; it != end; ++it)
+    ++entries;
+  EXPECT_EQ(1, entries);
+}
+
+TEST_F(LocalTransportTest, ListsFilesMissingOrDifferent) {
+  write_log("@1", "first\n", 1000);
+  write_log("@2", "second\n", 2000);
+  write_log("@3", "third\n", 3000);
+  const FileNameList files = {"@1", "@2", "@3"};
+
+  auto missing = fileops.log_files_not_on_target(source, files, target);
+  ASSERT_FALSE(isFailure(missing));
+  EXPECT_EQ(files, get(missing));
+
+  ASSERT_TRUE(fileops.ship_file(join_path(source, "@1"), target));
+  ASSERT_TRUE(fileops.ship_file(join_path(source, "@2"), target));
+  write_log("@2", "second, more\n", 2001);
+
+  missing = fileops.log_files_not_on_target(source, files, target);
+  ASSERT_FALSE(isFailure(missing));
+  EXPECT_EQ(FileNameList({"@2", "@3"}), get(missing));
+}
+
+TEST_F(LocalTransportTest, ReplacesOutdatedCopy) {
+  write_log("@1", "partial", 1000);
+  ASSERT_TRUE(fileops.ship_file(join_path(source, "@1"), target));
+  write_log("@1", "partial, then complete\n", 1001);
+  ASSERT_TRUE(fileops.ship_file(join_path(source, "@1"), target));
+  EXPECT_EQ("partial, then complete\n", shipped("@1"));
+}
+
+TEST_F(LocalTransportTest, FailsOnVanishedSource) {
+  EXPECT_FALSE(fileops.ship_file(join_path(source, "@9"), target));
+}
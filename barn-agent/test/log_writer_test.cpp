@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "log_writer.h"
+#include "temp_dir.h"
+
+using namespace std;
+
+class LogWriterTest : public ::testing::Test {
+public:
+  void SetUp() {
+    ASSERT_EQ(0, pipe(pipe_fds));
+  }
+
+  void TearDown() {
+    close(pipe_fds[0]);
+    if (pipe_fds[1] >= 0)
+      close(pipe_fds[1]);
+  }
+
+  // Fill the pipe, so the writer blocks until it's read.
+  void fill_pipe() {
+    fcntl(pipe_fds[1], F_SETFL, O_NONBLOCK);
+    // Whole lines, a pipe takes writes up to PIPE_BUF in one piece or not.
+    const string chunk = string(PIPE_BUF - 1, '-') + "\n";
+    while (write(pipe_fds[1], chunk.data(), chunk.size()) > 0) {}
+    fcntl(pipe_fds[1], F_SETFL, 0);
+  }
+
+  // Everything written to the pipe, once its write end is closed.
+  string read_pipe() {
+    string contents;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(pipe_fds[0], buffer, sizeof(buffer))) > 0)
+      contents.append(buffer, n);
+    return contents;
+  }
+
+  void close_pipe() {
+    close(pipe_fds[1]);
+    pipe_fds[1] = -1;
+  }
+
+  static vector<string> lines_of(const string& contents) {
+    vector<string> lines;
+    istringstream in(contents);
+    string line;
+    while (getline(in, line)) {
+      if (line.empty() || line[0] != '-')
+        lines.push_back(line);
+    }
+    return lines;
+  }
+
+  TempDir temp{"log_writer"};
+  const string path{temp.file("log")};
+  int pipe_fds[2];
+};
+
+TEST_F(LogWriterTest, RingKeepsOrderUntilFull) {
+  LogRing ring(3);
+  ASSERT_EQ(4U, ring.capacity());
+  for (int i = 0; i < 4; ++i)
+    EXPECT_TRUE(ring.try_push(el::Level::Info, "line " + to_string(i), 0));
+  EXPECT_FALSE(ring.try_push(el::Level::Info, "no room", 0));
+
+  for (int i = 0; i < 4; ++i) {
+    auto* slot = ring.front();
+    ASSERT_NE(nullptr, slot);
+    EXPECT_EQ("line " + to_string(i), string(slot->text, slot->length));
+    ring.release();
+  }
+  EXPECT_EQ(nullptr, ring.front());
+  EXPECT_TRUE(ring.try_push(el::Level::Error, "next lap", 2));
+  EXPECT_EQ(el::Level::Error, ring.front()->level);
+  EXPECT_EQ(2U, ring.front()->suppressed);
+}
+
+TEST_F(LogWriterTest, RingTruncatesLongLines) {
+  LogRing ring(2);
+  ring.try_push(el::Level::Info, string(LOG_LINE_BYTES * 2, 'x'), 0);
+  const auto* slot = ring.front();
+  ASSERT_EQ(LOG_LINE_BYTES, slot->length);
+  const string text(slot->text, slot->length);
+  EXPECT_EQ(" [truncated]", text.substr(text.size() - 12));
+}
+
+TEST_F(LogWriterTest, RateLimitsEachStatement) {
+  LogRateLimiter limiter(2);
+  uint32_t suppressed;
+  EXPECT_TRUE(limiter.admit("barn-agent.cpp", 10, 100, &suppressed));
+  EXPECT_TRUE(limiter.admit("barn-agent.cpp", 10, 100, &suppressed));
+  EXPECT_FALSE(limiter.admit("barn-agent.cpp", 10, 100, &suppressed));
+  EXPECT_FALSE(limiter.admit("barn-agent.cpp", 10, 100, &suppressed));
+  // Other statements have budgets of their own.
+  EXPECT_TRUE(limiter.admit("barn-agent.cpp", 11, 100, &suppressed));
+  EXPECT_EQ(0U, suppressed);
+
+  EXPECT_TRUE(limiter.admit("barn-agent.cpp", 10, 101, &suppressed));
+  EXPECT_EQ(2U, suppressed);
+  EXPECT_EQ(0U, limiter.take_suppressed());
+
+  limiter.admit("barn-agent.cpp", 10, 101, &suppressed);
+  limiter.admit("barn-agent.cpp", 10, 101, &suppressed);
+  EXPECT_EQ(1U, limiter.take_suppressed());
+  EXPECT_EQ(0U, limiter.take_suppressed());
+}
+
+TEST_F(LogWriterTest, NoLimitByDefault) {
+  LogRateLimiter limiter(0);
+  uint32_t suppressed;
+  for (int i = 0; i < 1000; ++i)
+    ASSERT_TRUE(limiter.admit("barn-agent.cpp", 10, 100, &suppressed));
+}
+
+TEST_F(LogWriterTest, WritesLinesLikeEasylogging) {
+  {
+    AsyncLogWriter writer("[svc:main]", 16, 0, LogWhenFull::Drop, pipe_fds[1]);
+    writer.log(el::Level::Info, "barn-agent.cpp", 10, "Shipped @4000.s");
+    writer.log(el::Level::Warning, "barn-agent.cpp", 11, "Slow");
+    writer.log(el::Level::Error, "barn-agent.cpp", 12, "Failed");
+  }
+  close_pipe();
+  EXPECT_EQ("INFO  [svc:main] : Shipped @4000.s\n"
+            "WARN  [svc:main] : Slow\n"
+            "ERROR [svc:main] : Failed\n", read_pipe());
+}
+
+TEST_F(LogWriterTest, DropsInfoLinesWhenFull) {
+  fill_pipe();
+  string contents;
+  thread reader;
+  {
+    AsyncLogWriter writer("[svc:main]", 2, 0, LogWhenFull::Drop, pipe_fds[1]);
+    writer.log(el::Level::Info, "barn-agent.cpp", 10, "taken");
+    this_thread::sleep_for(chrono::milliseconds(200));
+    for (int i = 0; i < 100; ++i)
+      writer.log(el::Level::Info, "barn-agent.cpp", 10, "line " + to_string(i));
+
+    reader = thread([this, &contents] { contents = read_pipe(); });
+    // Waits for room rather than dropping.
+    writer.log(el::Level::Error, "barn-agent.cpp", 12, "kept");
+  }
+  close_pipe();
+  reader.join();
+
+  const auto lines = lines_of(contents);
+  ASSERT_EQ(5U, lines.size()) << contents;
+  EXPECT_EQ("INFO  [svc:main] : taken", lines[0]);
+  EXPECT_EQ("INFO  [svc:main] : line 0", lines[1]);
+  EXPECT_EQ("INFO  [svc:main] : line 1", lines[2]);
+  // The report goes out once the writer catches up, before or after it.
+  const auto kept = find(lines.begin(), lines.end(), "ERROR [svc:main] : kept");
+  EXPECT_NE(lines.end(), kept);
+  const auto report = find(lines.begin(), lines.end(),
+        "WARN  [svc:main] : Dropped 98 log lines, the log buffer was full");
+  EXPECT_NE(lines.end(), report);
+}
+
+TEST_F(LogWriterTest, BlockingKeepsEveryLine) {
+  string contents;
+  thread reader([this, &contents] { contents = read_pipe(); });
+  {
+    AsyncLogWriter writer("[svc:main]", 4, 0, LogWhenFull::Block, pipe_fds[1]);
+    vector<thread> loggers;
+    for (int t = 0; t < 4; ++t) {
+      loggers.push_back(thread([&writer, t] {
+        for (int i = 0; i < 1000; ++i)
+          writer.log(el::Level::Info, "barn-agent.cpp", 10,
+                     to_string(t) + " " + to_string(i));
+      }));
+    }
+    for (auto& logger : loggers)
+      logger.join();
+    writer.flush();
+  }
+  close_pipe();
+  reader.join();
+
+  // All there, each thread's in order.
+  const auto lines = lines_of(contents);
+  ASSERT_EQ(4000U, lines.size());
+  vector<int> next(4, 0);
+  for (const auto& line : lines) {
+    int t, i;
+    ASSERT_EQ(2, sscanf(line.c_str(), "INFO  [svc:main] : %d %d", &t, &i)) << line;
+    EXPECT_EQ(next[t]++, i);
+  }
+}
+
+TEST_F(LogWriterTest, TakesOverEasylogging) {
+  const int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_LE(0, file);
+  fflush(stdout);
+  const int saved_stdout = dup(STDOUT_FILENO);
+  dup2(file, STDOUT_FILENO);
+
+  BarnConf conf;
+  conf.log_buffer_lines = 16;
+  conf.log_rate_limit = 0;
+  conf.log_when_full = "drop";
+  start_async_logging("[svc:main]", conf);
+  LOG(INFO) << "Through " << 1 << " LOG";
+  stop_async_logging();
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  close(file);
+
+  ifstream in(path.c_str());
+  const string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  EXPECT_EQ("INFO  [svc:main] : Through 1 LOG\n", contents);
+}
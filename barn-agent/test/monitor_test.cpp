@@ -0,0 +1,159 @@
+#include <string>
+#include <tuple>
+
+#include "gtest/gtest.h"
+#include "monitor/barn-agent-monitor.h"
+#include "monitor/localreport.h"
+
+using namespace std;
+
+class MonitorTest : public ::testing::Test {
+};
+
+class ReportSerializationTest : public MonitorTest {
+};
+
+TEST_F(ReportSerializationTest, RoundTrip) {
+  Report report = deserialize_report(
+      serialize_report(Report(NumFilesShipped, 3, "svc", "main")));
+  EXPECT_EQ(NumFilesShipped, report.key);
+  EXPECT_EQ(3, report.value);
+  EXPECT_EQ("svc", report.service_name);
+  EXPECT_EQ("main", report.category);
+}
+
+TEST_F(ReportSerializationTest, CarriesTypeAnd64BitValues) {
+  Report sent("barn_unknown_gauge", 5000000000LL, "svc", "main");
+  sent.type = MetricType::MinGauge;
+  EXPECT_EQ("barn_unknown_gauge 5000000000|min svc main", serialize_report(sent));
+  Report received = deserialize_report(serialize_report(sent));
+  EXPECT_EQ(5000000000LL, received.value);
+  EXPECT_TRUE(MetricType::MinGauge == received.type);
+}
+
+TEST_F(ReportSerializationTest, AcceptsUnlabeledReports) {
+  Report report = deserialize_report("barn_files_shipped 4");
+  EXPECT_EQ(NumFilesShipped, report.key);
+  EXPECT_EQ(4, report.value);
+  EXPECT_EQ("", report.service_name);
+  EXPECT_TRUE(MetricType::Counter == report.type);
+}
+
+
+class MetricAggregatorTest : public MonitorTest {
+};
+
+TEST_F(MetricAggregatorTest, KeepsStreamsAndTotals) {
+  MetricAggregator aggregator(10, 2);
+  aggregator.add(Report(NumFilesShipped, 1, "a", "main"));
+  aggregator.add(Report(NumFilesShipped, 2, "a", "main"));
+  aggregator.add(Report(NumFilesShipped, 5, "b", "main"));
+  aggregator.add(Report(NumFilesShipped, 7));
+
+  Interval interval = aggregator.take();
+  EXPECT_EQ(15, interval.totals[NumFilesShipped]);
+  EXPECT_EQ(3, interval.series[make_tuple("a", "main", NumFilesShipped)]);
+  EXPECT_EQ(5, interval.series[make_tuple("b", "main", NumFilesShipped)]);
+  EXPECT_EQ(0U, interval.series.count(make_tuple("", "", NumFilesShipped)));
+}
+
+TEST_F(MetricAggregatorTest, KeepsMaxOfLagMetrics) {
+  MetricAggregator aggregator(10, 2);
+  aggregator.add(Report(OldestUnshippedAge, 30, "a", "main"));
+  aggregator.add(Report(OldestUnshippedAge, 40, "a", "main"));
+  aggregator.add(Report(OldestUnshippedAge, 20, "b", "main"));
+
+  Interval interval = aggregator.take();
+  EXPECT_EQ(40, interval.totals[OldestUnshippedAge]);
+  EXPECT_EQ(40, interval.series[make_tuple("a", "main", OldestUnshippedAge)]);
+  EXPECT_EQ(20, interval.series[make_tuple("b", "main", OldestUnshippedAge)]);
+
+  aggregator.add(Report(BacklogBytes, 3000, "a", "main"));
+  aggregator.add(Report(BacklogBytes, 1000, "b", "main"));
+  EXPECT_EQ(3000, aggregator.take().totals[BacklogBytes]);
+}
+
+TEST_F(MetricAggregatorTest, KeepsLastGaugePerStream) {
+  MetricAggregator aggregator(10, 2);
+  aggregator.add(Report(FilesToShip, 5, "a", "main"));
+  aggregator.add(Report(FilesToShip, 2, "a", "main"));
+  aggregator.add(Report(FilesToShip, 3, "b", "main"));
+  aggregator.add(Report(FilesToShip, 1));
+
+  Interval interval = aggregator.take();
+  EXPECT_EQ(2, interval.series[make_tuple("a", "main", FilesToShip)]);
+  EXPECT_EQ(3, interval.series[make_tuple("b", "main", FilesToShip)]);
+  EXPECT_EQ(6, interval.totals[FilesToShip]);
+}
+
+TEST_F(MetricAggregatorTest, KeepsMinOfMinGauges) {
+  MetricAggregator aggregator(10, 2);
+  Report report("barn_free_bytes", 7, "a", "main");
+  report.type = MetricType::MinGauge;
+  aggregator.add(report);
+  report.value = 9;
+  aggregator.add(report);
+  report.service_name = "b";
+  report.value = 8;
+  aggregator.add(report);
+
+  Interval interval = aggregator.take();
+  EXPECT_EQ(7, interval.series[make_tuple("a", "main", "barn_free_bytes")]);
+  EXPECT_EQ(7, interval.totals["barn_free_bytes"]);
+  EXPECT_TRUE(MetricType::MinGauge == interval.types["barn_free_bytes"]);
+}
+
+TEST_F(MetricAggregatorTest, CountsIn64Bits) {
+  MetricAggregator aggregator(10, 2);
+  aggregator.add(Report(NumFilesShipped, 3000000000LL, "a", "main"));
+  aggregator.add(Report(NumFilesShipped, 3000000000LL, "b", "main"));
+  EXPECT_EQ(6000000000LL, aggregator.take().totals[NumFilesShipped]);
+}
+
+TEST_F(MetricAggregatorTest, RecordsTimers) {
+  MetricAggregator aggregator(10, 2);
+  aggregator.add(Report(ShipLatency, 10, "a", "main"));
+  aggregator.add(Report(ShipLatency, 30, "a", "main"));
+
+  Interval interval = aggregator.take();
+  EXPECT_EQ(0U, interval.series.count(make_tuple("a", "main", ShipLatency)));
+  EXPECT_EQ(2, interval.histograms[make_tuple("a", "main", ShipLatency)].count());
+}
+
+TEST_F(MetricAggregatorTest, ZeroesDefaultMetricsUntilStreamExpires) {
+  MetricAggregator aggregator(10, 2);
+  aggregator.add(Report(NumFilesShipped, 1, "a", "main"));
+  aggregator.take();
+
+  for (int i = 0; i < 2; i++) {
+    Interval interval = aggregator.take();
+    EXPECT_EQ(0, interval.totals[LostDuringShip]);
+    ASSERT_EQ(1U, interval.series.count(make_tuple("a", "main", LostDuringShip)));
+    EXPECT_EQ(0, interval.series[make_tuple("a", "main", NumFilesShipped)]);
+  }
+  Interval expired = aggregator.take();
+  EXPECT_EQ(0U, expired.series.size());
+  EXPECT_EQ(0, expired.totals[LostDuringShip]);
+}
+
+TEST_F(MetricAggregatorTest, BoundsCardinality) {
+  MetricAggregator aggregator(2, 2);
+  aggregator.add(Report(NumFilesShipped, 1, "a", "main"));
+  aggregator.add(Report(NumFilesShipped, 1, "b", "main"));
+  aggregator.add(Report(NumFilesShipped, 1, "c", "main"));
+  aggregator.add(Report(NumFilesShipped, 1, "d", "main"));
+  HistogramReport histogram;
+  histogram.service_name = "e";
+  histogram.category = "main";
+  histogram.key = ShipLatency;
+  histogram.histogram.record(10);
+  aggregator.add(histogram);
+
+  Interval interval = aggregator.take();
+  EXPECT_EQ(4, interval.totals[NumFilesShipped]);
+  EXPECT_EQ(2, interval.series[make_tuple(OverflowStream.first, OverflowStream.second,
+                                          NumFilesShipped)]);
+  EXPECT_EQ(1U, interval.histograms.count(
+      make_tuple(OverflowStream.first, OverflowStream.second, ShipLatency)));
+  EXPECT_EQ(0U, interval.series.count(make_tuple("c", "main", NumFilesShipped)));
+}
@@ -0,0 +1,51 @@
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "page_cache.h"
+#include "temp_dir.h"
+
+using namespace std;
+
+class PageCacheTest : public ::testing::Test {
+public:
+  // Write 'bytes' and read them back, so they're all cached.
+  void write_and_read(size_t bytes) {
+    ofstream(path.c_str(), ios::trunc) << string(bytes, 'x');
+    ifstream in(path.c_str());
+    string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    ASSERT_EQ(bytes, contents.size());
+  }
+
+  uintmax_t resident(size_t bytes) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    const auto resident = resident_bytes(fd, bytes);
+    close(fd);
+    return resident;
+  }
+
+  TempDir temp{"page_cache"};
+  const string path{temp.file("log")};
+};
+
+TEST_F(PageCacheTest, CountsCachedBytes) {
+  write_and_read(10000);
+  EXPECT_EQ(10000U, resident(10000));
+}
+
+TEST_F(PageCacheTest, DropReturnsCachedBytes) {
+  write_and_read(10000);
+  EXPECT_EQ(10000U, drop_from_page_cache(path));
+  // Filesystems without backing storage (tmpfs) keep their pages.
+  EXPECT_GE(10000U, resident(10000));
+}
+
+TEST_F(PageCacheTest, NothingCachedOfEmptyOrMissingFiles) {
+  write_and_read(0);
+  EXPECT_EQ(0U, drop_from_page_cache(path));
+  remove(path.c_str());
+  EXPECT_EQ(0U, drop_from_page_cache(path));
+}
@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "params.h"
+#include "temp_dir.h"
+
+using namespace std;
+
+class ParamsTest : public ::testing::Test {
+public:
+  void SetUp() {
+    write_config("target-addr = host:1000\nsleep_seconds = 5\n");
+
+    const char* argv[] = {"barn-agent", "--config", path.c_str(), "-s", "/var/log/svc",
+                          "-n", "svc", "-c", "main"};
+    current = parse_command_line(sizeof(argv) / sizeof(argv[0]), const_cast<char**>(argv));
+  }
+
+  void write_config(const string& contents) {
+    ofstream out(path.c_str(), ios::trunc);
+    out << contents;
+  }
+
+  TempDir temp{"params"};
+  const string path{temp.file("barn-agent.conf")};
+  BarnConf current;
+};
+
+TEST_F(ParamsTest, ReadsConfigFile) {
+  EXPECT_EQ("host:1000", current.primary_rsync_addr);
+  EXPECT_EQ(5, current.sleep_seconds);
+  EXPECT_EQ("svc", current.service_name);
+}
+
+TEST_F(ParamsTest, ReloadAppliesChanges) {
+  write_config("target-addr = other:1000\nbackup-addr = backup:1000\n"
+               "seconds_before_failover = 120\nsleep_seconds = 7\n");
+  auto reloaded = reload_configuration(current);
+  ASSERT_FALSE(isFailure(reloaded));
+  EXPECT_EQ("other:1000", get(reloaded).primary_rsync_addr);
+  EXPECT_EQ("backup:1000", get(reloaded).secondary_rsync_addr);
+  EXPECT_EQ(120, get(reloaded).seconds_before_failover);
+  EXPECT_EQ(7, get(reloaded).sleep_seconds);
+}
+
+TEST_F(ParamsTest, ReloadSwitchesToLocalTarget) {
+  write_config("target-addr = file:///srv/barn/\n");
+  auto reloaded = reload_configuration(current);
+  ASSERT_FALSE(isFailure(reloaded));
+  EXPECT_EQ("file:///srv/barn/", get(reloaded).primary_rsync_addr);
+}
+
+TEST_F(ParamsTest, CommandLineTakesPrecedence) {
+  write_config("target-addr = host:1000\nservice-name = other\n");
+  auto reloaded = reload_configuration(current);
+  ASSERT_FALSE(isFailure(reloaded));
+  EXPECT_EQ("svc", get(reloaded).service_name);
+}
+
+TEST_F(ParamsTest, ReloadRejectsRestartOnlyChanges) {
+  write_config("target-addr = host:1000\nmetrics_shm = /dev/shm/barn\n");
+  auto reloaded = reload_configuration(current);
+  ASSERT_TRUE(isFailure(reloaded));
+  EXPECT_NE(string::npos, error(reloaded).find("metrics_shm"));
+}
+
+TEST_F(ParamsTest, StartupChecksLikeReload) {
+  write_config("target-addr = host:1000\nsleep_seconds = -1\n");
+  const char* argv[] = {"barn-agent", "--config", path.c_str(), "-s", "/var/log/svc",
+                        "-n", "svc", "-c", "main"};
+  EXPECT_EXIT(parse_command_line(sizeof(argv) / sizeof(argv[0]), const_cast<char**>(argv)),
+              ::testing::ExitedWithCode(1), "sleep_seconds can't be negative");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+}
+
+TEST_F(ParamsTest, ReloadRejectsInvalidConfig) {
+  write_config("target-addr = host:1000\nseconds_before_failover = 10\n");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+
+  write_config("target-addr = host:1000\nseconds_before_failover = 120\n");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+
+  write_config("target-addr = host:1000\nno_such_option = 1\n");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+
+  write_config("target-addr = file:///\n");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+
+  write_config("target-addr = file://spool\n");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+
+  write_config("target-addr = host:1000\nio_class = realtime\n");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+
+  write_config("target-addr = host:1000\nlog_when_full = wait\n");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+
+  write_config("target-addr = host:1000\nmax_backoff_seconds = -1\n");
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+
+  remove(path.c_str());
+  EXPECT_TRUE(isFailure(reload_configuration(current)));
+}
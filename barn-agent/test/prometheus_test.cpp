@@ -0,0 +1,169 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <map>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "monitor/prometheus.h"
+
+using namespace std;
+
+class PrometheusTest : public ::testing::Test {
+};
+
+static bool contains(const string& haystack, const string& needle) {
+  return haystack.find(needle) != string::npos;
+}
+
+TEST_F(PrometheusTest, TotalsAndStreams) {
+  Interval interval;
+  interval.totals = {{"barn_files_shipped", 3}, {"time_since_success", 10}};
+  interval.series[make_tuple("svc", "main", "barn_files_shipped")] = 1;
+  interval.series[make_tuple("svc", "errors", "barn_files_shipped")] = 2;
+  string rendered = render_exposition(interval);
+  EXPECT_TRUE(contains(rendered,
+      "# TYPE barn_files_shipped_host gauge\nbarn_files_shipped_host{agg=\"sum\"} 3\n"));
+  EXPECT_TRUE(contains(rendered, "time_since_success_host{agg=\"max\"} 10\n"));
+  EXPECT_TRUE(contains(rendered, "# TYPE barn_files_shipped gauge\n"
+      "barn_files_shipped{service=\"svc\",category=\"errors\"} 2\n"
+      "barn_files_shipped{service=\"svc\",category=\"main\"} 1\n"));
+}
+
+TEST_F(PrometheusTest, MaxAggregatedTotals) {
+  Interval interval;
+  interval.totals = {{"barn_oldest_unshipped_age_seconds", 40}};
+  EXPECT_TRUE(contains(render_exposition(interval),
+      "barn_oldest_unshipped_age_seconds_host{agg=\"max\"} 40\n"));
+}
+
+TEST_F(PrometheusTest, HistogramsAsLabeledSummaries) {
+  Interval interval;
+  HistogramRepo& histograms = interval.histograms;
+  for (int i = 1; i <= 100; i++)
+    histograms[make_tuple("svc", "main", "barn_ship_latency_ms")].record(i);
+  histograms[make_tuple("svc", "main", "barn_ship_file_bytes")].record(5000);
+  histograms[make_tuple("other", "errors", "barn_ship_latency_ms")].record(7);
+
+  string rendered = render_exposition(interval);
+  EXPECT_TRUE(contains(rendered, "# TYPE barn_ship_latency_ms summary\n"));
+  EXPECT_TRUE(contains(rendered,
+      "barn_ship_latency_ms{service=\"svc\",category=\"main\",quantile=\"0.5\"} 50\n"));
+  EXPECT_TRUE(contains(rendered,
+      "barn_ship_latency_ms{service=\"other\",category=\"errors\",quantile=\"0.99\"} 7\n"));
+  EXPECT_TRUE(contains(rendered,
+      "barn_ship_latency_ms_count{service=\"svc\",category=\"main\"} 100\n"));
+  EXPECT_TRUE(contains(rendered,
+      "barn_ship_latency_ms_max{service=\"svc\",category=\"main\"} 100\n"));
+  // 5000 bytes in 5050ms
+  EXPECT_TRUE(contains(rendered,
+      "barn_ship_bytes_per_second{service=\"svc\",category=\"main\"} 990\n"));
+  // One TYPE line per family.
+  EXPECT_EQ(rendered.find("# TYPE barn_ship_latency_ms summary"),
+            rendered.rfind("# TYPE barn_ship_latency_ms summary"));
+}
+
+TEST_F(PrometheusTest, SanitizesNamesAndLabels) {
+  Interval interval;
+  interval.histograms[make_tuple("my\"svc", "a\\b", "9bad.name")].record(1);
+  interval.histograms[make_tuple("svc", "main", "rule:name")].record(1);
+  string rendered = render_exposition(interval);
+  EXPECT_TRUE(contains(rendered, "_9bad_name{service=\"my\\\"svc\",category=\"a\\\\b\",quantile"));
+  EXPECT_TRUE(contains(rendered, "# TYPE rule_name summary\n"));
+}
+
+TEST_F(PrometheusTest, ExporterServesLastPublished) {
+  PrometheusExporter exporter;
+  EXPECT_EQ("", *exporter.current());
+  auto before = exporter.current();
+  exporter.publish("a 1\n");
+  EXPECT_EQ("a 1\n", *exporter.current());
+  EXPECT_EQ("", *before);
+}
+
+// A connection to 'port', that buffers only 'receive_buffer' bytes if given.
+static int connect_to(int port, int receive_buffer = 0) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (receive_buffer > 0)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int attempt = 0; attempt < 50; attempt++) {
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0)
+      return fd;
+    this_thread::sleep_for(chrono::milliseconds(20));
+  }
+  close(fd);
+  return -1;
+}
+
+static const string METRICS_REQUEST = "GET /metrics HTTP/1.0\r\n\r\n";
+
+// Everything the server sends on 'fd' until it closes it.
+static string read_response(int fd) {
+  string response;
+  char chunk[65536];
+  ssize_t n;
+  while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+    response.append(chunk, n);
+  return response;
+}
+
+TEST_F(PrometheusTest, StalledClientDoesNotHoldUpScrapes) {
+  static PrometheusExporter exporter;
+  exporter.publish("a 1\n");
+  const int port = 20000 + getpid() % 20000;
+  thread([port]() { exporter.serve(port, 1); }).detach();
+
+  // Connects but never sends its request.
+  const int stalled = connect_to(port);
+  ASSERT_LE(0, stalled);
+  const int scraper = connect_to(port);
+  ASSERT_LE(0, scraper);
+  ASSERT_EQ(ssize_t(METRICS_REQUEST.size()),
+            write(scraper, METRICS_REQUEST.data(), METRICS_REQUEST.size()));
+
+  const auto start = chrono::steady_clock::now();
+  const auto response = read_response(scraper);
+  EXPECT_GT(chrono::seconds(4), chrono::steady_clock::now() - start);
+  EXPECT_TRUE(contains(response, "200 OK"));
+  EXPECT_TRUE(contains(response, "\r\n\r\na 1\n"));
+  close(scraper);
+  close(stalled);
+}
+
+TEST_F(PrometheusTest, ClientNotReadingDoesNotHoldUpScrapes) {
+  static PrometheusExporter exporter;
+  // Far more than fits into the socket buffers.
+  exporter.publish(string(32 << 20, '#'));
+  const int port = 20000 + (getpid() + 1) % 20000;
+  thread([port]() { exporter.serve(port, 1); }).detach();
+
+  // Asks for the metrics but never reads them.
+  const int stalled = connect_to(port, 4096);
+  ASSERT_LE(0, stalled);
+  ASSERT_EQ(ssize_t(METRICS_REQUEST.size()),
+            write(stalled, METRICS_REQUEST.data(), METRICS_REQUEST.size()));
+  const int scraper = connect_to(port);
+  ASSERT_LE(0, scraper);
+  // Fails instead of hanging if the server is stuck writing to 'stalled'.
+  struct timeval timeout = {10, 0};
+  setsockopt(scraper, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  ASSERT_EQ(ssize_t(METRICS_REQUEST.size()),
+            write(scraper, METRICS_REQUEST.data(), METRICS_REQUEST.size()));
+
+  const auto start = chrono::steady_clock::now();
+  const auto response = read_response(scraper);
+  EXPECT_GT(chrono::seconds(4), chrono::steady_clock::now() - start);
+  EXPECT_TRUE(contains(response, "200 OK"));
+  EXPECT_EQ(32U << 20, response.size() - response.find("\r\n\r\n") - 4);
+  close(scraper);
+  close(stalled);
+}
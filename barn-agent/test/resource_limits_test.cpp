@@ -0,0 +1,82 @@
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+#include "files.h"
+#include "resource_limits.h"
+#include "temp_dir.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+class SummingMetrics : public Metrics {
+public:
+  SummingMetrics() : Metrics("", "") {}
+
+  void send_metric(const string& key, int64_t value) const override {
+    sent[key] += value;
+  }
+
+  mutable map<string, int64_t> sent;
+};
+
+class ResourceLimitsTest : public ::testing::Test {
+public:
+  void write_stats(int periods, int64_t throttled_usec, int64_t stall_usec) {
+    ofstream(join_path(cgroup, "cpu.stat").c_str(), ios::trunc)
+      << "usage_usec 123456\nnr_periods 100\nnr_throttled " << periods
+      << "\nthrottled_usec " << throttled_usec << "\n";
+    ofstream(join_path(cgroup, "io.pressure").c_str(), ios::trunc)
+      << "some avg10=0.00 avg60=0.00 avg300=0.00 total=" << stall_usec
+      << "\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=1\n";
+  }
+
+  TempDir temp{"cgroup"};
+  const string cgroup{temp.path};
+};
+
+TEST_F(ResourceLimitsTest, ReadsCgroupStats) {
+  write_stats(3, 25000, 7000);
+  const auto stats = read_cgroup_stats(cgroup);
+  EXPECT_EQ(3, stats.throttled_periods);
+  EXPECT_EQ(25000, stats.throttled_usec);
+  EXPECT_EQ(7000, stats.io_stall_usec);
+}
+
+TEST_F(ResourceLimitsTest, MissingStatsReadAsZero) {
+  const auto stats = read_cgroup_stats(cgroup);
+  EXPECT_EQ(0, stats.throttled_periods);
+  EXPECT_EQ(0, stats.throttled_usec);
+  EXPECT_EQ(0, stats.io_stall_usec);
+}
+
+TEST_F(ResourceLimitsTest, ReportsThrottlingSinceLastReport) {
+  write_stats(3, 25000, 7000);
+  CgroupThrottling throttling(cgroup);
+  SummingMetrics metrics;
+
+  write_stats(5, 40500, 9000);
+  throttling.report(metrics);
+  EXPECT_EQ(2, metrics.sent[CpuThrottledPeriods]);
+  EXPECT_EQ(15, metrics.sent[CpuThrottledMs]);
+  EXPECT_EQ(2, metrics.sent[IoStalledMs]);
+
+  write_stats(5, 41000, 9000);
+  throttling.report(metrics);
+  EXPECT_EQ(2, metrics.sent[CpuThrottledPeriods]);
+  EXPECT_EQ(16, metrics.sent[CpuThrottledMs]);
+  EXPECT_EQ(2, metrics.sent[IoStalledMs]);
+}
+
+TEST_F(ResourceLimitsTest, RejectsUnknownIoClass) {
+  EXPECT_THROW(set_io_priority("realtime", 0), runtime_error);
+}
+
+TEST_F(ResourceLimitsTest, EnteringNonCgroupFails) {
+  EXPECT_THROW(enter_cgroup(join_path(cgroup, "agent"), "", ""), runtime_error);
+}
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+#include "rotation.h"
+#include "temp_dir.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+class RotationTest : public ::testing::Test {
+public:
+  void write_file(const string& name, const string& contents) {
+    ofstream(join_path(directory, name).c_str(), ios::trunc) << contents;
+  }
+
+  // Name svlogd gives a file rotated at 'unix_seconds'.
+  static string rotated_at(int64_t unix_seconds) {
+    char name[32];
+    snprintf(name, sizeof(name), "@%016llx%08x.s",
+             (unsigned long long)((1ULL << 62) + 10 + unix_seconds), 0);
+    return name;
+  }
+
+  TempDir temp{"rotation"};
+  const string directory{temp.path};
+};
+
+TEST_F(RotationTest, ParsesSvlogdConfig) {
+  auto limits = parse_svlogd_config("n10\ns4096\nt60\n!gzip\nu127.0.0.1:514\n");
+  EXPECT_EQ(4096, limits.max_size);
+  EXPECT_EQ(60, limits.max_age_seconds);
+
+  limits = parse_svlogd_config("n5\n");
+  EXPECT_EQ(99999, limits.max_size);
+  EXPECT_EQ(0, limits.max_age_seconds);
+}
+
+TEST_F(RotationTest, MissingConfigHasSvlogdDefaults) {
+  const auto limits = read_svlogd_limits(directory);
+  EXPECT_EQ(99999, limits.max_size);
+  EXPECT_EQ(0, limits.max_age_seconds);
+}
+
+TEST_F(RotationTest, ConfigWithoutSizeHasSvlogdDefaultSize) {
+  write_file("config", "n10\nt60\n");
+  const auto limits = read_svlogd_limits(directory);
+  EXPECT_EQ(99999, limits.max_size);
+  EXPECT_EQ(60, limits.max_age_seconds);
+}
+
+TEST_F(RotationTest, PredictsFromGrowth) {
+  const SvlogdLimits limits = {1000, 0};
+  RotationPredictor predictor;
+  EXPECT_GT(0, predictor.seconds_until_rotation(limits, 100, 100, -1));
+  EXPECT_EQ(80, predictor.seconds_until_rotation(limits, 110, 200, -1));
+  // Rotated in between, the rate stays.
+  EXPECT_EQ(90, predictor.seconds_until_rotation(limits, 120, 100, -1));
+  EXPECT_EQ(46, predictor.seconds_until_rotation(limits, 130, 300, -1));  // 15 B/s
+}
+
+TEST_F(RotationTest, PredictsFromAge) {
+  const SvlogdLimits limits = {0, 60};
+  RotationPredictor predictor;
+  EXPECT_EQ(20, predictor.seconds_until_rotation(limits, 1040, 10, 1000));
+  EXPECT_EQ(0, predictor.seconds_until_rotation(limits, 1070, 20, 1000));
+  // svlogd doesn't rotate an empty file on age.
+  EXPECT_GT(0, predictor.seconds_until_rotation(limits, 1080, 0, 1000));
+}
+
+TEST_F(RotationTest, DryRunDueBeforeRotation) {
+  write_file("config", "s1000000\nt60\n");
+  write_file("current", "some line\n");
+  write_file(rotated_at(time(0) - 50), "rotated\n");
+  FileOps fileops;
+
+  RotationWatch watch(2);
+  const int due_in = watch.dry_run_due_in(fileops, directory);
+  EXPECT_LE(7, due_in);
+  EXPECT_GE(8, due_in);
+
+  watch.configure(20);
+  EXPECT_EQ(0, watch.dry_run_due_in(fileops, directory));
+
+  watch.configure(0);
+  EXPECT_GT(0, watch.dry_run_due_in(fileops, directory));
+}
+
+TEST_F(RotationTest, DryRunServesOneRoundOfItsTarget) {
+  RotationWatch watch(2);
+  FileNameList on_target;
+  EXPECT_FALSE(watch.take_on_target("rsync://a/", &on_target));
+
+  watch.dry_run_done("rsync://a/", {"@1", "@2"});
+  EXPECT_TRUE(watch.take_on_target("rsync://a/", &on_target));
+  EXPECT_EQ(FileNameList({"@1", "@2"}), on_target);
+  EXPECT_FALSE(watch.take_on_target("rsync://a/", &on_target));
+
+  watch.dry_run_done("rsync://a/", {"@1"});
+  EXPECT_FALSE(watch.take_on_target("rsync://b/", &on_target));
+  EXPECT_FALSE(watch.take_on_target("rsync://a/", &on_target));
+}
@@ -0,0 +1,78 @@
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "scheduler.h"
+
+using namespace std;
+
+class RecordingMetrics : public Metrics {
+public:
+  RecordingMetrics() : Metrics("", "") {}
+
+  void send_metric(const string& key, int64_t value) const override {
+    sent[key] += value;
+  }
+  void record_value(const string& key, int64_t value) const override {
+    recorded[key].push_back(value);
+  }
+
+  mutable map<string, int64_t> sent;
+  mutable map<string, vector<int64_t>> recorded;
+};
+
+class SchedulerTest : public ::testing::Test {
+public:
+  RecordingMetrics metrics;
+};
+
+TEST_F(SchedulerTest, ShipsBackToBack) {
+  ShipScheduler scheduler(10, 5, 300);
+  auto decision = scheduler.after_round(RoundOutcome::Shipped, metrics);
+  EXPECT_EQ(NextRound::Now, decision.next);
+  EXPECT_EQ(1, metrics.sent[RoundsBackToBack]);
+  EXPECT_EQ(0, metrics.sent[BackoffSeconds]);
+}
+
+TEST_F(SchedulerTest, WaitsForFilesWhenCaughtUp) {
+  ShipScheduler scheduler(10, 5, 300);
+  auto decision = scheduler.after_round(RoundOutcome::CaughtUp, metrics);
+  EXPECT_EQ(NextRound::OnNewFile, decision.next);
+  EXPECT_EQ(10, decision.seconds);
+  EXPECT_EQ(1, metrics.sent[RoundsWaitingForFile]);
+}
+
+TEST_F(SchedulerTest, BacksOffExponentiallyOnErrors) {
+  ShipScheduler scheduler(10, 2, 10);
+  for (int limit : {2, 4, 8, 10, 10}) {
+    auto decision = scheduler.after_round(RoundOutcome::Failed, metrics);
+    EXPECT_EQ(NextRound::AfterBackoff, decision.next);
+    EXPECT_LE(limit / 2, decision.seconds);
+    EXPECT_GE(limit, decision.seconds);
+  }
+  EXPECT_EQ(5, metrics.sent[RoundsBackingOff]);
+
+  scheduler.after_round(RoundOutcome::CaughtUp, metrics);
+  EXPECT_EQ(2, scheduler.backoff_limit());
+}
+
+TEST_F(SchedulerTest, ReconfigureKeepsErrorStreak) {
+  ShipScheduler scheduler(10, 2, 100);
+  scheduler.after_round(RoundOutcome::Failed, metrics);
+  scheduler.after_round(RoundOutcome::Failed, metrics);
+  EXPECT_EQ(4, scheduler.backoff_limit());
+  scheduler.configure(10, 3, 100);
+  EXPECT_EQ(6, scheduler.backoff_limit());
+  scheduler.configure(10, 3, 5);
+  EXPECT_EQ(5, scheduler.backoff_limit());
+}
+
+TEST_F(SchedulerTest, ReportsFreshness) {
+  ShipScheduler scheduler(10, 5, 300);
+  scheduler.shipped(1000, 1004, metrics);
+  EXPECT_EQ(0, metrics.sent[FreshnessTargetMissed]);
+  scheduler.shipped(1000, 1030, metrics);
+  EXPECT_EQ(1, metrics.sent[FreshnessTargetMissed]);
+  EXPECT_EQ(vector<int64_t>({4, 30}), metrics.recorded[ShipFreshness]);
+}
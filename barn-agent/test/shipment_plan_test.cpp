@@ -0,0 +1,58 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "shipment_plan.h"
+
+using namespace std;
+
+class ShipmentPlanTest : public ::testing::Test {
+};
+
+TEST_F(ShipmentPlanTest, ContiguousMark) {
+  EXPECT_EQ("4", contiguous_shipped_mark({"1", "2", "3", "4", "5", "6"}, {"1", "2", "5", "6"}));
+  EXPECT_EQ("", contiguous_shipped_mark({"1", "2"}, {"1", "2"}));
+  EXPECT_EQ("2", contiguous_shipped_mark({"1", "2"}, {}));
+}
+
+TEST_F(ShipmentPlanTest, MatchesContiguousSuffixWithoutMark) {
+  const vector<string> local = {"1", "2", "3", "4", "5", "6"};
+  const vector<string> missing = {"1", "2", "5", "6"};
+  EXPECT_EQ(tail_intersection(local, missing),
+            unshipped_files(missing, contiguous_shipped_mark(local, missing)));
+}
+
+TEST_F(ShipmentPlanTest, UnshippedFilesKeepGaps) {
+  EXPECT_EQ(vector<string>({"3", "5"}), unshipped_files({"1", "3", "5"}, "2"));
+  EXPECT_EQ(vector<string>({"1", "3"}), unshipped_files({"1", "3"}, ""));
+  EXPECT_EQ(vector<string>(), unshipped_files({"1", "3"}, "3"));
+}
+
+TEST_F(ShipmentPlanTest, PlansNewestFirstWithBackfill) {
+  const vector<string> candidates = {"1", "2", "3", "4", "5", "6", "7", "8"};
+  const vector<uintmax_t> sizes(8, 100);
+  EXPECT_EQ(vector<string>({"8", "1", "7", "6", "5", "2", "4", "3"}),
+            plan_shipment(candidates, sizes, 0.25));
+  EXPECT_EQ(vector<string>({"8", "7", "6", "5", "4", "3", "2", "1"}),
+            plan_shipment(candidates, sizes, 0));
+}
+
+TEST_F(ShipmentPlanTest, BackfillShareIsInBytes) {
+  // The big old file uses up the backfill share for a while.
+  const vector<string> candidates = {"1", "2", "3", "4", "5"};
+  const vector<uintmax_t> sizes = {400, 100, 100, 100, 100};
+  EXPECT_EQ(vector<string>({"5", "1", "4", "3", "2"}),
+            plan_shipment(candidates, sizes, 0.5));
+}
+
+TEST_F(ShipmentPlanTest, AdvancesMarkUpToFirstPending) {
+  const vector<string> candidates = {"2", "3", "5", "6"};
+  const vector<string> local = {"1", "2", "3", "4", "5", "6"};
+  EXPECT_EQ("4", advance_shipped_mark("1", candidates, {"2", "3", "6"}, local));
+  EXPECT_EQ("1", advance_shipped_mark("1", candidates, {"6"}, local));
+  EXPECT_EQ("6", advance_shipped_mark("1", candidates, candidates, local));
+  // Files gone from the directory still count once done.
+  EXPECT_EQ("3", advance_shipped_mark("1", candidates, {"2", "3"}, {"5", "6"}));
+  // Never backwards.
+  EXPECT_EQ("9", advance_shipped_mark("9", candidates, candidates, local));
+}
@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <map>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "monitor/shmreport.h"
+#include "temp_dir.h"
+
+using namespace std;
+
+class ShmReportTest : public ::testing::Test {
+public:
+  map<string, int64_t> collect(MetricsSegment& segment) {
+    map<string, int64_t> collected;
+    segment.collect([&](const Report& report) {
+      collected[report.service_name + ":" + report.category + ":" + report.key]
+        += report.value;
+    });
+    return collected;
+  }
+
+  // A pid that is guaranteed to not be running anymore.
+  pid_t dead_pid() {
+    pid_t child = fork();
+    if (child == 0)
+      _exit(0);
+    waitpid(child, 0, 0);
+    return child;
+  }
+
+  TempDir temp{"shmreport"};
+  const string path{temp.file("report")};
+};
+
+TEST_F(ShmReportTest, CountersDrainGaugesStay) {
+  ShmReport agent(path, 0, "svc", "main");
+  MetricsSegment monitor(path);
+
+  agent.send_metric(NumFilesShipped, 2);
+  agent.send_metric(NumFilesShipped, 3);
+  agent.send_metric(FilesToShip, 4);
+  agent.send_metric(FilesToShip, 1);
+
+  auto first = collect(monitor);
+  EXPECT_EQ(5, first["svc:main:" + NumFilesShipped]);
+  EXPECT_EQ(1, first["svc:main:" + FilesToShip]);
+
+  auto second = collect(monitor);
+  EXPECT_EQ(0, second["svc:main:" + NumFilesShipped]);
+  EXPECT_EQ(1, second["svc:main:" + FilesToShip]);
+}
+
+TEST_F(ShmReportTest, MaxGaugesResetEachCollect) {
+  ShmReport agent(path, 0, "svc", "main");
+  MetricsSegment monitor(path);
+
+  agent.send_metric(TimeSinceSuccess, 40);
+  agent.send_metric(TimeSinceSuccess, 10);
+  EXPECT_EQ(40, collect(monitor)["svc:main:" + TimeSinceSuccess]);
+  EXPECT_EQ(0U, collect(monitor).count("svc:main:" + TimeSinceSuccess));
+}
+
+TEST_F(ShmReportTest, CountersSurviveMonitorRestart) {
+  ShmReport agent(path, 0, "svc", "main");
+  agent.send_metric(NumFilesShipped, 2);
+  {
+    MetricsSegment monitor(path);
+    EXPECT_EQ(2, collect(monitor)["svc:main:" + NumFilesShipped]);
+  }
+  // No monitor running
+  agent.send_metric(NumFilesShipped, 7);
+
+  MetricsSegment restarted(path);
+  EXPECT_EQ(7, collect(restarted)["svc:main:" + NumFilesShipped]);
+}
+
+TEST_F(ShmReportTest, ReclaimsSlotsOfDeadAgents) {
+  MetricsSegment segment(path);
+  pid_t dead = dead_pid();
+  ShmSlot* slot = segment.claim("gone", "main", dead);
+  ASSERT_TRUE(slot != 0);
+  segment.entry(slot, NumFilesShipped, MetricType::Counter)->value.fetch_add(3);
+
+  // Outstanding counters are still reported once.
+  EXPECT_EQ(3, collect(segment)["gone:main:" + NumFilesShipped]);
+  EXPECT_EQ(0, slot->owner_pid.load());
+  EXPECT_TRUE(collect(segment).empty());
+}
+
+TEST_F(ShmReportTest, RestartedAgentKeepsItsSlot) {
+  MetricsSegment segment(path);
+  ShmSlot* slot = segment.claim("svc", "main", dead_pid());
+  segment.entry(slot, NumFilesShipped, MetricType::Counter)->value.fetch_add(3);
+
+  ShmReport agent(path, 0, "svc", "main");
+  agent.send_metric(NumFilesShipped, 1);
+  EXPECT_EQ(getpid(), slot->owner_pid.load());
+  EXPECT_EQ(4, collect(segment)["svc:main:" + NumFilesShipped]);
+}
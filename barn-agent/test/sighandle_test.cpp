@@ -0,0 +1,36 @@
+#include <chrono>
+#include <signal.h>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "process.h"
+#include "sighandle.h"
+
+using namespace std;
+
+class SighandleTest : public ::testing::Test {
+public:
+  void TearDown() {
+    take_reload_request();
+    signal(SIGHUP, SIG_DFL);
+  }
+};
+
+TEST_F(SighandleTest, ReloadEndsTheWait) {
+  enable_reload_signal_handler();
+  EXPECT_FALSE(waits_interrupted());
+
+  // Stands in for inotifywait waiting for the next rotation.
+  thread reloader([]() {
+    this_thread::sleep_for(chrono::milliseconds(300));
+    kill(getpid(), SIGHUP);
+  });
+  const auto start = chrono::steady_clock::now();
+  run_command("sleep", {"sleep", "30"}, true);
+  reloader.join();
+
+  EXPECT_GT(chrono::seconds(10), chrono::steady_clock::now() - start);
+  EXPECT_TRUE(waits_interrupted());
+  EXPECT_TRUE(take_reload_request());
+  EXPECT_FALSE(waits_interrupted());
+}
@@ -0,0 +1,78 @@
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "gtest/gtest.h"
+#include "monitor/statsd.h"
+
+using namespace std;
+using boost::asio::ip::udp;
+
+/*
+ * Tests StatsdMetrics against a UDP socket standing in for statsd.
+ */
+class StatsdTest : public ::testing::Test {
+public:
+  StatsdTest() : socket(io_service, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {}
+
+  string address() {
+    return "127.0.0.1:" + to_string(socket.local_endpoint().port());
+  }
+
+  vector<string> received() {
+    vector<string> datagrams;
+    char buffer[65536];
+    while (socket.available() > 0) {
+      auto size = socket.receive(boost::asio::buffer(buffer));
+      datagrams.push_back(string(buffer, size));
+    }
+    return datagrams;
+  }
+
+  boost::asio::io_service io_service;
+  udp::socket socket;
+};
+
+TEST_F(StatsdTest, LineProtocol) {
+  StatsdMetrics metrics(address(), "barn", 1432, "my.svc", "main");
+  metrics.send_metric(NumFilesShipped, 3);
+  metrics.send_metric(FilesToShip, 7);
+  metrics.record_value(ShipLatency, 120);
+  EXPECT_TRUE(received().empty());
+
+  metrics.flush();
+  vector<string> datagrams = received();
+  ASSERT_EQ(1U, datagrams.size());
+  EXPECT_EQ("barn.my_svc.main.barn_files_shipped:3|c\n"
+            "barn.my_svc.main.barn_files_to_ship:7|g\n"
+            "barn.my_svc.main.barn_ship_latency_ms:120|ms", datagrams[0]);
+}
+
+TEST_F(StatsdTest, BatchesIntoDatagrams) {
+  const size_t max_datagram = 100;
+  StatsdMetrics metrics(address(), "barn", max_datagram, "svc", "main");
+  for (int i = 0; i < 50; i++)
+    metrics.record_value(ShipLatency, i);
+  metrics.flush();
+
+  vector<string> datagrams = received();
+  EXPECT_LT(1U, datagrams.size());
+  size_t lines = 0;
+  for (auto& datagram : datagrams) {
+    EXPECT_GE(max_datagram, datagram.size());
+    EXPECT_NE('\n', datagram.back());
+    lines += count(datagram.begin(), datagram.end(), '\n') + 1;
+  }
+  EXPECT_EQ(50U, lines);
+}
+
+TEST_F(StatsdTest, FlushesOnDestruction) {
+  {
+    StatsdMetrics metrics(address(), "barn", 1432, "svc", "main");
+    metrics.send_metric(LostDuringShip, 1);
+  }
+  vector<string> datagrams = received();
+  ASSERT_EQ(1U, datagrams.size());
+  EXPECT_EQ("barn.svc.main.barn_lost_during_ship:1|c", datagrams[0]);
+}
@@ -0,0 +1,39 @@
+#ifndef TEMP_DIR_H
+#define TEMP_DIR_H
+
+/*
+ * A scratch directory for a test, /tmp/barn_<name>_test_<pid>, created empty
+ * and removed with everything in it. Made a member of a fixture it lives as
+ * long as each test.
+ */
+
+#include <string>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+class TempDir {
+public:
+  explicit TempDir(const std::string& name)
+    : path("/tmp/barn_" + name + "_test_" + std::to_string(getpid())) {
+    boost::filesystem::remove_all(path);
+    boost::filesystem::create_directories(path);
+  }
+
+  ~TempDir() {
+    boost::system::error_code ignored;
+    boost::filesystem::remove_all(path, ignored);
+  }
+
+  TempDir(const TempDir&) = delete;
+  TempDir& operator=(const TempDir&) = delete;
+
+  // Path of 'name' in the directory.
+  std::string file(const std::string& name) const {
+    return path + "/" + name;
+  }
+
+  const std::string path;
+};
+
+#endif
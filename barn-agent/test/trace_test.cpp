@@ -0,0 +1,82 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "temp_dir.h"
+#include "trace.h"
+
+using namespace std;
+
+class TraceTest : public ::testing::Test {
+public:
+  void SetUp() {
+    cursor = trace_cursor();
+  }
+
+  void TearDown() {
+    tracing_enabled = false;
+  }
+
+  uint64_t cursor;
+};
+
+TEST_F(TraceTest, NothingRecordedWhenDisabled) {
+  tracing_enabled = false;
+  { TraceSpan span("disabled"); }
+  EXPECT_TRUE(trace_events_since(&cursor).empty());
+}
+
+TEST_F(TraceTest, RecordsSpans) {
+  tracing_enabled = true;
+  {
+    TraceSpan outer("outer");
+    TraceSpan inner("inner");
+  }
+  vector<TraceEvent> events = trace_events_since(&cursor);
+  ASSERT_EQ(2U, events.size());
+  EXPECT_EQ(string("inner"), events[0].name);
+  EXPECT_EQ(string("outer"), events[1].name);
+  EXPECT_LE(events[1].start_us, events[0].start_us);
+  EXPECT_GE(events[1].duration_us, events[0].duration_us);
+  EXPECT_EQ(trace_cursor(), cursor);
+}
+
+TEST_F(TraceTest, RingKeepsNewestEvents) {
+  for (int i = 0; i < TRACE_RING_SIZE + 10; i++)
+    trace_record(to_string(i).c_str(), i, 1);
+  vector<TraceEvent> events = trace_events_since(&cursor);
+  ASSERT_EQ((size_t)TRACE_RING_SIZE, events.size());
+  EXPECT_EQ(string("10"), events.front().name);
+  EXPECT_EQ(to_string(TRACE_RING_SIZE + 9), events.back().name);
+}
+
+TEST_F(TraceTest, TruncatesLongNames) {
+  trace_record(string(100, 'x').c_str(), 0, 1);
+  vector<TraceEvent> events = trace_events_since(&cursor);
+  ASSERT_EQ(1U, events.size());
+  EXPECT_EQ(string(TRACE_NAME_SIZE - 1, 'x'), events[0].name);
+}
+
+TEST_F(TraceTest, ChromeTraceEventJson) {
+  TraceEvent event = {"run_command \"rsync\"", 1500, 20, 7};
+  EXPECT_EQ("{\"name\":\"run_command \\\"rsync\\\"\",\"cat\":\"barn\",\"ph\":\"X\","
+            "\"ts\":1500,\"dur\":20,\"pid\":" + to_string(getpid()) + ",\"tid\":7}",
+            trace_event_json(event));
+}
+
+TEST_F(TraceTest, DumpsCompleteTrace) {
+  TempDir temp("trace");
+  const string path = temp.file("trace.json");
+  trace_record("dumped", 0, 1);
+  ASSERT_TRUE(dump_trace(path, "barn-agent svc:main"));
+
+  ifstream in(path.c_str());
+  string dumped((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  EXPECT_EQ(0U, dumped.find("{\"traceEvents\":["));
+  EXPECT_NE(string::npos, dumped.find("\"args\":{\"name\":\"barn-agent svc:main\"}"));
+  EXPECT_NE(string::npos, dumped.find("\"name\":\"dumped\""));
+  EXPECT_EQ("]}\n", dumped.substr(dumped.size() - 3));
+}
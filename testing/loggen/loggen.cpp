@@ -1,69 +1,497 @@
-#include "stdio.h"
+// loggen: write numbered log lines to stdout at a steady rate, for load
+// testing the pipeline (check what arrived with logverify).
+//
+// Every line starts with a "%10lu " sequence number, counting from 0 in the
+// order written. Lines are generated in batches on -t threads and
+// written by the main thread, paced against the wall clock: each batch is
+// due once the bytes before it fit the rate, so the rate holds however long
+// generating or writing takes, and a late writer catches up.
+//
+// With -r, lines of a real log are replayed instead, numbered the same way.
+// Lines with svlogd -t or -tt timestamps are replayed -x times as fast as
+// they were logged (the timestamp dropped, svlogd adds its own), others at
+// the given rate.
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
-#include <algorithm>
+#include <fcntl.h>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 using namespace std;
+typedef chrono::steady_clock Clock;
+
+// Roughly how many bytes are generated, paced and written at once.
+static const size_t BATCH_BYTES = 64 << 10;
+// Longest line body generated.
+static const int MAX_LENGTH = 1 << 20;
+
+static const char ALPHANUM[] =
+    "0123456789"
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz";
+
+// How long line bodies are, e.g. "uniform:0:498" (the default), "fixed:200",
+// "normal:200:50" (mean, standard deviation) or "lognormal:120:1" (median,
+// sigma of the log).
+struct LengthDistribution {
+  string kind;
+  double a, b;
+
+  double mean() const {
+    if (kind == "fixed" || kind == "normal")
+      return a;
+    if (kind == "uniform")
+      return (a + b) / 2;
+    return a * exp(b * b / 2);
+  }
+};
 
-//Code copied from http://stackoverflow.com/questions/440133/how-do-i-create-a-random-alpha-numeric-string-in-c
-void gen_random(char *s, const int len) {
-    static const char alphanum[] =
-        "0123456789"
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz";
+static bool parse_distribution(const string& spec, LengthDistribution* distribution) {
+  char kind[16];
+  double a = 0, b = 0;
+  const int n = sscanf(spec.c_str(), "%15[a-z]:%lf:%lf", kind, &a, &b);
+  distribution->kind = n >= 1 ? kind : "";
+  distribution->a = a;
+  distribution->b = b;
+  if (distribution->kind == "fixed")
+    return n == 2 && a >= 0;
+  if (distribution->kind == "uniform")
+    return n == 3 && a >= 0 && b >= a;
+  if (distribution->kind == "normal" || distribution->kind == "lognormal")
+    return n == 3 && a > 0 && b > 0;
+  return false;
+}
+
+// Generates line bodies, one per thread.
+class LineGenerator {
+public:
+  LineGenerator(const LengthDistribution& lengths, uint64_t seed):
+      lengths(lengths), engine(seed), state(seed | 1) {}
+
+  int next_length() {
+    double length;
+    if (lengths.kind == "fixed")
+      length = lengths.a;
+    else if (lengths.kind == "uniform")
+      length = uniform_int_distribution<int>(lengths.a, lengths.b)(engine);
+    else if (lengths.kind == "normal")
+      length = normal_distribution<double>(lengths.a, lengths.b)(engine);
+    else
+      length = lognormal_distribution<double>(log(lengths.a), lengths.b)(engine);
+    return min(max(int(length), 0), MAX_LENGTH);
+  }
 
-    for (int i = 0; i < len; ++i) {
-        s[i] = alphanum[rand() % (sizeof(alphanum) - 1)];
+  // Append 'length' random alphanumerics, 8 from each random number.
+  void append_body(int length, string* out) {
+    const size_t start = out->size();
+    out->resize(start + length);
+    char* p = &(*out)[start];
+    while (length > 0) {
+      uint64_t bits = xorshift();
+      for (int i = 0; i < 8 && length > 0; i++, length--, bits >>= 8)
+        *p++ = ALPHANUM[((bits & 0xff) * 62) >> 8];
     }
+  }
+
+private:
+  uint64_t xorshift() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
 
-    s[len] = 0;
+  const LengthDistribution& lengths;
+  mt19937_64 engine;
+  uint64_t state;
+};
+
+// Append 'seq' as printf("%10lu ") would.
+static void append_sequence(uint64_t seq, string* out) {
+  char digits[24];
+  int n = 0;
+  do {
+    digits[n++] = '0' + seq % 10;
+    seq /= 10;
+  } while (seq);
+  for (int i = n; i < 10; i++)
+    *out += ' ';
+  while (n)
+    *out += digits[--n];
+  *out += ' ';
 }
 
-// http://timmurphy.org/2009/09/29/nanosleep-in-c-c/
-void sleep_fraction(float fraction_of_second) {
-  int milisec = fraction_of_second * 1000; // length of time to sleep, in miliseconds
-  struct timespec req = {0};
-  req.tv_sec = 0;
-  req.tv_nsec = milisec * 1000000L - 1; //Minus one not to exceed 999999999
-  nanosleep(&req, (struct timespec *)NULL);
+// Bursts of 'factor' times the rate for 'seconds' every 'period' seconds,
+// e.g. "10:5:60".
+struct Bursts {
+  double factor, seconds, period;
+
+  double factor_at(double elapsed) const {
+    if (period <= 0)
+      return 1;
+    return fmod(elapsed, period) < seconds ? factor : 1;
+  }
+};
+
+// Paces writing at 'bytes_per_second' (as fast as possible if 0).
+class Pacer {
+public:
+  Pacer(double bytes_per_second, const Bursts& bursts):
+      bytes_per_second(bytes_per_second), bursts(bursts),
+      start(Clock::now()), due(start) {}
+
+  // Wait until 'bytes' more may be written.
+  void wait(size_t bytes) {
+    if (bytes_per_second <= 0)
+      return;
+    const double elapsed = chrono::duration<double>(due - start).count();
+    const double rate = bytes_per_second * bursts.factor_at(elapsed);
+    this_thread::sleep_until(due);
+    due += chrono::duration_cast<Clock::duration>(chrono::duration<double>(bytes / rate));
+  }
+
+private:
+  const double bytes_per_second;
+  const Bursts bursts;
+  const Clock::time_point start;
+  Clock::time_point due;
+};
+
+struct Options {
+  double mb_per_second = 0;
+  int threads = 1;
+  LengthDistribution lengths = {"uniform", 0, 498};
+  Bursts bursts = {1, 0, 0};
+  double duration = 0;  // Seconds, 0 for no limit
+  uint64_t max_lines = 0;  // 0 for no limit
+  string replay;
+  double speed = 1;
+  bool loop = false;
+};
+
+static void write_fully(const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const auto n = write(STDOUT_FILENO, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      perror("loggen: write");
+      exit(1);
+    }
+    written += n;
+  }
 }
 
-int main(int argc, char* argv[]) {
+struct Totals {
+  uint64_t lines = 0, bytes = 0;
+};
+
+// Batches generated ahead of the writer, by sequence.
+class BatchQueue {
+public:
+  explicit BatchQueue(size_t size): batches(size), ready(size, false) {}
+
+  // The buffer for batch 'n' once the writer is done with batch n - size.
+  string* claim(uint64_t n) {
+    unique_lock<mutex> lock(m);
+    changed.wait(lock, [&]() { return stopped || n < written + batches.size(); });
+    return stopped ? nullptr : &batches[n % batches.size()];
+  }
+
+  void publish(uint64_t n) {
+    lock_guard<mutex> lock(m);
+    ready[n % batches.size()] = true;
+    changed.notify_all();
+  }
+
+  // Batch 'written', once generated.
+  const string& next() {
+    unique_lock<mutex> lock(m);
+    changed.wait(lock, [&]() { return ready[written % batches.size()]; });
+    return batches[written % batches.size()];
+  }
+
+  void done() {
+    lock_guard<mutex> lock(m);
+    ready[written % batches.size()] = false;
+    written++;
+    changed.notify_all();
+  }
 
-  if(argc < 2) {
-    cerr << "Usage: loggen MB_OF_LOGS_TO_PRODUCE_PER_SEC" << endl;
-    exit(0);
+  void stop() {
+    lock_guard<mutex> lock(m);
+    stopped = true;
+    changed.notify_all();
   }
-  const int max_len = 500;
-  char* buffer = new char[max_len];
-  int len = 0;
-  double mb = atof(argv[1]);
 
-  cout << "Writing " << mb << " MB of random lines to stdout per sec" << endl;
+private:
+  mutex m;
+  condition_variable changed;
+  vector<string> batches;
+  vector<bool> ready;
+  uint64_t written = 0;
+  bool stopped = false;
+};
+
+static Totals generate(const Options& options, Clock::time_point end) {
+  // Lines per batch, fewer at low rates so pacing stays smooth.
+  const double line_bytes = options.lengths.mean() + 12;
+  double batch_lines = BATCH_BYTES / line_bytes;
+  if (options.mb_per_second > 0)
+    batch_lines = min(batch_lines, options.mb_per_second * 1048576 / line_bytes / 100);
+  const uint64_t lines_per_batch = max(uint64_t(batch_lines), uint64_t(1));
+  const uint64_t batches = options.max_lines == 0
+      ? UINT64_MAX : (options.max_lines + lines_per_batch - 1) / lines_per_batch;
+
+  BatchQueue queue(options.threads * 4);
+  atomic<uint64_t> next_batch(0);
+  vector<thread> generators;
+  for (int t = 0; t < options.threads; t++) {
+    generators.emplace_back([&, t]() {
+      LineGenerator generator(options.lengths, random_device()() ^ (uint64_t(t) << 32));
+      uint64_t n;
+      while ((n = next_batch++) < batches) {
+        string* batch = queue.claim(n);
+        if (!batch)
+          return;
+        batch->clear();
+        const uint64_t first = n * lines_per_batch;
+        uint64_t last = first + lines_per_batch;
+        if (options.max_lines)
+          last = min(last, options.max_lines);
+        for (uint64_t seq = first; seq < last; seq++) {
+          append_sequence(seq, batch);
+          generator.append_body(generator.next_length(), batch);
+          *batch += '\n';
+        }
+        queue.publish(n);
+      }
+    });
+  }
+
+  Totals totals;
+  Pacer pacer(options.mb_per_second * 1048576, options.bursts);
+  for (uint64_t n = 0; n < batches && Clock::now() < end; n++) {
+    const string& batch = queue.next();
+    pacer.wait(batch.size());
+    write_fully(batch);
+    totals.bytes += batch.size();
+    totals.lines += options.max_lines ? min(lines_per_batch, options.max_lines - n * lines_per_batch)
+                                      : lines_per_batch;
+    queue.done();
+  }
+  queue.stop();
+  for (auto& generator : generators)
+    generator.join();
+  return totals;
+}
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
 
+static int hex(char c) {
+  return is_digit(c) ? c - '0' : (c | 0x20) - 'a' + 10;
+}
 
-  unsigned long seq_num = 0;
-  int max_bytes = int(mb * 1024 * 1024);
+static int digits(const char* p, int n) {
+  int value = 0;
+  for (int i = 0; i < n; i++)
+    value = value * 10 + (p[i] - '0');
+  return value;
+}
 
-  while(true) {
-    const clock_t begin_time = clock();
+// Unix time of the svlogd timestamp at 'p', -1 if none, and where the line
+// after it starts.
+static double line_time(const char* p, const char* end, const char** rest) {
+  *rest = p;
+  if (end - p > 26 && p[0] == '@' && p[25] == ' ') {
+    uint64_t tai = 0;
+    uint32_t nanoseconds = 0;
+    for (int i = 1; i <= 16; i++)
+      tai = (tai << 4) | hex(p[i]);
+    for (int i = 17; i <= 24; i++)
+      nanoseconds = (nanoseconds << 4) | hex(p[i]);
+    *rest = p + 26;
+    return double(tai - ((uint64_t(1) << 62) + 10)) + nanoseconds / 1e9;
+  }
+  if (end - p > 20 && is_digit(p[0]) && p[4] == '-' && p[7] == '-' && p[10] == '_' &&
+      p[13] == ':' && p[16] == ':') {
+    struct tm t = {};
+    t.tm_year = digits(p, 4) - 1900;
+    t.tm_mon = digits(p + 5, 2) - 1;
+    t.tm_mday = digits(p + 8, 2);
+    t.tm_hour = digits(p + 11, 2);
+    t.tm_min = digits(p + 14, 2);
+    t.tm_sec = digits(p + 17, 2);
+    const char* f = p + 19;
+    double fraction = 0, scale = 1;
+    if (*f == '.') {
+      for (f++; f < end && is_digit(*f); f++)
+        fraction += (*f - '0') * (scale /= 10);
+    }
+    if (f < end && *f == ' ')
+      f++;
+    *rest = f;
+    return timegm(&t) + fraction;
+  }
+  return -1;
+}
 
-    int made_bytes = 0;
+static Totals replay(const Options& options, Clock::time_point end) {
+  const int fd = open(options.replay.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "loggen: can't replay %s\n", options.replay.c_str());
+    exit(1);
+  }
+  const char* data = (const char*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror("loggen: mmap");
+    exit(1);
+  }
+  madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+  const char* const data_end = data + st.st_size;
 
-    while(made_bytes <= max_bytes) {
-      len = rand() % (max_len - 1);
-      gen_random(buffer, len);
-      printf("%10lu ", seq_num++);
-      cout << buffer << "\n";
-      made_bytes += len + 12;
+  Totals totals;
+  Pacer pacer(options.mb_per_second * options.speed * 1048576, options.bursts);
+  string batch;
+  uint64_t seq = 0;
+  // Timestamped lines are due when they were logged, sped up.
+  Clock::time_point start = Clock::now(), due = start;
+  double first_time = -1;
+  do {
+    for (const char* p = data; p < data_end && Clock::now() < end;) {
+      const char* newline = (const char*)memchr(p, '\n', data_end - p);
+      if (!newline)
+        newline = data_end;
+      const char* rest;
+      const double time = line_time(p, newline, &rest);
+      if (time >= 0) {
+        if (first_time < 0)
+          first_time = time;
+        due = start + chrono::duration_cast<Clock::duration>(
+              chrono::duration<double>(max(time - first_time, 0.0) / options.speed));
+        // Written once the next line isn't due yet.
+        if (due > Clock::now() && !batch.empty()) {
+          write_fully(batch);
+          totals.bytes += batch.size();
+          batch.clear();
+        }
+        this_thread::sleep_until(due);
+      }
+      append_sequence(seq++, &batch);
+      batch.append(rest, newline);
+      batch += '\n';
+      totals.lines++;
+      if (time < 0 && batch.size() >= BATCH_BYTES / 16) {
+        pacer.wait(batch.size());
+        write_fully(batch);
+        totals.bytes += batch.size();
+        batch.clear();
+      }
+      if (batch.size() >= BATCH_BYTES) {
+        write_fully(batch);
+        totals.bytes += batch.size();
+        batch.clear();
+      }
+      p = newline + 1;
+      if (options.max_lines && seq == options.max_lines)
+        break;
     }
+    // Again from where the last pass ended.
+    start = due;
+    first_time = -1;
+  } while (options.loop && Clock::now() < end &&
+           (!options.max_lines || seq < options.max_lines));
+  write_fully(batch);
+  totals.bytes += batch.size();
+  munmap((void*)data, st.st_size);
+  return totals;
+}
 
-    const clock_t end_time = clock();
-    const float took = float( end_time - begin_time ) /  CLOCKS_PER_SEC;
+static void usage() {
+  fprintf(stderr,
+      "Usage: loggen [OPTIONS] [MB_OF_LOGS_TO_PRODUCE_PER_SEC]\n"
+      "Writes numbered random lines to stdout, as fast as possible at a rate of 0.\n"
+      "  -t THREADS        generate lines on this many threads (default 1)\n"
+      "  -l DISTRIBUTION   line lengths: uniform:MIN:MAX (default uniform:0:498),\n"
+      "                    fixed:N, normal:MEAN:STDDEV or lognormal:MEDIAN:SIGMA\n"
+      "  -b FACTOR:SECONDS:PERIOD\n"
+      "                    burst to FACTOR times the rate for SECONDS every PERIOD\n"
+      "  -d SECONDS        stop after this long\n"
+      "  -n LINES          stop after this many lines\n"
+      "  -r FILE           replay the lines of FILE instead, timestamped ones as\n"
+      "                    they were logged, others at the rate\n"
+      "  -x SPEED          replay this many times as fast (default 1)\n"
+      "  -L                replay FILE over and over\n");
+  exit(1);
+}
 
-    sleep_fraction(max(0., 1.0 - took));
+int main(int argc, char* argv[]) {
+  Options options;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:l:b:d:n:r:x:Lh")) != -1) {
+    switch (opt) {
+      case 't': options.threads = max(atoi(optarg), 1); break;
+      case 'l':
+        if (!parse_distribution(optarg, &options.lengths)) {
+          fprintf(stderr, "loggen: bad line length distribution '%s'\n", optarg);
+          usage();
+        }
+        break;
+      case 'b':
+        if (sscanf(optarg, "%lf:%lf:%lf", &options.bursts.factor, &options.bursts.seconds,
+                   &options.bursts.period) != 3 || options.bursts.factor <= 0) {
+          fprintf(stderr, "loggen: bad bursts '%s'\n", optarg);
+          usage();
+        }
+        break;
+      case 'd': options.duration = atof(optarg); break;
+      case 'n': options.max_lines = strtoull(optarg, nullptr, 10); break;
+      case 'r': options.replay = optarg; break;
+      case 'x': options.speed = atof(optarg); break;
+      case 'L': options.loop = true; break;
+      default: usage();
+    }
   }
+  if (optind < argc)
+    options.mb_per_second = atof(argv[optind]);
+  if (options.speed <= 0 || (options.replay.empty() && optind == argc))
+    usage();
+
+  if (options.replay.empty() && options.mb_per_second > 0)
+    fprintf(stderr, "Writing %g MB of random lines to stdout per sec\n", options.mb_per_second);
+  else if (options.replay.empty())
+    fprintf(stderr, "Writing random lines to stdout as fast as possible\n");
+  else
+    fprintf(stderr, "Replaying %s at %gx\n", options.replay.c_str(), options.speed);
 
+  const auto start = Clock::now();
+  const auto end = options.duration > 0
+      ? start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(options.duration))
+      : Clock::time_point::max();
+  const Totals totals = options.replay.empty() ? generate(options, end) : replay(options, end);
+  const double seconds = chrono::duration<double>(Clock::now() - start).count();
+  fprintf(stderr, "Wrote %llu lines, %.1f MB in %.1fs: %.2f MB/s\n",
+          (unsigned long long)totals.lines, totals.bytes / 1048576.0, seconds,
+          seconds > 0 ? totals.bytes / 1048576.0 / seconds : 0);
 }
@@ -0,0 +1,393 @@
+// logverify: check the lines loggen wrote made it through the pipeline.
+//
+// loggen starts each line with a "%10lu " sequence number. Given the files
+// received for a stream (svlogd directories, a copy of a barn-hdfs output
+// directory, or single files, read in path order), logverify reports the
+// sequence numbers missing, those received more than once, how often the
+// sequence goes backwards and what each file carried. Lines may carry a
+// svlogd -t (@tai64n) or -tt (YYYY-MM-DD_HH:MM:SS.xxxxx) timestamp, which
+// gives each file's time span (SPAN_S) and the rate it carried.
+//
+// Files are mmap'd and scanned in chunks on all cores, looking for newlines
+// 16 bytes at a time with SSE2.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Large files are split into chunks of about this many bytes.
+static const size_t CHUNK_BYTES = 64 << 20;
+
+// svlogd's own files in a log directory.
+static const char* SVLOGD_FILES[] = {"lock", "state", "newstate", "config"};
+
+struct Run {
+  uint64_t first, last;  // Consecutive sequence numbers
+};
+
+struct InputFile {
+  string path;
+  const char* data;
+  size_t size;
+};
+
+struct Chunk {
+  size_t file;
+  size_t begin, end;  // Lines starting in [begin, end)
+
+  vector<Run> runs;
+  uint64_t lines;
+  uint64_t unnumbered;  // Lines without a sequence number
+  double first_time, last_time;  // Of the first and last timestamped line, -1 if none
+};
+
+// The next newline at or after 'p', 'end' if there is none.
+static const char* find_newline(const char* p, const char* end) {
+#ifdef __SSE2__
+  const __m128i newline = _mm_set1_epi8('\n');
+  while (end - p >= 16) {
+    const int found = _mm_movemask_epi8(
+          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+    if (found)
+      return p + __builtin_ctz(found);
+    p += 16;
+  }
+#endif
+  const void* found = memchr(p, '\n', end - p);
+  return found ? (const char*)found : end;
+}
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Whether the line at 'p' starts with a svlogd -tt timestamp.
+static bool has_readable_timestamp(const char* p, const char* end) {
+  return end - p > 20 && p[4] == '-' && p[7] == '-' && p[10] == '_' && p[13] == ':' &&
+         is_digit(p[0]);
+}
+
+static int digits(const char* p, int n) {
+  int value = 0;
+  for (int i = 0; i < n; i++)
+    value = value * 10 + (p[i] - '0');
+  return value;
+}
+
+// Unix time of the svlogd timestamp the line at 'p' starts with, -1 if none.
+static double line_time(const char* p, const char* end) {
+  if (end - p > 25 && p[0] == '@') {
+    uint64_t tai = 0;
+    for (int i = 1; i <= 16; i++) {
+      const char c = p[i];
+      tai = (tai << 4) | (is_digit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    uint32_t nanoseconds = 0;
+    for (int i = 17; i <= 24; i++) {
+      const char c = p[i];
+      nanoseconds = (nanoseconds << 4) | (is_digit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    return double(tai - ((uint64_t(1) << 62) + 10)) + nanoseconds / 1e9;
+  }
+  if (has_readable_timestamp(p, end)) {
+    struct tm t = {};
+    t.tm_year = digits(p, 4) - 1900;
+    t.tm_mon = digits(p + 5, 2) - 1;
+    t.tm_mday = digits(p + 8, 2);
+    t.tm_hour = digits(p + 11, 2);
+    t.tm_min = digits(p + 14, 2);
+    t.tm_sec = digits(p + 17, 2);
+    double fraction = 0, scale = 0.1;
+    for (const char* f = p + 20; p[19] == '.' && f < end && is_digit(*f); f++, scale /= 10)
+      fraction += (*f - '0') * scale;
+    return timegm(&t) + fraction;
+  }
+  return -1;
+}
+
+// The sequence number of the line at 'p', false if it has none.
+static bool line_sequence(const char* p, const char* end, uint64_t* sequence) {
+  // Past the svlogd timestamp, if any.
+  if (*p == '@' || has_readable_timestamp(p, end)) {
+    while (p < end && *p != ' ')
+      p++;
+  }
+  while (p < end && *p == ' ')
+    p++;
+  if (p == end || !is_digit(*p))
+    return false;
+  uint64_t value = 0;
+  int n = 0;
+  for (; p < end && is_digit(*p) && n < 20; p++, n++)
+    value = value * 10 + (*p - '0');
+  if (p < end && *p != ' ')
+    return false;
+  *sequence = value;
+  return true;
+}
+
+static void scan(const InputFile& file, Chunk* chunk) {
+  const char* p = file.data + chunk->begin;
+  const char* const end = file.data + file.size;
+  const char* const stop = file.data + chunk->end;
+  // A line crossing the start of the chunk belongs to the one before.
+  if (chunk->begin > 0 && p[-1] != '\n')
+    p = min(find_newline(p, end) + 1, end);
+
+  const char* last_line = nullptr;
+  while (p < stop) {
+    const char* const newline = find_newline(p, end);
+    if (chunk->first_time < 0)
+      chunk->first_time = line_time(p, newline);
+    last_line = p;
+    chunk->lines++;
+    uint64_t sequence;
+    if (!line_sequence(p, newline, &sequence)) {
+      chunk->unnumbered++;
+    } else if (!chunk->runs.empty() && sequence == chunk->runs.back().last + 1) {
+      chunk->runs.back().last = sequence;
+    } else {
+      chunk->runs.push_back({sequence, sequence});
+    }
+    p = newline + 1;
+  }
+  if (last_line)
+    chunk->last_time = line_time(last_line, find_newline(last_line, end));
+}
+
+static void add_path(const string& path, vector<string>* paths) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    perror(path.c_str());
+    exit(2);
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    paths->push_back(path);
+    return;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    perror(path.c_str());
+    exit(2);
+  }
+  vector<string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    const string name = entry->d_name;
+    if (name[0] == '.' ||
+        find(begin(SVLOGD_FILES), end(SVLOGD_FILES), name) != end(SVLOGD_FILES))
+      continue;
+    names.push_back(name);
+  }
+  closedir(dir);
+  // svlogd's @tai64n names sort in rotation order, and before 'current'.
+  sort(names.begin(), names.end());
+  for (auto& name : names)
+    add_path(path + "/" + name, paths);
+}
+
+static InputFile map_file(const string& path) {
+  InputFile file = {path, nullptr, 0};
+  const int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path.c_str());
+    exit(2);
+  }
+  file.size = st.st_size;
+  if (file.size > 0) {
+    void* data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      perror(path.c_str());
+      exit(2);
+    }
+    madvise(data, file.size, MADV_SEQUENTIAL);
+    file.data = (const char*)data;
+  }
+  close(fd);
+  return file;
+}
+
+static string range(uint64_t first, uint64_t last) {
+  return first == last ? to_string(first) : to_string(first) + "-" + to_string(last);
+}
+
+static void usage() {
+  cerr << "Usage: logverify [-j THREADS] [-f FIRST] [-l LAST] [-r RANGES] [-s] FILE|DIRECTORY..."
+       << endl
+       << "  -f, -l  sequence numbers loggen started and stopped at, to count lines lost" << endl
+       << "          at either end (by default the first and last seen)" << endl
+       << "  -r      list at most this many missing and duplicate ranges (default 20)" << endl
+       << "  -s      summary only, without a line per file" << endl
+       << "Exits 1 if lines are missing or duplicate." << endl;
+  exit(2);
+}
+
+int main(int argc, char* argv[]) {
+  unsigned threads = max(thread::hardware_concurrency(), 1U);
+  bool has_first = false, has_last = false, summary_only = false;
+  uint64_t expected_first = 0, expected_last = 0;
+  size_t max_ranges = 20;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:f:l:r:s")) != -1) {
+    switch (opt) {
+      case 'j': threads = max(atoi(optarg), 1); break;
+      case 'f': has_first = true; expected_first = strtoull(optarg, nullptr, 10); break;
+      case 'l': has_last = true; expected_last = strtoull(optarg, nullptr, 10); break;
+      case 'r': max_ranges = atoi(optarg); break;
+      case 's': summary_only = true; break;
+      default: usage();
+    }
+  }
+  if (optind == argc)
+    usage();
+
+  vector<string> paths;
+  for (int i = optind; i < argc; i++)
+    add_path(argv[i], &paths);
+  vector<InputFile> files;
+  for (auto& path : paths)
+    files.push_back(map_file(path));
+
+  vector<Chunk> chunks;
+  for (size_t i = 0; i < files.size(); i++) {
+    for (size_t begin = 0; begin < files[i].size; begin += CHUNK_BYTES) {
+      Chunk chunk = {i, begin, min(begin + CHUNK_BYTES, files[i].size), {}, 0, 0, -1, -1};
+      chunks.push_back(chunk);
+    }
+  }
+
+  const auto start = chrono::steady_clock::now();
+  atomic<size_t> next_chunk(0);
+  vector<thread> workers;
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back([&]() {
+      size_t n;
+      while ((n = next_chunk++) < chunks.size())
+        scan(files[chunks[n].file], &chunks[n]);
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+  const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  // The runs of the whole stream, in the order received.
+  vector<Run> runs;
+  uint64_t lines = 0, unnumbered = 0, bytes = 0, backwards = 0;
+  for (auto& chunk : chunks) {
+    for (auto& run : chunk.runs) {
+      if (!runs.empty() && run.first == runs.back().last + 1)
+        runs.back().last = run.last;
+      else
+        runs.push_back(run);
+    }
+    lines += chunk.lines;
+    unnumbered += chunk.unnumbered;
+  }
+  for (size_t i = 1; i < runs.size(); i++) {
+    if (runs[i].first <= runs[i - 1].last)
+      backwards++;
+  }
+  for (auto& file : files)
+    bytes += file.size;
+
+  if (!summary_only) {
+    printf("%-50s %12s %10s %23s %10s %10s\n",
+           "FILE", "LINES", "MB", "SEQUENCE", "SPAN_S", "MB/S");
+    size_t c = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+      uint64_t file_lines = 0;
+      bool numbered = false;
+      uint64_t low = 0, high = 0;
+      double first_time = -1, last_time = -1;
+      for (; c < chunks.size() && chunks[c].file == i; c++) {
+        file_lines += chunks[c].lines;
+        for (auto& run : chunks[c].runs) {
+          low = numbered ? min(low, run.first) : run.first;
+          high = numbered ? max(high, run.last) : run.last;
+          numbered = true;
+        }
+        if (first_time < 0)
+          first_time = chunks[c].first_time;
+        if (chunks[c].last_time >= 0)
+          last_time = chunks[c].last_time;
+      }
+      const double mb = files[i].size / 1048576.0;
+      const double span = last_time - first_time;
+      printf("%-50s %12llu %10.1f %23s", files[i].path.c_str(), (unsigned long long)file_lines,
+             mb, numbered ? range(low, high).c_str() : "-");
+      // Rates only from timestamps at least a second apart.
+      if (first_time >= 0 && last_time >= 0 && span >= 1)
+        printf(" %10.1f %10.2f\n", span, mb / span);
+      else
+        printf(" %10s %10s\n", "-", "-");
+    }
+    printf("\n");
+  }
+
+  // Missing and duplicate sequence numbers, sweeping the runs in order.
+  sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.first < b.first; });
+  vector<Run> missing, duplicate;
+  uint64_t missing_count = 0, duplicate_count = 0;
+  if (!runs.empty()) {
+    const uint64_t first = has_first ? expected_first : runs.front().first;
+    uint64_t seen_to = first;  // Every number in [first, seen_to) was seen
+    for (auto& run : runs) {
+      if (run.last < first)
+        continue;
+      const uint64_t from = max(run.first, first);
+      if (from > seen_to) {
+        missing.push_back({seen_to, from - 1});
+        missing_count += from - seen_to;
+      }
+      if (from < seen_to) {
+        const uint64_t to = min(run.last, seen_to - 1);
+        duplicate.push_back({from, to});
+        duplicate_count += to - from + 1;
+      }
+      seen_to = max(seen_to, run.last + 1);
+    }
+    if (has_last && expected_last >= seen_to) {
+      missing.push_back({seen_to, expected_last});
+      missing_count += expected_last - seen_to + 1;
+    }
+    const uint64_t last = has_last ? max(expected_last, seen_to - 1) : seen_to - 1;
+    printf("sequence %s\n", range(first, last).c_str());
+  }
+
+  printf("files %zu, lines %llu (%llu without a sequence number), %.1f MB in %.2fs: %.0f MB/s\n",
+         files.size(), (unsigned long long)lines, (unsigned long long)unnumbered,
+         bytes / 1048576.0, seconds, seconds > 0 ? bytes / 1048576.0 / seconds : 0);
+  printf("missing %llu in %zu ranges\n", (unsigned long long)missing_count, missing.size());
+  for (size_t i = 0; i < missing.size() && i < max_ranges; i++)
+    printf("  %s\n", range(missing[i].first, missing[i].last).c_str());
+  printf("duplicate %llu in %zu ranges\n", (unsigned long long)duplicate_count, duplicate.size());
+  for (size_t i = 0; i < duplicate.size() && i < max_ranges; i++)
+    printf("  %s\n", range(duplicate[i].first, duplicate[i].last).c_str());
+  printf("out of order %llu times\n", (unsigned long long)backwards);
+
+  for (auto& file : files) {
+    if (file.data)
+      munmap((void*)file.data, file.size);
+  }
+  return missing_count > 0 || duplicate_count > 0 ? 1 : 0;
+}